@@ -0,0 +1,1237 @@
+//
+//  main.m
+//  Benchmark
+//
+//  Created by Jakub Hampl on 17.10.26.
+//  Copyright (c) 2026 Jakub Hampl. All rights reserved.
+//
+
+/*
+ Measures the highlighting pipeline on generated CSS and Ruby texts of growing size: loading a language, tokenize:,
+ stringify:theme:, convertToHTML:, autocompletion filtering, symbol lookups and re-highlighting after single keystrokes.
+
+ Options are read from the arguments through NSUserDefaults, so they are passed as `-name value`:
+
+ - `-sizes` Comma separated text sizes in bytes. Defaults to every power of ten from 1 KB to 100 MB.
+ - `-languages` Comma separated language names. Defaults to `css,ruby`.
+ - `-resources` The directory with the `.language` and `.theme` files. Defaults to the app's resources.
+ - `-iterations` How many times each measurement is repeated, of which the median is reported. Defaults to 3, but
+   texts of 10 MB and more are only done once.
+ - `-keystrokes` How many edits to time on every text. Defaults to 200.
+ - `-output` A file to write the results to, as a JSON array.
+ - `-baseline` The output of an earlier run, to compare against.
+ - `-label` Stored with every result, to tell runs apart (like the commit).
+ - `-instrumentation` A file to write the measurements of GMInstrumentation to, as JSON. Instrumentation is only
+   enabled when this is given, since it adds to the times measured.
+ - `-check YES` Instead of measuring anything, checks that the fast paths give the same results as the
+   straightforward ones on generated texts of every language, both as generated and with random characters typed
+   into them. Prints what differs and exits with 1 if anything does:
+   - `scanner` The tokens of the scanner engine against those of `GMTokenizerEngineRulePasses`, one by one.
+   - `concurrent` The token records of `tokenizesConcurrently` against those of tokenizing on one thread, one by one.
+   - `completion` The items GMCompletionIndex finds while words are typed against scoring every item, for every
+     matching algorithm.
+   - `incremental` The token records of the whole text with those of re-tokenizing after random edits put in place,
+     both through tokenBufferForText:editedRange:changeInLength: and tokenBufferForText:upToLocation:, against
+     tokenizing the whole edited text, after every edit.
+   - `lines` GMLineIndex updated for random edits against indexing the edited text again, after every edit.
+   - `tokens` GMTokenIndex updated for random edits and the tokens of the edited lines against an index of the
+     tokens of the whole edited text, after every edit.
+   - `symbols` The same for GMSymbolIndex, comparing the outline and the names completed for every token.
+   - `budget` The token records with the default ruleTimeLimit against those without any, which are only meant to
+     differ for rules that run out of time, and none do on these texts.
+   - `instrumentation` The token records with GMInstrumentation enabled against those without it, and that every
+     tokenizing was recorded.
+   - `nested` The tokens of a language found through [GMRegistry searchPaths] and nested in a grammar against those
+     of the language itself.
+   - `renderer` What GMRenderer writes, the way the `Highlight` tool uses it, with the smallest buffer against the
+     default one in every format, its `tokens` format against the outermost tokens of tokenBufferForText:, and its
+     `html` format against convertToHTML:.
+ */
+
+#import <Foundation/Foundation.h>
+#ifdef __APPLE__
+#import <malloc/malloc.h>
+#endif
+#import "GMLanguage.h"
+#import "GMGrammar.h"
+#import "GMSyntaxHighlighter.h"
+#import "GMTheme.h"
+#import "GMCompletionIndex.h"
+#import "GMSymbolIndex.h"
+#import "GMInstrumentation.h"
+#import "GMLineIndex.h"
+#import "GMTokenIndex.h"
+#import "GMRenderer.h"
+#import "GMRegistry.h"
+
+#define GMBenchmarkMaximumCompletionItems 1000000
+#define GMBenchmarkTypedFilters 20
+#define GMBenchmarkLargeText (10 * 1000 * 1000)
+#define GMCheckTextLength 20000
+#define GMCheckTypedCharacters 200
+// Long enough to be split into a few chunks by the concurrent path.
+#define GMCheckConcurrentTextLength 600000
+#define GMCheckCompletionItems 2000
+#define GMCheckEdits 1000
+#define GMCheckQueries 100
+#define GMCheckHighlightingStep 500
+
+typedef struct {
+  size_t bytes;
+  size_t blocks;
+} GMMemoryUsage;
+
+static GMMemoryUsage GMMemoryInUse(void)
+{
+#ifdef __APPLE__
+  malloc_statistics_t stats;
+  malloc_zone_statistics(NULL, &stats);
+  return (GMMemoryUsage){stats.size_in_use, stats.blocks_in_use};
+#else
+  return (GMMemoryUsage){0, 0};
+#endif
+}
+
+static NSTimeInterval GMNow(void)
+{
+  return [NSDate timeIntervalSinceReferenceDate];
+}
+
+// A deterministic generator, so that every run edits and filters the same way.
+static uint32_t GMRandom(uint32_t *state)
+{
+  *state = *state * 1664525 + 1013904223;
+  return *state >> 8;
+}
+
+static int GMCompareDoubles(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+static double GMPercentile(NSMutableData *samples, double percentile)
+{
+  NSUInteger count = [samples length] / sizeof(double);
+  if (count == 0) {
+    return 0;
+  }
+  double *values = [samples mutableBytes];
+  qsort(values, count, sizeof(double), GMCompareDoubles);
+  return values[MIN((NSUInteger)(percentile * count), count - 1)];
+}
+
+#pragma mark - Corpora
+
+static NSString *GMCSSSnippet(NSUInteger i)
+{
+  return [NSString stringWithFormat:
+          @"/* Section %lu */\n"
+          @".block-%lu > .element-%lu:hover, a[href^=\"http\"] {\n"
+          @"  color: #%06lx;\n"
+          @"  margin: %lupx auto 0 %luem;\n"
+          @"  font: 90%% \"Helvetica Neue\", sans-serif !important;\n"
+          @"}\n"
+          @"@media screen and (max-width: %lupx) {\n"
+          @"  #id-%lu { background: url(\"img/%lu.png\") no-repeat; }\n"
+          @"}\n\n",
+          i, i % 97, i, (unsigned long)(i * 2654435761u) & 0xffffff, i % 40, i % 7, 320 + i % 1000, i, i];
+}
+
+static NSString *GMRubySnippet(NSUInteger i)
+{
+  return [NSString stringWithFormat:
+          @"# Widget number %lu\n"
+          @"class Widget%lu < Base\n"
+          @"  attr_reader :name, :size\n"
+          @"\n"
+          @"  def initialize(name = \"widget-%lu\", size = %lu)\n"
+          @"    @name = name\n"
+          @"    @size = size * 2 + 0x%lx\n"
+          @"  end\n"
+          @"\n"
+          @"  def matches?(other)\n"
+          @"    other =~ /w%lu[a-z]+/i && @name != 'none'\n"
+          @"  end\n"
+          @"end\n\n",
+          i, i, i, i % 1000, i % 4096, i % 13];
+}
+
+// CSS in the middle of being typed: every rule ends in a property name without its colon yet, which only the
+// predictive pattern of `property` makes a property.
+static NSString *GMCSSTypingSnippet(NSUInteger i)
+{
+  return [NSString stringWithFormat:
+          @".rule-%lu > a:hover {\n"
+          @"  color: red;\n"
+          @"  border-style: solid dashed;\n"
+          @"  %@\n"
+          @"}\n\n",
+          i, @[@"backgr", @"font-we", @"margin", @"z"][i % 4]];
+}
+
+// A text of the given language of about length characters where predictive patterns match, or nil if there is none
+// for the language.
+static NSString *GMTypingCorpus(NSString *language, NSUInteger length)
+{
+  if (![language isEqualToString: @"css"]) {
+    return nil;
+  }
+  NSMutableString *text = [NSMutableString stringWithCapacity: length + 512];
+  for (NSUInteger i = 0; [text length] < length; i++) {
+    [text appendString: GMCSSTypingSnippet(i)];
+  }
+  return text;
+}
+
+// A text of the given language of about length characters, ending at a line boundary.
+static NSString *GMCorpus(NSString *language, NSUInteger length)
+{
+  NSString *(*snippet)(NSUInteger) = [language isEqualToString: @"ruby"] ? GMRubySnippet : GMCSSSnippet;
+  NSMutableString *text = [NSMutableString stringWithCapacity: length + 512];
+  for (NSUInteger i = 0; [text length] < length; i++) {
+    @autoreleasepool {
+      [text appendString: snippet(i)];
+    }
+  }
+  NSRange lastLine = [text lineRangeForRange: NSMakeRange(length - 1, 0)];
+  [text deleteCharactersInRange: NSMakeRange(NSMaxRange(lastLine), [text length] - NSMaxRange(lastLine))];
+  return text;
+}
+
+// A corpus with random characters typed into it, which leaves strings and comments unterminated and brackets
+// unbalanced all over it.
+static NSString *GMScrambledCorpus(NSString *language, NSUInteger length, NSUInteger characters, uint32_t seed)
+{
+  NSMutableString *text = [GMCorpus(language, length) mutableCopy];
+  NSArray *typed = @[@"a", @" ", @"{", @"}", @"\"", @"'", @"\n", @"#", @"/", @"*", @":", @";"];
+  for (NSUInteger i = 0; i < characters; i++) {
+    [text insertString: typed[GMRandom(&seed) % [typed count]] atIndex: GMRandom(&seed) % ([text length] + 1)];
+  }
+  return text;
+}
+
+// The distinct words of a text, up to a limit, in order of appearance.
+static NSArray *GMWordsOfText(NSString *text, NSUInteger limit)
+{
+  NSMutableOrderedSet *words = [NSMutableOrderedSet orderedSet];
+  NSCharacterSet *wordCharacters = [NSCharacterSet characterSetWithCharactersInString: @"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-"];
+  NSScanner *scanner = [NSScanner scannerWithString: text];
+  [scanner setCharactersToBeSkipped: [wordCharacters invertedSet]];
+  NSString *word;
+  while ([words count] < limit && [scanner scanCharactersFromSet: wordCharacters intoString: &word]) {
+    [words addObject: word];
+  }
+  return [words array];
+}
+
+#pragma mark - Measuring
+
+@interface GMBenchmark : NSObject
+{
+  NSUInteger _iterations;
+  NSString *_label;
+  NSMutableArray *_results;
+}
+
+- (id)initWithIterations: (NSUInteger)iterations label: (NSString *)label;
+// Runs block as many times as the text size allows and records the median time, along with the memory the first
+// run's result holds on to.
+- (void)measure: (NSString *)benchmark language: (NSString *)language bytes: (NSUInteger)bytes block: (id (^)(void))block;
+- (void)recordLatencies: (NSMutableData *)samples benchmark: (NSString *)benchmark language: (NSString *)language bytes: (NSUInteger)bytes;
+- (NSArray *)results;
+
+@end
+
+@implementation GMBenchmark
+
+- (id)initWithIterations:(NSUInteger)iterations label:(NSString *)label
+{
+  if (self = [super init]) {
+    _iterations = MAX(iterations, 1);
+    _label = label;
+    _results = [NSMutableArray array];
+  }
+  return self;
+}
+
+- (NSMutableDictionary *)resultFor: (NSString *)benchmark language: (NSString *)language bytes: (NSUInteger)bytes
+{
+  NSMutableDictionary *result = [@{@"benchmark": benchmark, @"language": language, @"bytes": @(bytes)} mutableCopy];
+  if (_label) {
+    result[@"label"] = _label;
+  }
+  [_results addObject: result];
+  return result;
+}
+
+- (void)measure:(NSString *)benchmark language:(NSString *)language bytes:(NSUInteger)bytes block:(id (^)(void))block
+{
+  NSUInteger iterations = bytes >= GMBenchmarkLargeText ? 1 : _iterations;
+  NSMutableData *times = [NSMutableData data];
+  GMMemoryUsage retained = {0, 0};
+  for (NSUInteger i = 0; i < iterations; i++) {
+    @autoreleasepool {
+      GMMemoryUsage before = GMMemoryInUse();
+      NSTimeInterval start = GMNow();
+      id result = block();
+      double elapsed = GMNow() - start;
+      GMMemoryUsage after = GMMemoryInUse();
+      [times appendBytes: &elapsed length: sizeof(elapsed)];
+      // Later runs free the previous result while they go, which would throw the numbers off.
+      if (i == 0) {
+        retained.bytes = after.bytes > before.bytes ? after.bytes - before.bytes : 0;
+        retained.blocks = after.blocks > before.blocks ? after.blocks - before.blocks : 0;
+      }
+      result = nil;
+    }
+  }
+  double seconds = GMPercentile(times, 0.5);
+  NSMutableDictionary *result = [self resultFor: benchmark language: language bytes: bytes];
+  result[@"iterations"] = @(iterations);
+  result[@"seconds"] = @(seconds);
+  result[@"megabytesPerSecond"] = @(seconds > 0 ? bytes / seconds / 1e6 : 0);
+  result[@"retainedBytes"] = @(retained.bytes);
+  result[@"retainedAllocations"] = @(retained.blocks);
+  printf("%-10s %-6s %11lu  %9.4f s  %9.2f MB/s  %11lu B  %9lu allocs\n", [benchmark UTF8String], [language UTF8String],
+         (unsigned long)bytes, seconds, [result[@"megabytesPerSecond"] doubleValue], (unsigned long)retained.bytes, (unsigned long)retained.blocks);
+}
+
+- (void)recordLatencies:(NSMutableData *)samples benchmark:(NSString *)benchmark language:(NSString *)language bytes:(NSUInteger)bytes
+{
+  NSMutableDictionary *result = [self resultFor: benchmark language: language bytes: bytes];
+  result[@"samples"] = @([samples length] / sizeof(double));
+  result[@"p50"] = @(GMPercentile(samples, 0.5));
+  result[@"p99"] = @(GMPercentile(samples, 0.99));
+  printf("%-10s %-6s %11lu  p50 %9.3f ms  p99 %9.3f ms\n", [benchmark UTF8String], [language UTF8String],
+         (unsigned long)bytes, [result[@"p50"] doubleValue] * 1000, [result[@"p99"] doubleValue] * 1000);
+}
+
+- (NSArray *)results
+{
+  return _results;
+}
+
+@end
+
+#pragma mark - Benchmarks
+
+static void GMBenchmarkLanguage(GMBenchmark *benchmark, NSString *name, NSString *resources, GMTheme *theme, NSArray *sizes, NSUInteger keystrokes)
+{
+  NSString *path = [[resources stringByAppendingPathComponent: name] stringByAppendingPathExtension: @"language"];
+  NSUInteger fileSize = (NSUInteger)[[[NSFileManager defaultManager] attributesOfItemAtPath: path error: NULL] fileSize];
+  __block NSDictionary *language;
+  [benchmark measure: @"load" language: name bytes: fileSize block: ^id {
+    language = [GMLanguage languageAtPath: path];
+    return language;
+  }];
+  if (!language) {
+    fprintf(stderr, "Can't load %s\n", [path fileSystemRepresentation]);
+    return;
+  }
+  GMSyntaxHighlighter *highlighter = [[GMSyntaxHighlighter alloc] init];
+  highlighter.language = language;
+  highlighter.theme = theme;
+
+  for (NSNumber *size in sizes) {
+    @autoreleasepool {
+      NSString *text = GMCorpus(name, [size unsignedIntegerValue]);
+      NSUInteger bytes = [text lengthOfBytesUsingEncoding: NSUTF8StringEncoding];
+
+      __block NSArray *tokens;
+      [benchmark measure: @"tokenize" language: name bytes: bytes block: ^id {
+        tokens = [highlighter tokenize: text];
+        return tokens;
+      }];
+      __block NSAttributedString *highlighted;
+      [benchmark measure: @"stringify" language: name bytes: bytes block: ^id {
+        highlighted = [GMToken stringify: tokens theme: theme];
+        return highlighted;
+      }];
+      tokens = nil;
+      [benchmark measure: @"html" language: name bytes: bytes block: ^id {
+        return [highlighter convertToHTML: highlighted];
+      }];
+      highlighted = nil;
+
+      // Autocompletion, typing the first few letters of words of the text.
+      NSArray *words = GMWordsOfText(text, GMBenchmarkMaximumCompletionItems);
+      __block GMCompletionIndex *index;
+      [benchmark measure: @"index" language: name bytes: bytes block: ^id {
+        index = [[GMCompletionIndex alloc] initWithStrings: words];
+        return index;
+      }];
+      uint32_t seed = 1;
+      for (NSNumber *algorithm in @[@(GMMatchingPrefix), @(GMMatchingSubletters)]) {
+        NSMutableData *latencies = [NSMutableData data];
+        for (NSUInteger i = 0; i < GMBenchmarkTypedFilters && [words count]; i++) {
+          NSString *word = words[GMRandom(&seed) % [words count]];
+          for (NSUInteger length = 1; length <= MIN([word length], 8); length++) {
+            NSTimeInterval start = GMNow();
+            [index matchFilter: [word substringToIndex: length] algorithm: [algorithm intValue]];
+            double elapsed = GMNow() - start;
+            [latencies appendBytes: &elapsed length: sizeof(elapsed)];
+          }
+        }
+        NSString *title = [algorithm intValue] == GMMatchingPrefix ? @"filter" : @"filter-sub";
+        [benchmark recordLatencies: latencies benchmark: title language: name bytes: bytes];
+      }
+      index = nil;
+
+      // Symbols, collected from the tokens of the whole text and then looked up at random locations.
+      if ([language[@"symbols"] count]) {
+        GMTokenBuffer *buffer = [highlighter tokenBufferForText: text];
+        __block GMSymbolIndex *symbols;
+        [benchmark measure: @"symbols" language: name bytes: bytes block: ^id {
+          symbols = [[GMSymbolIndex alloc] initWithDefinitions: language[@"symbols"]];
+          [symbols updateWithTokenBuffer: buffer];
+          return symbols;
+        }];
+        NSMutableSet *triggers = [NSMutableSet set];
+        for (NSDictionary *definition in language[@"symbols"]) {
+          [triggers addObjectsFromArray: definition[@"completes"] ?: @[]];
+        }
+        NSMutableData *latencies = [NSMutableData data];
+        for (NSUInteger i = 0; i < GMBenchmarkTypedFilters * 8; i++) {
+          NSUInteger location = GMRandom(&seed) % ([text length] + 1);
+          NSTimeInterval start = GMNow();
+          for (NSString *trigger in triggers) {
+            [symbols namesForToken: trigger excludingSymbolAtLocation: location];
+          }
+          [symbols outlineSymbolAtLocation: location];
+          double elapsed = GMNow() - start;
+          [latencies appendBytes: &elapsed length: sizeof(elapsed)];
+        }
+        [benchmark recordLatencies: latencies benchmark: @"symbol-query" language: name bytes: bytes];
+      }
+
+      // Single character edits all over the text, re-highlighted the way GMCodeEditor does it.
+      NSMutableString *edited = [text mutableCopy];
+      [highlighter invalidateLineCache];
+      [highlighter highlight: edited editedRange: NSMakeRange(0, [edited length]) changeInLength: [edited length] highlightedRange: NULL];
+      NSMutableData *latencies = [NSMutableData data];
+      NSArray *typed = @[@"a", @" ", @"{", @"\"", @"\n", @"#", @"/"];
+      for (NSUInteger i = 0; i < keystrokes; i++) {
+        @autoreleasepool {
+          NSUInteger location = GMRandom(&seed) % ([edited length] + 1);
+          NSRange editedRange;
+          NSInteger delta;
+          if (i % 4 == 3 && location < [edited length]) {
+            // Every fourth edit deletes a character instead.
+            [edited deleteCharactersInRange: NSMakeRange(location, 1)];
+            editedRange = NSMakeRange(location, 0);
+            delta = -1;
+          } else {
+            NSString *character = typed[GMRandom(&seed) % [typed count]];
+            [edited insertString: character atIndex: location];
+            editedRange = NSMakeRange(location, 1);
+            delta = 1;
+          }
+          NSTimeInterval start = GMNow();
+          [highlighter highlight: edited editedRange: editedRange changeInLength: delta highlightedRange: NULL];
+          double elapsed = GMNow() - start;
+          [latencies appendBytes: &elapsed length: sizeof(elapsed)];
+        }
+      }
+      [benchmark recordLatencies: latencies benchmark: @"keystroke" language: name bytes: bytes];
+    }
+  }
+}
+
+// Prints how much every measurement changed since a previous run.
+static void GMCompareWithBaseline(NSArray *results, NSString *path)
+{
+  NSArray *baseline = [NSJSONSerialization JSONObjectWithData: [NSData dataWithContentsOfFile: path] ?: [NSData data] options: 0 error: NULL];
+  if (![baseline isKindOfClass: [NSArray class]]) {
+    fprintf(stderr, "Can't read the baseline %s\n", [path fileSystemRepresentation]);
+    return;
+  }
+  NSMutableDictionary *previous = [NSMutableDictionary dictionary];
+  for (NSDictionary *result in baseline) {
+    previous[@[result[@"benchmark"], result[@"language"], result[@"bytes"]]] = result;
+  }
+  printf("\nCompared to %s:\n", [path fileSystemRepresentation]);
+  for (NSDictionary *result in results) {
+    NSDictionary *old = previous[@[result[@"benchmark"], result[@"language"], result[@"bytes"]]];
+    NSString *key = result[@"seconds"] ? @"seconds" : @"p50";
+    double before = [old[key] doubleValue], after = [result[key] doubleValue];
+    if (!old || before <= 0) {
+      continue;
+    }
+    printf("%-10s %-6s %11lu  %-7s %+7.1f%%\n", [result[@"benchmark"] UTF8String], [result[@"language"] UTF8String],
+           [result[@"bytes"] unsignedLongValue], [key UTF8String], (after - before) / before * 100);
+  }
+}
+
+#pragma mark - Checks
+
+// Turns tokens into a list of pieces of text, each with the types of the tokens it is in (as `type/inner type`, or an
+// empty string for plain text), merging neighbouring pieces of the same types. This way tokens compare the same no
+// matter how their content is split into strings and arrays.
+static void GMFlattenTokens(id tokens, NSString *types, NSMutableArray *pieces)
+{
+  if ([tokens isKindOfClass: [NSArray class]]) {
+    for (id token in tokens) {
+      GMFlattenTokens(token, types, pieces);
+    }
+  } else if ([tokens isKindOfClass: [GMToken class]]) {
+    NSString *type = [tokens tokenType];
+    GMFlattenTokens([tokens content], [types length] ? [NSString stringWithFormat: @"%@/%@", types, type] : type, pieces);
+  } else if ([tokens length]) {
+    NSArray *last = [pieces lastObject];
+    if ([last[0] isEqualToString: types]) {
+      [pieces replaceObjectAtIndex: [pieces count] - 1 withObject: @[types, [last[1] stringByAppendingString: tokens]]];
+    } else {
+      [pieces addObject: @[types, tokens]];
+    }
+  }
+}
+
+// The start of a piece of text, fit for a single line.
+static NSString *GMQuoted(NSString *text)
+{
+  text = [text length] > 40 ? [[text substringToIndex: 40] stringByAppendingString: @"..."] : text;
+  text = [[text stringByReplacingOccurrencesOfString: @"\n" withString: @"\\n"] stringByReplacingOccurrencesOfString: @"\t" withString: @"\\t"];
+  return [NSString stringWithFormat: @"\"%@\"", text];
+}
+
+// Compares two lists of tokens piece by piece and reports the first difference. Returns whether they are the same.
+static BOOL GMCheckTokens(NSString *check, NSString *language, NSArray *tokens, NSArray *expected)
+{
+  NSMutableArray *pieces = [NSMutableArray array], *expectedPieces = [NSMutableArray array];
+  GMFlattenTokens(tokens, @"", pieces);
+  GMFlattenTokens(expected, @"", expectedPieces);
+  NSUInteger offset = 0;
+  for (NSUInteger i = 0; i < MAX([pieces count], [expectedPieces count]); i++) {
+    NSArray *piece = i < [pieces count] ? pieces[i] : @[@"", @"(nothing)"];
+    NSArray *expectedPiece = i < [expectedPieces count] ? expectedPieces[i] : @[@"", @"(nothing)"];
+    if (![piece isEqual: expectedPiece]) {
+      fprintf(stderr, "%s %s: piece %lu at %lu is <%s> %s, expected <%s> %s\n", [check UTF8String], [language UTF8String],
+              (unsigned long)i, (unsigned long)offset, [piece[0] UTF8String], [GMQuoted(piece[1]) UTF8String],
+              [expectedPiece[0] UTF8String], [GMQuoted(expectedPiece[1]) UTF8String]);
+      return NO;
+    }
+    offset += [piece[1] length];
+  }
+  return YES;
+}
+
+// The same language without its predictive patterns.
+static NSDictionary *GMLanguageWithoutPredictives(NSDictionary *language)
+{
+  GMOrderedDictionary *rules = [GMOrderedDictionary dictionary];
+  for (NSString *name in language[@"grammar"]) {
+    id rule = language[@"grammar"][name];
+    if ([rule isKindOfClass: [NSDictionary class]] && rule[@"predictive"]) {
+      rule = [rule mutableCopy];
+      [rule removeObjectsForKeys: @[@"predictive", @"predictive_window"]];
+    }
+    [rules setObject: rule forKey: name];
+  }
+  return [GMLanguage languageWithDictionary: @{@"name": language[@"name"] ?: @"", @"grammar": rules}];
+}
+
+/*
+ The scanner engine is meant to produce the same tokens as the original rule passes. The rule passes lose text where
+ a predictive pattern matches after a short start of the text (see [GMSyntaxHighlighter engine]), so on the generated
+ texts their tokens are compared as they are only where they still add up to the text, and without the language's
+ predictive patterns always. The scanner's own predictive pass only looks at a window of the last tokens, so it is
+ compared as it is on a text made for its patterns to match where the rule passes keep all of the text.
+ */
+static NSUInteger GMCheckScanner(NSString *name, NSDictionary *language, NSArray *texts)
+{
+  NSUInteger failures = 0;
+  GMSyntaxHighlighter *scanner = [[GMSyntaxHighlighter alloc] init];
+  GMSyntaxHighlighter *rulePasses = [[GMSyntaxHighlighter alloc] init];
+  rulePasses.engine = GMTokenizerEngineRulePasses;
+  NSDictionary *withoutPredictives = GMLanguageWithoutPredictives(language);
+  for (NSString *text in texts) {
+    @autoreleasepool {
+      for (NSDictionary *checked in @[language, withoutPredictives]) {
+        scanner.language = checked;
+        rulePasses.language = checked;
+        NSArray *expected = [rulePasses tokenize: text];
+        NSMutableArray *pieces = [NSMutableArray array];
+        GMFlattenTokens(expected, @"", pieces);
+        NSMutableString *expectedText = [NSMutableString string];
+        for (NSArray *piece in pieces) {
+          [expectedText appendString: piece[1]];
+        }
+        if (checked == language && ![expectedText isEqualToString: text]) {
+          continue;
+        }
+        failures += !GMCheckTokens(@"scanner", name, [scanner tokenize: text], expected);
+      }
+    }
+  }
+
+  NSString *typing = GMTypingCorpus(name, GMCheckTextLength);
+  if (typing) {
+    rulePasses.language = withoutPredictives;
+    NSMutableArray *unpredicted = [NSMutableArray array], *pieces = [NSMutableArray array];
+    GMFlattenTokens([rulePasses tokenize: typing], @"", unpredicted);
+    rulePasses.language = language;
+    scanner.language = language;
+    NSArray *expected = [rulePasses tokenize: typing];
+    GMFlattenTokens(expected, @"", pieces);
+    NSMutableString *expectedText = [NSMutableString string];
+    for (NSArray *piece in pieces) {
+      [expectedText appendString: piece[1]];
+    }
+    if (![expectedText isEqualToString: typing] || [pieces isEqual: unpredicted]) {
+      fprintf(stderr, "scanner %s: the rule passes %s on the text made for the predictive patterns\n", [name UTF8String],
+              [pieces isEqual: unpredicted] ? "don't predict any token" : "lose text");
+      failures++;
+    } else {
+      failures += !GMCheckTokens(@"scanner", name, [scanner tokenize: typing], expected);
+    }
+  }
+  return failures;
+}
+
+// Compares the records of two token buffers one by one and reports the first difference. Returns whether they are
+// the same.
+static BOOL GMCheckRecords(NSString *check, NSString *language, GMTokenBuffer *buffer, GMTokenBuffer *expected)
+{
+  const GMTokenRecord *records = [buffer records], *expectedRecords = [expected records];
+  for (NSUInteger i = 0; i < MAX([buffer count], [expected count]); i++) {
+    GMTokenRecord record = i < [buffer count] ? records[i] : (GMTokenRecord){NSNotFound, 0, 0, 0};
+    GMTokenRecord expectedRecord = i < [expected count] ? expectedRecords[i] : (GMTokenRecord){NSNotFound, 0, 0, 0};
+    if (record.offset != expectedRecord.offset || record.length != expectedRecord.length || record.type != expectedRecord.type || record.depth != expectedRecord.depth) {
+      NSString *type = i < [buffer count] ? [buffer nameOfType: record.type] : @"(nothing)";
+      NSString *expectedType = i < [expected count] ? [expected nameOfType: expectedRecord.type] : @"(nothing)";
+      fprintf(stderr, "%s %s: record %lu is %s at {%lu, %lu} depth %u, expected %s at {%lu, %lu} depth %u\n",
+              [check UTF8String], [language UTF8String], (unsigned long)i,
+              [type UTF8String], (unsigned long)record.offset, (unsigned long)record.length, record.depth,
+              [expectedType UTF8String], (unsigned long)expectedRecord.offset, (unsigned long)expectedRecord.length, expectedRecord.depth);
+      return NO;
+    }
+  }
+  return YES;
+}
+
+/*
+ Tokenizing concurrently is meant to give exactly the records of tokenizing on one thread. The texts with characters
+ typed into them have comments and strings running across the boundaries of the chunks, whose state then differs
+ from the fresh one they were started in.
+ */
+static NSUInteger GMCheckConcurrent(NSString *name, NSDictionary *language, NSArray *texts)
+{
+  NSUInteger failures = 0;
+  GMSyntaxHighlighter *serial = [[GMSyntaxHighlighter alloc] init];
+  GMSyntaxHighlighter *concurrent = [[GMSyntaxHighlighter alloc] init];
+  serial.language = language;
+  concurrent.language = language;
+  concurrent.tokenizesConcurrently = YES;
+  for (NSString *text in texts) {
+    @autoreleasepool {
+      failures += !GMCheckRecords(@"concurrent", name, [concurrent tokenBufferForText: text], [serial tokenBufferForText: text]);
+    }
+  }
+  return failures;
+}
+
+/*
+ GMCompletionIndex only scores the items that matched the previous filter again when the filter is extended, and
+ finds prefixes by binary search. Its results are meant to be those of scoring every item: the ones above 0.1, by
+ score and then by index. The words are typed letter by letter, with a stray letter thrown in now and then.
+ */
+static NSUInteger GMCheckCompletion(NSString *name, NSString *text)
+{
+  NSArray *words = GMWordsOfText(text, GMCheckCompletionItems);
+  GMCompletionIndex *index = [[GMCompletionIndex alloc] initWithStrings: words];
+  NSUInteger count = [words count], failures = 0;
+  uint32_t seed = 4;
+  for (NSNumber *algorithm in @[@(GMMatchingPrefix), @(GMMatchingPrefixSuffixSorted), @(GMMatchingSubstring), @(GMMatchingDiceCoefficient), @(GMMatchingSubletters)]) {
+    for (NSUInteger i = 0; i < GMBenchmarkTypedFilters && count && !failures; i++) {
+      NSMutableString *filter = [NSMutableString string];
+      NSString *word = words[GMRandom(&seed) % count];
+      for (NSUInteger length = 1; length <= MIN([word length], 8) && !failures; length++) {
+        [filter appendString: GMRandom(&seed) % 8 ? [word substringWithRange: NSMakeRange(length - 1, 1)] : @"q"];
+        NSUInteger matches = [index matchFilter: filter algorithm: [algorithm intValue]];
+        NSMutableArray *expected = [NSMutableArray array];
+        NSMutableArray *scores = [NSMutableArray arrayWithCapacity: count];
+        for (NSUInteger item = 0; item < count; item++) {
+          double score = [index scoreOfItemAtIndex: item forFilter: filter algorithm: [algorithm intValue]];
+          [scores addObject: @(score)];
+          if (score > 0.1) {
+            [expected addObject: @(item)];
+          }
+        }
+        [expected sortUsingComparator: ^NSComparisonResult(NSNumber *a, NSNumber *b) {
+          NSComparisonResult order = [scores[[b unsignedIntegerValue]] compare: scores[[a unsignedIntegerValue]]];
+          return order != NSOrderedSame ? order : [a compare: b];
+        }];
+        BOOL same = matches == [expected count];
+        for (NSUInteger j = 0; j < matches && same; j++) {
+          same = [index results][j] == [expected[j] unsignedIntegerValue];
+        }
+        if (!same) {
+          fprintf(stderr, "completion %s: algorithm %d finds %lu items for \"%s\", expected %lu\n", [name UTF8String],
+                  [algorithm intValue], (unsigned long)matches, [filter UTF8String], (unsigned long)[expected count]);
+          failures++;
+        }
+      }
+    }
+  }
+  return failures;
+}
+
+// Replaces a random range of up to a few characters with one of the given strings. Returns the range of the new
+// characters and sets delta to the change in length.
+static NSRange GMRandomEdit(NSMutableString *text, NSArray *insertions, uint32_t *seed, NSInteger *delta)
+{
+  NSUInteger location = GMRandom(seed) % ([text length] + 1);
+  NSUInteger length = MIN(GMRandom(seed) % 4, [text length] - location);
+  NSString *insertion = GMRandom(seed) % 3 ? insertions[GMRandom(seed) % [insertions count]] : @"";
+  [text replaceCharactersInRange: NSMakeRange(location, length) withString: insertion];
+  *delta = (NSInteger)[insertion length] - (NSInteger)length;
+  return NSMakeRange(location, [insertion length]);
+}
+
+// Puts the records of an incremental tokenizing in place of those of the whole text before an edit, the way
+// GMCodeEditor applies them: the records after the edit move by delta, those it touched go, and those in the range of
+// buffer are replaced by its own. Returns the records of the whole edited text.
+static GMTokenBuffer *GMApplyTokenBuffer(GMTokenBuffer *whole, GMTokenBuffer *buffer, NSRange editedRange, NSInteger delta)
+{
+  NSRange range = [buffer range];
+  NSUInteger editedEnd = NSMaxRange(editedRange) - delta;
+  NSMutableData *before = [NSMutableData data], *after = [NSMutableData data];
+  const GMTokenRecord *records = [whole records];
+  for (NSUInteger i = 0; i < [whole count]; i++) {
+    GMTokenRecord record = records[i];
+    if (record.offset >= editedEnd) {
+      record.offset += delta;
+    } else if (record.offset + record.length > editedRange.location) {
+      continue;
+    }
+    if (record.offset + record.length <= range.location && record.offset < range.location) {
+      [before appendBytes: &record length: sizeof(record)];
+    } else if (record.offset >= NSMaxRange(range)) {
+      [after appendBytes: &record length: sizeof(record)];
+    }
+  }
+  [before appendBytes: [buffer records] length: [buffer count] * sizeof(GMTokenRecord)];
+  [before appendData: after];
+  GMTokenBuffer *merged = [[GMTokenBuffer alloc] initWithString: [buffer string] range: NSMakeRange(0, [[buffer string] length]) typeNames: [buffer typeNames]];
+  [merged replaceRecordsFromIndex: 0 withRecords: [before bytes] count: [before length] / sizeof(GMTokenRecord)];
+  return merged;
+}
+
+/*
+ After an edit, GMSyntaxHighlighter only tokenizes from the last line before it that no token crosses until it is back
+ in sync with its line cache. After every one of a series of random edits, the records of the whole text with those
+ of the lines it tokenized put in place are meant to be those of tokenizing the whole edited text. Every other edit
+ goes through tokenBufferForText:upToLocation: in short steps instead, the way GMCodeEditor fills in the highlighting.
+ */
+static NSUInteger GMCheckIncremental(NSString *name, NSDictionary *language, NSString *text)
+{
+  NSMutableString *edited = [text mutableCopy];
+  NSArray *insertions = @[@"a", @" ", @"\n", @"{", @"}", @"\"", @"'", @"#", @"/*", @"*/", @":", @";", @"/", @"end\n"];
+  GMSyntaxHighlighter *incremental = [[GMSyntaxHighlighter alloc] init];
+  GMSyntaxHighlighter *whole = [[GMSyntaxHighlighter alloc] init];
+  incremental.language = language;
+  whole.language = language;
+  GMTokenBuffer *records = [incremental tokenBufferForText: edited editedRange: NSMakeRange(0, [edited length]) changeInLength: [edited length]];
+  uint32_t seed = 9;
+  for (NSUInteger i = 0; i < GMCheckEdits; i++) {
+    @autoreleasepool {
+      NSInteger delta;
+      NSRange editedRange = GMRandomEdit(edited, insertions, &seed, &delta);
+      if (i % 2) {
+        records = GMApplyTokenBuffer(records, [incremental tokenBufferForText: edited editedRange: editedRange changeInLength: delta], editedRange, delta);
+      } else {
+        [[incremental lineCache] editedRange: editedRange changeInLength: delta];
+        NSRange unapplied = editedRange;
+        NSInteger unappliedDelta = delta;
+        NSUInteger dirty;
+        while ((dirty = [[incremental lineCache] dirtyRange].location) != NSNotFound) {
+          records = GMApplyTokenBuffer(records, [incremental tokenBufferForText: edited upToLocation: dirty + GMCheckHighlightingStep], unapplied, unappliedDelta);
+          unapplied = NSMakeRange(0, 0);
+          unappliedDelta = 0;
+        }
+      }
+      if (!GMCheckRecords(@"incremental", name, records, [whole tokenBufferForText: edited])) {
+        fprintf(stderr, "incremental %s: after replacing %ld characters at %lu with %lu%s\n", [name UTF8String],
+                (long)editedRange.length - delta, (unsigned long)editedRange.location, (unsigned long)editedRange.length,
+                i % 2 ? "" : ", tokenized in steps");
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+/*
+ GMLineIndex only looks at the edited characters and keeps the shift of the lines after an edit pending. After every
+ one of a series of random edits, which also split and join `\r\n` pairs, it is meant to agree with an index of the
+ edited text made from scratch, and with NSString about the line of any location.
+ */
+static NSUInteger GMCheckLineIndex(NSString *name, NSString *text)
+{
+  NSMutableString *edited = [text mutableCopy];
+  NSArray *insertions = @[@"a", @"\n", @"\r", @"\r\n", @"\n\n", @"ab\ncd", @"\u2028", @"\u0085", @" {\r\n}"];
+  GMLineIndex *index = [[GMLineIndex alloc] initWithString: edited];
+  uint32_t seed = 5;
+  for (NSUInteger i = 0; i < GMCheckEdits; i++) {
+    @autoreleasepool {
+      NSInteger delta;
+      NSRange editedRange = GMRandomEdit(edited, insertions, &seed, &delta);
+      [index editedRange: editedRange changeInLength: delta string: edited];
+      GMLineIndex *expected = [[GMLineIndex alloc] initWithString: edited];
+      BOOL same = [index count] == [expected count] && [index textLength] == [expected textLength];
+      for (NSUInteger line = 0; line < [index count] && same; line++) {
+        same = [index startOfLine: line] == [expected startOfLine: line];
+      }
+      NSUInteger location = GMRandom(&seed) % ([edited length] + 1);
+      NSRange lineRange = [edited lineRangeForRange: NSMakeRange(location, 0)];
+      if (!same || !NSEqualRanges([index rangeOfLineContainingLocation: location], lineRange)) {
+        fprintf(stderr, "lines %s: after replacing %ld characters at %lu with %lu, the index has %lu lines, expected %lu; the line at %lu is %s, expected %s\n",
+                [name UTF8String], (long)editedRange.length - delta, (unsigned long)editedRange.location, (unsigned long)editedRange.length,
+                (unsigned long)[index count], (unsigned long)[expected count], (unsigned long)location,
+                [NSStringFromRange([index rangeOfLineContainingLocation: location]) UTF8String], [NSStringFromRange(lineRange) UTF8String]);
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+/*
+ GMTokenIndex moves and stretches its tokens for an edit and then replaces those of the lines GMCodeEditor highlights
+ again. After every one of a series of random edits, it is meant to answer the same as an index made from the tokens
+ of the whole edited text, both around the edit and anywhere else.
+ */
+static NSUInteger GMCheckTokenIndex(NSString *name, NSDictionary *language, NSString *text)
+{
+  NSMutableString *edited = [text mutableCopy];
+  NSArray *insertions = @[@"a", @" ", @"\n", @"{", @"}", @"\"", @"'", @"#", @"/*", @"*/", @":", @";", @"/", @"end\n"];
+  GMSyntaxHighlighter *incremental = [[GMSyntaxHighlighter alloc] init];
+  GMSyntaxHighlighter *whole = [[GMSyntaxHighlighter alloc] init];
+  incremental.language = language;
+  whole.language = language;
+  GMTokenIndex *index = [[GMTokenIndex alloc] init];
+  [index updateWithTokenBuffer: [incremental tokenBufferForText: edited editedRange: NSMakeRange(0, [edited length]) changeInLength: [edited length]]];
+  uint32_t seed = 6;
+  for (NSUInteger i = 0; i < GMCheckEdits; i++) {
+    @autoreleasepool {
+      NSInteger delta;
+      NSRange editedRange = GMRandomEdit(edited, insertions, &seed, &delta);
+      [index editedRange: editedRange changeInLength: delta];
+      [index updateWithTokenBuffer: [incremental tokenBufferForText: edited editedRange: editedRange changeInLength: delta]];
+      GMTokenIndex *expected = [[GMTokenIndex alloc] init];
+      [expected updateWithTokenBuffer: [whole tokenBufferForText: edited]];
+      NSString *difference = nil;
+      if ([index count] != [expected count]) {
+        difference = [NSString stringWithFormat: @"has %lu tokens, expected %lu", (unsigned long)[index count], (unsigned long)[expected count]];
+      }
+      for (NSUInteger query = 0; query < GMCheckQueries && !difference; query++) {
+        // Half of the locations are around the edit.
+        NSUInteger location = query % 2 ? GMRandom(&seed) % ([edited length] + 1) : editedRange.location - MIN(editedRange.location, 16) + GMRandom(&seed) % 32;
+        location = MIN(location, [edited length]);
+        NSString *type, *expectedType;
+        NSRange range = [index rangeOfTokenAtLocation: location type: &type];
+        NSRange expectedRange = [expected rangeOfTokenAtLocation: location type: &expectedType];
+        NSArray *typeNames = [expected typeNames];
+        NSString *nextType = [typeNames count] ? typeNames[GMRandom(&seed) % [typeNames count]] : nil;
+        if (!NSEqualRanges(range, expectedRange) || (type != expectedType && ![type isEqualToString: expectedType])) {
+          difference = [NSString stringWithFormat: @"has %@ %@ at %lu, expected %@ %@", type, NSStringFromRange(range),
+                        (unsigned long)location, expectedType, NSStringFromRange(expectedRange)];
+        } else if (nextType && !NSEqualRanges([index rangeOfNextTokenOfType: nextType fromLocation: location],
+                                              [expected rangeOfNextTokenOfType: nextType fromLocation: location])) {
+          difference = [NSString stringWithFormat: @"has the next %@ from %lu at %@, expected %@", nextType, (unsigned long)location,
+                        NSStringFromRange([index rangeOfNextTokenOfType: nextType fromLocation: location]),
+                        NSStringFromRange([expected rangeOfNextTokenOfType: nextType fromLocation: location])];
+        } else if (!NSEqualRanges([index rangeOfNextTokenFromLocation: location depth: 0 type: NULL],
+                                  [expected rangeOfNextTokenFromLocation: location depth: 0 type: NULL])) {
+          difference = [NSString stringWithFormat: @"has the next token from %lu at %@, expected %@", (unsigned long)location,
+                        NSStringFromRange([index rangeOfNextTokenFromLocation: location depth: 0 type: NULL]),
+                        NSStringFromRange([expected rangeOfNextTokenFromLocation: location depth: 0 type: NULL])];
+        }
+      }
+      if (difference) {
+        fprintf(stderr, "tokens %s: after replacing %ld characters at %lu with %lu, the index %s\n", [name UTF8String],
+                (long)editedRange.length - delta, (unsigned long)editedRange.location, (unsigned long)editedRange.length,
+                [difference UTF8String]);
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+/*
+ GMSymbolIndex drops the symbols an edit touches and then finds those of the lines GMCodeEditor highlights again.
+ After every one of a series of random edits, it is meant to hold the same symbols as an index made from the tokens of
+ the whole edited text.
+ */
+static NSUInteger GMCheckSymbolIndex(NSString *name, NSDictionary *language, NSString *text)
+{
+  NSArray *definitions = language[@"symbols"];
+  if ([definitions count] == 0) {
+    return 0;
+  }
+  NSMutableSet *triggers = [NSMutableSet set];
+  for (NSDictionary *definition in definitions) {
+    [triggers addObjectsFromArray: definition[@"completes"] ?: @[]];
+  }
+  NSMutableString *edited = [text mutableCopy];
+  NSArray *insertions = @[@"a", @" ", @"\n", @"{", @"}", @"\"", @"#", @"/*", @"*/", @".x", @"def y", @"@z", @"class W\n"];
+  GMSyntaxHighlighter *incremental = [[GMSyntaxHighlighter alloc] init];
+  GMSyntaxHighlighter *whole = [[GMSyntaxHighlighter alloc] init];
+  incremental.language = language;
+  whole.language = language;
+  GMSymbolIndex *index = [[GMSymbolIndex alloc] initWithDefinitions: definitions];
+  [index updateWithTokenBuffer: [incremental tokenBufferForText: edited editedRange: NSMakeRange(0, [edited length]) changeInLength: [edited length]]];
+  uint32_t seed = 7;
+  for (NSUInteger i = 0; i < GMCheckEdits; i++) {
+    @autoreleasepool {
+      NSInteger delta;
+      NSRange editedRange = GMRandomEdit(edited, insertions, &seed, &delta);
+      [index editedRange: editedRange changeInLength: delta];
+      [index updateWithTokenBuffer: [incremental tokenBufferForText: edited editedRange: editedRange changeInLength: delta]];
+      GMSymbolIndex *expected = [[GMSymbolIndex alloc] initWithDefinitions: definitions];
+      [expected updateWithTokenBuffer: [whole tokenBufferForText: edited]];
+      NSString *difference = nil;
+      if ([index count] != [expected count]) {
+        difference = [NSString stringWithFormat: @"has %lu symbols, expected %lu", (unsigned long)[index count], (unsigned long)[expected count]];
+      } else if (![[index outline] isEqual: [expected outline]]) {
+        difference = [NSString stringWithFormat: @"has an outline of %lu symbols that differs from the expected one of %lu",
+                      (unsigned long)[[index outline] count], (unsigned long)[[expected outline] count]];
+      }
+      for (NSString *trigger in triggers) {
+        if (!difference && ![[index namesForToken: trigger] isEqual: [expected namesForToken: trigger]]) {
+          difference = [NSString stringWithFormat: @"completes %lu names in %@, expected %lu", (unsigned long)[[index namesForToken: trigger] count],
+                        trigger, (unsigned long)[[expected namesForToken: trigger] count]];
+        }
+      }
+      if (difference) {
+        fprintf(stderr, "symbols %s: after replacing %ld characters at %lu with %lu, the index %s\n", [name UTF8String],
+                (long)editedRange.length - delta, (unsigned long)editedRange.location, (unsigned long)editedRange.length,
+                [difference UTF8String]);
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+/*
+ Searches are timed against the budget of ruleTimeLimit by default, which is meant to change nothing but where a
+ rule runs out of time, and no rule of the bundled languages should on texts like these.
+ */
+static NSUInteger GMCheckBudget(NSString *name, NSDictionary *language, NSArray *texts)
+{
+  NSUInteger failures = 0;
+  GMSyntaxHighlighter *limited = [[GMSyntaxHighlighter alloc] init];
+  GMSyntaxHighlighter *unlimited = [[GMSyntaxHighlighter alloc] init];
+  limited.language = language;
+  unlimited.language = language;
+  unlimited.ruleTimeLimit = 0;
+  for (NSString *text in texts) {
+    @autoreleasepool {
+      GMTokenBuffer *buffer = [limited tokenBufferForText: text];
+      for (NSDictionary *entry in [limited exceededRules]) {
+        fprintf(stderr, "budget %s: rule %s ran out of time in %s\n", [name UTF8String], [entry[GMSyntaxHighlighterRuleKey] UTF8String],
+                [NSStringFromRange([entry[GMSyntaxHighlighterRangeKey] rangeValue]) UTF8String]);
+        failures++;
+      }
+      failures += !GMCheckRecords(@"budget", name, buffer, [unlimited tokenBufferForText: text]);
+    }
+  }
+  return failures;
+}
+
+/*
+ Instrumentation only observes: with it enabled, tokenizing on one thread and concurrently is meant to give the same
+ records as without it, and each call to be recorded as one run of the tokenizing phase.
+ */
+static NSUInteger GMCheckInstrumentation(NSString *name, NSDictionary *language, NSArray *texts)
+{
+  NSUInteger failures = 0, calls = 0;
+  GMInstrumentation *instrumentation = [GMInstrumentation sharedInstrumentation];
+  BOOL wasEnabled = [instrumentation isEnabled];
+  NSString *phase = [GMInstrumentation nameOfPhase: GMInstrumentationPhaseTokenizing];
+  GMSyntaxHighlighter *highlighter = [[GMSyntaxHighlighter alloc] init];
+  highlighter.language = language;
+  for (NSNumber *concurrently in @[@NO, @YES]) {
+    highlighter.tokenizesConcurrently = [concurrently boolValue];
+    for (NSString *text in texts) {
+      @autoreleasepool {
+        [instrumentation setEnabled: NO];
+        GMTokenBuffer *expected = [highlighter tokenBufferForText: text];
+        [instrumentation reset];
+        [instrumentation setEnabled: YES];
+        failures += !GMCheckRecords(@"instrumentation", name, [highlighter tokenBufferForText: text], expected);
+        [instrumentation setEnabled: NO];
+        NSUInteger recorded = 0;
+        for (NSDictionary *entry in [instrumentation dictionaryRepresentation][@"phases"]) {
+          if ([entry[GMInstrumentationNameKey] isEqualToString: phase]) {
+            recorded = [entry[GMInstrumentationCountKey] unsignedIntegerValue];
+          }
+        }
+        calls++;
+        if (recorded != 1) {
+          fprintf(stderr, "instrumentation %s: tokenizing text %lu recorded %lu runs of %s, expected 1\n", [name UTF8String],
+                  (unsigned long)calls, (unsigned long)recorded, [phase UTF8String]);
+          failures++;
+        }
+      }
+    }
+  }
+  [instrumentation reset];
+  [instrumentation setEnabled: wasEnabled];
+  return failures;
+}
+
+// Everything a renderer writes for a text.
+static NSData *GMRenderedText(GMSyntaxHighlighter *highlighter, GMRendererFormat format, NSUInteger bufferSize, NSString *text)
+{
+  NSMutableData *output = [NSMutableData data];
+  GMRenderer *renderer = [[GMRenderer alloc] initWithHighlighter: highlighter format: format sink: ^(const uint8_t *bytes, NSUInteger length) {
+    [output appendBytes: bytes length: length];
+  }];
+  if (bufferSize) {
+    renderer.bufferSize = bufferSize;
+  }
+  [renderer renderText: text];
+  return output;
+}
+
+// The runs of an HTML rendering, as pairs of a class (empty outside of spans) and the HTML between the tags. Next runs
+// of the same class are joined, since convertToHTML: puts neighbouring tokens of a type into a single span.
+static NSArray *GMHTMLRuns(NSString *html)
+{
+  NSMutableArray *runs = [NSMutableArray array];
+  NSScanner *scanner = [NSScanner scannerWithString: html];
+  [scanner setCharactersToBeSkipped: nil];
+  while (![scanner isAtEnd]) {
+    NSString *type = @"", *content = @"";
+    if ([scanner scanString: @"<span class='" intoString: NULL]) {
+      [scanner scanUpToString: @"'>" intoString: &type];
+      [scanner scanString: @"'>" intoString: NULL];
+      [scanner scanUpToString: @"</span>" intoString: &content];
+      [scanner scanString: @"</span>" intoString: NULL];
+    } else {
+      [scanner scanUpToString: @"<span class='" intoString: &content];
+    }
+    NSArray *last = [runs lastObject];
+    if ([last[0] isEqualToString: type]) {
+      [runs replaceObjectAtIndex: [runs count] - 1 withObject: @[type, [last[1] stringByAppendingString: content]]];
+    } else {
+      [runs addObject: @[type, content]];
+    }
+  }
+  return runs;
+}
+
+/*
+ GMRenderer streams the tokens of enumerateTokensInText:usingBlock: into a fixed buffer, flushing it whenever it is
+ full, and encodes and escapes the text itself. Its output is meant not to depend on the size of the buffer, the
+ tokens it streams to be the outermost ones of tokenizing into a buffer, and its HTML to be that of convertToHTML:. The
+ texts get characters outside the BMP, so that surrogate pairs meet the ends of the buffer and of the chunks the text
+ is read in, and every character HTML needs escaped.
+ */
+static NSUInteger GMCheckRenderer(NSString *name, NSDictionary *language, GMTheme *theme, NSArray *texts)
+{
+  NSUInteger failures = 0;
+  GMSyntaxHighlighter *highlighter = [[GMSyntaxHighlighter alloc] init];
+  highlighter.language = language;
+  highlighter.theme = theme;
+  NSString *wide = [NSString stringWithFormat: @"a%C%C", (unichar)0xD83D, (unichar)0xDE00];
+  for (NSString *text in texts) {
+    @autoreleasepool {
+      text = [[text componentsSeparatedByString: @"a"] componentsJoinedByString: wide];
+      text = [[text componentsSeparatedByString: @"e"] componentsJoinedByString: @"e&<>\"'"];
+      GMTokenBuffer *buffer = [highlighter tokenBufferForText: text];
+      NSMutableString *tokens = [NSMutableString string];
+      for (NSUInteger i = 0; i < [buffer count]; i++) {
+        GMTokenRecord record = [buffer records][i];
+        if (record.depth == 0) {
+          [tokens appendFormat: @"%lu %lu %@\n", (unsigned long)record.offset, (unsigned long)record.length, [buffer nameOfType: record.type]];
+        }
+      }
+      if (![GMRenderedText(highlighter, GMRendererFormatTokens, 0, text) isEqual: [tokens dataUsingEncoding: NSUTF8StringEncoding]]) {
+        fprintf(stderr, "renderer %s: the tokens format differs from the outermost tokens of the buffer\n", [name UTF8String]);
+        failures++;
+      }
+      NSString *html = [[NSString alloc] initWithData: GMRenderedText(highlighter, GMRendererFormatHTML, 0, text) encoding: NSUTF8StringEncoding];
+      NSArray *runs = GMHTMLRuns(html ?: @""), *expectedRuns = GMHTMLRuns([highlighter convertToHTML: [highlighter highlight: text]]);
+      for (NSUInteger i = 0; i < MAX([runs count], [expectedRuns count]); i++) {
+        NSArray *run = i < [runs count] ? runs[i] : @[@"(nothing)", @""];
+        NSArray *expectedRun = i < [expectedRuns count] ? expectedRuns[i] : @[@"(nothing)", @""];
+        if (![run isEqual: expectedRun]) {
+          fprintf(stderr, "renderer %s: span %lu of the html format is <%s> %s, convertToHTML: has <%s> %s\n", [name UTF8String],
+                  (unsigned long)i, [run[0] UTF8String], [GMQuoted(run[1]) UTF8String], [expectedRun[0] UTF8String], [GMQuoted(expectedRun[1]) UTF8String]);
+          failures++;
+          break;
+        }
+      }
+      for (NSNumber *format in @[@(GMRendererFormatHTML), @(GMRendererFormatANSI), @(GMRendererFormatTokens)]) {
+        if (![GMRenderedText(highlighter, [format intValue], 1, text) isEqual: GMRenderedText(highlighter, [format intValue], 0, text)]) {
+          fprintf(stderr, "renderer %s: format %d writes something else with the smallest buffer\n", [name UTF8String], [format intValue]);
+          failures++;
+        }
+      }
+    }
+  }
+  return failures;
+}
+
+/*
+ A grammar can nest a whole language by name, which the registry looks for in its searchPaths before the application
+ bundle, the way the Highlight tool finds the languages in its `-resources`. A language of a single rule nesting the
+ checked one, loaded from a directory of its own, is meant to give the tokens of the checked language inside the token
+ of that rule.
+ */
+static NSUInteger GMCheckNested(NSString *name, NSDictionary *language, NSArray *texts)
+{
+  NSString *directory = [NSTemporaryDirectory() stringByAppendingPathComponent: [[NSUUID UUID] UUIDString]];
+  NSString *path = [[directory stringByAppendingPathComponent: @"nested"] stringByAppendingPathExtension: @"language"];
+  NSDictionary *nested = @{@"grammar": @[@{@"block": @{@"pattern": @"/<<<[\\w\\W]*?>>>/", @"language": name}}]};
+  if (![[NSFileManager defaultManager] createDirectoryAtPath: directory withIntermediateDirectories: YES attributes: nil error: NULL] ||
+      ![nested writeToFile: path atomically: YES]) {
+    fprintf(stderr, "Can't write %s\n", [path fileSystemRepresentation]);
+    return 1;
+  }
+  NSDictionary *outerLanguage = [[GMRegistry sharedRegistry] languageAtPath: path];
+  [[NSFileManager defaultManager] removeItemAtPath: directory error: NULL];
+  if (!outerLanguage) {
+    fprintf(stderr, "Can't load %s\n", [path fileSystemRepresentation]);
+    return 1;
+  }
+  NSUInteger failures = 0;
+  GMSyntaxHighlighter *outer = [[GMSyntaxHighlighter alloc] init];
+  GMSyntaxHighlighter *inner = [[GMSyntaxHighlighter alloc] init];
+  outer.language = outerLanguage;
+  inner.language = language;
+  for (NSString *text in texts) {
+    @autoreleasepool {
+      NSString *wrapped = [NSString stringWithFormat: @"<<<%@>>>", text];
+      NSArray *expected = @[[[GMToken alloc] initWithToken: @"block" inside: [inner tokenize: wrapped]]];
+      failures += !GMCheckTokens(@"nested", name, [outer tokenize: wrapped], expected);
+    }
+  }
+  return failures;
+}
+
+// Runs all checks on one language and returns how many failed.
+static NSUInteger GMCheckLanguage(NSString *name, NSString *resources, GMTheme *theme)
+{
+  NSString *path = [[resources stringByAppendingPathComponent: name] stringByAppendingPathExtension: @"language"];
+  NSDictionary *language = [GMLanguage languageAtPath: path];
+  if (!language) {
+    fprintf(stderr, "Can't load %s\n", [path fileSystemRepresentation]);
+    return 1;
+  }
+  NSArray *texts = @[GMCorpus(name, GMCheckTextLength), GMScrambledCorpus(name, GMCheckTextLength, GMCheckTypedCharacters, 1)];
+  NSUInteger failures = 0, checkFailures;
+
+  checkFailures = GMCheckScanner(name, language, texts);
+  printf("%-10s %-6s %s\n", "scanner", [name UTF8String], checkFailures ? "FAILED" : "ok");
+  failures += checkFailures;
+
+  NSArray *longTexts = @[GMCorpus(name, GMCheckConcurrentTextLength),
+                         GMScrambledCorpus(name, GMCheckConcurrentTextLength, GMCheckTypedCharacters, 2),
+                         GMScrambledCorpus(name, GMCheckConcurrentTextLength, GMCheckTypedCharacters * 10, 3)];
+  checkFailures = GMCheckConcurrent(name, language, longTexts);
+  printf("%-10s %-6s %s\n", "concurrent", [name UTF8String], checkFailures ? "FAILED" : "ok");
+  failures += checkFailures;
+
+  checkFailures = GMCheckCompletion(name, texts[0]);
+  printf("%-10s %-6s %s\n", "completion", [name UTF8String], checkFailures ? "FAILED" : "ok");
+  failures += checkFailures;
+
+  checkFailures = GMCheckIncremental(name, language, texts[0]);
+  printf("%-10s %-6s %s\n", "incremental", [name UTF8String], checkFailures ? "FAILED" : "ok");
+  failures += checkFailures;
+
+  checkFailures = GMCheckLineIndex(name, texts[0]);
+  printf("%-10s %-6s %s\n", "lines", [name UTF8String], checkFailures ? "FAILED" : "ok");
+  failures += checkFailures;
+
+  checkFailures = GMCheckTokenIndex(name, language, texts[0]);
+  printf("%-10s %-6s %s\n", "tokens", [name UTF8String], checkFailures ? "FAILED" : "ok");
+  failures += checkFailures;
+
+  checkFailures = GMCheckSymbolIndex(name, language, texts[0]);
+  printf("%-10s %-6s %s\n", "symbols", [name UTF8String], checkFailures ? "FAILED" : "ok");
+  failures += checkFailures;
+
+  checkFailures = GMCheckBudget(name, language, texts);
+  printf("%-10s %-6s %s\n", "budget", [name UTF8String], checkFailures ? "FAILED" : "ok");
+  failures += checkFailures;
+
+  checkFailures = GMCheckInstrumentation(name, language, @[texts[0], longTexts[1]]);
+  printf("%-10s %-6s %s\n", "instrumentation", [name UTF8String], checkFailures ? "FAILED" : "ok");
+  failures += checkFailures;
+
+  checkFailures = GMCheckNested(name, language, texts);
+  printf("%-10s %-6s %s\n", "nested", [name UTF8String], checkFailures ? "FAILED" : "ok");
+  failures += checkFailures;
+
+  checkFailures = GMCheckRenderer(name, language, theme, texts);
+  printf("%-10s %-6s %s\n", "renderer", [name UTF8String], checkFailures ? "FAILED" : "ok");
+  failures += checkFailures;
+
+  return failures;
+}
+
+int main(int argc, const char *argv[])
+{
+  @autoreleasepool {
+    NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];
+    NSString *here = [[NSString stringWithUTF8String: __FILE__] stringByDeletingLastPathComponent];
+    [defaults registerDefaults: @{
+      @"sizes": @"1000,10000,100000,1000000,10000000,100000000",
+      @"languages": @"css,ruby",
+      @"resources": [[here stringByDeletingLastPathComponent] stringByAppendingPathComponent: @"GMCodeEditor/resources"],
+      @"iterations": @3,
+      @"keystrokes": @200
+    }];
+
+    NSMutableArray *sizes = [NSMutableArray array];
+    for (NSString *size in [[defaults stringForKey: @"sizes"] componentsSeparatedByString: @","]) {
+      if ([size integerValue] > 0) {
+        [sizes addObject: @([size integerValue])];
+      }
+    }
+    NSString *resources = [defaults stringForKey: @"resources"];
+    [[GMRegistry sharedRegistry] setSearchPaths: @[resources]];
+    GMTheme *theme = [GMTheme themeAtPath: [resources stringByAppendingPathComponent: @"light.theme"]];
+    GMBenchmark *benchmark = [[GMBenchmark alloc] initWithIterations: [defaults integerForKey: @"iterations"] label: [defaults stringForKey: @"label"]];
+    NSString *instrumentation = [defaults stringForKey: @"instrumentation"];
+    [[GMInstrumentation sharedInstrumentation] setEnabled: instrumentation != nil];
+
+    if ([defaults boolForKey: @"check"]) {
+      NSUInteger failures = 0;
+      for (NSString *language in [[defaults stringForKey: @"languages"] componentsSeparatedByString: @","]) {
+        failures += GMCheckLanguage(language, resources, theme);
+      }
+      return failures ? 1 : 0;
+    }
+
+    for (NSString *language in [[defaults stringForKey: @"languages"] componentsSeparatedByString: @","]) {
+      GMBenchmarkLanguage(benchmark, language, resources, theme, sizes, [defaults integerForKey: @"keystrokes"]);
+    }
+
+    NSString *output = [defaults stringForKey: @"output"];
+    if (output) {
+      NSData *json = [NSJSONSerialization dataWithJSONObject: [benchmark results] options: NSJSONWritingPrettyPrinted error: NULL];
+      if (![json writeToFile: output atomically: YES]) {
+        fprintf(stderr, "Can't write %s\n", [output fileSystemRepresentation]);
+        return 1;
+      }
+    }
+    NSError *error = nil;
+    if (instrumentation && ![[GMInstrumentation sharedInstrumentation] writeJSONToFile: instrumentation error: &error]) {
+      fprintf(stderr, "Can't write %s: %s\n", [instrumentation fileSystemRepresentation], [[error localizedDescription] UTF8String]);
+      return 1;
+    }
+    NSString *baseline = [defaults stringForKey: @"baseline"];
+    if (baseline) {
+      GMCompareWithBaseline([benchmark results], baseline);
+    }
+  }
+  return 0;
+}
@@ -13,6 +13,17 @@
 {
   IBOutlet GMCodeEditor *textView;
   NSAttributedString *_loadedText;
+  NSData *_mappedData;
+  NSUInteger _loadedLength;
+  NSStringEncoding _encoding;
+  BOOL _largeFile;
 }
 
+/**
+ Files at least this many bytes long are opened in large file mode: the file is memory mapped and decoded into the
+ editor a chunk at a time, only the visible text is highlighted and saving writes the text out in chunks, so that
+ the file is never held in memory more than once. Defaults to 16 MB.
+ */
+@property NSUInteger largeFileThreshold;
+
 @end
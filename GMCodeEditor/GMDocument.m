@@ -8,13 +8,57 @@
 
 #import "GMDocument.h"
 
+#define GMDocumentDefaultLargeFileThreshold (16 * 1024 * 1024)
+// How many bytes of a large file are decoded and added to the editor at once.
+#define GMDocumentLoadingChunkLength (4 * 1024 * 1024)
+// How many characters of a large file are encoded and written at once.
+#define GMDocumentWritingChunkLength (1024 * 1024)
+
+// Whether bytes are well-formed UTF-8 (see table 3-7 of the Unicode standard), which is what NSString decodes.
+static BOOL GMIsValidUTF8(const uint8_t *bytes, NSUInteger length)
+{
+  NSUInteger i = 0;
+  while (i < length) {
+    uint8_t b = bytes[i];
+    if (b < 0x80) {
+      i++;
+      continue;
+    }
+    NSUInteger count;
+    uint8_t low = 0x80, high = 0xBF;
+    if (b >= 0xC2 && b <= 0xDF) {
+      count = 1;
+    } else if (b >= 0xE0 && b <= 0xEF) {
+      count = 2;
+      if (b == 0xE0) low = 0xA0;
+      if (b == 0xED) high = 0x9F;
+    } else if (b >= 0xF0 && b <= 0xF4) {
+      count = 3;
+      if (b == 0xF0) low = 0x90;
+      if (b == 0xF4) high = 0x8F;
+    } else {
+      return NO;
+    }
+    if (length - i <= count || bytes[i + 1] < low || bytes[i + 1] > high) {
+      return NO;
+    }
+    for (NSUInteger j = 2; j <= count; j++) {
+      if ((bytes[i + j] & 0xC0) != 0x80) {
+        return NO;
+      }
+    }
+    i += count + 1;
+  }
+  return YES;
+}
+
 @implementation GMDocument
 
 - (id)init
 {
     self = [super init];
     if (self) {
-    // Add your subclass-specific initialization here.
+    _largeFileThreshold = GMDocumentDefaultLargeFileThreshold;
     }
     return self;
 }
@@ -30,10 +74,24 @@
 {
   [super windowControllerDidLoadNib:aController];
   if(_loadedText) [textView.textStorage setAttributedString: _loadedText];
+  _loadedText = nil;
   [textView setLanguage: @"css"];
+  if (_largeFile) {
+    [textView setHighlightsVisibleRangeOnly: YES];
+    [textView setEditable: NO];
+    // The chunks are highlighted once they are all there, not one by one.
+    [textView setSuspendsHighlighting: YES];
+    [self performSelector: @selector(loadNextChunk) withObject: nil afterDelay: 0];
+  }
   // Add any code here that needs to be executed once the windowController has loaded the document's window.
 }
 
+- (void)close
+{
+  [NSObject cancelPreviousPerformRequestsWithTarget: self selector: @selector(loadNextChunk) object: nil];
+  [super close];
+}
+
 + (BOOL)autosavesInPlace
 {
     return YES;
@@ -45,6 +103,26 @@
 
 }
 
+- (BOOL)readFromURL:(NSURL *)url ofType:(NSString *)typeName error:(NSError **)outError
+{
+  NSNumber *size;
+  [url getResourceValue: &size forKey: NSURLFileSizeKey error: nil];
+  if ([size unsignedIntegerValue] < _largeFileThreshold) {
+    _largeFile = NO;
+    return [super readFromURL: url ofType: typeName error: outError];
+  }
+  _mappedData = [NSData dataWithContentsOfURL: url options: NSDataReadingMappedAlways error: outError];
+  _loadedLength = 0;
+  _largeFile = YES;
+  // The whole file is read in one encoding, rather than deciding for every chunk.
+  _encoding = NSUTF8StringEncoding;
+  if (_mappedData && !GMIsValidUTF8([_mappedData bytes], [_mappedData length])) {
+    NSLog(@"WARNING: %@ isn't valid UTF-8, reading it as Latin 1", [url path]);
+    _encoding = NSISOLatin1StringEncoding;
+  }
+  return _mappedData != nil;
+}
+
 - (BOOL)readFromData:(NSData *)data ofType:(NSString *)typeName error:(NSError **)outError
 {
   NSMutableString *str = [[NSMutableString alloc] initWithData:data encoding:NSUTF8StringEncoding];
@@ -53,4 +131,63 @@
   return YES;
 }
 
+- (BOOL)writeToURL:(NSURL *)url ofType:(NSString *)typeName error:(NSError **)outError
+{
+  if (!_largeFile) {
+    return [super writeToURL: url ofType: typeName error: outError];
+  }
+  if (_mappedData) {
+    // Still loading, so the file hasn't been edited yet.
+    return [_mappedData writeToURL: url options: 0 error: outError];
+  }
+  NSOutputStream *stream = [NSOutputStream outputStreamWithURL: url append: NO];
+  [stream open];
+  NSString *string = textView.textStorage.string;
+  NSMutableData *buffer = [NSMutableData dataWithLength: GMDocumentWritingChunkLength * 3];
+  NSRange remaining = NSMakeRange(0, [string length]);
+  BOOL written = YES;
+  while (written && remaining.length > 0) {
+    NSUInteger used;
+    NSRange chunk = NSMakeRange(remaining.location, MIN(remaining.length, (NSUInteger)GMDocumentWritingChunkLength));
+    // A chunk that splits a surrogate pair gets its high half carried over to the next one.
+    [string getBytes: [buffer mutableBytes] maxLength: [buffer length] usedLength: &used encoding: NSUTF8StringEncoding options: 0 range: chunk remainingRange: &chunk];
+    if (used == 0) {
+      break;
+    }
+    written = [stream write: [buffer bytes] maxLength: used] == (NSInteger)used;
+    remaining = NSMakeRange(chunk.location, NSMaxRange(remaining) - chunk.location);
+  }
+  written = written && remaining.length == 0;
+  if (!written && outError) {
+    *outError = [stream streamError] ?: [NSError errorWithDomain: NSCocoaErrorDomain code: NSFileWriteUnknownError userInfo: nil];
+  }
+  [stream close];
+  return written;
+}
+
+#pragma mark - Large files
+
+// Appends the next chunk of the mapped file to the editor, ending it before a character that continues into the next.
+// The file was checked to be in _encoding as a whole when it was mapped, so every chunk decodes.
+- (void)loadNextChunk
+{
+  const uint8_t *bytes = [_mappedData bytes];
+  NSUInteger total = [_mappedData length];
+  NSUInteger end = MIN(_loadedLength + GMDocumentLoadingChunkLength, total);
+  while (_encoding == NSUTF8StringEncoding && end < total && end > _loadedLength && (bytes[end] & 0xC0) == 0x80) {
+    end--;
+  }
+  NSString *chunk = [[NSString alloc] initWithBytes: bytes + _loadedLength length: end - _loadedLength encoding: _encoding];
+  NSTextStorage *textStorage = textView.textStorage;
+  [textStorage replaceCharactersInRange: NSMakeRange([textStorage length], 0) withString: chunk];
+  _loadedLength = end;
+  if (_loadedLength < total) {
+    [self performSelector: @selector(loadNextChunk) withObject: nil afterDelay: 0];
+  } else {
+    _mappedData = nil;
+    [textView setSuspendsHighlighting: NO];
+    [textView setEditable: YES];
+  }
+}
+
 @end
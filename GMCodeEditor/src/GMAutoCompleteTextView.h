@@ -1,4 +1,5 @@
 #import <Cocoa/Cocoa.h>
+#import "GMCompletionIndex.h"
 
 
 @protocol GMAutocompleteItem <NSObject>
@@ -9,14 +10,6 @@
 @end
 
 
-typedef enum {
-  GMMatchingPrefix = 0,
-  GMMatchingPrefixSuffixSorted,
-  GMMatchingSubstring,
-  GMMatchingDiceCoefficient,
-  GMMatchingSubletters
-} GMMatchingAlgorithm;
-
 /**
  GMAutoCompleteTextView is a general purpose autocompletion text component. It allows for sofisticated customization,
  mostly through subclassing, which is required for proper usage of this component.
@@ -66,6 +59,7 @@ typedef enum {
   NSTableView *autocompleteTable;
   NSWindow *autocompleteWindow;
   id trigger;
+  NSMapTable *completionIndexes;
 }
 
 
@@ -161,6 +155,11 @@ If the scores are tied, the original ordering (from autocompletionListForTrigger
  order (especially when using `GMMatchingPrefix`, this is necessary, since all the matching elements have the same 
  ordering). 
 
+As long as this method isn't overridden, the list isn't filtered by calling it for every item, but through a GMCompletionIndex
+ that scores items the same way. The index is built from textForObject: the first time a list is filtered and kept for as long
+ as autocompletionListForTrigger: keeps returning the same array, so return the same array for the same trigger and replace
+ it rather than mutating it when the completions change.
+
 @param item The object which is part of the array returned by autocompletionListForTrigger:.
 @param filter What has been already typed. (NB: this is equal to @autocompleteFilter, but passed in for convenience).
 @return A score between <0,1>, such that scores below 0.1 will not be shown, and the autocompletion list will be 
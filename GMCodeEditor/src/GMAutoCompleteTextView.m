@@ -1,4 +1,6 @@
 #import "GMAutoCompleteTextView.h"
+#import "GMCompletionIndex.h"
+#import "GMInstrumentation.h"
 
 
 @implementation GMAutoCompleteTextView
@@ -25,22 +27,35 @@
 
 -(void) filterAutoCompletionList: (NSString *)filter
 {
+  GMInstrumentationMark mark = GMInstrumentationBeginPhase();
   filteredList = [NSMutableArray array];
   filter = [[[filter stringByReplacingOccurrencesOfString:@"\n" withString:@""] stringByReplacingOccurrencesOfString:@"@" withString:@""] stringByReplacingOccurrencesOfString:@" " withString:@""];
   
-  NSMutableArray *sortArr = [NSMutableArray array];
-  NSUInteger i = 0;
-  for (id obj in [self autocompletionListForTrigger:trigger]) {
-    double score = [self item: obj matchesFilter: filter];
-    if(score > 0.1) {
-      
-      [sortArr addObject: @{@"score": @(score), @"index": @(i), @"object": obj}];
-      i++;
+  NSArray *list = [self autocompletionListForTrigger:trigger];
+  if ([self usesDefaultMatching]) {
+    GMCompletionIndex *index = [self completionIndexForList: list];
+    NSUInteger count = [index matchFilter: filter algorithm: self.matchingAlgorithm];
+    const NSUInteger *results = [index results];
+    filteredList = [NSMutableArray arrayWithCapacity: count];
+    for (NSUInteger i = 0; i < count; i++) {
+      [filteredList addObject: list[results[i]]];
+    }
+  } else {
+    NSMutableArray *sortArr = [NSMutableArray array];
+    NSUInteger i = 0;
+    for (id obj in list) {
+      double score = [self item: obj matchesFilter: filter];
+      if(score > 0.1) {
+        
+        [sortArr addObject: @{@"score": @(score), @"index": @(i), @"object": obj}];
+        i++;
+      }
     }
+    [sortArr sortUsingDescriptors:@[[NSSortDescriptor sortDescriptorWithKey:@"score" ascending:NO], [NSSortDescriptor sortDescriptorWithKey:@"index" ascending:YES]]];
+    
+    filteredList = [sortArr valueForKey: @"object"];
   }
-  [sortArr sortUsingDescriptors:@[[NSSortDescriptor sortDescriptorWithKey:@"score" ascending:NO], [NSSortDescriptor sortDescriptorWithKey:@"index" ascending:YES]]];
-  
-  filteredList = [sortArr valueForKey: @"object"];
+  GMInstrumentationEndPhase(GMInstrumentationPhaseFilteringCompletions, mark);
   if ([filteredList count] == 0) {
     filter = @"";
     [autocompleteWindow orderOut:nil];
@@ -257,75 +272,38 @@
 
 - (double)item: (id)item matchesFilter: (NSString *)filter
 {
-  NSString *itemString = [self textForObject: item];
-  if ([itemString isEqualToString: filter]) {
-    return 0.0;
-  }
-  if (self.matchingAlgorithm == GMMatchingDiceCoefficient) {
-    return [self diceCoefficient: itemString and: filter];
-  } else if (self.matchingAlgorithm == GMMatchingSubletters) {
-    NSMutableString *re = [NSMutableString string];
-    for (int i = 0; i < [filter length]-1; i++) {
-      [re appendFormat:@"(%C)[^%C]*", [filter characterAtIndex: i], [filter characterAtIndex: i + 1]];
-    }
-    [re appendFormat:@"(%C)", [filter characterAtIndex: [filter length] - 1]];
-    NSRegularExpression *reg = [NSRegularExpression regularExpressionWithPattern: re options:NSRegularExpressionCaseInsensitive error:nil];
-
-    NSTextCheckingResult * matches = [reg firstMatchInString:itemString options:0 range:NSMakeRange(0, [itemString length])];
-    if (matches) {
-      NSUInteger score = 1;
-      NSUInteger lastPosition = [matches rangeAtIndex: 0].location;
-      for (int i = 1; i < [matches numberOfRanges]; i++) {
-        score += [matches rangeAtIndex:i].location - lastPosition;
-        lastPosition = [matches rangeAtIndex:i].location;
-      }
-      return (double)[filter length] / (double)score;
-    } else {
-      return 0.0;
-    }
-
-  } else { //GMMatchingPrefix is the default
-    if ([itemString hasPrefix: filter]) {
-      return 1.0;
-    } else {
-      return 0.0;
-    }
-  }
+  NSString *itemString = [self textForObject: item] ?: @"";
+  GMCompletionIndex *index = [[GMCompletionIndex alloc] initWithStrings: @[itemString]];
+  return [index scoreOfItemAtIndex: 0 forFilter: filter algorithm: self.matchingAlgorithm];
 }
 
 #pragma mark - Private Utility
 
+- (BOOL)usesDefaultMatching
+{
+  SEL selector = @selector(item:matchesFilter:);
+  return [[self class] instanceMethodForSelector: selector] == [GMAutoCompleteTextView instanceMethodForSelector: selector];
+}
+
 /*
- * @see http://www.catalysoft.com/articles/strikeamatch.html
+ * Indexes are keyed by the identity of the list, so building one is paid once per list rather than once per keystroke.
  */
-- (double)diceCoefficient: (NSString *)string1 and: (NSString *)string2
+- (GMCompletionIndex *)completionIndexForList: (NSArray *)list
 {
-  NSMutableArray *pairs1 = [NSMutableArray array];
-  for (NSString *s in [string1 componentsSeparatedByCharactersInSet: [NSCharacterSet whitespaceAndNewlineCharacterSet]]) {
-    for (int i = 0; i < [s length] - 1; i++) {
-      [pairs1 addObject: [s substringWithRange:NSMakeRange(i, 2)]];
-    }
-  }
-  
-  NSMutableArray *pairs2 = [NSMutableArray array];
-  for (NSString *s in [string2 componentsSeparatedByCharactersInSet: [NSCharacterSet whitespaceAndNewlineCharacterSet]]) {
-    for (int i = 0; i < [s length] - 1; i++) {
-      [pairs2 addObject: [s substringWithRange:NSMakeRange(i, 2)]];
-    }
+  if (!completionIndexes) {
+    completionIndexes = [NSMapTable mapTableWithKeyOptions: NSPointerFunctionsWeakMemory | NSPointerFunctionsObjectPointerPersonality
+                                              valueOptions: NSPointerFunctionsStrongMemory];
   }
-  double intersection = 0;
-  double both = (double)[pairs1 count] + (double)[pairs2 count];
-  for (NSString *pair1 in pairs1) {
-    for (int j = 0; j < [pairs2 count]; j++) {
-      NSString *pair2 = pairs2[j];
-      if ([pair1 isEqualToString: pair2]) {
-        intersection += 2;
-        [pairs2 removeObjectAtIndex: j];
-      }
+  GMCompletionIndex *index = [completionIndexes objectForKey: list];
+  if (!index || [index count] != [list count]) {
+    NSMutableArray *strings = [NSMutableArray arrayWithCapacity: [list count]];
+    for (id obj in list) {
+      [strings addObject: [self textForObject: obj] ?: @""];
     }
+    index = [[GMCompletionIndex alloc] initWithStrings: strings];
+    [completionIndexes setObject: index forKey: list];
   }
-  
-  return intersection / both;
+  return index;
 }
 
 
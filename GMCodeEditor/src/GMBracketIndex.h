@@ -0,0 +1,100 @@
+//
+//  GMBracketIndex.h
+//  Code Editor
+//
+//  Created by Jakub Hampl on 17.10.26.
+//  Copyright (c) 2026 Jakub Hampl. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class GMTokenBuffer;
+
+/**
+ GMBracketIndex keeps track of the brackets of a document, so that finding the bracket matching a bracket or the
+ block enclosing a location doesn't mean scanning the text.
+
+ The index is a sorted array of the locations of the brackets, which is kept up to date as the text is edited (see
+ editedRange:changeInLength:string:). Brackets inside tokens such as strings and comments don't count; they are
+ dropped whenever tokens covering them are reported through updateWithTokenBuffer: or removeBracketsInRange:.
+
+ Which brackets match is worked out in one pass over the array the first time it is needed after a change. A
+ closing bracket only matches the innermost open bracket, and only if that is of the same kind. Queries are then
+ binary searches.
+ */
+@interface GMBracketIndex : NSObject
+{
+@private
+  unichar *_openings;
+  unichar *_closings;
+  NSUInteger _pairCount;
+  struct GMBracket *_brackets;
+  NSUInteger _count;
+  NSUInteger _capacity;
+  NSUInteger *_matches;
+  NSUInteger *_parents;
+  BOOL _nestingIsValid;
+  NSArray *_lastTypeNames;
+  NSMutableData *_ignoredTypes;
+}
+
+/**
+ Creates an empty index.
+ @param pairs The paired characters of a language, each opening character mapped to its closing character (as in
+ the `paired_characters` of a [language](GMLanguage)). Pairs whose opening and closing characters are the same, like
+ quotes, aren't brackets and are left out.
+ */
+- (id)initWithPairs: (NSDictionary *)pairs;
+
+/**
+ The names of token types whose brackets don't count. Defaults to `string` and `comment`.
+ */
+@property (copy) NSSet *ignoredTypeNames;
+
+/**
+ @name Updating the index
+ */
+/**
+ Indexes every bracket of a string, as if it had no tokens.
+ */
+- (void)resetWithString: (NSString *)string;
+/**
+ Updates the index for an edit of the text, indexing the new characters as if they had no tokens.
+ @param editedRange The range of the new characters, in the coordinates of the text after the edit.
+ @param delta The change in length caused by the edit.
+ @param string The text after the edit.
+ */
+- (void)editedRange: (NSRange)editedRange changeInLength: (NSInteger)delta string: (NSString *)string;
+/**
+ Indexes the range of the string a token buffer covers again, leaving out the brackets in tokens of the ignored types.
+ Only tokens at depth 0 are considered, since whatever is nested in them belongs to them.
+ */
+- (void)updateWithTokenBuffer: (GMTokenBuffer *)buffer;
+/**
+ Drops the brackets in a range, for when it is known to be a token of an ignored type.
+ */
+- (void)removeBracketsInRange: (NSRange)range;
+
+/**
+ @name Querying the index
+ */
+/**
+ The number of brackets.
+ */
+- (NSUInteger)count;
+/**
+ Finds the bracket that matches a bracket.
+ @param location The location of a bracket.
+ @return The range of the matching bracket, or `{NSNotFound, 0}` if there is no bracket at location or it doesn't
+ match any.
+ */
+- (NSRange)rangeOfBracketMatchingBracketAtLocation: (NSUInteger)location;
+/**
+ Finds the innermost pair of matching brackets around a location.
+ @param location A location in the text. A block encloses the locations after its opening bracket up to and
+ including its closing bracket.
+ @return The range from the opening through the closing bracket, or `{NSNotFound, 0}` if location isn't in a block.
+ */
+- (NSRange)rangeOfBlockEnclosingLocation: (NSUInteger)location;
+
+@end
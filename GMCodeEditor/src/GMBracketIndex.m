@@ -0,0 +1,247 @@
+//
+//  GMBracketIndex.m
+//  Code Editor
+//
+//  Created by Jakub Hampl on 17.10.26.
+//  Copyright (c) 2026 Jakub Hampl. All rights reserved.
+//
+
+#import "GMBracketIndex.h"
+#import "GMTokenBuffer.h"
+
+#define GMBracketScanChunk 4096
+
+struct GMBracket {
+  NSUInteger location;
+  uint32_t pair;
+  BOOL closing;
+};
+
+@implementation GMBracketIndex
+
+- (id)initWithPairs:(NSDictionary *)pairs
+{
+  self = [super init];
+  if (self) {
+    _openings = malloc(sizeof(unichar) * MAX([pairs count], 1));
+    _closings = malloc(sizeof(unichar) * MAX([pairs count], 1));
+    for (NSString *opening in pairs) {
+      NSString *closing = pairs[opening];
+      if ([opening length] != 1 || [closing length] != 1 || [opening isEqualToString: closing]) {
+        continue;
+      }
+      _openings[_pairCount] = [opening characterAtIndex: 0];
+      _closings[_pairCount] = [closing characterAtIndex: 0];
+      _pairCount++;
+    }
+    _ignoredTypeNames = [NSSet setWithObjects: @"string", @"comment", nil];
+  }
+  return self;
+}
+
+- (void)dealloc
+{
+  free(_openings);
+  free(_closings);
+  free(_brackets);
+  free(_matches);
+  free(_parents);
+}
+
+- (void)setIgnoredTypeNames:(NSSet *)ignoredTypeNames
+{
+  _ignoredTypeNames = [ignoredTypeNames copy];
+  _lastTypeNames = nil;
+}
+
+#pragma mark - Updating the index
+
+- (void)ensureCapacity: (NSUInteger)capacity
+{
+  if (capacity <= _capacity) {
+    return;
+  }
+  _capacity = MAX(capacity, MAX(_capacity * 2, 64));
+  _brackets = realloc(_brackets, sizeof(struct GMBracket) * _capacity);
+  _matches = realloc(_matches, sizeof(NSUInteger) * _capacity);
+  _parents = realloc(_parents, sizeof(NSUInteger) * _capacity);
+}
+
+// The index of the first bracket at or after location.
+- (NSUInteger)indexOfFirstBracketFromLocation: (NSUInteger)location
+{
+  NSUInteger low = 0, high = _count;
+  while (low < high) {
+    NSUInteger middle = low + (high - low) / 2;
+    if (_brackets[middle].location < location) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+// Replaces the brackets from index first up to last with count slots, returning where the slots start.
+- (struct GMBracket *)spliceFromIndex: (NSUInteger)first toIndex: (NSUInteger)last count: (NSUInteger)count
+{
+  [self ensureCapacity: _count - (last - first) + count];
+  memmove(_brackets + first + count, _brackets + last, sizeof(struct GMBracket) * (_count - last));
+  _count = _count - (last - first) + count;
+  _nestingIsValid = NO;
+  return _brackets + first;
+}
+
+// The brackets among the characters in range, without any tokens.
+- (NSMutableData *)bracketsInString: (NSString *)string range: (NSRange)range
+{
+  NSMutableData *found = [NSMutableData data];
+  unichar characters[GMBracketScanChunk];
+  for (NSUInteger start = range.location; start < NSMaxRange(range); start += GMBracketScanChunk) {
+    NSUInteger length = MIN((NSUInteger)GMBracketScanChunk, NSMaxRange(range) - start);
+    [string getCharacters: characters range: NSMakeRange(start, length)];
+    for (NSUInteger i = 0; i < length; i++) {
+      unichar c = characters[i];
+      for (uint32_t p = 0; p < _pairCount; p++) {
+        if (c == _openings[p] || c == _closings[p]) {
+          struct GMBracket bracket = {start + i, p, c == _closings[p]};
+          [found appendBytes: &bracket length: sizeof(bracket)];
+          break;
+        }
+      }
+    }
+  }
+  return found;
+}
+
+- (void)replaceBracketsInRange: (NSRange)range withBracketsOfString: (NSString *)string shiftingBy: (NSInteger)delta
+{
+  NSUInteger first = [self indexOfFirstBracketFromLocation: range.location];
+  NSUInteger last = [self indexOfFirstBracketFromLocation: NSMaxRange(range)];
+  for (NSUInteger i = last; i < _count; i++) {
+    _brackets[i].location += delta;
+  }
+  NSRange scanned = NSMakeRange(range.location, range.length + delta);
+  NSMutableData *found = [self bracketsInString: string range: scanned];
+  NSUInteger count = [found length] / sizeof(struct GMBracket);
+  memcpy([self spliceFromIndex: first toIndex: last count: count], [found bytes], [found length]);
+}
+
+- (void)resetWithString:(NSString *)string
+{
+  _count = 0;
+  [self replaceBracketsInRange: NSMakeRange(0, 0) withBracketsOfString: string shiftingBy: [string length]];
+}
+
+- (void)editedRange:(NSRange)editedRange changeInLength:(NSInteger)delta string:(NSString *)string
+{
+  // The replaced characters, in the coordinates of the text before the edit.
+  NSRange replaced = NSMakeRange(editedRange.location, editedRange.length - delta);
+  [self replaceBracketsInRange: replaced withBracketsOfString: string shiftingBy: delta];
+}
+
+- (void)removeBracketsInRange:(NSRange)range
+{
+  NSUInteger first = [self indexOfFirstBracketFromLocation: range.location];
+  NSUInteger last = [self indexOfFirstBracketFromLocation: NSMaxRange(range)];
+  if (last > first) {
+    [self spliceFromIndex: first toIndex: last count: 0];
+  }
+}
+
+- (void)updateWithTokenBuffer:(GMTokenBuffer *)buffer
+{
+  [self replaceBracketsInRange: [buffer range] withBracketsOfString: [buffer string] shiftingBy: 0];
+
+  NSArray *typeNames = [buffer typeNames];
+  if (typeNames != _lastTypeNames) {
+    _lastTypeNames = typeNames;
+    _ignoredTypes = [NSMutableData dataWithLength: [typeNames count]];
+    BOOL *ignored = [_ignoredTypes mutableBytes];
+    NSUInteger i = 0;
+    for (NSString *name in typeNames) {
+      ignored[i++] = [_ignoredTypeNames containsObject: name];
+    }
+  }
+  const BOOL *ignored = [_ignoredTypes bytes];
+  NSUInteger typeCount = [_ignoredTypes length];
+
+  const GMTokenRecord *records = [buffer records];
+  NSUInteger count = [buffer count];
+  for (NSUInteger i = 0; i < count; i++) {
+    if (records[i].depth == 0 && records[i].type < typeCount && ignored[records[i].type]) {
+      [self removeBracketsInRange: NSMakeRange(records[i].offset, records[i].length)];
+    }
+  }
+}
+
+#pragma mark - Querying the index
+
+- (NSUInteger)count
+{
+  return _count;
+}
+
+// Pairs up the brackets with a stack, recording the match and the enclosing open bracket of each.
+- (void)validateNesting
+{
+  if (_nestingIsValid) {
+    return;
+  }
+  NSUInteger *stack = malloc(sizeof(NSUInteger) * MAX(_count, 1));
+  NSUInteger depth = 0;
+  for (NSUInteger i = 0; i < _count; i++) {
+    _matches[i] = NSNotFound;
+    if (!_brackets[i].closing) {
+      _parents[i] = depth ? stack[depth - 1] : NSNotFound;
+      stack[depth++] = i;
+    } else if (depth && _brackets[stack[depth - 1]].pair == _brackets[i].pair) {
+      NSUInteger opening = stack[--depth];
+      _matches[i] = opening;
+      _matches[opening] = i;
+      _parents[i] = _parents[opening];
+    } else {
+      _parents[i] = depth ? stack[depth - 1] : NSNotFound;
+    }
+  }
+  free(stack);
+  _nestingIsValid = YES;
+}
+
+- (NSRange)rangeOfBracketMatchingBracketAtLocation:(NSUInteger)location
+{
+  NSUInteger i = [self indexOfFirstBracketFromLocation: location];
+  if (i == _count || _brackets[i].location != location) {
+    return NSMakeRange(NSNotFound, 0);
+  }
+  [self validateNesting];
+  if (_matches[i] == NSNotFound) {
+    return NSMakeRange(NSNotFound, 0);
+  }
+  return NSMakeRange(_brackets[_matches[i]].location, 1);
+}
+
+- (NSRange)rangeOfBlockEnclosingLocation:(NSUInteger)location
+{
+  NSUInteger i = [self indexOfFirstBracketFromLocation: location];
+  if (i == 0) {
+    return NSMakeRange(NSNotFound, 0);
+  }
+  [self validateNesting];
+  // The last bracket before location is either the opening bracket of the block, or it ends a block nested in it.
+  NSUInteger block = i - 1;
+  if (_brackets[block].closing) {
+    block = _parents[block];
+  }
+  // Unmatched brackets don't make a block, but they don't end the one they are in either.
+  while (block != NSNotFound && _matches[block] == NSNotFound) {
+    block = _parents[block];
+  }
+  if (block == NSNotFound) {
+    return NSMakeRange(NSNotFound, 0);
+  }
+  NSUInteger start = _brackets[block].location;
+  return NSMakeRange(start, _brackets[_matches[block]].location + 1 - start);
+}
+
+@end
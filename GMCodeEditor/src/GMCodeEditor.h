@@ -9,6 +9,10 @@
 #import "GMAutoCompleteTextView.h"
 #import "NoodleLineNumberView.h"
 #import "GMSyntaxHighlighter.h"
+#import "GMBracketIndex.h"
+#import "GMLineIndex.h"
+#import "GMTokenIndex.h"
+#import "GMSymbolIndex.h"
 
 /**
  GMCodeEditor is a code editing component. In general it is designed to work
@@ -36,6 +40,17 @@
 @private
   NoodleLineNumberView	*_lineNumberView;
   GMSyntaxHighlighter *_syntaxHighlighter;
+  dispatch_queue_t _highlightQueue;
+  NSUInteger _highlightGeneration;
+  NSUInteger _appliedGeneration;
+  NSUInteger _pendingGeneration;
+  NSRange _pendingRange;
+  CFAbsoluteTime _editTime;
+  GMBracketIndex *_bracketIndex;
+  GMLineIndex *_lineIndex;
+  GMTokenIndex *_tokenIndex;
+  GMSymbolIndex *_symbolIndex;
+  NSMutableDictionary *_completionLists;
   //NSDictionary *_autocompletes;
   NSDictionary *_language;
 }
@@ -53,13 +68,82 @@
 - (NSDictionary *)language;
 /**
  Set the language to use for editing and syntax highlighting.
- @param lang Either a string in which case [GMLanguage languageFromBundleWithName:] will be called, otherwise a dictionary which should be the language representation itself (prefferably constructed with GMLanguage class methods).
+ @param lang Either a string in which case the shared language of that name is used (see [GMRegistry languageNamed:]), otherwise a dictionary which should be the language representation itself (prefferably constructed with GMLanguage class methods).
  */
 - (void)setLanguage:(id)lang;
 /**
  The number of spaces a tab press will insert and also the amount by which the indent: command will indent the code.
  */
 @property NSUInteger tabWidth;
+/**
+ Whether edits only re-highlight the lines they touch.
+ 
+ When enabled (the default), an edit re-tokenizes the edited lines and keeps going until the tokenizer is back in
+ the same state as before the edit (see [GMSyntaxHighlighter tokenize:editedRange:changeInLength:tokenizedRange:]).
+ Only the attributes of that region are replaced. When disabled, the whole document is re-highlighted after every edit.
+ */
+@property BOOL incrementalHighlighting;
+/**
+ Whether tokenizing happens on a background queue.
+ 
+ When enabled, every edit hands a copy of the text to a serial background queue, so that a slow grammar never holds
+ up typing. Only applying the resulting attributes happens on the main thread. Each edit bumps a generation counter,
+ and results computed for an older generation than the current one are thrown away; the lines they covered are
+ tokenized again along with the newer edit.
+ 
+ Defaults to `NO`. Change it before the editor is edited, not while highlighting is in progress.
+ */
+@property BOOL asynchronousHighlighting;
+/**
+ Whether the visible part of the document is highlighted before the rest.
+ 
+ When enabled (the default), highlight and edits only highlight the text that is visible in the enclosing scroll
+ view, plus a screenful above and below, right away. The rest of the document is filled in a chunk at a time while
+ the editor is idle, and scrolling to a part that isn't done yet highlights it first. Text shown before the
+ highlighting from the top of the document gets to it can be off where a construct like a comment starts above the
+ visible part; it is fixed when the fill arrives.
+ 
+ Has no effect when asynchronousHighlighting is enabled, or when incrementalHighlighting is disabled.
+ */
+@property BOOL prioritizesVisibleRange;
+/**
+ Whether only the visible part of the document is ever highlighted.
+
+ When enabled, the rest of the document isn't filled in while the editor is idle (see prioritizesVisibleRange), so
+ text is only highlighted once it is scrolled into view. This is meant for very large documents, where highlighting
+ and attributing all of the text would cost more time and memory than it is worth.
+
+ Defaults to `NO`. Only has an effect together with prioritizesVisibleRange.
+ */
+@property BOOL highlightsVisibleRangeOnly;
+/**
+ Whether edits are left alone for the time being.
+
+ While enabled, edits of the text are neither highlighted nor applied to the editor's line, bracket, token and symbol
+ indexes, and highlight does nothing. Disabling it again rebuilds the indexes and highlights the document once. This
+ is meant for changing the text in many steps that no one is going to look at in between, like when loading a large
+ file in chunks.
+
+ Defaults to `NO`.
+ */
+@property (nonatomic) BOOL suspendsHighlighting;
+
+/**
+ @name Syntax Highlighting
+ */
+/**
+ Re-highlights the whole document.
+ */
+- (void)highlight;
+/**
+ Re-highlights the lines affected by an edit.
+ 
+ This is called automatically after every edit when incrementalHighlighting is enabled. With asynchronousHighlighting
+ the attributes are applied later, once the background queue gets to it.
+ @param editedRange The range of the edited characters, in the coordinates of the text after the edit.
+ @param delta The change in length caused by the edit.
+ */
+- (void)highlightEditedRange:(NSRange)editedRange changeInLength:(NSInteger)delta;
 
 /**
  @name Text Editing Commands
@@ -76,16 +160,69 @@
  Inspects the current selection and toggles comments.
  
  If all of the lines selected are commented, then the comments will be removed, otherwise comments will be added.
+ Blank lines are left as they are. Where the language has block comments, a selection is wrapped in one instead.
  
  If the selection is zero length, then the current line is considered the selection.
 */
 - (IBAction)toggleComments:(id)sender;
+/**
+ Selects the innermost block around the selection, from its opening through its closing bracket. Repeating it
+ selects the enclosing blocks in turn.
+ */
+- (IBAction)selectEnclosingBlock:(id)sender;
 /**
  Scrolls the completion view to the line given and sets the insertion point to the begening of that line.
  @param num The line number to scroll to.
 */
 - (void)scrollToLine:(NSUInteger)num;
 
+/**
+ @name Lines
+ */
+/**
+ The start offsets of the lines of the document, for going between line numbers and character offsets.
+
+ It is created when first needed and kept up to date with every edit. Note that it numbers lines from 0, while
+ scrollToLine: numbers them from 1.
+ */
+- (GMLineIndex *)lineIndex;
+
+/**
+ @name Brackets
+ */
+/**
+ The brackets of the document, which is what matching braces are found with.
+
+ It is created for the language's `paired_characters` when first needed and kept up to date with every edit and
+ every highlighting pass, which also tells it which brackets are in strings and comments. Returns nil if the
+ language has no paired characters.
+ */
+- (GMBracketIndex *)bracketIndex;
+
+/**
+ @name Tokens
+ */
+/**
+ The tokens of the document, which selectedToken, the number stepping of moveUp: and moveDown: and spell checking
+ look up instead of going through the attributes of the text.
+
+ It is kept up to date with every edit and every highlighting pass.
+ */
+- (GMTokenIndex *)tokenIndex;
+
+/**
+ @name Symbols
+ */
+/**
+ The symbols of the document, created for the `symbols` of the language when it is set and filled in by the
+ highlighting passes that follow. Returns nil if the language has no symbols.
+
+ Besides giving the outline of the document, its names are offered for completion together with the language's
+ `autocompletion` lists. Names of definitions that complete `text` are offered while typing a word outside of any
+ token.
+ */
+- (GMSymbolIndex *)symbolIndex;
+
 // private
 @property (retain) NSString *lastAutoInsert;
 
@@ -8,7 +8,14 @@
 
 #import "GMCodeEditor.h"
 #import "GMLanguage.h"
+#import "GMRegistry.h"
 #import "TETextUtils.h"
+#import "GMInstrumentation.h"
+
+// How many characters are highlighted at once while filling in the document in the background.
+#define GMHighlightingChunkLength 32768
+// The trigger of completions while typing a word that isn't in any token.
+#define GMPlainTextTrigger @"text"
 
 
 @implementation NSString (GMStringUtils)
@@ -24,6 +31,98 @@
 
 @end
 
+#pragma mark - GMTextEdits
+
+// A list of replacements in a text, in the order of the text and not overlapping, that commands working line by line
+// collect so that they change the text once.
+@interface GMTextEdits : NSObject
+{
+  NSMutableData *_ranges;
+  NSMutableArray *_strings;
+}
+- (void)replaceCharactersInRange: (NSRange)range withString: (NSString *)string;
+- (NSUInteger)count;
+- (NSRange)spannedRange;
+- (NSString *)replacementOfSpannedRangeInString: (NSString *)string;
+- (NSRange)rangeAfterEdits: (NSRange)range;
+@end
+
+@implementation GMTextEdits
+
+- (id)init
+{
+  if (self = [super init]) {
+    _ranges = [NSMutableData data];
+    _strings = [NSMutableArray array];
+  }
+  return self;
+}
+
+- (void)replaceCharactersInRange: (NSRange)range withString: (NSString *)string
+{
+  [_ranges appendBytes: &range length: sizeof(range)];
+  [_strings addObject: [string copy]];
+}
+
+- (NSUInteger)count
+{
+  return [_strings count];
+}
+
+- (NSRange)spannedRange
+{
+  const NSRange *ranges = [_ranges bytes];
+  NSUInteger count = [self count];
+  return count ? NSUnionRange(ranges[0], ranges[count - 1]) : NSMakeRange(NSNotFound, 0);
+}
+
+- (NSString *)replacementOfSpannedRangeInString: (NSString *)string
+{
+  const NSRange *ranges = [_ranges bytes];
+  NSRange spanned = [self spannedRange];
+  NSMutableString *replacement = [NSMutableString stringWithCapacity: spanned.length + [self count] * 4];
+  NSUInteger location = spanned.location;
+  for (NSUInteger i = 0; i < [self count]; i++) {
+    if (ranges[i].location > location) {
+      [replacement appendString: [string substringWithRange: NSMakeRange(location, ranges[i].location - location)]];
+    }
+    [replacement appendString: _strings[i]];
+    location = NSMaxRange(ranges[i]);
+  }
+  return replacement;
+}
+
+// Where a location ends up. Locations in a replaced range go to the start of its replacement, or to the end of it
+// when after is set, which is also where locations right after an insertion go.
+- (NSUInteger)locationAfterEdits: (NSUInteger)location after: (BOOL)after
+{
+  const NSRange *ranges = [_ranges bytes];
+  NSInteger delta = 0;
+  for (NSUInteger i = 0; i < [self count]; i++) {
+    NSRange range = ranges[i];
+    if (range.location > location || (range.location == location && !after)) {
+      break;
+    }
+    if (NSMaxRange(range) > location) {
+      return range.location + delta + (after ? [_strings[i] length] : 0);
+    }
+    delta += (NSInteger)[_strings[i] length] - (NSInteger)range.length;
+  }
+  return location + delta;
+}
+
+- (NSRange)rangeAfterEdits: (NSRange)range
+{
+  // An insertion point moves along with the text; a selection takes in the edits at its ends.
+  NSUInteger start = [self locationAfterEdits: range.location after: range.length == 0];
+  NSUInteger end = [self locationAfterEdits: NSMaxRange(range) after: YES];
+  return NSMakeRange(start, MAX(end, start) - start);
+}
+
+@end
+
+#pragma mark - GMCodeEditor
+
 @implementation GMCodeEditor
 
 - (id)initWithFrame:(NSRect)frame
@@ -57,13 +156,15 @@
   [[self textStorage] setDelegate:self];
   
   [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(textViewDidChangeSelection:) name:NSTextViewDidChangeSelectionNotification object:self];
+  [[[self enclosingScrollView] contentView] setPostsBoundsChangedNotifications: YES];
+  [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(visibleRectDidChange:) name:NSViewBoundsDidChangeNotification object:[[self enclosingScrollView] contentView]];
   
   
   //[self parseCode:nil];
   
   _syntaxHighlighter = [GMSyntaxHighlighter new];
-  _syntaxHighlighter.language =  [GMLanguage languageFromBundleWithName: @"css"];
-  GMTheme *theme = [GMTheme themeFromBundleWithName: @"okaida"];
+  _syntaxHighlighter.language = _language ?: [[GMRegistry sharedRegistry] languageNamed: @"css"];
+  GMTheme *theme = [[GMRegistry sharedRegistry] themeNamed: @"okaida"];
   _syntaxHighlighter.theme = theme;
   if (@available(macOS 10.8, *)) {
       [self setBackgroundColor: theme.defaultAttributes[NSBackgroundColorDocumentAttribute]];
@@ -71,13 +172,22 @@
   } else {
       // Fallback on earlier versions
   }
-  [[self textStorage] setAttributedString: [_syntaxHighlighter highlight: [self string]]];
+  _incrementalHighlighting = YES;
+  _prioritizesVisibleRange = YES;
+  _tokenIndex = [[GMTokenIndex alloc] init];
+  [self highlight];
   _tabWidth = 4;
     
   self.automaticQuoteSubstitutionEnabled = NO;
   
 }
 
+- (void)dealloc
+{
+  [NSObject cancelPreviousPerformRequestsWithTarget: self];
+  [[NSNotificationCenter defaultCenter] removeObserver: self];
+}
+
 - (void)autoInsertText:(NSString*)text {
   
   [super insertText:text];
@@ -89,31 +199,206 @@
 
 - (void)highlight
 {
-  //NSRange r = [self selectedRange];
-//  NSMutableAttributedString *s = [[NSMutableAttributedString alloc] initWithAttributedString: ];
-//  [s addAttribute:NSFontAttributeName value:[NSFont fontWithName:@"Monaco" size:13] range:NSMakeRange(0, [s length])];
-  NSAttributedString *s = [_syntaxHighlighter highlight: [self string]];
-  [[self textStorage] setAttributedString: s];
-  //[self setSelectedRange: r];
+  if (_suspendsHighlighting) {
+    return;
+  }
+  NSRange all = NSMakeRange(0, [[self textStorage] length]);
+  if (_asynchronousHighlighting) {
+    [self scheduleHighlightingOfEditedRange: all changeInLength: 0 invalidate: YES];
+    return;
+  }
+  [_syntaxHighlighter invalidateLineCache];
+  [self highlightEditedRange: all changeInLength: 0];
 }
 
-- (NSString *)selectedToken
+- (void)highlightEditedRange:(NSRange)editedRange changeInLength:(NSInteger)delta
 {
-  if ([[self string] length] > NSMaxRange(self.selectedRange) - 1) {
-    return [self.attributedString attribute: @"GMToken" atIndex: NSMaxRange(self.selectedRange) - 1 effectiveRange: nil];
-  } else {
-    return nil;
+  if (_asynchronousHighlighting) {
+    [self scheduleHighlightingOfEditedRange: editedRange changeInLength: delta invalidate: NO];
+    return;
+  }
+  __atomic_add_fetch(&_highlightGeneration, 1, __ATOMIC_SEQ_CST);
+  if (_prioritizesVisibleRange && _incrementalHighlighting) {
+    [[_syntaxHighlighter lineCache] editedRange: editedRange changeInLength: delta];
+    [self highlightVisibleRange];
+    return;
+  }
+  [self applyTokenBuffer: [_syntaxHighlighter tokenBufferForText: [[self textStorage] string] editedRange: editedRange changeInLength: delta]];
+}
+
+- (void)applyTokenBuffer: (GMTokenBuffer *)buffer
+{
+  NSTextStorage *textStorage = [self textStorage];
+  GMInstrumentationMark mark = GMInstrumentationBeginPhase();
+  [_bracketIndex updateWithTokenBuffer: buffer];
+  [_tokenIndex updateWithTokenBuffer: buffer];
+  [_symbolIndex updateWithTokenBuffer: buffer];
+  GMInstrumentationEndPhase(GMInstrumentationPhaseIndexing, mark);
+  mark = GMInstrumentationBeginPhase();
+  [textStorage beginEditing];
+  [buffer enumerateAttributesWithTheme: [_syntaxHighlighter theme] usingBlock:^(NSDictionary *attrs, NSRange r) {
+    [textStorage setAttributes: attrs range: r];
+  }];
+  [textStorage endEditing];
+  GMInstrumentationEndPhase(GMInstrumentationPhaseApplyingAttributes, mark);
+}
+
+#pragma mark - Viewport-first highlighting
+
+// The characters in the visible rect and a screenful above and below it.
+- (NSRange)visibleCharacterRange
+{
+  NSRect visible = [self visibleRect];
+  NSPoint origin = [self textContainerOrigin];
+  visible = NSOffsetRect(NSInsetRect(visible, 0, -NSHeight(visible)), -origin.x, -origin.y);
+  NSLayoutManager *layoutManager = [self layoutManager];
+  NSRange glyphs = [layoutManager glyphRangeForBoundingRectWithoutAdditionalLayout: visible inTextContainer: [self textContainer]];
+  return [layoutManager characterRangeForGlyphRange: glyphs actualGlyphRange: NULL];
+}
+
+// Where the line cache stops being up to date, or NSNotFound if the whole text is done.
+- (NSUInteger)firstDirtyLocation
+{
+  GMLineCache *lineCache = [_syntaxHighlighter lineCache];
+  NSUInteger length = [[self textStorage] length];
+  if ([lineCache textLength] != length || ([lineCache count] == 0 && length > 0)) {
+    return 0;
+  }
+  return [lineCache dirtyRange].location;
+}
+
+- (void)highlightVisibleRange
+{
+  NSString *text = [[self textStorage] string];
+  NSRange visible = [self visibleCharacterRange];
+  NSUInteger dirty = [self firstDirtyLocation];
+  if (dirty != NSNotFound && dirty <= NSMaxRange(visible)) {
+    // Close enough to the visible text, getting there properly is cheap. Otherwise show an approximation.
+    if (dirty + GMHighlightingChunkLength >= visible.location) {
+      [self applyTokenBuffer: [_syntaxHighlighter tokenBufferForText: text upToLocation: NSMaxRange(visible)]];
+    } else {
+      [self applyTokenBuffer: [_syntaxHighlighter tokenBufferForText: text inRange: visible]];
+    }
+  }
+  [self scheduleFill];
+}
+
+- (void)scheduleFill
+{
+  [NSObject cancelPreviousPerformRequestsWithTarget: self selector: @selector(fillHighlighting) object: nil];
+  if (!_highlightsVisibleRangeOnly && [self firstDirtyLocation] != NSNotFound) {
+    [self performSelector: @selector(fillHighlighting) withObject: nil afterDelay: 0];
+  }
+}
+
+- (void)fillHighlighting
+{
+  NSUInteger dirty = [self firstDirtyLocation];
+  if (dirty == NSNotFound || _asynchronousHighlighting || _suspendsHighlighting) {
+    return;
+  }
+  [self applyTokenBuffer: [_syntaxHighlighter tokenBufferForText: [[self textStorage] string] upToLocation: dirty + GMHighlightingChunkLength]];
+  [self scheduleFill];
+}
+
+- (void)visibleRectDidChange:(NSNotification *)note
+{
+  if (_prioritizesVisibleRange && _incrementalHighlighting && !_asynchronousHighlighting && !_suspendsHighlighting) {
+    [self highlightVisibleRange];
   }
+}
+
+#pragma mark - Asynchronous highlighting
+
+- (void)scheduleHighlightingOfEditedRange: (NSRange)editedRange changeInLength: (NSInteger)delta invalidate: (BOOL)invalidate
+{
+  if (!_highlightQueue) {
+    _highlightQueue = dispatch_queue_create("com.gampleman.GMCodeEditor.highlighting", DISPATCH_QUEUE_SERIAL);
+  }
+  // The generation is bumped on the main thread and read on the queue, so it is only ever accessed atomically there.
+  NSUInteger generation = __atomic_add_fetch(&_highlightGeneration, 1, __ATOMIC_SEQ_CST);
+  CFAbsoluteTime editTime = _editTime;
+  NSString *snapshot = [[[self textStorage] string] copy];
+  GMSyntaxHighlighter *highlighter = _syntaxHighlighter;
   
+  // The line cache and the grammar are only ever touched on the queue, which sees every edit in order.
+  dispatch_async(_highlightQueue, ^{
+    if (_pendingGeneration && _pendingGeneration != __atomic_load_n(&_appliedGeneration, __ATOMIC_SEQ_CST)) {
+      // The last run was thrown away on the main thread, because the text had changed by the time it got there. The
+      // edit that changed it is this one or one still in the queue, so the range moves along with the rest of the
+      // cache and gets tokenized again.
+      [[highlighter lineCache] invalidateRange: _pendingRange];
+    }
+    _pendingGeneration = 0;
+    if (invalidate) {
+      [highlighter invalidateLineCache];
+    }
+    if (generation != __atomic_load_n(&_highlightGeneration, __ATOMIC_SEQ_CST)) {
+      // A newer edit is already queued and will tokenize these lines along with its own.
+      [[highlighter lineCache] editedRange: editedRange changeInLength: delta];
+      return;
+    }
+    GMTokenBuffer *buffer = [highlighter tokenBufferForText: snapshot editedRange: editedRange changeInLength: delta];
+    _pendingGeneration = generation;
+    _pendingRange = [buffer range];
+    dispatch_async(dispatch_get_main_queue(), ^{
+      if (generation == _highlightGeneration) {
+        [self applyTokenBuffer: buffer];
+        __atomic_store_n(&_appliedGeneration, generation, __ATOMIC_SEQ_CST);
+        if (editTime && GMInstrumentationEnabled) {
+          GMInstrumentationRecordKeystroke(editTime);
+        }
+      }
+    });
+  });
+}
+
+- (void)setSuspendsHighlighting:(BOOL)suspends
+{
+  BOOL resumes = _suspendsHighlighting && !suspends;
+  _suspendsHighlighting = suspends;
+  if (resumes) {
+    // None of the edits in the meantime made it into the indexes, so they start over from the text.
+    _lineIndex = nil;
+    _bracketIndex = nil;
+    [_tokenIndex removeAllTokens];
+    [_symbolIndex removeAllSymbols];
+    [self highlight];
+  }
+}
+
+- (NSString *)selectedToken
+{
+  NSString *type = nil;
+  if (NSMaxRange(self.selectedRange) > 0) {
+    [_tokenIndex rangeOfTokenAtLocation: NSMaxRange(self.selectedRange) - 1 depth: 0 type: &type];
+  }
+  return type;
 }
 
 - (void)setLanguage:(id)lang
 {
   if ([lang isKindOfClass: [NSString class]]) {
-    _language = [GMLanguage languageFromBundleWithName: (NSString *)lang];
+    _language = [[GMRegistry sharedRegistry] languageNamed: (NSString *)lang];
   } else {
     _language = lang;
   }
+  _bracketIndex = nil;
+  _symbolIndex = [_language[@"symbols"] count] ? [[GMSymbolIndex alloc] initWithDefinitions: _language[@"symbols"]] : nil;
+  _completionLists = [NSMutableDictionary dictionary];
+  if (_syntaxHighlighter) {
+    NSDictionary *language = _language;
+    GMSyntaxHighlighter *highlighter = _syntaxHighlighter;
+    if (_highlightQueue) {
+      // Behind whatever the queue is still tokenizing with the old grammar.
+      dispatch_async(_highlightQueue, ^{
+        highlighter.language = language;
+      });
+    } else {
+      highlighter.language = language;
+    }
+    [self highlight];
+  }
 }
 
 -(NSDictionary *)language
@@ -142,15 +427,14 @@
   // Find if it is already commented
   if ([commentString hasPrefix: startMarker]) {
     replacementString = [commentString substringFromIndex: [startMarker length]];
-    if ([replacementString characterAtIndex: 0] == ' ') { // strip extra space
+    if ([replacementString hasPrefix: @" "]) { // strip extra space
       replacementString = [replacementString substringFromIndex: 1];
     }
     if ([replacementString hasSuffix: endMarker]) {
-      NSUInteger repI = replacementString.length - 2;
-      if ([replacementString characterAtIndex: repI - 1] == ' ') {
-        repI--;
+      replacementString = [replacementString substringToIndex: [replacementString length] - [endMarker length]];
+      if ([replacementString hasSuffix: @" "]) {
+        replacementString = [replacementString substringToIndex: [replacementString length] - 1];
       }
-      replacementString = [replacementString substringToIndex: repI];
     }
   } else {
     replacementString = [NSString stringWithFormat:@"%@ %@ %@", startMarker, commentString, endMarker];
@@ -158,99 +442,178 @@
   return [replacementString mutableCopy];
 }
 
-- (NSMutableString *)commentLine: (NSRange)r
+// Each line a range touches, without its line ending, along with the white space it starts with and how many spaces
+// that is worth. An empty range touches the line it is on.
+- (void)enumerateLinesInRange: (NSRange)range usingBlock: (void (^)(NSRange line, NSRange indentation, unsigned spaces))block
 {
-  //NSRange r = [self selectionRangeForProposedRange:s granularity:NSSelectByParagraph];
-  NSRange g = r;
-  unsigned spaces = TE_numberOfLeadingSpacesFromRangeInString([self string], &g, (unsigned)_tabWidth);
-  r.length -= spaces + 1;
-  r.location += spaces;
-  NSString *line = [[self string] substringWithRange: r];
-  if ([line hasPrefix: _language[@"comments"][@"line"]]) {
-    return [NSMutableString stringWithFormat: @"%@%@", [NSString stringWithRepetitions:spaces - 1 ofString:@" "], [line substringFromIndex: 2]];
+  NSString *string = [self string];
+  NSUInteger location = range.location;
+  do {
+    NSUInteger start, end, contentsEnd;
+    [string getLineStart: &start end: &end contentsEnd: &contentsEnd forRange: NSMakeRange(location, 0)];
+    NSRange line = NSMakeRange(start, contentsEnd - start);
+    NSRange indentation = line;
+    unsigned spaces = TE_numberOfLeadingSpacesFromRangeInString(string, &indentation, (unsigned)_tabWidth);
+    block(line, indentation, spaces);
+    location = end;
+  } while (location < NSMaxRange(range));
+}
+
+- (void)toggleLineCommentsInRange: (NSRange)range
+{
+  NSString *marker = _language[@"comments"][@"line"];
+  NSString *string = [self string];
+  // Blank lines are left alone, and don't count when deciding whether the lines are all commented.
+  NSMutableData *contents = [NSMutableData data];
+  __block BOOL commented = YES;
+  [self enumerateLinesInRange: range usingBlock:^(NSRange line, NSRange indentation, unsigned spaces) {
+    NSRange content = NSMakeRange(NSMaxRange(indentation), NSMaxRange(line) - NSMaxRange(indentation));
+    if (content.length == 0) {
+      return;
+    }
+    [contents appendBytes: &content length: sizeof(content)];
+    if (commented && [string rangeOfString: marker options: NSAnchoredSearch | NSLiteralSearch range: content].location == NSNotFound) {
+      commented = NO;
+    }
+  }];
+
+  GMTextEdits *edits = [[GMTextEdits alloc] init];
+  NSString *insertion = [marker stringByAppendingString: @" "];
+  const NSRange *lines = [contents bytes];
+  for (NSUInteger i = 0; i < [contents length] / sizeof(NSRange); i++) {
+    if (commented) {
+      NSRange removed = NSMakeRange(lines[i].location, [marker length]);
+      if (NSMaxRange(removed) < NSMaxRange(lines[i]) && [string characterAtIndex: NSMaxRange(removed)] == ' ') {
+        removed.length++;
+      }
+      [edits replaceCharactersInRange: removed withString: @""];
+    } else {
+      [edits replaceCharactersInRange: NSMakeRange(lines[i].location, 0) withString: insertion];
+    }
   }
-  return [NSMutableString stringWithFormat: @"%@%@ %@", [NSString stringWithRepetitions:spaces ofString:@" "], _language[@"comments"][@"line"], line];
+  [self applyTextEdits: edits];
 }
 
 -(IBAction)toggleComments:(id)sender
 {
   NSRange s = [self selectedRange];
-  NSTextStorage *textStorage = [self textStorage];
-  NSMutableString *replacementString;
+  NSDictionary *comments = _language[@"comments"];
+  // Selections are wrapped in a block comment where the language has them, and otherwise commented line by line.
+  if (comments[@"line"] && !(s.length && comments[@"start"])) {
+    [self toggleLineCommentsInRange: s];
+    return;
+  }
+  if (!comments[@"start"]) {
+    return;
+  }
   NSRange r = s;
-  if (s.length == 0) { // toggle current line
-    // get current line
-    r = [self selectionRangeForProposedRange:s granularity:NSSelectByParagraph];
-    if (_language[@"comments"] && _language[@"comments"][@"line"]) {
-      replacementString = [self commentLine: r];
-      [replacementString appendString: @"\n"];
-    } else if (_language[@"comments"] && _language[@"comments"][@"start"]) {
-      NSRange g = r;
-      unsigned spaces = TE_numberOfLeadingSpacesFromRangeInString([self string], &g, (unsigned)_tabWidth);
-      r.length -= spaces + 1;
-      r.location += spaces;
-      replacementString = [self commentRange: r];
-    }
-  } else {
-    if (_language[@"comments"] && _language[@"comments"][@"start"]) {
-      replacementString = [self commentRange: r];
-      s.length = replacementString.length;
-    } else if (_language[@"comments"] && _language[@"comments"][@"line"]) {
-      replacementString = [NSMutableString string];
-      [[textStorage string] enumerateSubstringsInRange: s options: NSStringEnumerationByLines usingBlock:^(NSString *substring, NSRange substringRange, NSRange enclosingRange, BOOL *stop) {
-        [replacementString appendFormat:@"%@\n", [self commentLine: substringRange]];
-      }];
-    }
+  if (s.length == 0) { // toggle current line, from its indentation up to its line ending
+    __block NSRange content = s;
+    [self enumerateLinesInRange: s usingBlock:^(NSRange line, NSRange indentation, unsigned spaces) {
+      content = NSMakeRange(NSMaxRange(indentation), NSMaxRange(line) - NSMaxRange(indentation));
+    }];
+    r = content;
   }
-  
-  if ([self shouldChangeTextInRange:r replacementString:replacementString]) {
-    [[textStorage mutableString] replaceCharactersInRange:r withString: replacementString];
-    //[textStorage replaceCharactersInRange:charRange withAttributedString:newText];
-    [self setSelectedRange:s];
-    [self didChangeText];
+  GMTextEdits *edits = [[GMTextEdits alloc] init];
+  [edits replaceCharactersInRange: r withString: [self commentRange: r]];
+  [self applyTextEdits: edits];
+}
+
+// Makes all the edits as one change of the text: they are undone together, and the text storage processes, and the
+// editor re-highlights, only the stretch from the first edit to the last one, once.
+- (BOOL)applyTextEdits: (GMTextEdits *)edits
+{
+  if (![edits count]) {
+    return NO;
+  }
+  NSRange spanned = [edits spannedRange];
+  NSString *replacement = [edits replacementOfSpannedRangeInString: [self string]];
+  if (![self shouldChangeTextInRange: spanned replacementString: replacement]) {
+    return NO;
   }
+  NSRange selection = [edits rangeAfterEdits: [self selectedRange]];
+  NSTextStorage *textStorage = [self textStorage];
+  [textStorage beginEditing];
+  [[textStorage mutableString] replaceCharactersInRange: spanned withString: replacement];
+  [textStorage endEditing];
+  [self setSelectedRange: selection];
+  [self didChangeText];
+  return YES;
+}
 
+- (IBAction)selectEnclosingBlock:(id)sender
+{
+  NSRange selection = [self selectedRange];
+  GMBracketIndex *index = [self bracketIndex];
+  // A selection starting with an opening bracket can still be inside of that bracket's block.
+  NSRange block = [index rangeOfBlockEnclosingLocation: selection.location + (selection.length ? 1 : 0)];
+  while (block.location != NSNotFound && (NSMaxRange(block) < NSMaxRange(selection) || NSEqualRanges(block, selection))) {
+    block = [index rangeOfBlockEnclosingLocation: block.location];
+  }
+  if (block.location == NSNotFound) {
+    NSBeep();
+    return;
+  }
+  [self setSelectedRange: block];
+  [self scrollRangeToVisible: block];
 }
 
 -(void)scrollToLine:(NSUInteger)num
 {
-  __block NSUInteger line = 0;
-  __block NSUInteger charCount = 0;
-  [[self string] enumerateSubstringsInRange: NSMakeRange(0, self.string.length) options:NSStringEnumerationByLines usingBlock:^(NSString *substring, NSRange substringRange, NSRange enclosingRange, BOOL *stop) {
-    if (++line == num) {
-      [self setSelectedRange:NSMakeRange(charCount,0)];
-      [self scrollRangeToVisible:NSMakeRange(charCount,0)];
-      *stop = YES;
-    }
-    charCount += enclosingRange.length;
-  }];
+  GMLineIndex *lines = [self lineIndex];
+  if (num == 0 || num > [lines count]) {
+    return;
+  }
+  NSUInteger charCount = [lines startOfLine: num - 1];
+  [self setSelectedRange:NSMakeRange(charCount,0)];
+  [self scrollRangeToVisible:NSMakeRange(charCount,0)];
+}
+
+- (GMLineIndex *)lineIndex
+{
+  if (!_lineIndex || [_lineIndex textLength] != [[self textStorage] length]) {
+    _lineIndex = [[GMLineIndex alloc] initWithString: [[self textStorage] string]];
+  }
+  return _lineIndex;
+}
+
+- (GMTokenIndex *)tokenIndex
+{
+  return _tokenIndex;
+}
+
+- (GMSymbolIndex *)symbolIndex
+{
+  return _symbolIndex;
 }
 
 
 #pragma mark - Text Utils Stuff
 - (void)userIndentByNumberOfLevels:(int)levels {
-  // Because of the way paragraph ranges work we will add spaces a final paragraph separator only if the selection is an insertion point at the end of the text.
   // We ask for rangeForUserTextChange and extend it to paragraph boundaries instead of asking rangeForUserParagraphAttributeChange because this is not an attribute change and we don't want it to be affected by the usesRuler setting.
-  NSRange charRange = [[self string] lineRangeForRange:[self rangeForUserTextChange]];
-  NSRange selRange = [self selectedRange];
-  if (charRange.location != NSNotFound) {
-    NSTextStorage *textStorage = [self textStorage];
-    NSAttributedString *newText;
-    
-    unsigned indentWidth = (unsigned)_tabWidth;
-    BOOL usesTabs = NO;
-    
-    selRange.location -= charRange.location;
-    newText = TE_attributedStringByIndentingParagraphs([textStorage attributedSubstringFromRange:charRange], levels,  &selRange, [self typingAttributes], (unsigned)_tabWidth, indentWidth, usesTabs);
-    
-    selRange.location += charRange.location;
-    if ([self shouldChangeTextInRange:charRange replacementString:[newText string]]) {
-      [[textStorage mutableString] replaceCharactersInRange:charRange withString:[newText string]];
-      //[textStorage replaceCharactersInRange:charRange withAttributedString:newText];
-      [self setSelectedRange:selRange];
-      [self didChangeText];
-    }
+  NSRange userRange = [self rangeForUserTextChange];
+  if (userRange.location == NSNotFound) {
+    return;
   }
+  NSString *string = [self string];
+  NSRange charRange = [string lineRangeForRange: userRange];
+  unsigned indentWidth = (unsigned)_tabWidth;
+  BOOL usesTabs = NO;
+
+  // Only the leading white space of each line changes, so that is all that gets replaced.
+  GMTextEdits *edits = [[GMTextEdits alloc] init];
+  [self enumerateLinesInRange: charRange usingBlock:^(NSRange line, NSRange indentation, unsigned spaces) {
+    int currentLevels = spaces / indentWidth;
+    if (levels < 0 && spaces % indentWidth != 0) {
+      currentLevels++;
+    }
+    currentLevels = MAX(currentLevels + levels, 0);
+    NSString *whitespace = [TE_tabbifiedStringWithNumberOfSpaces(currentLevels * indentWidth, indentWidth, usesTabs) copy];
+    if ([whitespace length] != indentation.length || [string compare: whitespace options: NSLiteralSearch range: indentation] != NSOrderedSame) {
+      [edits replaceCharactersInRange: indentation withString: whitespace];
+    }
+  }];
+  [self applyTextEdits: edits];
 }
 
 
@@ -261,7 +624,15 @@
 
 - (id)triggerForCurrentPosition
 {
-  return [self selectedToken];
+  NSString *token = [self selectedToken];
+  NSUInteger location = NSMaxRange([self selectedRange]);
+  if (!token && location > 0 && [[_symbolIndex namesForToken: GMPlainTextTrigger] count]) {
+    unichar c = [[self string] characterAtIndex: location - 1];
+    if ([[NSCharacterSet alphanumericCharacterSet] characterIsMember: c] || c == '_') {
+      return GMPlainTextTrigger;
+    }
+  }
+  return token;
 }
 
 - (NSArray *)autocompletionListForTrigger: (id)trigger
@@ -272,7 +643,26 @@
 //    _autocompletes = [NSDictionary dictionaryWithContentsOfFile: [[NSBundle mainBundle] pathForResource: @"css" ofType: @"autocomplete"]];
 //    return _autocompletes[trigger];
 //  }
-  return _language[@"autocompletion"][trigger];
+  NSArray *list = _language[@"autocompletion"][trigger];
+  NSUInteger location = NSMaxRange([self selectedRange]);
+  NSArray *names = [_symbolIndex namesForToken: trigger excludingSymbolAtLocation: location ? location - 1 : 0];
+  if (![names count]) {
+    return list;
+  }
+  // The same lists give back the same array, so that GMAutoCompleteTextView can keep its index of it.
+  NSDictionary *cached = _completionLists[trigger];
+  if (cached && cached[@"list"] == (list ?: [NSNull null]) && cached[@"names"] == names) {
+    return cached[@"combined"];
+  }
+  NSMutableArray *combined = [NSMutableArray arrayWithArray: list ?: @[]];
+  NSSet *titles = [NSSet setWithArray: [combined valueForKey: @"title"]];
+  for (NSString *name in names) {
+    if (![titles containsObject: name]) {
+      [combined addObject: @{@"title": name}];
+    }
+  }
+  _completionLists[trigger] = @{@"list": list ?: [NSNull null], @"names": names, @"combined": combined};
+  return combined;
 }
 
 - (NSString *)textForObject: (id) object
@@ -292,7 +682,27 @@
 }
 
 - (void) textStorageDidProcessEditing:(NSNotification *)note {
-  [self highlight];
+  NSTextStorage *textStorage = [note object];
+  // Our own attribute changes come back through here as well.
+  if (!([textStorage editedMask] & NSTextStorageEditedCharacters) || _suspendsHighlighting) {
+    return;
+  }
+  [_lineIndex editedRange: [textStorage editedRange] changeInLength: [textStorage changeInLength] string: [textStorage string]];
+  [_bracketIndex editedRange: [textStorage editedRange] changeInLength: [textStorage changeInLength] string: [textStorage string]];
+  [_tokenIndex editedRange: [textStorage editedRange] changeInLength: [textStorage changeInLength]];
+  [_symbolIndex editedRange: [textStorage editedRange] changeInLength: [textStorage changeInLength]];
+  // With asynchronous highlighting, the latency is recorded once the highlighting of the edit is applied. An edit
+  // that a later one catches up with isn't recorded.
+  _editTime = GMInstrumentationEnabled ? CFAbsoluteTimeGetCurrent() : 0;
+  if (_incrementalHighlighting) {
+    [self highlightEditedRange: [textStorage editedRange] changeInLength: [textStorage changeInLength]];
+  } else {
+    [self highlight];
+  }
+  if (_editTime && !_asynchronousHighlighting && GMInstrumentationEnabled) {
+    GMInstrumentationRecordKeystroke(_editTime);
+  }
+  _editTime = 0;
 }
 
 
@@ -300,7 +710,9 @@
 - (void)insertText:(id)insertString {
   
   // make sure we're not doing anything fancy in a quoted string.
-  if (NSMaxRange([self selectedRange]) < [[self textStorage] length] && [[[self textStorage] attribute:@"GMToken" atIndex:self.selectedRange.location effectiveRange: nil] isEqualToString: @"string"]) {
+  NSString *type = nil;
+  [_tokenIndex rangeOfTokenAtLocation: self.selectedRange.location depth: 0 type: &type];
+  if ([type isEqualToString: @"string"]) {
     [super insertText:insertString];
     return;
   }
@@ -326,7 +738,7 @@
   [self setLastAutoInsert:nil];
   [super insertText:insertString];
   NSRange currentRange = [self selectedRange];
-  NSRange r = [self selectionRangeForProposedRange:currentRange granularity:NSSelectByParagraph];
+  NSRange r = [[self lineIndex] rangeOfLineContainingLocation: currentRange.location];
   BOOL atEndOfLine = (NSMaxRange(r) - 1 == NSMaxRange(currentRange));
   
   NSArray *keys = [_language[@"paired_characters"] allKeys];
@@ -334,7 +746,6 @@
   
   if (atEndOfLine && ir.length == 1) {
     
-    r = [self selectionRangeForProposedRange:currentRange granularity:NSSelectByParagraph];
     NSString *myLine = [[[self textStorage] mutableString] substringWithRange:r];
     
     NSMutableString *indent = [NSMutableString string];
@@ -373,7 +784,7 @@
       r.location --;
     }
     
-    r = [self selectionRangeForProposedRange:r granularity:NSSelectByParagraph];
+    r = [[self lineIndex] rangeOfLineContainingLocation: r.location];
     
     NSString *previousLine = [[[self textStorage] mutableString] substringWithRange:r];
     
@@ -394,8 +805,8 @@
 
 
 - (BOOL)changeSelectedNumberByDelta:(NSInteger)d {
-  NSRange r   = [self selectedRange];
-  NSString *token = [self.attributedString attribute: @"GMToken" atIndex:r.location longestEffectiveRange:&r inRange:NSMakeRange(0, self.attributedString.length)];
+  NSString *token = nil;
+  NSRange r   = [_tokenIndex rangeOfTokenAtLocation: [self selectedRange].location depth: 0 type: &token];
   if ([token isEqualToString: @"number"]) {
     NSString *s = [[[self textStorage] mutableString] substringWithRange:r];
     NSInteger i = [s integerValue];
@@ -440,73 +851,60 @@
  */
 -(void)setSpellingState:(NSInteger)value range:(NSRange)charRange
 {
-  NSRange r;
-  NSNumber *v = [self.attributedString attribute:@"GMSpellCheck" atIndex: charRange.location longestEffectiveRange: &r inRange:charRange];
-  BOOL spellCheck = [v boolValue];
-  if (spellCheck && NSEqualRanges(r, charRange)) {
+  // A range can span several tokens in a row, like a comment and the plain text after it. It is checked if all of
+  // them are.
+  GMTheme *theme = [_syntaxHighlighter theme];
+  NSUInteger location = charRange.location, end = NSMaxRange(charRange);
+  BOOL spellCheck = YES;
+  while (spellCheck && location < end) {
+    NSString *type = nil;
+    NSRange r = [_tokenIndex rangeOfTokenAtLocation: location depth: 0 type: &type];
+    if (type) {
+      spellCheck = [[theme attributesForToken: type][@"GMSpellCheck"] boolValue];
+    } else if ([[theme defaultAttributes][@"GMSpellCheck"] boolValue]) {
+      // Plain text is only checked if the theme asks for it. It runs up to the next token.
+      NSRange next = [_tokenIndex rangeOfNextTokenFromLocation: location depth: 0 type: NULL];
+      r = NSMakeRange(location, MIN(next.location, end) - location);
+    } else {
+      spellCheck = NO;
+    }
+    location = NSMaxRange(r);
+  }
+  if (spellCheck) {
     [super setSpellingState: value range:charRange];
   }
 }
 
 #pragma mark - Braces highlighting
 
-#define IS_OPENING_BRACE(str) ([[_language[@"paired_characters"] allKeys] containsObject: [NSString stringWithCharacters: &str length: 1]])
-
 #define IS_CLOSING_BRACE(str) ([[_language[@"paired_characters"] allValues] containsObject: [NSString stringWithCharacters: &str length: 1]])
 
-
-// Code partially adapated from TextExtras
-- (NSRange)findMatchingBraceForBraceRange: (NSRange)r
+- (GMBracketIndex *)bracketIndex
 {
-  NSRange matchRange = NSMakeRange(NSNotFound, 0);
-  unichar selChar = [self.string characterAtIndex:r.location];
-  unichar matchBrace;
-  NSString *selString = [self.string substringWithRange:NSMakeRange(r.location, 1)];
-  BOOL backwards;
-  if ([[_language[@"paired_characters"] allKeys] containsObject: selString]) {
-    backwards = NO;
-    matchBrace = [_language[@"paired_characters"][selString] characterAtIndex: 0];
-  } else if ([[_language[@"paired_characters"] allValues] containsObject: selString]) {
-    backwards = YES;
-    matchBrace = [[_language[@"paired_characters"] allKeysForObject: selString][0] characterAtIndex: 0];
-  } else {
-    return matchRange;
-  }
-  
-  NSRange searchRange;
-  if (backwards) {
-    searchRange = NSMakeRange(0, r.location);
-  } else {
-    searchRange = NSMakeRange(NSMaxRange(r), [self.string length] - NSMaxRange(r));
-  }
-  
-  BOOL done = NO;
-  NSInteger stack = 1;
-  NSInteger i;
-  // Fill the buffer with a chunk of the searchRange
-  // This loops over all the characters in buffRange, going either backwards or forwards.
-  for (i = (backwards ? (searchRange.length - 1) : 0); (!done && (backwards ? (i >= 0) : (i < searchRange.length))); (backwards ? i-- : i++)) {
-    unichar curString = [self.string characterAtIndex: i];
-    // Now do the push or pop, if any
-    if (curString == matchBrace) {
-      if (--stack < 0) {
-        // Might want to beep here?
-        done = YES;
-      } else if (stack == 0) {
-        matchRange = NSMakeRange(i, 1);
-        done = YES;
+  if (!_bracketIndex && [_language[@"paired_characters"] count]) {
+    _bracketIndex = [[GMBracketIndex alloc] initWithPairs: _language[@"paired_characters"]];
+    [_bracketIndex resetWithString: [[self textStorage] string]];
+    // Until the next highlighting pass, the tokens highlighted so far tell which brackets don't count. Like
+    // [GMBracketIndex updateWithTokenBuffer:], only the outermost tokens do.
+    for (NSString *type in [_bracketIndex ignoredTypeNames]) {
+      NSUInteger location = 0;
+      NSRange r;
+      while ((r = [_tokenIndex rangeOfNextTokenOfType: type fromLocation: location]).location != NSNotFound) {
+        NSString *outer;
+        if (NSEqualRanges([_tokenIndex rangeOfTokenAtLocation: r.location depth: 0 type: &outer], r) && [outer isEqualToString: type]) {
+          [_bracketIndex removeBracketsInRange: r];
+        }
+        location = MAX(NSMaxRange(r), r.location + 1);
       }
-    } else if (curString == selChar) {
-      stack++;
     }
   }
-  return matchRange;
+  return _bracketIndex;
 }
 
-
-
-                  
-                  
+- (NSRange)findMatchingBraceForBraceRange: (NSRange)r
+{
+  return [[self bracketIndex] rangeOfBracketMatchingBracketAtLocation: r.location];
+}
 
 - (void)textViewDidChangeSelection:(NSNotification *)notification {
   NSTextView *textView = [notification object];
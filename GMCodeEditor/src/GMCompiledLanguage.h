@@ -0,0 +1,89 @@
+//
+//  GMCompiledLanguage.h
+//  Code Editor
+//
+//  Created by Jakub Hampl on 17.10.26.
+//  Copyright (c) 2026 Jakub Hampl. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+extern NSString * const GMCompiledLanguageErrorDomain;
+
+enum {
+  GMCompiledLanguageInvalidGrammarError = 1
+};
+
+/**
+ GMCompiledLanguage reads and writes the precompiled form of a [language](GMLanguage), stored in files with the
+ extension `.languagec`.
+
+ Loading a language plist means parsing XML and compiling every regular expression of the grammar up front. A
+ compiled language is instead a single binary file that is memory mapped: the token type names are already
+ interned, nested grammars are flattened into one table of rules and patterns are only compiled when the
+ highlighter first needs them (see [GMGrammar patternOfRule:]). The rest of the language (paired characters,
+ comments, autocompletion and so on) is kept in a small binary plist inside the file.
+
+ The file records a hash of the plist it was compiled from, so [GMLanguage languageAtPath:] can tell when it is
+ out of date and fall back to the plist.
+
+ ## File Format
+
+ All integers are 32 bit in the byte order of the machine that wrote the file, except for the 64 bit source hash.
+ The file starts with a header of the magic `GMLC`, the format version, the source hash and the count and offset
+ of each table, followed by the tables:
+
+ - strings: the offset and length of each string in the string data, which is UTF-8;
+ - types: the string index of each token type name, in order of type ID;
+ - grammars: the first rule and number of rules of each grammar, the language grammar being the first one and
+   nested grammars always coming after the grammar they are nested in;
+ - rules: the type ID, pattern string index, pattern options, flags, nested grammar index, predictive
+   pattern string index, options and window and nested language name string index of each rule.
+
+ A file that doesn't check out in any way is not loaded at all.
+ */
+@interface GMCompiledLanguage : NSObject
+
+/**
+ @name Compiling a language
+ */
+/**
+ Compiles a language.
+ @param dict The language definition dictionary, as it is stored in a language plist.
+ @param sourceHash The hash of the plist the language comes from, see GMHashOfData().
+ @param error Set to the reason if the language can't be compiled.
+ @return The compiled language, or nil if the grammar is invalid.
+ */
++ (NSData *)dataByCompilingLanguage: (NSDictionary *)dict sourceHash: (uint64_t)sourceHash error: (NSError **)error;
+/**
+ Compiles a language plist into a `.languagec` file.
+ @param path The path of the language plist.
+ @param compiledPath Where to write the compiled language, usually `path` followed by `c`.
+ @param error Set to the reason if the language can't be read, compiled or written.
+ @return Whether the language was compiled.
+ */
++ (BOOL)compileLanguageAtPath: (NSString *)path toPath: (NSString *)compiledPath error: (NSError **)error;
+
+/**
+ @name Loading a compiled language
+ */
+/**
+ Loads a compiled language.
+ @param path The path of the `.languagec` file.
+ @param source The contents of the plist the language should have been compiled from, or nil to not check that.
+ @return A language dictionary like [GMLanguage languageWithDictionary:] returns, except that it only has the
+ compiled grammar. Returns nil if the file can't be read, is damaged, has a different version or was compiled
+ from something else than source.
+ */
++ (NSDictionary *)languageWithContentsOfFile: (NSString *)path sourceData: (NSData *)source;
+/**
+ Loads a compiled language from memory. See languageWithContentsOfFile:sourceData:.
+ */
++ (NSDictionary *)languageWithData: (NSData *)data sourceData: (NSData *)source;
+
+@end
+
+/**
+ The 64 bit FNV-1a hash of some data, which is how compiled languages identify the plist they come from.
+ */
+extern uint64_t GMHashOfData(NSData *data);
@@ -0,0 +1,413 @@
+//
+//  GMCompiledLanguage.m
+//  Code Editor
+//
+//  Created by Jakub Hampl on 17.10.26.
+//  Copyright (c) 2026 Jakub Hampl. All rights reserved.
+//
+
+#import "GMCompiledLanguage.h"
+#import "GMLanguage.h"
+#import "GMGrammar.h"
+
+NSString * const GMCompiledLanguageErrorDomain = @"GMCompiledLanguageErrorDomain";
+
+#define GMCompiledLanguageVersion 3
+#define GMCompiledNone UINT32_MAX
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint64_t sourceHash;
+  uint32_t stringCount, stringsOffset;
+  uint32_t typeCount, typesOffset;
+  uint32_t grammarCount, grammarsOffset;
+  uint32_t ruleCount, rulesOffset;
+  uint32_t stringDataLength, stringDataOffset;
+  uint32_t propertiesLength, propertiesOffset;
+} GMCompiledHeader;
+
+typedef struct {
+  uint32_t offset;
+  uint32_t length;
+} GMCompiledString;
+
+typedef struct {
+  uint32_t firstRule;
+  uint32_t ruleCount;
+} GMCompiledGrammar;
+
+typedef struct {
+  uint32_t type;
+  uint32_t pattern;
+  uint32_t options;
+  uint32_t flags;
+  uint32_t inside;
+  uint32_t predictive;
+  uint32_t predictiveOptions;
+  uint32_t predictiveWindow;
+  uint32_t language;
+} GMCompiledRule;
+
+uint64_t GMHashOfData(NSData *data)
+{
+  const uint8_t *bytes = [data bytes];
+  uint64_t hash = 14695981039346656037ULL;
+  for (NSUInteger i = 0; i < [data length]; i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+#pragma mark - Compiling
+
+// Keeps the tables of a language being compiled.
+@interface GMLanguageCompiler : NSObject
+{
+@private
+  NSMutableArray *_strings;
+  NSMutableDictionary *_stringIndexes;
+  NSMutableArray *_types;
+  NSMutableDictionary *_typeIDs;
+  NSMutableData *_grammars;
+  NSMutableData *_rules;
+  NSMutableArray *_queue;
+}
+- (BOOL)compileGrammar: (id)grammar error: (NSError **)error;
+- (NSData *)dataWithSourceHash: (uint64_t)sourceHash properties: (NSData *)properties;
+@end
+
+@implementation GMLanguageCompiler
+
+- (id)init
+{
+  if (self = [super init]) {
+    _strings = [NSMutableArray array];
+    _stringIndexes = [NSMutableDictionary dictionary];
+    _types = [NSMutableArray array];
+    _typeIDs = [NSMutableDictionary dictionary];
+    _grammars = [NSMutableData data];
+    _rules = [NSMutableData data];
+    _queue = [NSMutableArray array];
+  }
+  return self;
+}
+
+- (uint32_t)indexOfString: (NSString *)string
+{
+  NSNumber *index = _stringIndexes[string];
+  if (!index) {
+    index = @([_strings count]);
+    [_strings addObject: string];
+    [_stringIndexes setObject: index forKey: string];
+  }
+  return [index unsignedIntValue];
+}
+
+- (uint32_t)typeIDOfName: (NSString *)name
+{
+  NSNumber *typeID = _typeIDs[name];
+  if (!typeID) {
+    typeID = @([_types count]);
+    [_types addObject: @([self indexOfString: name])];
+    [_typeIDs setObject: typeID forKey: name];
+  }
+  return [typeID unsignedIntValue];
+}
+
+// Grammars are stored in the order they are queued in, so the rules of each one are contiguous and nested grammars
+// come after their parents.
+- (uint32_t)enqueueGrammar: (id)grammar
+{
+  [_queue addObject: grammar];
+  return (uint32_t)[_queue count] - 1;
+}
+
+- (NSError *)errorWithDescription: (NSString *)description
+{
+  return [NSError errorWithDomain: GMCompiledLanguageErrorDomain code: GMCompiledLanguageInvalidGrammarError userInfo: @{NSLocalizedDescriptionKey: description}];
+}
+
+// The pattern of a `/pattern/flags` string or a regular expression, checked by compiling it.
+- (NSString *)patternOfItem: (id)item options: (NSRegularExpressionOptions *)options error: (NSError **)error
+{
+  NSString *pattern;
+  if ([item isKindOfClass: [NSRegularExpression class]]) {
+    pattern = [item pattern];
+    *options = [item options];
+    return pattern;
+  }
+  if (![item isKindOfClass: [NSString class]]) {
+    if (error) *error = [self errorWithDescription: [NSString stringWithFormat: @"%@ is not a regular expression.", item]];
+    return nil;
+  }
+  pattern = [GMLanguage patternOfRegularExpressionString: item options: options];
+  if (![NSRegularExpression regularExpressionWithPattern: pattern options: *options error: error]) {
+    return nil;
+  }
+  return pattern;
+}
+
+- (BOOL)addRuleWithName: (NSString *)name item: (id)item error: (NSError **)error
+{
+  GMCompiledRule rule = {[self typeIDOfName: name], GMCompiledNone, 0, 0, GMCompiledNone, GMCompiledNone, 0, GMDefaultPredictiveWindow, GMCompiledNone};
+  id pattern = item;
+  if ([item isKindOfClass: [NSDictionary class]]) {
+    pattern = item[@"pattern"];
+    if ([item[@"lookbehind"] boolValue]) {
+      rule.flags |= GMRuleLookbehind;
+    }
+    if (item[@"inside"]) {
+      rule.inside = [self enqueueGrammar: item[@"inside"]];
+    } else if ([item[@"language"] isKindOfClass: [NSString class]]) {
+      rule.language = [self indexOfString: item[@"language"]];
+    }
+    if (item[@"predictive"]) {
+      NSRegularExpressionOptions options;
+      NSString *predictive = [self patternOfItem: item[@"predictive"] options: &options error: error];
+      if (!predictive) {
+        return NO;
+      }
+      rule.predictive = [self indexOfString: predictive];
+      rule.predictiveOptions = (uint32_t)options;
+      if (item[@"predictive_window"]) {
+        rule.predictiveWindow = (uint32_t)MIN([item[@"predictive_window"] unsignedIntegerValue], UINT32_MAX);
+      }
+    }
+  }
+  if (pattern) {
+    NSRegularExpressionOptions options;
+    NSString *source = [self patternOfItem: pattern options: &options error: error];
+    if (!source) {
+      return NO;
+    }
+    rule.pattern = [self indexOfString: source];
+    rule.options = (uint32_t)options;
+    rule.flags |= GMBoundsSensitivityOfPattern(source);
+  }
+  [_rules appendBytes: &rule length: sizeof(rule)];
+  return YES;
+}
+
+- (BOOL)compileGrammar: (id)grammar error: (NSError **)error
+{
+  [self enqueueGrammar: grammar];
+  for (NSUInteger i = 0; i < [_queue count]; i++) {
+    id item = _queue[i];
+    GMCompiledGrammar compiled = {(uint32_t)([_rules length] / sizeof(GMCompiledRule)), 0};
+    // Grammars are arrays of single entry dictionaries in plists, or ordered dictionaries when built by hand.
+    NSArray *entries = [item isKindOfClass: [NSArray class]] ? item : @[item];
+    for (id entry in entries) {
+      if (![entry isKindOfClass: [NSDictionary class]]) {
+        if (error) *error = [self errorWithDescription: [NSString stringWithFormat: @"%@ is not a grammar rule.", entry]];
+        return NO;
+      }
+      for (NSString *name in entry) {
+        if (![self addRuleWithName: name item: entry[name] error: error]) {
+          return NO;
+        }
+        compiled.ruleCount++;
+      }
+    }
+    [_grammars appendBytes: &compiled length: sizeof(compiled)];
+  }
+  return YES;
+}
+
+- (NSData *)dataWithSourceHash: (uint64_t)sourceHash properties: (NSData *)properties
+{
+  NSMutableData *stringData = [NSMutableData data];
+  NSMutableData *strings = [NSMutableData data];
+  for (NSString *string in _strings) {
+    NSData *utf8 = [string dataUsingEncoding: NSUTF8StringEncoding];
+    GMCompiledString compiled = {(uint32_t)[stringData length], (uint32_t)[utf8 length]};
+    [strings appendBytes: &compiled length: sizeof(compiled)];
+    [stringData appendData: utf8];
+  }
+  NSMutableData *types = [NSMutableData data];
+  for (NSNumber *type in _types) {
+    uint32_t index = [type unsignedIntValue];
+    [types appendBytes: &index length: sizeof(index)];
+  }
+
+  GMCompiledHeader header = {{'G', 'M', 'L', 'C'}, GMCompiledLanguageVersion, sourceHash};
+  NSMutableData *data = [NSMutableData dataWithLength: sizeof(header)];
+  void (^append)(NSData *, uint32_t *) = ^(NSData *table, uint32_t *offset) {
+    *offset = (uint32_t)[data length];
+    [data appendData: table];
+    // Keep every table aligned so it can be used straight from the mapped file.
+    [data increaseLengthBy: (4 - [data length] % 4) % 4];
+  };
+  header.stringCount = (uint32_t)[_strings count];
+  append(strings, &header.stringsOffset);
+  header.typeCount = (uint32_t)[_types count];
+  append(types, &header.typesOffset);
+  header.grammarCount = (uint32_t)([_grammars length] / sizeof(GMCompiledGrammar));
+  append(_grammars, &header.grammarsOffset);
+  header.ruleCount = (uint32_t)([_rules length] / sizeof(GMCompiledRule));
+  append(_rules, &header.rulesOffset);
+  header.stringDataLength = (uint32_t)[stringData length];
+  append(stringData, &header.stringDataOffset);
+  header.propertiesLength = (uint32_t)[properties length];
+  append(properties, &header.propertiesOffset);
+  [data replaceBytesInRange: NSMakeRange(0, sizeof(header)) withBytes: &header];
+  return data;
+}
+
+@end
+
+@implementation GMCompiledLanguage
+
++ (NSData *)dataByCompilingLanguage:(NSDictionary *)dict sourceHash:(uint64_t)sourceHash error:(NSError **)error
+{
+  GMLanguageCompiler *compiler = [[GMLanguageCompiler alloc] init];
+  if (![compiler compileGrammar: dict[@"grammar"] ?: @[] error: error]) {
+    return nil;
+  }
+  NSMutableDictionary *properties = [dict mutableCopy];
+  [properties removeObjectForKey: @"grammar"];
+  NSData *plist = [NSPropertyListSerialization dataWithPropertyList: properties format: NSPropertyListBinaryFormat_v1_0 options: 0 error: error];
+  if (!plist) {
+    return nil;
+  }
+  return [compiler dataWithSourceHash: sourceHash properties: plist];
+}
+
++ (BOOL)compileLanguageAtPath:(NSString *)path toPath:(NSString *)compiledPath error:(NSError **)error
+{
+  NSData *source = [NSData dataWithContentsOfFile: path options: 0 error: error];
+  if (!source) {
+    return NO;
+  }
+  NSDictionary *dict = [NSPropertyListSerialization propertyListWithData: source options: NSPropertyListImmutable format: NULL error: error];
+  if (![dict isKindOfClass: [NSDictionary class]]) {
+    if (dict && error) {
+      *error = [NSError errorWithDomain: GMCompiledLanguageErrorDomain code: GMCompiledLanguageInvalidGrammarError userInfo: @{NSLocalizedDescriptionKey: [NSString stringWithFormat: @"%@ is not a language.", path]}];
+    }
+    return NO;
+  }
+  NSData *compiled = [self dataByCompilingLanguage: dict sourceHash: GMHashOfData(source) error: error];
+  return compiled && [compiled writeToFile: compiledPath options: NSDataWritingAtomic error: error];
+}
+
+#pragma mark - Loading
+
++ (NSDictionary *)languageWithContentsOfFile:(NSString *)path sourceData:(NSData *)source
+{
+  NSData *data = [NSData dataWithContentsOfFile: path options: NSDataReadingMappedAlways error: NULL];
+  return data ? [self languageWithData: data sourceData: source] : nil;
+}
+
+// Whether count items of size at offset lie within length bytes and are aligned.
+static BOOL GMTableFits(uint32_t offset, uint32_t count, size_t size, NSUInteger length)
+{
+  return offset % 4 == 0 && (uint64_t)offset + (uint64_t)count * size <= length;
+}
+
++ (NSDictionary *)languageWithData:(NSData *)data sourceData:(NSData *)source
+{
+  const uint8_t *bytes = [data bytes];
+  NSUInteger length = [data length];
+  if (length < sizeof(GMCompiledHeader)) {
+    return nil;
+  }
+  const GMCompiledHeader *header = (const GMCompiledHeader *)bytes;
+  if (memcmp(header->magic, "GMLC", 4) != 0 || header->version != GMCompiledLanguageVersion) {
+    return nil;
+  }
+  if (source && header->sourceHash != GMHashOfData(source)) {
+    return nil;
+  }
+  if (!GMTableFits(header->stringsOffset, header->stringCount, sizeof(GMCompiledString), length) ||
+      !GMTableFits(header->typesOffset, header->typeCount, sizeof(uint32_t), length) ||
+      !GMTableFits(header->grammarsOffset, header->grammarCount, sizeof(GMCompiledGrammar), length) ||
+      !GMTableFits(header->rulesOffset, header->ruleCount, sizeof(GMCompiledRule), length) ||
+      !GMTableFits(header->stringDataOffset, header->stringDataLength, 1, length) ||
+      !GMTableFits(header->propertiesOffset, header->propertiesLength, 1, length) ||
+      header->grammarCount == 0) {
+    return nil;
+  }
+
+  const GMCompiledString *stringTable = (const GMCompiledString *)(bytes + header->stringsOffset);
+  const char *stringData = (const char *)(bytes + header->stringDataOffset);
+  NSMutableArray *strings = [NSMutableArray arrayWithCapacity: header->stringCount];
+  for (uint32_t i = 0; i < header->stringCount; i++) {
+    if ((uint64_t)stringTable[i].offset + stringTable[i].length > header->stringDataLength) {
+      return nil;
+    }
+    NSString *string = [[NSString alloc] initWithBytes: stringData + stringTable[i].offset length: stringTable[i].length encoding: NSUTF8StringEncoding];
+    if (!string) {
+      return nil;
+    }
+    [strings addObject: string];
+  }
+
+  const uint32_t *typeTable = (const uint32_t *)(bytes + header->typesOffset);
+  NSMutableArray *typeNames = [NSMutableArray arrayWithCapacity: header->typeCount];
+  for (uint32_t i = 0; i < header->typeCount; i++) {
+    if (typeTable[i] >= header->stringCount || [typeNames containsObject: strings[typeTable[i]]]) {
+      return nil;
+    }
+    [typeNames addObject: strings[typeTable[i]]];
+  }
+
+  // All grammars share the type IDs of the language grammar. Nested grammars always come after their parents, which
+  // makes sure there are no cycles.
+  const GMCompiledGrammar *grammarTable = (const GMCompiledGrammar *)(bytes + header->grammarsOffset);
+  const GMCompiledRule *ruleTable = (const GMCompiledRule *)(bytes + header->rulesOffset);
+  GMGrammar *root = [[GMGrammar alloc] initWithTypeNames: typeNames];
+  NSMutableArray *grammars = [NSMutableArray arrayWithObject: root];
+  for (uint32_t i = 1; i < header->grammarCount; i++) {
+    [grammars addObject: [root nestedGrammar]];
+  }
+  for (uint32_t g = 0; g < header->grammarCount; g++) {
+    GMCompiledGrammar compiled = grammarTable[g];
+    if ((uint64_t)compiled.firstRule + compiled.ruleCount > header->ruleCount) {
+      return nil;
+    }
+    GMGrammar *grammar = grammars[g];
+    for (uint32_t r = compiled.firstRule; r < compiled.firstRule + compiled.ruleCount; r++) {
+      GMCompiledRule rule = ruleTable[r];
+      if (rule.type >= header->typeCount ||
+          (rule.pattern != GMCompiledNone && rule.pattern >= header->stringCount) ||
+          (rule.predictive != GMCompiledNone && rule.predictive >= header->stringCount) ||
+          (rule.language != GMCompiledNone && rule.language >= header->stringCount) ||
+          (rule.inside != GMCompiledNone && (rule.inside <= g || rule.inside >= header->grammarCount)) ||
+          (rule.flags & ~(GMRuleLookbehind | GMRuleStartSensitive | GMRuleEndSensitive))) {
+        return nil;
+      }
+      NSRegularExpression *predictive;
+      if (rule.predictive != GMCompiledNone) {
+        predictive = [NSRegularExpression regularExpressionWithPattern: strings[rule.predictive] options: rule.predictiveOptions error: NULL];
+        if (!predictive) {
+          return nil;
+        }
+      }
+      GMGrammar *inside;
+      if (rule.inside != GMCompiledNone) {
+        inside = grammars[rule.inside];
+      } else if (rule.language != GMCompiledNone) {
+        inside = [root nestedGrammarWithLanguageNamed: strings[rule.language]];
+      }
+      [grammar addRuleWithName: typeNames[rule.type]
+                 patternSource: rule.pattern == GMCompiledNone ? nil : strings[rule.pattern]
+                       options: rule.options
+                         flags: rule.flags
+                        inside: inside
+                    predictive: predictive];
+      if (predictive) {
+        [grammar setPredictiveWindow: rule.predictiveWindow forName: typeNames[rule.type]];
+      }
+    }
+  }
+
+  NSData *plist = [data subdataWithRange: NSMakeRange(header->propertiesOffset, header->propertiesLength)];
+  NSDictionary *properties = [NSPropertyListSerialization propertyListWithData: plist options: NSPropertyListImmutable format: NULL error: NULL];
+  if (![properties isKindOfClass: [NSDictionary class]]) {
+    return nil;
+  }
+  return [GMLanguage languageWithDictionary: properties grammar: grammars[0]];
+}
+
+@end
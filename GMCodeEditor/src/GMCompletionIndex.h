@@ -0,0 +1,102 @@
+//
+//  GMCompletionIndex.h
+//  Code Editor
+//
+//  Created by Jakub Hampl on 17.10.26.
+//  Copyright (c) 2026 Jakub Hampl. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+typedef enum {
+  GMMatchingPrefix = 0,
+  GMMatchingPrefixSuffixSorted,
+  GMMatchingSubstring,
+  GMMatchingDiceCoefficient,
+  GMMatchingSubletters
+} GMMatchingAlgorithm;
+
+/**
+ GMCompletionIndex filters and sorts a fixed list of autocompletion strings the way
+ [GMAutoCompleteTextView item:matchesFilter:] scores them, without creating any objects per item or per keystroke.
+
+ The strings are copied once into a single UTF-16 pool together with a case folded copy, a lexicographically sorted
+ permutation (so the items with a given prefix are one binary search away) and the sorted bigrams of every item for
+ `GMMatchingDiceCoefficient`.
+
+ The index remembers the items that matched the last filter. When the next filter merely extends it, which is what
+ happens while typing, only those items are scored again. This holds for every algorithm except
+ `GMMatchingDiceCoefficient`, where a longer filter can match items a shorter one didn't.
+ */
+@interface GMCompletionIndex : NSObject
+{
+@private
+  NSUInteger _count;
+  unichar *_characters;
+  unichar *_folded;
+  NSUInteger *_offsets;
+  NSUInteger *_lengths;
+  NSUInteger *_sorted;
+  uint32_t *_bigrams;
+  NSUInteger *_bigramOffsets;
+  NSUInteger *_bigramCounts;
+
+  unichar *_filter;
+  NSUInteger _filterLength;
+  GMMatchingAlgorithm _algorithm;
+  BOOL _hasFilter;
+  NSUInteger *_candidates;
+  NSUInteger _candidateCount;
+  struct GMScoredCompletion *_scored;
+  NSUInteger *_results;
+}
+
+/**
+ Creates an index.
+ @param strings The strings to complete, in the order of the autocompletion list. Anything that isn't a string is
+ indexed as an empty string.
+ */
+- (id)initWithStrings: (NSArray *)strings;
+
+/**
+ The number of indexed strings.
+ */
+- (NSUInteger)count;
+
+/**
+ @name Scoring
+ */
+/**
+ The score of one item, the same as [GMAutoCompleteTextView item:matchesFilter:] returns for it.
+ @param index The index of the item.
+ @param filter What has been typed.
+ @param algorithm The matching algorithm to use.
+ */
+- (double)scoreOfItemAtIndex: (NSUInteger)index forFilter: (NSString *)filter algorithm: (GMMatchingAlgorithm)algorithm;
+/**
+ Finds the items to show for a filter.
+ @param filter What has been typed.
+ @param algorithm The matching algorithm to use.
+ @return The number of items scoring above 0.1, which are then available through results.
+ */
+- (NSUInteger)matchFilter: (NSString *)filter algorithm: (GMMatchingAlgorithm)algorithm;
+/**
+ The indexes of the items found by the last matchFilter:algorithm:, ordered by score and then by index. The pointer
+ is only valid until the next matchFilter:algorithm:.
+ */
+- (const NSUInteger *)results;
+
+@end
+
+/**
+ Scores a string against a filter. Both are plain UTF-16 arrays, the folded ones being case folded for
+ `GMMatchingSubletters`, and the bigrams being the sorted bigrams of each whitespace separated word, which only
+ `GMMatchingDiceCoefficient` uses.
+ @return Whether the item matches at all; score is set to its score, which can be 0 even for a match.
+ */
+extern BOOL GMCompletionScore(GMMatchingAlgorithm algorithm,
+                              const unichar *item, const unichar *foldedItem, NSUInteger itemLength,
+                              const uint32_t *itemBigrams, NSUInteger itemBigramCount,
+                              const unichar *filter, const unichar *foldedFilter, NSUInteger filterLength,
+                              const uint32_t *filterBigrams, NSUInteger filterBigramCount,
+                              double *score);
@@ -0,0 +1,373 @@
+//
+//  GMCompletionIndex.m
+//  Code Editor
+//
+//  Created by Jakub Hampl on 17.10.26.
+//  Copyright (c) 2026 Jakub Hampl. All rights reserved.
+//
+
+#import "GMCompletionIndex.h"
+
+#define GMCompletionMinimumScore 0.1
+
+struct GMScoredCompletion {
+  double score;
+  NSUInteger index;
+};
+
+#pragma mark - Characters
+
+static BOOL GMIsSpace(unichar c)
+{
+  return c == ' ' || (c >= 0x09 && c <= 0x0D) || c == 0x85 || c == 0xA0 || c == 0x1680 || (c >= 0x2000 && c <= 0x200A) ||
+    c == 0x2028 || c == 0x2029 || c == 0x202F || c == 0x205F || c == 0x3000;
+}
+
+static unichar GMFoldCharacter(unichar c)
+{
+  if (c < 0x80) {
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+  }
+  NSString *folded = [[NSString stringWithCharacters: &c length: 1] lowercaseString];
+  return [folded length] == 1 ? [folded characterAtIndex: 0] : c;
+}
+
+static NSComparisonResult GMCompareCharacters(const unichar *a, NSUInteger aLength, const unichar *b, NSUInteger bLength)
+{
+  NSUInteger length = MIN(aLength, bLength);
+  for (NSUInteger i = 0; i < length; i++) {
+    if (a[i] != b[i]) {
+      return a[i] < b[i] ? NSOrderedAscending : NSOrderedDescending;
+    }
+  }
+  if (aLength == bLength) {
+    return NSOrderedSame;
+  }
+  return aLength < bLength ? NSOrderedAscending : NSOrderedDescending;
+}
+
+static int GMCompareBigrams(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static int GMCompareScored(const void *a, const void *b)
+{
+  const struct GMScoredCompletion *x = a, *y = b;
+  if (x->score != y->score) {
+    return x->score > y->score ? -1 : 1;
+  }
+  return x->index < y->index ? -1 : (x->index > y->index ? 1 : 0);
+}
+
+// The bigrams of every whitespace separated word, sorted. out needs room for length bigrams.
+static NSUInteger GMCollectBigrams(const unichar *characters, NSUInteger length, uint32_t *out)
+{
+  NSUInteger count = 0;
+  for (NSUInteger i = 1; i < length; i++) {
+    if (!GMIsSpace(characters[i - 1]) && !GMIsSpace(characters[i])) {
+      out[count++] = ((uint32_t)characters[i - 1] << 16) | characters[i];
+    }
+  }
+  qsort(out, count, sizeof(uint32_t), GMCompareBigrams);
+  return count;
+}
+
+// Bottom-up merge sort of item indexes by their strings.
+static void GMSortByString(NSUInteger *indexes, NSUInteger count, const unichar *characters, const NSUInteger *offsets, const NSUInteger *lengths)
+{
+  NSUInteger *scratch = malloc(sizeof(NSUInteger) * MAX(count, 1));
+  NSUInteger *from = indexes, *to = scratch;
+  for (NSUInteger width = 1; width < count; width *= 2) {
+    for (NSUInteger start = 0; start < count; start += 2 * width) {
+      NSUInteger middle = MIN(start + width, count), end = MIN(start + 2 * width, count);
+      NSUInteger i = start, j = middle, k = start;
+      while (i < middle && j < end) {
+        NSUInteger a = from[i], b = from[j];
+        if (GMCompareCharacters(characters + offsets[b], lengths[b], characters + offsets[a], lengths[a]) == NSOrderedAscending) {
+          to[k++] = from[j++];
+        } else {
+          to[k++] = from[i++];
+        }
+      }
+      while (i < middle) to[k++] = from[i++];
+      while (j < end) to[k++] = from[j++];
+    }
+    NSUInteger *swap = from; from = to; to = swap;
+  }
+  if (from != indexes) {
+    memcpy(indexes, from, sizeof(NSUInteger) * count);
+  }
+  free(scratch);
+}
+
+#pragma mark - Scoring
+
+BOOL GMCompletionScore(GMMatchingAlgorithm algorithm,
+                       const unichar *item, const unichar *foldedItem, NSUInteger itemLength,
+                       const uint32_t *itemBigrams, NSUInteger itemBigramCount,
+                       const unichar *filter, const unichar *foldedFilter, NSUInteger filterLength,
+                       const uint32_t *filterBigrams, NSUInteger filterBigramCount,
+                       double *score)
+{
+  *score = 0.0;
+  if (algorithm == GMMatchingDiceCoefficient) {
+    // Both bigram lists are sorted, so their intersection is a merge.
+    NSUInteger i = 0, j = 0, intersection = 0;
+    while (i < itemBigramCount && j < filterBigramCount) {
+      if (itemBigrams[i] == filterBigrams[j]) {
+        intersection++; i++; j++;
+      } else if (itemBigrams[i] < filterBigrams[j]) {
+        i++;
+      } else {
+        j++;
+      }
+    }
+    if (intersection == 0) {
+      return NO;
+    }
+    *score = 2.0 * intersection / (double)(itemBigramCount + filterBigramCount);
+  } else if (algorithm == GMMatchingSubletters) {
+    // The first occurrence of every letter of the filter after the previous one. If that chain can't be completed
+    // from the first occurrence of the first letter, it can't be completed from a later one either.
+    if (filterLength == 0) {
+      return NO;
+    }
+    NSUInteger position = 0, first = 0;
+    for (NSUInteger f = 0; f < filterLength; f++) {
+      while (position < itemLength && foldedItem[position] != foldedFilter[f]) {
+        position++;
+      }
+      if (position == itemLength) {
+        return NO;
+      }
+      if (f == 0) {
+        first = position;
+      }
+      position++;
+    }
+    *score = (double)filterLength / (double)(1 + (position - 1) - first);
+  } else if (algorithm == GMMatchingSubstring) {
+    if (filterLength > itemLength) {
+      return NO;
+    }
+    NSUInteger last = itemLength - filterLength;
+    NSUInteger i;
+    for (i = 0; i <= last; i++) {
+      if (memcmp(item + i, filter, sizeof(unichar) * filterLength) == 0) {
+        break;
+      }
+    }
+    if (i > last) {
+      return NO;
+    }
+    *score = 1.0;
+  } else { // GMMatchingPrefix and GMMatchingPrefixSuffixSorted
+    if (filterLength > itemLength || memcmp(item, filter, sizeof(unichar) * filterLength) != 0) {
+      return NO;
+    }
+    if (algorithm == GMMatchingPrefixSuffixSorted) {
+      *score = MAX(0.0, 1.0 - (double)(itemLength - filterLength) / 100.0);
+    } else {
+      *score = 1.0;
+    }
+  }
+  if (itemLength == filterLength && memcmp(item, filter, sizeof(unichar) * filterLength) == 0) {
+    // Nothing left to complete.
+    *score = 0.0;
+  }
+  return YES;
+}
+
+@implementation GMCompletionIndex
+
+- (id)initWithStrings:(NSArray *)strings
+{
+  self = [super init];
+  if (self) {
+    _count = [strings count];
+    NSUInteger total = 0;
+    for (id string in strings) {
+      if ([string isKindOfClass: [NSString class]]) {
+        total += [string length];
+      }
+    }
+    NSUInteger capacity = MAX(_count, 1);
+    _characters = malloc(sizeof(unichar) * MAX(total, 1));
+    _folded = malloc(sizeof(unichar) * MAX(total, 1));
+    _bigrams = malloc(sizeof(uint32_t) * MAX(total, 1));
+    _offsets = malloc(sizeof(NSUInteger) * capacity);
+    _lengths = malloc(sizeof(NSUInteger) * capacity);
+    _bigramOffsets = malloc(sizeof(NSUInteger) * capacity);
+    _bigramCounts = malloc(sizeof(NSUInteger) * capacity);
+    _sorted = malloc(sizeof(NSUInteger) * capacity);
+    _candidates = malloc(sizeof(NSUInteger) * capacity);
+    _results = malloc(sizeof(NSUInteger) * capacity);
+    _scored = malloc(sizeof(struct GMScoredCompletion) * capacity);
+
+    NSUInteger offset = 0, bigramOffset = 0, i = 0;
+    for (id string in strings) {
+      NSUInteger length = 0;
+      if ([string isKindOfClass: [NSString class]]) {
+        length = [string length];
+        [string getCharacters: _characters + offset range: NSMakeRange(0, length)];
+      }
+      for (NSUInteger c = 0; c < length; c++) {
+        _folded[offset + c] = GMFoldCharacter(_characters[offset + c]);
+      }
+      _offsets[i] = offset;
+      _lengths[i] = length;
+      _bigramOffsets[i] = bigramOffset;
+      _bigramCounts[i] = GMCollectBigrams(_characters + offset, length, _bigrams + bigramOffset);
+      _sorted[i] = i;
+      offset += length;
+      bigramOffset += _bigramCounts[i];
+      i++;
+    }
+    GMSortByString(_sorted, _count, _characters, _offsets, _lengths);
+  }
+  return self;
+}
+
+- (void)dealloc
+{
+  free(_characters);
+  free(_folded);
+  free(_bigrams);
+  free(_offsets);
+  free(_lengths);
+  free(_bigramOffsets);
+  free(_bigramCounts);
+  free(_sorted);
+  free(_candidates);
+  free(_results);
+  free(_scored);
+  free(_filter);
+}
+
+- (NSUInteger)count
+{
+  return _count;
+}
+
+- (const NSUInteger *)results
+{
+  return _results;
+}
+
+#pragma mark - Matching
+
+// The filter and its case folded copy, one after the other.
+static unichar *GMCopyFilter(NSString *filter, NSUInteger length)
+{
+  unichar *characters = malloc(sizeof(unichar) * MAX(2 * length, 1));
+  [filter getCharacters: characters range: NSMakeRange(0, length)];
+  for (NSUInteger i = 0; i < length; i++) {
+    characters[length + i] = GMFoldCharacter(characters[i]);
+  }
+  return characters;
+}
+
+- (BOOL)scoreItemAtIndex: (NSUInteger)index filter: (const unichar *)filter length: (NSUInteger)length bigrams: (const uint32_t *)bigrams count: (NSUInteger)bigramCount algorithm: (GMMatchingAlgorithm)algorithm score: (double *)score
+{
+  return GMCompletionScore(algorithm,
+                           _characters + _offsets[index], _folded + _offsets[index], _lengths[index],
+                           _bigrams + _bigramOffsets[index], _bigramCounts[index],
+                           filter, filter + length, length, bigrams, bigramCount, score);
+}
+
+- (double)scoreOfItemAtIndex:(NSUInteger)index forFilter:(NSString *)filter algorithm:(GMMatchingAlgorithm)algorithm
+{
+  NSUInteger length = [filter length];
+  unichar *characters = GMCopyFilter(filter, length);
+  uint32_t *bigrams = malloc(sizeof(uint32_t) * MAX(length, 1));
+  NSUInteger bigramCount = GMCollectBigrams(characters, length, bigrams);
+  double score;
+  [self scoreItemAtIndex: index filter: characters length: length bigrams: bigrams count: bigramCount algorithm: algorithm score: &score];
+  free(bigrams);
+  free(characters);
+  return score;
+}
+
+// The range of _sorted holding the items that start with the filter.
+- (NSRange)sortedRangeWithPrefix: (const unichar *)filter length: (NSUInteger)length
+{
+  NSUInteger low = 0, high = _count;
+  while (low < high) {
+    NSUInteger middle = low + (high - low) / 2, item = _sorted[middle];
+    if (GMCompareCharacters(_characters + _offsets[item], _lengths[item], filter, length) == NSOrderedAscending) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  NSUInteger start = low;
+  high = _count;
+  while (low < high) {
+    NSUInteger middle = low + (high - low) / 2, item = _sorted[middle];
+    if (_lengths[item] >= length && memcmp(_characters + _offsets[item], filter, sizeof(unichar) * length) == 0) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return NSMakeRange(start, low - start);
+}
+
+- (NSUInteger)matchFilter:(NSString *)filter algorithm:(GMMatchingAlgorithm)algorithm
+{
+  NSUInteger length = [filter length];
+  unichar *characters = GMCopyFilter(filter, length);
+  uint32_t *bigrams = malloc(sizeof(uint32_t) * MAX(length, 1));
+  NSUInteger bigramCount = GMCollectBigrams(characters, length, bigrams);
+
+  // Typing more of the same filter can only drop items, except for the Dice coefficient, which doesn't require the
+  // whole filter to match.
+  BOOL narrowing = _hasFilter && _filterLength > 0 && algorithm == _algorithm && algorithm != GMMatchingDiceCoefficient &&
+    length >= _filterLength && memcmp(characters, _filter, sizeof(unichar) * _filterLength) == 0;
+
+  const NSUInteger *source;
+  NSUInteger sourceCount;
+  if (narrowing) {
+    source = _candidates;
+    sourceCount = _candidateCount;
+  } else if ((algorithm == GMMatchingPrefix || algorithm == GMMatchingPrefixSuffixSorted) && length > 0) {
+    NSRange range = [self sortedRangeWithPrefix: characters length: length];
+    source = _sorted + range.location;
+    sourceCount = range.length;
+  } else {
+    source = NULL;
+    sourceCount = _count;
+  }
+
+  // Candidates are rewritten in place, which is safe since no more are written than have been read.
+  NSUInteger candidateCount = 0, resultCount = 0;
+  for (NSUInteger i = 0; i < sourceCount; i++) {
+    NSUInteger index = source ? source[i] : i;
+    double score;
+    if ([self scoreItemAtIndex: index filter: characters length: length bigrams: bigrams count: bigramCount algorithm: algorithm score: &score]) {
+      _candidates[candidateCount++] = index;
+      if (score > GMCompletionMinimumScore) {
+        _scored[resultCount].score = score;
+        _scored[resultCount].index = index;
+        resultCount++;
+      }
+    }
+  }
+  qsort(_scored, resultCount, sizeof(struct GMScoredCompletion), GMCompareScored);
+  for (NSUInteger i = 0; i < resultCount; i++) {
+    _results[i] = _scored[i].index;
+  }
+
+  free(bigrams);
+  free(_filter);
+  _filter = characters;
+  _filterLength = length;
+  _algorithm = algorithm;
+  _hasFilter = YES;
+  _candidateCount = candidateCount;
+  return resultCount;
+}
+
+@end
@@ -0,0 +1,190 @@
+//
+//  GMGrammar.h
+//  Code Editor
+//
+//  Created by Jakub Hampl on 17.10.26.
+//  Copyright (c) 2026 Jakub Hampl. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class GMOrderedDictionary;
+
+enum {
+  GMTokenTypeNone = UINT32_MAX
+};
+
+enum {
+  GMDefaultPredictiveWindow = 64
+};
+
+typedef enum {
+  GMRuleLookbehind = 1 << 0,
+  GMRuleStartSensitive = 1 << 1,
+  GMRuleEndSensitive = 1 << 2
+} GMRuleFlags;
+
+/**
+ GMGrammar is the compiled form of the `grammar` of a [language](GMLanguage).
+
+ The ordered dictionary of rules is flattened into a table indexed by rule number, nested (`inside`) grammars are
+ compiled along with their parent, and each pattern is analysed for whether its matches depend on where the text
+ it is matched against starts or ends (anchors, word boundaries and lookaround do). Patterns that don't can have
+ their matches reused for any part of a previously searched range, which is what lets GMSyntaxHighlighter go over
+ the text in a single pass.
+ 
+ Token type names are interned to small integers (type IDs) shared by a grammar and all the grammars nested in it,
+ which is what a GMTokenBuffer stores instead of strings.
+
+ GMLanguage compiles the grammar when a language is loaded, so you only need this class if you build language
+ dictionaries by hand.
+ */
+@interface GMGrammar : NSObject
+{
+@private
+  NSMutableArray *_names;
+  NSMutableArray *_sources;
+  NSMutableArray *_insides;
+  NSMutableArray *_typeNames;
+  NSMutableDictionary *_typeIDs;
+  struct GMGrammarRule *_rules;
+  NSUInteger _capacity;
+  GMOrderedDictionary *_predictives;
+  NSMutableDictionary *_predictiveWindows;
+}
+
+/**
+ Compiles a grammar.
+ @param grammar An ordered dictionary of rules, as produced by [GMLanguage languageWithDictionary:].
+ @return A compiled grammar.
+ */
++ (GMGrammar *)grammarWithDictionary: (NSDictionary *)grammar;
+- (id)initWithDictionary: (NSDictionary *)grammar;
+/**
+ Compiles a grammar as it is stored in a language plist, before [GMLanguage languageWithDictionary:] processes it.
+
+ Every pattern is checked (which compiles it) right away, so a grammar that is created can't fail while tokenizing.
+ @param grammar An array of single entry dictionaries of token types to `/pattern/flags` strings or rule dictionaries.
+ @param error Set to the reason if a pattern isn't a valid regular expression.
+ @return The grammar, or nil if a pattern isn't valid.
+ */
+- (id)initWithSourceGrammar: (NSArray *)grammar error: (NSError **)error;
+/**
+ Creates an empty grammar to add rules to with addRuleWithName:patternSource:options:flags:inside:predictive:.
+ @param typeNames The interned token type names, indexed by type ID. Rule names that aren't among them are added.
+ Grammars nested in this one have to be created with nestedGrammar.
+ */
+- (id)initWithTypeNames: (NSArray *)typeNames;
+/**
+ An empty grammar that shares the type IDs of this one, to be used as the `inside` grammar of one of its rules.
+ */
+- (GMGrammar *)nestedGrammar;
+/**
+ A copy of a grammar, typically that of another language, that shares the type IDs of this one so it can be used as
+ the `inside` grammar of one of its rules. Patterns the grammar has already compiled are shared with it.
+ */
+- (GMGrammar *)nestedGrammarWithGrammar: (GMGrammar *)grammar;
+/**
+ The grammar of a language from the [shared registry](GMRegistry), nested with nestedGrammarWithGrammar:.
+ 
+ This is what a rule with a `language` entry instead of `inside` (like `{"pattern": …, "language": "css"}` for the
+ contents of an HTML `<style>` element) is compiled to. A language that is nested in itself, directly or not, doesn't
+ get nested the second time around.
+ @return The nested grammar, or nil if there is no such language.
+ */
+- (GMGrammar *)nestedGrammarWithLanguageNamed: (NSString *)name;
+/**
+ Adds a rule whose regular expression is only compiled when it is first needed.
+ 
+ This is how GMCompiledLanguage builds grammars, so that loading a language doesn't compile patterns that the text
+ never gets to. The source has to be a valid pattern, checked beforehand (GMCompiledLanguage checks the patterns of
+ a language when compiling it); one that doesn't compile after all is logged and the rule never matches.
+ @param name The token type the rule produces.
+ @param source The regular expression pattern, or nil for a rule that never matches.
+ @param options The options to compile the pattern with.
+ @param flags The rule's flags, including the bounds sensitivity of the pattern.
+ @param inside The grammar to tokenize the rule's tokens with, or nil.
+ @param predictive The rule's predictive pattern, or nil.
+ */
+- (void)addRuleWithName: (NSString *)name patternSource: (NSString *)source options: (NSRegularExpressionOptions)options flags: (GMRuleFlags)flags inside: (GMGrammar *)inside predictive: (NSRegularExpression *)predictive;
+
+/**
+ The number of rules, in order of precedence.
+ */
+- (NSUInteger)ruleCount;
+/**
+ The token type a rule produces.
+ */
+- (NSString *)nameOfRule: (NSUInteger)rule;
+/**
+ The regular expression of a rule, or nil if it has none. It is compiled on first use if it hasn't been yet.
+ */
+- (NSRegularExpression *)patternOfRule: (NSUInteger)rule;
+/**
+ The regular expression pattern of a rule, or nil if it has none. Unlike patternOfRule:, this doesn't compile it.
+ */
+- (NSString *)patternSourceOfRule: (NSUInteger)rule;
+/**
+ The grammar tokens of this rule are further tokenized with, or nil.
+ */
+- (GMGrammar *)insideOfRule: (NSUInteger)rule;
+- (GMRuleFlags)flagsOfRule: (NSUInteger)rule;
+/**
+ The type ID of the tokens a rule produces.
+ */
+- (uint32_t)typeIDOfRule: (NSUInteger)rule;
+/**
+ The interned token type names, indexed by type ID.
+ */
+- (NSArray *)typeNames;
+/**
+ The type ID of a token type name, or `GMTokenTypeNone` if no rule of the language produces it.
+ */
+- (uint32_t)typeIDForName: (NSString *)name;
+/**
+ The `predictive` patterns of the rules that have them, keyed by token type.
+ */
+- (GMOrderedDictionary *)predictives;
+/**
+ How many of the preceding tokens a `predictive` pattern gets to see.
+ 
+ A predictive pattern is matched against the token types that precede a stretch of plain text (written as
+ `<type>`, with the plain text between them) followed by that text. Only the last few tokens are included, so that
+ the cost doesn't grow with the length of the text. Rules set this with a `predictive_window` entry; the default
+ is `GMDefaultPredictiveWindow`.
+ @param name The token type of the rule.
+ */
+- (NSUInteger)predictiveWindowForName: (NSString *)name;
+/**
+ Sets the predictiveWindowForName: of a rule.
+ */
+- (void)setPredictiveWindow: (NSUInteger)window forName: (NSString *)name;
+/**
+ The grammar in the form of the `grammar` entry of a language dictionary: an ordered dictionary of token types to
+ regular expressions, or to dictionaries with a `pattern` and the rule's options. Compiles all patterns.
+ */
+- (GMOrderedDictionary *)ruleDictionary;
+/**
+ A hash of everything about the grammar that decides how it tokenizes: the type names in order of type ID and the
+ name, pattern, options, flags, predictive pattern and nested grammar of every rule. Two grammars with the same
+ fingerprint produce the same token records. Doesn't compile any patterns.
+ */
+- (uint64_t)fingerprint;
+
+@end
+
+/**
+ Works out whether matches of a regular expression pattern depend on the bounds of the range it's matched in.
+
+ The result is conservative: anything the function doesn't understand counts as sensitive to both bounds.
+ @return A combination of `GMRuleStartSensitive` and `GMRuleEndSensitive`.
+ */
+extern GMRuleFlags GMBoundsSensitivityOfPattern(NSString *pattern);
+
+/**
+ Works out whether a regular expression pattern repeats something that is itself quantified, like `(a+)+` or
+ `(\\?.)*`. Such patterns can take exponential time to fail on text they almost match.
+
+ Like GMBoundsSensitivityOfPattern(), this is only a rough look at the pattern, not a full parse.
+ */
+extern BOOL GMPatternHasNestedQuantifiers(NSString *pattern);
@@ -0,0 +1,542 @@
+//
+//  GMGrammar.m
+//  Code Editor
+//
+//  Created by Jakub Hampl on 17.10.26.
+//  Copyright (c) 2026 Jakub Hampl. All rights reserved.
+//
+
+#import "GMGrammar.h"
+#import "GMLanguage.h"
+#import "GMRegistry.h"
+#import "GMCompiledLanguage.h"
+
+GMRuleFlags GMBoundsSensitivityOfPattern(NSString *pattern)
+{
+  GMRuleFlags flags = 0;
+  NSUInteger length = [pattern length];
+  NSUInteger classDepth = 0;
+  for (NSUInteger i = 0; i < length; i++) {
+    unichar c = [pattern characterAtIndex: i];
+    if (c == '\\') {
+      if (++i >= length) {
+        break;
+      }
+      unichar escaped = [pattern characterAtIndex: i];
+      if (classDepth == 0) {
+        if (escaped == 'b' || escaped == 'B') {
+          flags |= GMRuleStartSensitive | GMRuleEndSensitive;
+        } else if (escaped == 'A' || escaped == 'G') {
+          flags |= GMRuleStartSensitive;
+        } else if (escaped == 'Z' || escaped == 'z') {
+          flags |= GMRuleEndSensitive;
+        }
+      }
+    } else if (c == '[') {
+      classDepth++;
+      // A ']' right at the start of a class is a literal.
+      if (i + 1 < length && [pattern characterAtIndex: i + 1] == '^') i++;
+      if (i + 1 < length && [pattern characterAtIndex: i + 1] == ']') i++;
+    } else if (c == ']' && classDepth > 0) {
+      classDepth--;
+    } else if (classDepth > 0) {
+      continue;
+    } else if (c == '^') {
+      flags |= GMRuleStartSensitive;
+    } else if (c == '$') {
+      flags |= GMRuleEndSensitive;
+    } else if (c == '(' && i + 2 < length && [pattern characterAtIndex: i + 1] == '?') {
+      unichar kind = [pattern characterAtIndex: i + 2];
+      if (kind == '=' || kind == '!') {
+        flags |= GMRuleEndSensitive;
+      } else if (kind == '<' && i + 3 < length && ([pattern characterAtIndex: i + 3] == '=' || [pattern characterAtIndex: i + 3] == '!')) {
+        flags |= GMRuleStartSensitive;
+      } else if (kind != ':' && kind != '<' && kind != '#') {
+        // Inline flags, atomic groups and the like. Not worth the trouble.
+        flags |= GMRuleStartSensitive | GMRuleEndSensitive;
+      }
+    }
+  }
+  if (classDepth > 0) {
+    flags |= GMRuleStartSensitive | GMRuleEndSensitive;
+  }
+  return flags;
+}
+
+// Reads the quantifier at i, if there is one, returning its length and whether it allows more than one repetition.
+static NSUInteger GMQuantifierAtIndex(NSString *pattern, NSUInteger i, BOOL *repeats)
+{
+  NSUInteger length = [pattern length];
+  if (i >= length) {
+    return 0;
+  }
+  unichar c = [pattern characterAtIndex: i];
+  if (c == '*' || c == '+' || c == '?') {
+    *repeats = c != '?';
+    return 1;
+  }
+  if (c != '{') {
+    return 0;
+  }
+  NSUInteger j = i + 1, minimum = 0, maximum = 0;
+  BOOL comma = NO, hasMaximum = NO;
+  for (; j < length; j++) {
+    unichar d = [pattern characterAtIndex: j];
+    if (d >= '0' && d <= '9') {
+      if (comma) {
+        maximum = maximum * 10 + (d - '0');
+        hasMaximum = YES;
+      } else {
+        minimum = minimum * 10 + (d - '0');
+      }
+    } else if (d == ',' && !comma && j > i + 1) {
+      comma = YES;
+    } else {
+      break;
+    }
+  }
+  if (j == i + 1 || j >= length || [pattern characterAtIndex: j] != '}') {
+    // Not a quantifier, just a brace.
+    return 0;
+  }
+  *repeats = comma ? (!hasMaximum || maximum > 1) : minimum > 1;
+  return j + 1 - i;
+}
+
+BOOL GMPatternHasNestedQuantifiers(NSString *pattern)
+{
+  NSUInteger length = [pattern length];
+  NSUInteger classDepth = 0;
+  // Whether each open group contains a quantifier so far.
+  NSMutableData *groups = [NSMutableData dataWithLength: sizeof(BOOL)];
+  for (NSUInteger i = 0; i < length; i++) {
+    unichar c = [pattern characterAtIndex: i];
+    BOOL *quantified = (BOOL *)[groups mutableBytes] + [groups length] / sizeof(BOOL) - 1;
+    BOOL repeats = NO, innerQuantified = NO;
+    if (c == '\\') {
+      if (++i >= length || classDepth > 0) {
+        continue;
+      }
+    } else if (c == '[') {
+      classDepth++;
+      if (i + 1 < length && [pattern characterAtIndex: i + 1] == '^') i++;
+      if (i + 1 < length && [pattern characterAtIndex: i + 1] == ']') i++;
+      continue;
+    } else if (c == ']' && classDepth > 0) {
+      // A whole class is a single atom.
+      if (--classDepth > 0) {
+        continue;
+      }
+    } else if (classDepth > 0) {
+      continue;
+    } else if (c == '(') {
+      BOOL open = NO;
+      [groups appendBytes: &open length: sizeof(BOOL)];
+      continue;
+    } else if (c == ')' && [groups length] > sizeof(BOOL)) {
+      innerQuantified = *quantified;
+      [groups setLength: [groups length] - sizeof(BOOL)];
+      quantified = (BOOL *)[groups mutableBytes] + [groups length] / sizeof(BOOL) - 1;
+      *quantified = *quantified || innerQuantified;
+    } else if (GMQuantifierAtIndex(pattern, i, &repeats)) {
+      // A quantifier with nothing to repeat, which the pattern compiler rejects anyway.
+      continue;
+    }
+    NSUInteger quantifierLength = GMQuantifierAtIndex(pattern, i + 1, &repeats);
+    if (quantifierLength == 0) {
+      continue;
+    }
+    if (innerQuantified && repeats) {
+      return YES;
+    }
+    *quantified = YES;
+    i += quantifierLength;
+    // A lazy or possessive modifier.
+    if (i + 1 < length && ([pattern characterAtIndex: i + 1] == '?' || [pattern characterAtIndex: i + 1] == '+')) {
+      i++;
+    }
+  }
+  return NO;
+}
+
+static void GMHashAppend(uint64_t *hash, const void *bytes, NSUInteger length)
+{
+  const uint8_t *b = bytes;
+  for (NSUInteger i = 0; i < length; i++) {
+    *hash ^= b[i];
+    *hash *= 1099511628211ULL;
+  }
+}
+
+static void GMHashAppendString(uint64_t *hash, NSString *string)
+{
+  const char *utf8 = [string UTF8String] ?: "";
+  // Including the terminator keeps "ab" + "c" apart from "a" + "bc".
+  GMHashAppend(hash, utf8, strlen(utf8) + 1);
+}
+
+struct GMGrammarRule {
+  uint32_t type;
+  GMRuleFlags flags;
+  NSRegularExpressionOptions options;
+  // A retained NSRegularExpression, or NULL until it is compiled.
+  void *pattern;
+};
+
+@implementation GMGrammar
+
++ (GMGrammar *)grammarWithDictionary:(NSDictionary *)grammar
+{
+  return [[self alloc] initWithDictionary: grammar];
+}
+
+- (id)initWithDictionary:(NSDictionary *)grammar
+{
+  return [self initWithDictionary: grammar typeNames: [NSMutableArray array] typeIDs: [NSMutableDictionary dictionary]];
+}
+
+- (id)initWithTypeNames: (NSMutableArray *)typeNames typeIDs: (NSMutableDictionary *)typeIDs
+{
+  if (self = [super init]) {
+    _names = [NSMutableArray array];
+    _sources = [NSMutableArray array];
+    _insides = [NSMutableArray array];
+    _typeNames = typeNames;
+    _typeIDs = typeIDs;
+    _predictives = [GMOrderedDictionary dictionary];
+    _predictiveWindows = [NSMutableDictionary dictionary];
+  }
+  return self;
+}
+
+- (id)initWithTypeNames:(NSArray *)typeNames
+{
+  NSMutableDictionary *typeIDs = [NSMutableDictionary dictionaryWithCapacity: [typeNames count]];
+  for (NSUInteger i = 0; i < [typeNames count]; i++) {
+    [typeIDs setObject: @(i) forKey: typeNames[i]];
+  }
+  return [self initWithTypeNames: [typeNames mutableCopy] typeIDs: typeIDs];
+}
+
+// Nested grammars share the type ID table of the grammar they are nested in.
+- (id)initWithDictionary: (NSDictionary *)grammar typeNames: (NSMutableArray *)typeNames typeIDs: (NSMutableDictionary *)typeIDs
+{
+  if (self = [self initWithTypeNames: typeNames typeIDs: typeIDs]) {
+    for (NSString *token in grammar) {
+      id val = grammar[token];
+      NSRegularExpression *pattern, *predictive;
+      GMRuleFlags flags = 0;
+      GMGrammar *inside;
+      if ([val isKindOfClass: [NSDictionary class]]) {
+        pattern = val[@"pattern"];
+        if ([val[@"lookbehind"] boolValue]) {
+          flags |= GMRuleLookbehind;
+        }
+        if (val[@"inside"]) {
+          inside = [[GMGrammar alloc] initWithDictionary: val[@"inside"] typeNames: typeNames typeIDs: typeIDs];
+        } else if (val[@"language"]) {
+          inside = [self nestedGrammarWithLanguageNamed: val[@"language"]];
+        }
+        predictive = val[@"predictive"];
+      } else if ([val isKindOfClass: [NSRegularExpression class]]) {
+        pattern = val;
+      }
+      if (pattern) {
+        flags |= GMBoundsSensitivityOfPattern([pattern pattern]);
+      }
+      [self addRuleWithName: token patternSource: [pattern pattern] options: [pattern options] flags: flags inside: inside predictive: predictive];
+      if ([val isKindOfClass: [NSDictionary class]] && val[@"predictive_window"]) {
+        [self setPredictiveWindow: [val[@"predictive_window"] unsignedIntegerValue] forName: token];
+      }
+      if (pattern) {
+        _rules[[self ruleCount] - 1].pattern = (__bridge_retained void *)pattern;
+      }
+    }
+  }
+  return self;
+}
+
+- (id)initWithSourceGrammar:(NSArray *)grammar error:(NSError **)error
+{
+  return [self initWithSourceGrammar: grammar typeNames: [NSMutableArray array] typeIDs: [NSMutableDictionary dictionary] error: error];
+}
+
+// Compiles a `/pattern/flags` string, which is how it is checked.
+static NSRegularExpression *GMRegularExpressionOfSource(id source, NSError **error)
+{
+  if (![source isKindOfClass: [NSString class]]) {
+    if (error) *error = [NSError errorWithDomain: GMCompiledLanguageErrorDomain code: GMCompiledLanguageInvalidGrammarError
+                                        userInfo: @{NSLocalizedDescriptionKey: [NSString stringWithFormat: @"%@ is not a regular expression.", source]}];
+    return nil;
+  }
+  NSRegularExpressionOptions options;
+  NSString *pattern = [GMLanguage patternOfRegularExpressionString: source options: &options];
+  return [NSRegularExpression regularExpressionWithPattern: pattern options: options error: error];
+}
+
+- (id)initWithSourceGrammar: (NSArray *)grammar typeNames: (NSMutableArray *)typeNames typeIDs: (NSMutableDictionary *)typeIDs error: (NSError **)error
+{
+  if (self = [self initWithTypeNames: typeNames typeIDs: typeIDs]) {
+    for (NSDictionary *entry in grammar) {
+      for (NSString *token in entry) {
+        id val = entry[token];
+        id source;
+        NSRegularExpression *pattern, *predictive;
+        GMGrammar *inside;
+        GMRuleFlags flags = 0;
+        if ([val isKindOfClass: [NSDictionary class]]) {
+          source = val[@"pattern"];
+          if ([val[@"lookbehind"] boolValue]) {
+            flags |= GMRuleLookbehind;
+          }
+          if (val[@"inside"]) {
+            inside = [[GMGrammar alloc] initWithSourceGrammar: val[@"inside"] typeNames: typeNames typeIDs: typeIDs error: error];
+            if (!inside) {
+              return nil;
+            }
+          } else if (val[@"language"]) {
+            inside = [self nestedGrammarWithLanguageNamed: val[@"language"]];
+          }
+          if (val[@"predictive"] && !(predictive = GMRegularExpressionOfSource(val[@"predictive"], error))) {
+            return nil;
+          }
+        } else {
+          source = val;
+        }
+        // Every pattern is checked here, on the thread loading the language, rather than failing while tokenizing on
+        // whatever thread that happens on. Checking it compiles it, so the result is kept.
+        if (source && !(pattern = GMRegularExpressionOfSource(source, error))) {
+          return nil;
+        }
+        if (pattern) {
+          flags |= GMBoundsSensitivityOfPattern([pattern pattern]);
+        }
+        [self addRuleWithName: token patternSource: [pattern pattern] options: [pattern options] flags: flags inside: inside predictive: predictive];
+        if ([val isKindOfClass: [NSDictionary class]] && val[@"predictive_window"]) {
+          [self setPredictiveWindow: [val[@"predictive_window"] unsignedIntegerValue] forName: token];
+        }
+        if (pattern) {
+          _rules[[self ruleCount] - 1].pattern = (__bridge_retained void *)pattern;
+        }
+      }
+    }
+  }
+  return self;
+}
+
+- (void)dealloc
+{
+  for (NSUInteger i = 0; i < [self ruleCount]; i++) {
+    if (_rules[i].pattern) {
+      (void)(__bridge_transfer NSRegularExpression *)_rules[i].pattern;
+    }
+  }
+  free(_rules);
+}
+
+- (void)addRuleWithName:(NSString *)name patternSource:(NSString *)source options:(NSRegularExpressionOptions)options flags:(GMRuleFlags)flags inside:(GMGrammar *)inside predictive:(NSRegularExpression *)predictive
+{
+  NSUInteger count = [self ruleCount];
+  if (count == _capacity) {
+    _capacity = _capacity ? _capacity * 2 : 16;
+    _rules = realloc(_rules, _capacity * sizeof(struct GMGrammarRule));
+  }
+  if (!_typeIDs[name]) {
+    [_typeIDs setObject: @([_typeNames count]) forKey: name];
+    [_typeNames addObject: name];
+  }
+  _rules[count] = (struct GMGrammarRule){[_typeIDs[name] unsignedIntValue], flags, options, NULL};
+  [_names addObject: name];
+  [_sources addObject: source ?: [NSNull null]];
+  [_insides addObject: inside ?: [NSNull null]];
+  if (predictive) {
+    [_predictives setValue: predictive forKey: name];
+  }
+}
+
+- (GMGrammar *)nestedGrammar
+{
+  return [[GMGrammar alloc] initWithTypeNames: _typeNames typeIDs: _typeIDs];
+}
+
+- (GMGrammar *)nestedGrammarWithGrammar:(GMGrammar *)grammar
+{
+  GMGrammar *copy = [self nestedGrammar];
+  for (NSUInteger i = 0; i < [grammar ruleCount]; i++) {
+    NSString *name = grammar->_names[i];
+    GMGrammar *inside = [grammar insideOfRule: i];
+    NSString *source = grammar->_sources[i];
+    [copy addRuleWithName: name
+            patternSource: source == (id)[NSNull null] ? nil : source
+                  options: grammar->_rules[i].options
+                    flags: grammar->_rules[i].flags
+                   inside: inside ? [self nestedGrammarWithGrammar: inside] : nil
+               predictive: grammar->_predictives[name]];
+    if (grammar->_predictiveWindows[name]) {
+      [copy setPredictiveWindow: [grammar predictiveWindowForName: name] forName: name];
+    }
+    // No need to compile a pattern twice.
+    if (grammar->_rules[i].pattern) {
+      copy->_rules[i].pattern = (__bridge_retained void *)(__bridge NSRegularExpression *)grammar->_rules[i].pattern;
+    }
+  }
+  return copy;
+}
+
+- (GMGrammar *)nestedGrammarWithLanguageNamed:(NSString *)name
+{
+  GMGrammar *grammar = [[GMRegistry sharedRegistry] languageNamed: name][@"compiled_grammar"];
+  if (!grammar) {
+    NSLog(@"WARNING: Language %@ can't be nested, it doesn't exist or is being loaded.", name);
+    return nil;
+  }
+  return [self nestedGrammarWithGrammar: grammar];
+}
+
+- (NSUInteger)ruleCount
+{
+  return [_names count];
+}
+
+- (NSString *)nameOfRule:(NSUInteger)rule
+{
+  return _names[rule];
+}
+
+- (NSRegularExpression *)patternOfRule:(NSUInteger)rule
+{
+  void *pattern = _rules[rule].pattern;
+  if (!pattern) {
+    NSString *source = _sources[rule];
+    if (source == (id)[NSNull null]) {
+      return nil;
+    }
+    // Rules may be asked for from several threads at once (see GMSyntaxHighlighter's tokenizesConcurrently).
+    @synchronized (self) {
+      pattern = _rules[rule].pattern;
+      if (!pattern) {
+        // Sources are checked before they get here (by initWithSourceGrammar:error: or by GMCompiledLanguage), so this
+        // doesn't fail. Should it anyway, the rule doesn't match rather than raising on a tokenizing thread.
+        NSError *err;
+        NSRegularExpression *compiled = [NSRegularExpression regularExpressionWithPattern: source options: _rules[rule].options error: &err];
+        if (!compiled) {
+          NSLog(@"WARNING: Pattern %@ of rule %@ doesn't compile: %@", source, _names[rule], err);
+          return nil;
+        }
+        pattern = (__bridge_retained void *)compiled;
+        __sync_synchronize();
+        _rules[rule].pattern = pattern;
+      }
+    }
+  }
+  return (__bridge NSRegularExpression *)pattern;
+}
+
+- (NSString *)patternSourceOfRule:(NSUInteger)rule
+{
+  NSString *source = _sources[rule];
+  return source == (id)[NSNull null] ? nil : source;
+}
+
+- (GMGrammar *)insideOfRule:(NSUInteger)rule
+{
+  id inside = _insides[rule];
+  return inside == [NSNull null] ? nil : inside;
+}
+
+- (GMRuleFlags)flagsOfRule:(NSUInteger)rule
+{
+  return _rules[rule].flags;
+}
+
+- (uint32_t)typeIDOfRule:(NSUInteger)rule
+{
+  return _rules[rule].type;
+}
+
+- (NSArray *)typeNames
+{
+  return _typeNames;
+}
+
+- (uint32_t)typeIDForName:(NSString *)name
+{
+  NSNumber *typeID = _typeIDs[name];
+  return typeID ? [typeID unsignedIntValue] : GMTokenTypeNone;
+}
+
+- (GMOrderedDictionary *)predictives
+{
+  return _predictives;
+}
+
+- (NSUInteger)predictiveWindowForName:(NSString *)name
+{
+  NSNumber *window = _predictiveWindows[name];
+  return window ? [window unsignedIntegerValue] : GMDefaultPredictiveWindow;
+}
+
+- (void)setPredictiveWindow:(NSUInteger)window forName:(NSString *)name
+{
+  [_predictiveWindows setObject: @(window) forKey: name];
+}
+
+- (GMOrderedDictionary *)ruleDictionary
+{
+  GMOrderedDictionary *grammar = [GMOrderedDictionary dictionary];
+  for (NSUInteger i = 0; i < [self ruleCount]; i++) {
+    NSString *name = _names[i];
+    NSRegularExpression *pattern = [self patternOfRule: i];
+    GMGrammar *inside = [self insideOfRule: i];
+    if (inside || _predictives[name] || (_rules[i].flags & GMRuleLookbehind) || !pattern) {
+      NSMutableDictionary *rule = [NSMutableDictionary dictionary];
+      [rule setValue: pattern forKey: @"pattern"];
+      [rule setValue: [inside ruleDictionary] forKey: @"inside"];
+      [rule setValue: _predictives[name] forKey: @"predictive"];
+      [rule setValue: _predictiveWindows[name] forKey: @"predictive_window"];
+      if (_rules[i].flags & GMRuleLookbehind) {
+        [rule setObject: @YES forKey: @"lookbehind"];
+      }
+      [grammar setObject: rule forKey: name];
+    } else {
+      [grammar setObject: pattern forKey: name];
+    }
+  }
+  return grammar;
+}
+
+- (uint64_t)fingerprint
+{
+  uint64_t hash = 14695981039346656037ULL;
+  for (NSString *name in _typeNames) {
+    GMHashAppendString(&hash, name);
+  }
+  [self appendRulesToHash: &hash];
+  return hash;
+}
+
+- (void)appendRulesToHash: (uint64_t *)hash
+{
+  uint64_t count = [self ruleCount];
+  GMHashAppend(hash, &count, sizeof(count));
+  for (NSUInteger i = 0; i < count; i++) {
+    NSString *name = _names[i];
+    NSString *source = _sources[i];
+    GMHashAppendString(hash, name);
+    GMHashAppendString(hash, source == (id)[NSNull null] ? nil : source);
+    uint64_t values[4] = {_rules[i].options, _rules[i].flags, [_predictives[name] options], [self predictiveWindowForName: name]};
+    GMHashAppend(hash, values, sizeof(values));
+    GMHashAppendString(hash, [_predictives[name] pattern]);
+    GMGrammar *inside = [self insideOfRule: i];
+    uint8_t hasInside = inside != nil;
+    GMHashAppend(hash, &hasInside, sizeof(hasInside));
+    [inside appendRulesToHash: hash];
+  }
+}
+
+- (NSString *)description
+{
+  return [NSString stringWithFormat: @"<GMGrammar: %@>", [_names componentsJoinedByString: @", "]];
+}
+
+@end
@@ -0,0 +1,220 @@
+//
+//  GMInstrumentation.h
+//  Code Editor
+//
+//  Created by Jakub Hampl on 17.10.26.
+//  Copyright (c) 2026 Jakub Hampl. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class GMInstrumentation;
+
+/** The parts of highlighting and completion that are timed. */
+typedef enum {
+  /** Reading and compiling a language, in GMLanguage and GMRegistry. */
+  GMInstrumentationPhaseLanguageLoading = 0,
+  /** Tokenizing a text or a part of it, in GMSyntaxHighlighter. */
+  GMInstrumentationPhaseTokenizing,
+  /** Turning tokens into an attributed string with a theme, as in [GMTheme formatString:forToken:]. */
+  GMInstrumentationPhaseFormatting,
+  /** Updating the bracket, token and symbol indexes of a GMCodeEditor with a token buffer. */
+  GMInstrumentationPhaseIndexing,
+  /** Setting the attributes of a token buffer on the text storage of a GMCodeEditor. */
+  GMInstrumentationPhaseApplyingAttributes,
+  /** [GMAutoCompleteTextView filterAutoCompletionList:]. */
+  GMInstrumentationPhaseFilteringCompletions,
+  GMInstrumentationPhaseCount
+} GMInstrumentationPhase;
+
+/** The key of the name of a phase, or of the language of a rule, in the dictionaryRepresentation. */
+extern NSString * const GMInstrumentationNameKey;
+/** The key of the name of a rule in the rules of the dictionaryRepresentation. */
+extern NSString * const GMInstrumentationRuleKey;
+/** The key of how many times a phase was timed, or how many searches a rule was timed in. */
+extern NSString * const GMInstrumentationCountKey;
+/** The key of the tokens a rule matched. */
+extern NSString * const GMInstrumentationMatchesKey;
+/** The key of the time spent altogether, in seconds. */
+extern NSString * const GMInstrumentationSecondsKey;
+
+/**
+ Whether instrumentation is on. This is what the instrumented code checks before taking any measurement, so that
+ with instrumentation off it costs a load and a branch. Read it, but change it through
+ [GMInstrumentation setEnabled:].
+ */
+extern BOOL GMInstrumentationEnabled;
+
+/** When a phase started, as returned by GMInstrumentationBeginPhase(). */
+typedef struct {
+  double time;
+  size_t bytes;
+  size_t blocks;
+} GMInstrumentationMark;
+
+extern GMInstrumentationMark GMInstrumentationMarkNow(void);
+extern void GMInstrumentationRecordPhase(GMInstrumentationPhase phase, GMInstrumentationMark mark);
+extern void GMInstrumentationRecordKeystroke(double start);
+
+/**
+ Starts timing a phase. Pass the result to GMInstrumentationEndPhase() once the phase is over:
+
+    GMInstrumentationMark mark = GMInstrumentationBeginPhase();
+    ...
+    GMInstrumentationEndPhase(GMInstrumentationPhaseTokenizing, mark);
+
+ Does nothing when instrumentation is off.
+ */
+static inline GMInstrumentationMark GMInstrumentationBeginPhase(void)
+{
+  return GMInstrumentationEnabled ? GMInstrumentationMarkNow() : (GMInstrumentationMark){0, 0, 0};
+}
+
+/**
+ Records the time since GMInstrumentationBeginPhase() for a phase. A phase that started while instrumentation was
+ off isn't recorded.
+ */
+static inline void GMInstrumentationEndPhase(GMInstrumentationPhase phase, GMInstrumentationMark mark)
+{
+  if (GMInstrumentationEnabled && mark.time != 0) {
+    GMInstrumentationRecordPhase(phase, mark);
+  }
+}
+
+/**
+ The GMInstrumentationObserver protocol is for objects that want to see measurements as they are taken, such as to
+ log slow keystrokes. The methods are called on the thread the measurement was taken on, which for tokenizing may be
+ any thread.
+ */
+@protocol GMInstrumentationObserver <NSObject>
+@optional
+/**
+ A phase is over.
+ @param duration How long it took, in seconds.
+ */
+- (void)instrumentation: (GMInstrumentation *)instrumentation didRecordPhase: (GMInstrumentationPhase)phase duration: (NSTimeInterval)duration;
+/**
+ The rules of a language were searched while tokenizing.
+ @param rules The rules that were searched in that call, as dictionaries with the GMInstrumentationRuleKey,
+ GMInstrumentationCountKey, GMInstrumentationMatchesKey and GMInstrumentationSecondsKey.
+ */
+- (void)instrumentation: (GMInstrumentation *)instrumentation didRecordRules: (NSArray *)rules ofLanguage: (NSString *)language;
+/**
+ An edit of the text of a GMCodeEditor has been highlighted.
+ @param latency The time from the text storage processing the edit to the editor applying its highlighting.
+ */
+- (void)instrumentation: (GMInstrumentation *)instrumentation didRecordKeystrokeLatency: (NSTimeInterval)latency;
+@end
+
+/**
+ GMInstrumentation collects where the time goes while highlighting and completing, to find out why an editor lags
+ and which rules of a `.language` file are slow.
+
+ There is a single, shared instance, which is off until enabled. While it is on, it collects:
+
+ - For every rule of every language, how many searches were made for it, how many tokens it matched and how long
+   its searches took. Nested rules are named by the path of rules they are inside of, like `tag > attr-value`.
+ - For every GMInstrumentationPhase, how many times it ran, how long it took altogether and at the most, and, if
+   tracksAllocations is on, how much memory it allocated (net of what it freed, for the whole process).
+ - For every edit in a GMCodeEditor, how long it took from the text storage processing it to the highlighting being
+   applied, as a histogram.
+
+ The totals are read with dictionaryRepresentation or written out as JSON, and observers see every measurement as it
+ is taken.
+ */
+@interface GMInstrumentation : NSObject
+{
+@private
+  BOOL _tracksAllocations;
+  NSHashTable *_observers;
+  double *_phaseSeconds;
+  double *_phaseMaximums;
+  NSUInteger *_phaseCounts;
+  long long *_phaseBytes;
+  long long *_phaseBlocks;
+  NSMutableDictionary *_rules;
+  NSUInteger *_latencyCounts;
+  NSUInteger _keystrokes;
+  double _latencySeconds;
+  double _latencyMaximum;
+}
+
+/**
+ The instance the instrumented code reports to.
+ */
++ (GMInstrumentation *)sharedInstrumentation;
+
+/**
+ @name Collecting measurements
+ */
+/**
+ Whether measurements are taken. Defaults to `NO`.
+ */
+@property (getter=isEnabled) BOOL enabled;
+/**
+ Whether phases also count the memory allocated while they ran. This asks the allocator for its statistics at the
+ start and end of every phase, which is slow enough to skew the timings of short phases.
+
+ Defaults to `NO`. Only works on OS X.
+ */
+@property BOOL tracksAllocations;
+/**
+ Forgets all measurements.
+ */
+- (void)reset;
+/**
+ Adds an observer. Observers aren't retained.
+ */
+- (void)addObserver: (id<GMInstrumentationObserver>)observer;
+- (void)removeObserver: (id<GMInstrumentationObserver>)observer;
+
+/**
+ @name Recording measurements
+ */
+/**
+ Adds the searches of the rules of a language. This is what GMSyntaxHighlighter calls at the end of tokenizing.
+ @param rules Dictionaries as passed to [GMInstrumentationObserver instrumentation:didRecordRules:ofLanguage:].
+ */
+- (void)recordRules: (NSArray *)rules ofLanguage: (NSString *)language;
+/**
+ Adds a run of a phase.
+ @param bytes The bytes allocated during the phase, 0 if not known.
+ @param blocks The blocks allocated during the phase, 0 if not known.
+ */
+- (void)recordPhase: (GMInstrumentationPhase)phase duration: (NSTimeInterval)duration bytes: (long long)bytes blocks: (long long)blocks;
+/**
+ Adds the latency of an edit to the histogram.
+ */
+- (void)recordKeystrokeLatency: (NSTimeInterval)latency;
+
+/**
+ @name Reading measurements
+ */
+/**
+ The name of a phase, as used in the dictionaryRepresentation, like `tokenizing`.
+ */
++ (NSString *)nameOfPhase: (GMInstrumentationPhase)phase;
+/**
+ All measurements so far:
+
+ - `phases`: an array of dictionaries with the GMInstrumentationNameKey, GMInstrumentationCountKey,
+   GMInstrumentationSecondsKey, `maximumSeconds`, and `allocatedBytes` and `allocatedBlocks` if tracksAllocations is
+   on, for every phase that ran.
+ - `rules`: an array of dictionaries with the GMInstrumentationNameKey (the language), GMInstrumentationRuleKey,
+   GMInstrumentationCountKey, GMInstrumentationMatchesKey and GMInstrumentationSecondsKey, slowest first.
+ - `keystrokes`: a dictionary with the GMInstrumentationCountKey, GMInstrumentationSecondsKey, `maximumSeconds` and
+   a `histogram`, an array of dictionaries with a `count` of the latencies of at least `fromMilliseconds` and below
+   `toMilliseconds` (missing in the last one).
+ */
+- (NSDictionary *)dictionaryRepresentation;
+/**
+ The dictionaryRepresentation as JSON.
+ */
+- (NSData *)JSONData;
+/**
+ Writes the JSONData to a file.
+ @return Whether the file could be written.
+ */
+- (BOOL)writeJSONToFile: (NSString *)path error: (NSError **)error;
+
+@end
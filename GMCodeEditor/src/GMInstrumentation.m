@@ -0,0 +1,293 @@
+//
+//  GMInstrumentation.m
+//  Code Editor
+//
+//  Created by Jakub Hampl on 17.10.26.
+//  Copyright (c) 2026 Jakub Hampl. All rights reserved.
+//
+
+#import "GMInstrumentation.h"
+#import <dispatch/dispatch.h>
+#ifdef __APPLE__
+#import <malloc/malloc.h>
+#endif
+
+// Latencies are counted in buckets that double in width, from below a millisecond to a second and more.
+#define GMLatencyBucketCount 12
+
+NSString * const GMInstrumentationNameKey = @"name";
+NSString * const GMInstrumentationRuleKey = @"rule";
+NSString * const GMInstrumentationCountKey = @"count";
+NSString * const GMInstrumentationMatchesKey = @"matches";
+NSString * const GMInstrumentationSecondsKey = @"seconds";
+
+BOOL GMInstrumentationEnabled = NO;
+
+static BOOL GMInstrumentationTracksAllocations = NO;
+
+GMInstrumentationMark GMInstrumentationMarkNow(void)
+{
+  GMInstrumentationMark mark = {[NSDate timeIntervalSinceReferenceDate], 0, 0};
+#ifdef __APPLE__
+  if (GMInstrumentationTracksAllocations) {
+    malloc_statistics_t stats;
+    malloc_zone_statistics(NULL, &stats);
+    mark.bytes = stats.size_in_use;
+    mark.blocks = stats.blocks_in_use;
+  }
+#endif
+  return mark;
+}
+
+void GMInstrumentationRecordPhase(GMInstrumentationPhase phase, GMInstrumentationMark mark)
+{
+  GMInstrumentationMark now = GMInstrumentationMarkNow();
+  long long bytes = 0, blocks = 0;
+  if (GMInstrumentationTracksAllocations && mark.bytes) {
+    bytes = (long long)now.bytes - (long long)mark.bytes;
+    blocks = (long long)now.blocks - (long long)mark.blocks;
+  }
+  [[GMInstrumentation sharedInstrumentation] recordPhase: phase duration: now.time - mark.time bytes: bytes blocks: blocks];
+}
+
+void GMInstrumentationRecordKeystroke(double start)
+{
+  [[GMInstrumentation sharedInstrumentation] recordKeystrokeLatency: [NSDate timeIntervalSinceReferenceDate] - start];
+}
+
+@implementation GMInstrumentation
+
++ (GMInstrumentation *)sharedInstrumentation
+{
+  static GMInstrumentation *instrumentation;
+  static dispatch_once_t once;
+  dispatch_once(&once, ^{
+    instrumentation = [[GMInstrumentation alloc] init];
+  });
+  return instrumentation;
+}
+
++ (NSString *)nameOfPhase:(GMInstrumentationPhase)phase
+{
+  switch (phase) {
+    case GMInstrumentationPhaseLanguageLoading: return @"language-loading";
+    case GMInstrumentationPhaseTokenizing: return @"tokenizing";
+    case GMInstrumentationPhaseFormatting: return @"formatting";
+    case GMInstrumentationPhaseIndexing: return @"indexing";
+    case GMInstrumentationPhaseApplyingAttributes: return @"applying-attributes";
+    case GMInstrumentationPhaseFilteringCompletions: return @"filtering-completions";
+    default: return nil;
+  }
+}
+
+- (id)init
+{
+  if (self = [super init]) {
+    _observers = [NSHashTable weakObjectsHashTable];
+    _phaseSeconds = calloc(GMInstrumentationPhaseCount, sizeof(double));
+    _phaseMaximums = calloc(GMInstrumentationPhaseCount, sizeof(double));
+    _phaseCounts = calloc(GMInstrumentationPhaseCount, sizeof(NSUInteger));
+    _phaseBytes = calloc(GMInstrumentationPhaseCount, sizeof(long long));
+    _phaseBlocks = calloc(GMInstrumentationPhaseCount, sizeof(long long));
+    _latencyCounts = calloc(GMLatencyBucketCount, sizeof(NSUInteger));
+    _rules = [NSMutableDictionary dictionary];
+  }
+  return self;
+}
+
+- (void)dealloc
+{
+  free(_phaseSeconds);
+  free(_phaseMaximums);
+  free(_phaseCounts);
+  free(_phaseBytes);
+  free(_phaseBlocks);
+  free(_latencyCounts);
+}
+
+- (BOOL)isEnabled
+{
+  return GMInstrumentationEnabled;
+}
+
+- (void)setEnabled:(BOOL)enabled
+{
+  GMInstrumentationEnabled = enabled;
+}
+
+- (BOOL)tracksAllocations
+{
+  return GMInstrumentationTracksAllocations;
+}
+
+- (void)setTracksAllocations:(BOOL)tracksAllocations
+{
+  GMInstrumentationTracksAllocations = tracksAllocations;
+}
+
+- (void)reset
+{
+  @synchronized (self) {
+    memset(_phaseSeconds, 0, GMInstrumentationPhaseCount * sizeof(double));
+    memset(_phaseMaximums, 0, GMInstrumentationPhaseCount * sizeof(double));
+    memset(_phaseCounts, 0, GMInstrumentationPhaseCount * sizeof(NSUInteger));
+    memset(_phaseBytes, 0, GMInstrumentationPhaseCount * sizeof(long long));
+    memset(_phaseBlocks, 0, GMInstrumentationPhaseCount * sizeof(long long));
+    memset(_latencyCounts, 0, GMLatencyBucketCount * sizeof(NSUInteger));
+    _keystrokes = 0;
+    _latencySeconds = 0;
+    _latencyMaximum = 0;
+    [_rules removeAllObjects];
+  }
+}
+
+- (void)addObserver:(id<GMInstrumentationObserver>)observer
+{
+  @synchronized (self) {
+    [_observers addObject: observer];
+  }
+}
+
+- (void)removeObserver:(id<GMInstrumentationObserver>)observer
+{
+  @synchronized (self) {
+    [_observers removeObject: observer];
+  }
+}
+
+// The observers that implement a method, taken out of the lock so that they are called without holding it.
+- (NSArray *)observersRespondingToSelector: (SEL)selector
+{
+  @synchronized (self) {
+    if ([_observers count] == 0) {
+      return nil;
+    }
+    NSMutableArray *observers = [NSMutableArray array];
+    for (id<GMInstrumentationObserver> observer in _observers) {
+      if ([observer respondsToSelector: selector]) {
+        [observers addObject: observer];
+      }
+    }
+    return observers;
+  }
+}
+
+#pragma mark - Recording
+
+- (void)recordRules:(NSArray *)rules ofLanguage:(NSString *)language
+{
+  language = language ?: @"(unnamed)";
+  @synchronized (self) {
+    NSMutableDictionary *totals = _rules[language];
+    if (!totals) {
+      totals = [NSMutableDictionary dictionary];
+      [_rules setObject: totals forKey: language];
+    }
+    for (NSDictionary *rule in rules) {
+      NSString *name = rule[GMInstrumentationRuleKey];
+      NSDictionary *total = totals[name];
+      [totals setObject: @{GMInstrumentationCountKey: @([total[GMInstrumentationCountKey] unsignedIntegerValue] + [rule[GMInstrumentationCountKey] unsignedIntegerValue]),
+                           GMInstrumentationMatchesKey: @([total[GMInstrumentationMatchesKey] unsignedIntegerValue] + [rule[GMInstrumentationMatchesKey] unsignedIntegerValue]),
+                           GMInstrumentationSecondsKey: @([total[GMInstrumentationSecondsKey] doubleValue] + [rule[GMInstrumentationSecondsKey] doubleValue])}
+                 forKey: name];
+    }
+  }
+  for (id<GMInstrumentationObserver> observer in [self observersRespondingToSelector: @selector(instrumentation:didRecordRules:ofLanguage:)]) {
+    [observer instrumentation: self didRecordRules: rules ofLanguage: language];
+  }
+}
+
+- (void)recordPhase:(GMInstrumentationPhase)phase duration:(NSTimeInterval)duration bytes:(long long)bytes blocks:(long long)blocks
+{
+  if (phase >= GMInstrumentationPhaseCount) {
+    return;
+  }
+  @synchronized (self) {
+    _phaseCounts[phase]++;
+    _phaseSeconds[phase] += duration;
+    _phaseMaximums[phase] = MAX(_phaseMaximums[phase], duration);
+    _phaseBytes[phase] += bytes;
+    _phaseBlocks[phase] += blocks;
+  }
+  for (id<GMInstrumentationObserver> observer in [self observersRespondingToSelector: @selector(instrumentation:didRecordPhase:duration:)]) {
+    [observer instrumentation: self didRecordPhase: phase duration: duration];
+  }
+}
+
+- (void)recordKeystrokeLatency:(NSTimeInterval)latency
+{
+  // The first bucket is below a millisecond, every one after it twice as wide as the one before.
+  NSUInteger bucket = 0;
+  for (double bound = 0.001; bucket < GMLatencyBucketCount - 1 && latency >= bound; bound *= 2) {
+    bucket++;
+  }
+  @synchronized (self) {
+    _latencyCounts[bucket]++;
+    _keystrokes++;
+    _latencySeconds += latency;
+    _latencyMaximum = MAX(_latencyMaximum, latency);
+  }
+  for (id<GMInstrumentationObserver> observer in [self observersRespondingToSelector: @selector(instrumentation:didRecordKeystrokeLatency:)]) {
+    [observer instrumentation: self didRecordKeystrokeLatency: latency];
+  }
+}
+
+#pragma mark - Reading
+
+- (NSDictionary *)dictionaryRepresentation
+{
+  @synchronized (self) {
+    NSMutableArray *phases = [NSMutableArray array];
+    for (NSUInteger phase = 0; phase < GMInstrumentationPhaseCount; phase++) {
+      if (_phaseCounts[phase] == 0) {
+        continue;
+      }
+      NSMutableDictionary *entry = [@{GMInstrumentationNameKey: [GMInstrumentation nameOfPhase: (GMInstrumentationPhase)phase],
+                                      GMInstrumentationCountKey: @(_phaseCounts[phase]),
+                                      GMInstrumentationSecondsKey: @(_phaseSeconds[phase]),
+                                      @"maximumSeconds": @(_phaseMaximums[phase])} mutableCopy];
+      if (GMInstrumentationTracksAllocations) {
+        [entry setObject: @(_phaseBytes[phase]) forKey: @"allocatedBytes"];
+        [entry setObject: @(_phaseBlocks[phase]) forKey: @"allocatedBlocks"];
+      }
+      [phases addObject: entry];
+    }
+
+    NSMutableArray *rules = [NSMutableArray array];
+    [_rules enumerateKeysAndObjectsUsingBlock:^(NSString *language, NSDictionary *totals, BOOL *stop) {
+      [totals enumerateKeysAndObjectsUsingBlock:^(NSString *rule, NSDictionary *total, BOOL *stop) {
+        NSMutableDictionary *entry = [total mutableCopy];
+        [entry setObject: language forKey: GMInstrumentationNameKey];
+        [entry setObject: rule forKey: GMInstrumentationRuleKey];
+        [rules addObject: entry];
+      }];
+    }];
+    [rules sortUsingDescriptors: @[[NSSortDescriptor sortDescriptorWithKey: GMInstrumentationSecondsKey ascending: NO]]];
+
+    NSMutableArray *histogram = [NSMutableArray array];
+    double from = 0, to = 1;
+    for (NSUInteger i = 0; i < GMLatencyBucketCount; i++, from = to, to *= 2) {
+      if (i < GMLatencyBucketCount - 1) {
+        [histogram addObject: @{@"fromMilliseconds": @(from), @"toMilliseconds": @(to), GMInstrumentationCountKey: @(_latencyCounts[i])}];
+      } else {
+        [histogram addObject: @{@"fromMilliseconds": @(from), GMInstrumentationCountKey: @(_latencyCounts[i])}];
+      }
+    }
+    NSDictionary *keystrokes = @{GMInstrumentationCountKey: @(_keystrokes), GMInstrumentationSecondsKey: @(_latencySeconds),
+                                 @"maximumSeconds": @(_latencyMaximum), @"histogram": histogram};
+
+    return @{@"phases": phases, @"rules": rules, @"keystrokes": keystrokes};
+  }
+}
+
+- (NSData *)JSONData
+{
+  return [NSJSONSerialization dataWithJSONObject: [self dictionaryRepresentation] options: NSJSONWritingPrettyPrinted error: NULL];
+}
+
+- (BOOL)writeJSONToFile:(NSString *)path error:(NSError **)error
+{
+  return [[self JSONData] writeToFile: path options: NSDataWritingAtomic error: error];
+}
+
+@end
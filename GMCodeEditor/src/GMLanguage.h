@@ -8,6 +8,8 @@
 
 #import <Foundation/Foundation.h>
 
+@class GMGrammar;
+
 /**
  GMLanguage is a class that loads a language used by the other components in this kit. Typically languages
  are stored in plist files with the extension `.language` and the language name as the name of the file.
@@ -32,6 +34,9 @@
 + (NSDictionary *)languageAtURL: (NSURL *)url;
 /**
  Loads a language plist from a given path.
+ 
+ If there is a [compiled](GMCompiledLanguage) version of the language next to it (at the same path with the
+ extension `.languagec`) that was compiled from the same plist, it is loaded instead, which is a lot faster.
  @param path The accessible filesystem path where to find the language declaration.
  @return Returns a new language dictionary instance if the file was found and parsed properly, otherwise nil.
  */
@@ -53,6 +58,11 @@
  Processes a dictionary, turning certain strings into regular expressions and also turning arrays of dictionaries
  into [ordered dictionaries](GMOrderedDictionary).
  
+ The `grammar` is compiled into a [grammar](GMGrammar) added under `compiled_grammar`, which is what the highlighter
+ uses. Every pattern of the grammar is checked as it is compiled, so a language with an invalid one isn't created. The
+ `grammar` itself stays, in the processed form shown below; it is only built (from the compiled grammar's
+ [ruleDictionary](GMGrammar ruleDictionary)) when it is first asked for.
+ 
  Example of creating a language programatically:
  
      NSDictionary *css = @{
@@ -68,7 +78,8 @@
      };
      NSDictionary *cssLanguage = [GMLanguage languageWithDictionary: css];
  
- Which would be roughly equivalent to doing (although this is implementation specific and may change):
+ Which would be roughly equivalent to doing (although this is implementation specific and may change, and
+ GMSyntaxHighlighter compiles a processed `grammar` like this one in full when it is given the language):
     
      NSError *err;
      GMOrderedDictionary *grammar = [GMOrderedDictionary dictionary];
@@ -83,9 +94,39 @@
      }
  
  @param dict The language definition dictionary.
- @return Returns a new language dictionary.
+ @return Returns a new language dictionary, or nil if a pattern of the grammar isn't a valid regular expression (the
+ error is logged).
  */
 + (NSDictionary *)languageWithDictionary: (NSDictionary *)dict;
+/**
+ Processes a dictionary like languageWithDictionary:, but with a grammar that has been compiled already.
+
+ This is how GMCompiledLanguage creates languages. Any `grammar` in the dictionary is replaced by the one of `grammar`.
+ @param dict The language definition dictionary.
+ @param grammar The compiled grammar of the language, or nil if it has none.
+ @return Returns a new language dictionary.
+ */
++ (NSDictionary *)languageWithDictionary: (NSDictionary *)dict grammar: (GMGrammar *)grammar;
+/**
+ Splits a regular expression in the `/pattern/flags` notation used by language files.
+ @param string The regular expression string.
+ @param options Set to the regular expression options the flags stand for.
+ @return The pattern.
+ */
++ (NSString *)patternOfRegularExpressionString: (NSString *)string options: (NSRegularExpressionOptions *)options;
+/**
+ @name Checking a language
+ */
+/**
+ Looks for rules whose patterns are likely to backtrack catastrophically, that is ones with nested quantifiers (see
+ GMPatternHasNestedQuantifiers()), in a grammar and the `inside` grammars of its rules.
+
+ Languages are checked when they are loaded, and the warnings logged. GMSyntaxHighlighter gives up on a rule that
+ takes too long (see its ruleTimeLimit), so such a rule won't hang the editor, but it may leave text unhighlighted.
+ @param grammar The compiled grammar of a language.
+ @return A description of every suspicious rule, naming the rule and its pattern.
+ */
++ (NSArray *)warningsForGrammar: (GMGrammar *)grammar;
 
 @end
 
@@ -112,7 +153,7 @@
 // This class was altered by Jakub Hampl by adding a class prefix and made it ARC
 // compatible.
 
-#import <Cocoa/Cocoa.h>
+#import <Foundation/Foundation.h>
 
 @interface GMOrderedDictionary : NSMutableDictionary
 {
@@ -7,55 +7,146 @@
 //
 
 #import "GMLanguage.h"
+#import "GMGrammar.h"
+#import "GMCompiledLanguage.h"
+#import "GMInstrumentation.h"
+
+// A processed language, whose `grammar` is only built from the `compiled_grammar` when something asks for it, as
+// building it compiles every pattern.
+@interface GMLanguageDictionary : NSDictionary {
+  @private
+  NSDictionary *_entries;
+  GMGrammar *_grammar;
+  GMOrderedDictionary *_ruleDictionary;
+}
+- (id)initWithEntries: (NSDictionary *)entries grammar: (GMGrammar *)grammar;
+@end
+
+@implementation GMLanguageDictionary
+
+- (id)initWithEntries:(NSDictionary *)entries grammar:(GMGrammar *)grammar
+{
+  if (self = [super init]) {
+    _entries = [entries copy];
+    _grammar = grammar;
+  }
+  return self;
+}
+
+- (id)copyWithZone:(NSZone *)zone
+{
+  return self;
+}
+
+- (NSUInteger)count
+{
+  return [_entries count] + 1;
+}
+
+- (id)objectForKey:(id)aKey
+{
+  if (![aKey isEqual: @"grammar"]) {
+    return [_entries objectForKey: aKey];
+  }
+  @synchronized (self) {
+    if (!_ruleDictionary) {
+      _ruleDictionary = [_grammar ruleDictionary];
+    }
+    return _ruleDictionary;
+  }
+}
+
+- (NSEnumerator *)keyEnumerator
+{
+  return [[[_entries allKeys] arrayByAddingObject: @"grammar"] objectEnumerator];
+}
+
+@end
 
 @implementation GMLanguage
 
 + (NSDictionary *)languageAtURL:(NSURL *)url
 {
+  GMInstrumentationMark mark = GMInstrumentationBeginPhase();
   NSDictionary *dict = [NSDictionary dictionaryWithContentsOfURL: url];
-  return [self languageWithDictionary: dict];
+  NSDictionary *lang = [self languageWithDictionary: dict];
+  GMInstrumentationEndPhase(GMInstrumentationPhaseLanguageLoading, mark);
+  return lang;
 }
 
 + (NSDictionary *)languageAtPath:(NSString *)path
 {
-  NSDictionary *dict = [NSDictionary dictionaryWithContentsOfFile: path];
-  return [self languageWithDictionary: dict];
+  GMInstrumentationMark mark = GMInstrumentationBeginPhase();
+  NSDictionary *lang = nil;
+  NSString *compiledPath = [path stringByAppendingString: @"c"];
+  if ([[NSFileManager defaultManager] fileExistsAtPath: compiledPath]) {
+    NSData *source = [NSData dataWithContentsOfFile: path options: NSDataReadingMappedIfSafe error: NULL];
+    lang = [GMCompiledLanguage languageWithContentsOfFile: compiledPath sourceData: source];
+  }
+  if (!lang) {
+    NSDictionary *dict = [NSDictionary dictionaryWithContentsOfFile: path];
+    lang = [self languageWithDictionary: dict];
+  }
+  GMInstrumentationEndPhase(GMInstrumentationPhaseLanguageLoading, mark);
+  return lang;
 }
 
 + (NSDictionary *)languageFromBundleWithName:(NSString *)name
 {
-  return [self languageAtPath: [[NSBundle mainBundle] pathForResource: name ofType: @"language"]];
+  NSString *path = [[NSBundle mainBundle] pathForResource: name ofType: @"language"];
+  if (!path) {
+    // Applications may ship only the compiled form of a language.
+    path = [[NSBundle mainBundle] pathForResource: name ofType: @"languagec"];
+    return path ? [GMCompiledLanguage languageWithContentsOfFile: path sourceData: nil] : nil;
+  }
+  return [self languageAtPath: path];
 }
 
 + (NSDictionary *)languageWithDictionary:(NSDictionary *)dict
 {
-  NSMutableDictionary *lang = [NSMutableDictionary dictionaryWithDictionary: dict];
-  if (lang[@"grammar"]) {
-    [lang setObject: [self processGrammarItem: lang[@"grammar"]] forKey: @"grammar"];
+  id source = dict[@"grammar"];
+  GMGrammar *grammar;
+  if ([source isKindOfClass: [NSArray class]]) {
+    NSError *err;
+    grammar = [[GMGrammar alloc] initWithSourceGrammar: source error: &err];
+    if (!grammar) {
+      NSLog(@"ERROR: %@", err);
+      return nil;
+    }
+  } else if (source) {
+    // A grammar that has been processed already is compiled the way it is.
+    grammar = [GMGrammar grammarWithDictionary: source];
+  }
+  if (grammar) {
+    [self logWarningsForGrammar: grammar language: dict[@"name"]];
   }
+  return [self languageWithDictionary: dict grammar: grammar];
+}
+
++ (NSDictionary *)languageWithDictionary:(NSDictionary *)dict grammar:(GMGrammar *)grammar
+{
+  NSMutableDictionary *lang = [NSMutableDictionary dictionaryWithDictionary: dict];
+  [lang removeObjectForKey: @"grammar"];
   if (lang[@"paired_characters"]) {
     [lang setValue: [self processPairedCharacters: lang[@"paired_characters"]] forKey:@"paired_characters"];
   }
-  return lang;
+  if (lang[@"symbols"]) {
+    [lang setObject: [self processSymbols: lang[@"symbols"]] forKey: @"symbols"];
+  }
+  if (!grammar) {
+    return lang;
+  }
+  [lang setObject: grammar forKey: @"compiled_grammar"];
+  return [[GMLanguageDictionary alloc] initWithEntries: lang grammar: grammar];
 }
 
 + (id)processGrammarItem: (id)item
 {
   if ([item isKindOfClass: [NSString class]]) {
-    NSUInteger indexOfLastSeparator = [item rangeOfCharacterFromSet: [NSCharacterSet characterSetWithCharactersInString:@"/"] options: NSBackwardsSearch | NSLiteralSearch].location - 1;
-    NSCharacterSet *opts = [NSCharacterSet characterSetWithCharactersInString: [item substringWithRange:NSMakeRange(indexOfLastSeparator, [item length] - indexOfLastSeparator)]];
-    NSUInteger options = 0;
-    if ([opts characterIsMember: 'i']) {
-      //options = options | NSRegularExpressionCaseInsensitive;
-    }
-    if ([opts characterIsMember: 'x']) {
-      options = options | NSRegularExpressionAllowCommentsAndWhitespace;
-    }
-    if ([opts characterIsMember: 's']) {
-      options = options | NSRegularExpressionDotMatchesLineSeparators;
-    }
+    NSRegularExpressionOptions options;
+    NSString *pattern = [self patternOfRegularExpressionString: item options: &options];
     NSError *err;
-    NSRegularExpression *ret = [NSRegularExpression regularExpressionWithPattern: [item substringWithRange: NSMakeRange(1, indexOfLastSeparator)] options: options error: &err];
+    NSRegularExpression *ret = [NSRegularExpression regularExpressionWithPattern: pattern options: options error: &err];
     if (ret) {
       return ret;
     } else {
@@ -76,6 +167,11 @@
   if ([item isKindOfClass: [NSDictionary class]]) {
     NSMutableDictionary *ret = [NSMutableDictionary dictionary];
     for (id key in item) {
+      // The name of a nested language isn't a pattern.
+      if ([key isEqual: @"language"]) {
+        [ret setValue: item[key] forKey: key];
+        continue;
+      }
       [ret setValue: [self processGrammarItem: item[key]] forKey: key];
     }
     return ret;
@@ -83,6 +179,66 @@
   return item;
 }
 
++ (NSString *)patternOfRegularExpressionString:(NSString *)string options:(NSRegularExpressionOptions *)options
+{
+  NSUInteger indexOfLastSeparator = [string rangeOfCharacterFromSet: [NSCharacterSet characterSetWithCharactersInString:@"/"] options: NSBackwardsSearch | NSLiteralSearch].location - 1;
+  NSCharacterSet *opts = [NSCharacterSet characterSetWithCharactersInString: [string substringWithRange:NSMakeRange(indexOfLastSeparator, [string length] - indexOfLastSeparator)]];
+  *options = 0;
+  if ([opts characterIsMember: 'i']) {
+    //*options = *options | NSRegularExpressionCaseInsensitive;
+  }
+  if ([opts characterIsMember: 'x']) {
+    *options = *options | NSRegularExpressionAllowCommentsAndWhitespace;
+  }
+  if ([opts characterIsMember: 's']) {
+    *options = *options | NSRegularExpressionDotMatchesLineSeparators;
+  }
+  return [string substringWithRange: NSMakeRange(1, indexOfLastSeparator)];
+}
+
++ (NSArray *)warningsForGrammar:(GMGrammar *)grammar
+{
+  NSMutableArray *warnings = [NSMutableArray array];
+  [self addWarningsForGrammar: grammar path: nil to: warnings];
+  return warnings;
+}
+
++ (void)addWarningsForGrammar: (GMGrammar *)grammar path: (NSString *)path to: (NSMutableArray *)warnings
+{
+  for (NSUInteger i = 0; i < [grammar ruleCount]; i++) {
+    NSString *name = path ? [NSString stringWithFormat: @"%@.%@", path, [grammar nameOfRule: i]] : [grammar nameOfRule: i];
+    NSString *source = [grammar patternSourceOfRule: i];
+    if (source && GMPatternHasNestedQuantifiers(source)) {
+      [warnings addObject: [NSString stringWithFormat: @"Rule %@ has nested quantifiers and may backtrack catastrophically: /%@/", name, source]];
+    }
+    GMGrammar *inside = [grammar insideOfRule: i];
+    if (inside) {
+      [self addWarningsForGrammar: inside path: name to: warnings];
+    }
+  }
+}
+
++ (void)logWarningsForGrammar: (GMGrammar *)grammar language: (NSString *)name
+{
+  for (NSString *warning in [self warningsForGrammar: grammar]) {
+    NSLog(@"WARNING: %@%@", name ? [name stringByAppendingString: @": "] : @"", warning);
+  }
+}
+
+// Only the patterns of symbol definitions are regular expressions; kinds and token names are plain strings.
++ (NSArray *)processSymbols: (NSArray *)symbols
+{
+  NSMutableArray *ret = [NSMutableArray arrayWithCapacity: [symbols count]];
+  for (NSDictionary *definition in symbols) {
+    NSMutableDictionary *processed = [NSMutableDictionary dictionaryWithDictionary: definition];
+    if ([definition[@"pattern"] isKindOfClass: [NSString class]]) {
+      [processed setObject: [self processGrammarItem: definition[@"pattern"]] forKey: @"pattern"];
+    }
+    [ret addObject: processed];
+  }
+  return ret;
+}
+
 + (NSDictionary *)processPairedCharacters: (NSString *)str
 {
   NSMutableDictionary *dict = [NSMutableDictionary dictionaryWithCapacity: [str length] / 2];
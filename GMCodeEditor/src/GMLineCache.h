@@ -0,0 +1,186 @@
+//
+//  GMLineCache.h
+//  Code Editor
+//
+//  Created by Jakub Hampl on 17.10.26.
+//  Copyright (c) 2026 Jakub Hampl. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ A single entry on the tokenizer stack.
+
+ A frame is either a fragment of text that still has to be matched against the grammar rules starting at `rule`,
+ or (when `token` is non-zero) a token of type `rule` that is waiting to be emitted. Offsets are relative to the
+ location the state was captured at, so they can be negative for a token that started on an earlier line.
+ */
+typedef struct {
+  NSInteger location;
+  NSInteger end;
+  NSUInteger rule;
+  NSUInteger token;
+} GMTokenizerFrame;
+
+/**
+ GMTokenizerState is an immutable snapshot of the tokenizer at a line boundary.
+
+ Since grammars are applied rule by rule (earlier rules take precedence over later ones), the tokenizer's state is
+ the stack of fragments that still have to be matched by the remaining rules. Two equal states at the start of a line
+ followed by equal text will always produce the same tokens, which is what allows GMSyntaxHighlighter to stop
+ re-tokenizing as soon as it gets back in sync with a previous run.
+ */
+@interface GMTokenizerState : NSObject
+{
+@private
+  GMTokenizerFrame *_frames;
+  NSUInteger _count;
+  NSInteger _textEnd;
+}
+
+/**
+ Creates a state from absolute tokenizer frames.
+ @param frames The frames, bottom of the stack first, with absolute offsets.
+ @param count The number of frames.
+ @param location The location the state is captured at. Offsets will be stored relative to it.
+ @param length The length of the text the state is captured in.
+ */
+- (id)initWithFrames: (const GMTokenizerFrame *)frames count: (NSUInteger)count relativeTo: (NSUInteger)location textLength: (NSUInteger)length;
+/**
+ The number of frames on the stack.
+ */
+- (NSUInteger)frameCount;
+/**
+ Copies the frames out of the state, translating them to absolute offsets and rebasing them to the length of the
+ text the state is restored in: frames that ran to the end of the text the state was captured in run to the end of
+ this one, and the others are cut off at it. A frame can end up empty that way.
+ @param frames A buffer that can hold at least frameCount frames.
+ @param location The location the state is restored at.
+ @param length The length of the text the state is restored in.
+ */
+- (void)getFrames: (GMTokenizerFrame *)frames relativeTo: (NSUInteger)location textLength: (NSUInteger)length;
+/**
+ Whether a token (such as a multi-line comment) started before the location of this state and continues past it.
+ */
+- (BOOL)isInsideToken;
+/**
+ The offset of the start of the token this state is inside of, relative to the location of the state (so it is never positive).
+ Only meaningful when isInsideToken returns `YES`.
+ */
+- (NSInteger)tokenLocation;
+
+@end
+
+/**
+ GMLineCache stores the tokenizer state at the start of every line of a document.
+
+ It is the bookkeeping behind [GMSyntaxHighlighter tokenize:editedRange:changeInLength:tokenizedRange:]. Besides
+ the state, each line remembers its start offset and a hash of its text, so that a line whose text and start state
+ are unchanged can be recognized and skipped.
+
+ Edits are reported through editedRange:changeInLength:, which shifts the lines after the edit and marks the edited
+ characters as dirty until they are tokenized again.
+ */
+@interface GMLineCache : NSObject
+{
+@private
+  NSMutableData *_starts;
+  NSMutableData *_hashes;
+  NSMutableArray *_states;
+  NSRange _dirtyRange;
+  NSUInteger _textLength;
+}
+
+/**
+ @name Querying lines
+ */
+/**
+ The number of lines in the cache.
+ */
+- (NSUInteger)count;
+/**
+ The length of the text the cache describes.
+ */
+- (NSUInteger)textLength;
+/**
+ The range of characters that have been edited since they were last tokenized, or `{NSNotFound, 0}` if there are none.
+ */
+- (NSRange)dirtyRange;
+- (NSUInteger)startOfLineAtIndex: (NSUInteger)index;
+- (NSUInteger)hashOfLineAtIndex: (NSUInteger)index;
+/**
+ The tokenizer state at the start of the line.
+ 
+ The frames of a state reach ahead to where the tokenizer found the next matches, possibly far past the line. The
+ lines before an edit are kept as they are, so their frames can describe text that has since changed, or run past the
+ end of a text that got shorter. Compare states and ask them isInsideToken, but don't resume tokenizing from one
+ unless nothing after the line has been edited since it was cached.
+ */
+- (GMTokenizerState *)stateAtIndex: (NSUInteger)index;
+/**
+ The index of the last line starting at or before location, or NSNotFound if the cache is empty.
+ */
+- (NSUInteger)indexOfLineContainingLocation: (NSUInteger)location;
+/**
+ The index of the line that starts exactly at location, or NSNotFound.
+ */
+- (NSUInteger)indexOfLineStartingAtLocation: (NSUInteger)location;
+/**
+ Finds a line at which tokenizing can safely start in order to re-tokenize location.
+
+ That is the line containing location, unless a token that began on an earlier line runs into it, in which case it is
+ the line that token started on.
+ @return A line index, or NSNotFound if the cache is empty.
+ */
+- (NSUInteger)indexOfSafeLineForLocation: (NSUInteger)location;
+
+/**
+ @name Updating the cache
+ */
+/**
+ Discards all lines and marks the whole text as dirty.
+ @param length The length of the text.
+ */
+- (void)resetWithTextLength: (NSUInteger)length;
+/**
+ Discards all lines and marks the whole text as dirty.
+ */
+- (void)removeAllLines;
+/**
+ Updates the cache for an edit of the text.
+
+ Lines that started inside the replaced characters are dropped, the following lines are shifted and the edited
+ characters are added to dirtyRange.
+ @param editedRange The range of the new characters, in the coordinates of the text after the edit.
+ @param delta The change in length caused by the edit.
+ */
+- (void)editedRange: (NSRange)editedRange changeInLength: (NSInteger)delta;
+/**
+ Adds a range of characters to dirtyRange, so that it is tokenized again even though the text didn't change.
+ @param range The range to tokenize again.
+ */
+- (void)invalidateRange: (NSRange)range;
+/**
+ Replaces dirtyRange, for when tokenizing stops before the whole dirty range is done.
+ 
+ A zero length range still counts as dirty: tokenizing resumes at its location and carries on until it is back in
+ sync with the lines after it.
+ */
+- (void)setDirtyRange: (NSRange)range;
+/**
+ Replaces all lines starting inside range with freshly tokenized ones.
+
+ If range covers the dirtyRange, it is cleared.
+ @param range The range of characters that has been tokenized.
+ @param starts The start offsets of the new lines.
+ @param hashes The hashes of the new lines, as computed by GMLineHash().
+ @param states The tokenizer states at the start of the new lines.
+ */
+- (void)replaceLinesInRange: (NSRange)range withStarts: (NSData *)starts hashes: (NSData *)hashes states: (NSArray *)states;
+
+@end
+
+/**
+ Hashes the characters of a line for GMLineCache.
+ */
+extern NSUInteger GMLineHash(NSString *text, NSRange range);
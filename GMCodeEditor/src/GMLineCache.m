@@ -0,0 +1,274 @@
+//
+//  GMLineCache.m
+//  Code Editor
+//
+//  Created by Jakub Hampl on 17.10.26.
+//  Copyright (c) 2026 Jakub Hampl. All rights reserved.
+//
+
+#import "GMLineCache.h"
+
+NSUInteger GMLineHash(NSString *text, NSRange range)
+{
+  // FNV-1a over the UTF-16 code units. -[NSString hash] only looks at some of the characters of long strings.
+  uint64_t hash = 14695981039346656037ULL;
+  unichar buffer[256];
+  NSUInteger location = range.location, end = NSMaxRange(range);
+  while (location < end) {
+    NSUInteger length = MIN(end - location, 256);
+    [text getCharacters: buffer range: NSMakeRange(location, length)];
+    for (NSUInteger i = 0; i < length; i++) {
+      hash ^= buffer[i];
+      hash *= 1099511628211ULL;
+    }
+    location += length;
+  }
+  return (NSUInteger)hash;
+}
+
+@implementation GMTokenizerState
+
+- (id)initWithFrames:(const GMTokenizerFrame *)frames count:(NSUInteger)count relativeTo:(NSUInteger)location textLength:(NSUInteger)length
+{
+  if (self = [super init]) {
+    _count = count;
+    _textEnd = (NSInteger)length - (NSInteger)location;
+    _frames = calloc(MAX(count, 1), sizeof(GMTokenizerFrame));
+    for (NSUInteger i = 0; i < count; i++) {
+      _frames[i].location = frames[i].location - (NSInteger)location;
+      _frames[i].end = frames[i].end - (NSInteger)location;
+      _frames[i].rule = frames[i].rule;
+      _frames[i].token = frames[i].token;
+    }
+  }
+  return self;
+}
+
+- (void)dealloc
+{
+  free(_frames);
+}
+
+- (NSUInteger)frameCount
+{
+  return _count;
+}
+
+- (void)getFrames:(GMTokenizerFrame *)frames relativeTo:(NSUInteger)location textLength:(NSUInteger)length
+{
+  for (NSUInteger i = 0; i < _count; i++) {
+    frames[i] = _frames[i];
+    frames[i].location += (NSInteger)location;
+    frames[i].end = _frames[i].end == _textEnd ? (NSInteger)length : MIN(frames[i].end + (NSInteger)location, (NSInteger)length);
+  }
+}
+
+- (BOOL)isInsideToken
+{
+  return _count > 0 && _frames[_count - 1].token && _frames[_count - 1].location < 0;
+}
+
+- (NSInteger)tokenLocation
+{
+  return [self isInsideToken] ? _frames[_count - 1].location : 0;
+}
+
+- (BOOL)isEqual:(id)object
+{
+  if (![object isKindOfClass: [GMTokenizerState class]]) {
+    return NO;
+  }
+  GMTokenizerState *other = object;
+  return _count == other->_count && memcmp(_frames, other->_frames, _count * sizeof(GMTokenizerFrame)) == 0;
+}
+
+- (NSUInteger)hash
+{
+  return _count ? (NSUInteger)_frames[_count - 1].end ^ _count : 0;
+}
+
+- (NSString *)description
+{
+  NSMutableString *description = [NSMutableString stringWithFormat: @"<GMTokenizerState:"];
+  for (NSUInteger i = 0; i < _count; i++) {
+    [description appendFormat: @" %@%lu[%ld, %ld)", _frames[i].token ? @"token " : @"", (unsigned long)_frames[i].rule, (long)_frames[i].location, (long)_frames[i].end];
+  }
+  [description appendString: @">"];
+  return description;
+}
+
+@end
+
+@implementation GMLineCache
+
+- (id)init
+{
+  if (self = [super init]) {
+    _starts = [NSMutableData data];
+    _hashes = [NSMutableData data];
+    _states = [NSMutableArray array];
+    _dirtyRange = NSMakeRange(NSNotFound, 0);
+  }
+  return self;
+}
+
+#pragma mark - Querying lines
+
+- (NSUInteger)count
+{
+  return [_states count];
+}
+
+- (NSUInteger)textLength
+{
+  return _textLength;
+}
+
+- (NSRange)dirtyRange
+{
+  return _dirtyRange;
+}
+
+- (NSUInteger)startOfLineAtIndex:(NSUInteger)index
+{
+  return ((const NSUInteger *)[_starts bytes])[index];
+}
+
+- (NSUInteger)hashOfLineAtIndex:(NSUInteger)index
+{
+  return ((const NSUInteger *)[_hashes bytes])[index];
+}
+
+- (GMTokenizerState *)stateAtIndex:(NSUInteger)index
+{
+  return _states[index];
+}
+
+// The index of the first line that starts after location.
+- (NSUInteger)indexOfFirstLineStartingAfter: (NSUInteger)location
+{
+  const NSUInteger *starts = [_starts bytes];
+  NSUInteger low = 0, high = [self count];
+  while (low < high) {
+    NSUInteger mid = (low + high) / 2;
+    if (starts[mid] <= location) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+- (NSUInteger)indexOfLineContainingLocation:(NSUInteger)location
+{
+  NSUInteger index = [self indexOfFirstLineStartingAfter: location];
+  return index > 0 ? index - 1 : NSNotFound;
+}
+
+- (NSUInteger)indexOfLineStartingAtLocation:(NSUInteger)location
+{
+  NSUInteger index = [self indexOfLineContainingLocation: location];
+  if (index != NSNotFound && [self startOfLineAtIndex: index] == location) {
+    return index;
+  }
+  return NSNotFound;
+}
+
+- (NSUInteger)indexOfSafeLineForLocation:(NSUInteger)location
+{
+  NSUInteger index = [self indexOfLineContainingLocation: location];
+  while (index != NSNotFound && index > 0) {
+    GMTokenizerState *state = _states[index];
+    if (![state isInsideToken]) {
+      break;
+    }
+    NSInteger tokenStart = (NSInteger)[self startOfLineAtIndex: index] + [state tokenLocation];
+    NSUInteger tokenLine = [self indexOfLineContainingLocation: (NSUInteger)MAX(tokenStart, 0)];
+    index = tokenLine < index ? tokenLine : index - 1;
+  }
+  return index;
+}
+
+#pragma mark - Updating the cache
+
+- (void)removeAllLines
+{
+  [_starts setLength: 0];
+  [_hashes setLength: 0];
+  [_states removeAllObjects];
+  _dirtyRange = NSMakeRange(0, _textLength);
+}
+
+- (void)resetWithTextLength:(NSUInteger)length
+{
+  [self removeAllLines];
+  _textLength = length;
+  _dirtyRange = NSMakeRange(0, length);
+}
+
+- (void)editedRange:(NSRange)editedRange changeInLength:(NSInteger)delta
+{
+  NSUInteger location = editedRange.location;
+  NSUInteger oldEnd = NSMaxRange(editedRange) - delta;
+  NSUInteger count = [self count];
+  NSUInteger first = [self indexOfFirstLineStartingAfter: location], last = first;
+  NSUInteger *starts = [_starts mutableBytes];
+
+  while (last < count && starts[last] <= oldEnd) {
+    last++;
+  }
+  for (NSUInteger i = last; i < count; i++) {
+    starts[i] += delta;
+  }
+  if (last > first) {
+    NSRange removed = NSMakeRange(first * sizeof(NSUInteger), (last - first) * sizeof(NSUInteger));
+    [_starts replaceBytesInRange: removed withBytes: NULL length: 0];
+    [_hashes replaceBytesInRange: removed withBytes: NULL length: 0];
+    [_states removeObjectsInRange: NSMakeRange(first, last - first)];
+  }
+
+  if (_dirtyRange.location == NSNotFound) {
+    _dirtyRange = editedRange;
+  } else {
+    NSUInteger dirtyStart = _dirtyRange.location, dirtyEnd = NSMaxRange(_dirtyRange);
+    if (dirtyStart > location) {
+      dirtyStart = dirtyStart >= oldEnd ? dirtyStart + delta : location;
+    }
+    if (dirtyEnd > location) {
+      dirtyEnd = dirtyEnd >= oldEnd ? dirtyEnd + delta : NSMaxRange(editedRange);
+    }
+    _dirtyRange = NSUnionRange(NSMakeRange(dirtyStart, dirtyEnd - dirtyStart), editedRange);
+  }
+  _textLength += delta;
+}
+
+- (void)invalidateRange:(NSRange)range
+{
+  range = NSIntersectionRange(range, NSMakeRange(0, _textLength));
+  _dirtyRange = _dirtyRange.location == NSNotFound ? range : NSUnionRange(_dirtyRange, range);
+}
+
+- (void)setDirtyRange:(NSRange)range
+{
+  _dirtyRange = range;
+}
+
+- (void)replaceLinesInRange:(NSRange)range withStarts:(NSData *)starts hashes:(NSData *)hashes states:(NSArray *)states
+{
+  NSUInteger first = range.location > 0 ? [self indexOfFirstLineStartingAfter: range.location - 1] : 0;
+  NSUInteger last = NSMaxRange(range) > 0 ? [self indexOfFirstLineStartingAfter: NSMaxRange(range) - 1] : 0;
+  if (range.length == 0) {
+    last = first;
+  }
+  NSRange replaced = NSMakeRange(first * sizeof(NSUInteger), (last - first) * sizeof(NSUInteger));
+  [_starts replaceBytesInRange: replaced withBytes: [starts bytes] length: [starts length]];
+  [_hashes replaceBytesInRange: replaced withBytes: [hashes bytes] length: [hashes length]];
+  [_states replaceObjectsInRange: NSMakeRange(first, last - first) withObjectsFromArray: states];
+
+  if (_dirtyRange.location != NSNotFound && range.location <= _dirtyRange.location && NSMaxRange(range) >= NSMaxRange(_dirtyRange)) {
+    _dirtyRange = NSMakeRange(NSNotFound, 0);
+  }
+}
+
+@end
@@ -0,0 +1,86 @@
+//
+//  GMLineIndex.h
+//  Code Editor
+//
+//  Created by Jakub Hampl on 17.10.26.
+//  Copyright (c) 2026 Jakub Hampl. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ GMLineIndex maps between lines and character offsets of a text without going over the text.
+
+ It is a sorted array of the offsets at which lines start, updated for every edit through
+ editedRange:changeInLength:string:, which only looks at the edited characters. Lines are separated the same way
+ NSString separates them (by `\n`, `\r`, `\r\n`, U+0085, U+2028 or U+2029), and a text ending with a line separator
+ has an empty last line. Lines are numbered from 0.
+
+ Most edits don't add or remove lines but move all the following ones. Rather than rewriting their offsets, the index
+ keeps that as a pending shift of every line from some index on, which subsequent edits near the same place just add
+ to. Offsets are only rewritten when the line count changes or an edit happens far from the previous one.
+ Lookups are binary searches.
+ */
+@interface GMLineIndex : NSObject
+{
+@private
+  NSInteger *_starts;
+  NSUInteger _count;
+  NSUInteger _capacity;
+  NSUInteger _shiftIndex;
+  NSInteger _shift;
+  NSUInteger _length;
+}
+
+/**
+ Creates an index of a text.
+ */
+- (id)initWithString: (NSString *)string;
+
+/**
+ @name Updating the index
+ */
+/**
+ Indexes a whole text again.
+ */
+- (void)resetWithString: (NSString *)string;
+/**
+ Updates the index for an edit of the text.
+ @param editedRange The range of the new characters, in the coordinates of the text after the edit.
+ @param delta The change in length caused by the edit.
+ @param string The text after the edit.
+ */
+- (void)editedRange: (NSRange)editedRange changeInLength: (NSInteger)delta string: (NSString *)string;
+
+/**
+ @name Querying lines
+ */
+/**
+ The number of lines, which is at least 1.
+ */
+- (NSUInteger)count;
+/**
+ The length of the text the index describes.
+ */
+- (NSUInteger)textLength;
+/**
+ The offset at which a line starts.
+ @param line A line number smaller than count.
+ */
+- (NSUInteger)startOfLine: (NSUInteger)line;
+/**
+ The range of a line, including its line separator.
+ @param line A line number smaller than count.
+ */
+- (NSRange)rangeOfLine: (NSUInteger)line;
+/**
+ The number of the line a character is on. Locations past the end of the text are on the last line.
+ */
+- (NSUInteger)lineForLocation: (NSUInteger)location;
+/**
+ The range of the line a character is on, including its line separator. The same as NSString's `lineRangeForRange:`
+ of an empty range at location.
+ */
+- (NSRange)rangeOfLineContainingLocation: (NSUInteger)location;
+
+@end
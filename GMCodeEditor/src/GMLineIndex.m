@@ -0,0 +1,164 @@
+//
+//  GMLineIndex.m
+//  Code Editor
+//
+//  Created by Jakub Hampl on 17.10.26.
+//  Copyright (c) 2026 Jakub Hampl. All rights reserved.
+//
+
+#import "GMLineIndex.h"
+
+#define GMLineScanChunk 4096
+
+static BOOL GMIsLineSeparator(unichar c)
+{
+  return c == '\n' || c == '\r' || c == 0x85 || c == 0x2028 || c == 0x2029;
+}
+
+@implementation GMLineIndex
+
+- (id)initWithString:(NSString *)string
+{
+  self = [super init];
+  if (self) {
+    [self resetWithString: string];
+  }
+  return self;
+}
+
+- (void)dealloc
+{
+  free(_starts);
+}
+
+#pragma mark - Updating the index
+
+- (void)ensureCapacity: (NSUInteger)capacity
+{
+  if (capacity <= _capacity) {
+    return;
+  }
+  _capacity = MAX(capacity, MAX(_capacity * 2, 256));
+  _starts = realloc(_starts, sizeof(NSInteger) * _capacity);
+}
+
+// The starts of the lines after the separators in range, where the separator itself is. A `\r` at the end of the
+// range is looked past, so that it isn't counted apart from the `\n` after it.
+- (NSMutableData *)lineStartsInString: (NSString *)string range: (NSRange)range
+{
+  NSMutableData *found = [NSMutableData data];
+  NSUInteger length = [string length];
+  unichar characters[GMLineScanChunk + 1];
+  for (NSUInteger start = range.location; start < NSMaxRange(range); start += GMLineScanChunk) {
+    NSUInteger count = MIN((NSUInteger)GMLineScanChunk, NSMaxRange(range) - start);
+    NSUInteger available = MIN(count + 1, length - start);
+    [string getCharacters: characters range: NSMakeRange(start, available)];
+    for (NSUInteger i = 0; i < count; i++) {
+      if (!GMIsLineSeparator(characters[i]) || (characters[i] == '\r' && i + 1 < available && characters[i + 1] == '\n')) {
+        continue;
+      }
+      NSInteger lineStart = start + i + 1;
+      [found appendBytes: &lineStart length: sizeof(lineStart)];
+    }
+  }
+  return found;
+}
+
+// Makes the pending shift apply from index on instead of from _shiftIndex on.
+- (void)moveShiftToIndex: (NSUInteger)index
+{
+  if (_shift != 0) {
+    for (NSUInteger i = index; i < _shiftIndex; i++) {
+      _starts[i] -= _shift;
+    }
+    for (NSUInteger i = _shiftIndex; i < index; i++) {
+      _starts[i] += _shift;
+    }
+  }
+  _shiftIndex = index;
+}
+
+- (void)resetWithString:(NSString *)string
+{
+  _length = [string length];
+  NSMutableData *found = [self lineStartsInString: string range: NSMakeRange(0, _length)];
+  _count = 1 + [found length] / sizeof(NSInteger);
+  [self ensureCapacity: _count];
+  _starts[0] = 0;
+  memcpy(_starts + 1, [found bytes], [found length]);
+  _shiftIndex = _count;
+  _shift = 0;
+}
+
+- (void)editedRange:(NSRange)editedRange changeInLength:(NSInteger)delta string:(NSString *)string
+{
+  // One character more on either side, since a `\r\n` can be joined or split by the edit.
+  NSUInteger length = [string length];
+  NSUInteger start = editedRange.location > 0 ? editedRange.location - 1 : 0;
+  NSUInteger end = MIN(NSMaxRange(editedRange) + 1, length);
+
+  // The lines starting in (start, end], which are the only ones the edit can change, found before the edit.
+  NSUInteger first = [self indexOfFirstLineStartingAfter: start];
+  NSUInteger last = [self indexOfFirstLineStartingAfter: (NSUInteger)((NSInteger)end - delta)];
+  [self moveShiftToIndex: last];
+  _shift += delta;
+
+  NSMutableData *found = [self lineStartsInString: string range: NSMakeRange(start, end - start)];
+  NSUInteger count = [found length] / sizeof(NSInteger);
+  [self ensureCapacity: _count - (last - first) + count];
+  memmove(_starts + first + count, _starts + last, sizeof(NSInteger) * (_count - last));
+  memcpy(_starts + first, [found bytes], [found length]);
+  _count = _count - (last - first) + count;
+  _shiftIndex = first + count;
+  _length = length;
+}
+
+#pragma mark - Querying lines
+
+- (NSUInteger)count
+{
+  return _count;
+}
+
+- (NSUInteger)textLength
+{
+  return _length;
+}
+
+- (NSUInteger)startOfLine:(NSUInteger)line
+{
+  return _starts[line] + (line >= _shiftIndex ? _shift : 0);
+}
+
+- (NSUInteger)indexOfFirstLineStartingAfter: (NSUInteger)location
+{
+  NSUInteger low = 0, high = _count;
+  while (low < high) {
+    NSUInteger middle = low + (high - low) / 2;
+    if ([self startOfLine: middle] <= location) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+- (NSRange)rangeOfLine:(NSUInteger)line
+{
+  NSUInteger start = [self startOfLine: line];
+  NSUInteger end = line + 1 < _count ? [self startOfLine: line + 1] : _length;
+  return NSMakeRange(start, end - start);
+}
+
+- (NSUInteger)lineForLocation:(NSUInteger)location
+{
+  return [self indexOfFirstLineStartingAfter: location] - 1;
+}
+
+- (NSRange)rangeOfLineContainingLocation:(NSUInteger)location
+{
+  return [self rangeOfLine: [self lineForLocation: location]];
+}
+
+@end
@@ -0,0 +1,81 @@
+//
+//  GMRegistry.h
+//  Code Editor
+//
+//  Created by Jakub Hampl on 17.10.26.
+//  Copyright (c) 2026 Jakub Hampl. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class GMTheme;
+
+/**
+ GMRegistry hands out languages and themes that are shared by everything that uses them.
+
+ Loading a language or theme with the GMLanguage and GMTheme class methods makes a new copy every time, with its own
+ regular expressions, colors and fonts. With many documents open that adds up, so GMCodeEditor and
+ GMSyntaxHighlighter get theirs from the shared registry instead, which loads each file once and keeps it for as
+ long as the file doesn't change on disk.
+
+ Languages come from a [compiled language](GMCompiledLanguage) file when there is an up to date one, and are
+ otherwise loaded as with [GMLanguage languageWithDictionary:].
+
+ The registry can be used from any thread. Don't modify the languages it returns, since everyone else is using them
+ too; load your own copy with GMLanguage if you need to. Themes are handed out as copies, see themeAtPath:.
+ */
+@interface GMRegistry : NSObject
+{
+@private
+  NSMutableDictionary *_entries;
+  NSMutableSet *_loading;
+  NSArray *_searchPaths;
+}
+
+/**
+ The registry shared by the whole process.
+ */
++ (GMRegistry *)sharedRegistry;
+
+/**
+ @name Getting languages and themes
+ */
+/**
+ The shared language loaded from a path.
+ @param path The path of a `.language` plist or a `.languagec` compiled language.
+ @return The language, or nil if the file doesn't exist or can't be loaded. Unless the language has a `name` of its
+ own, it is named after the file.
+ */
+- (NSDictionary *)languageAtPath: (NSString *)path;
+/**
+ The shared language of the given name from the first of the searchPaths that has it, or otherwise from the
+ application bundle, see [GMLanguage languageFromBundleWithName:].
+ 
+ This is also how the languages that grammars nest (with a `language` entry) are found.
+ */
+- (NSDictionary *)languageNamed: (NSString *)name;
+/**
+ Directories to look for `.language` and `.languagec` files in before the application bundle, in order. Tools that
+ load their languages from a directory of their own set it, so that the languages nested in them are found there too.
+ */
+@property (copy) NSArray *searchPaths;
+/**
+ The shared theme loaded from a path.
+ 
+ Each call returns a new copy of the theme, which shares the colors and fonts loaded from the file with the other
+ copies, so it can be modified with [GMTheme setValue:forAttribute:inToken:] without affecting anyone else.
+ @param path The path of a `.theme` plist.
+ @return The theme, or nil if the file doesn't exist.
+ */
+- (GMTheme *)themeAtPath: (NSString *)path;
+/**
+ The shared theme of the given name from the application bundle, see [GMTheme themeFromBundleWithName:].
+ */
+- (GMTheme *)themeNamed: (NSString *)name;
+
+/**
+ Forgets everything that was loaded. Objects that are still in use aren't affected.
+ */
+- (void)removeAllObjects;
+
+@end
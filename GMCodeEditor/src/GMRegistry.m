@@ -0,0 +1,141 @@
+//
+//  GMRegistry.m
+//  Code Editor
+//
+//  Created by Jakub Hampl on 17.10.26.
+//  Copyright (c) 2026 Jakub Hampl. All rights reserved.
+//
+
+#import "GMRegistry.h"
+#import "GMLanguage.h"
+#import "GMCompiledLanguage.h"
+#import "GMTheme.h"
+#import "GMInstrumentation.h"
+#import <dispatch/dispatch.h>
+
+@implementation GMRegistry
+
+@synthesize searchPaths = _searchPaths;
+
++ (GMRegistry *)sharedRegistry
+{
+  static GMRegistry *registry;
+  static dispatch_once_t once;
+  dispatch_once(&once, ^{
+    registry = [[GMRegistry alloc] init];
+  });
+  return registry;
+}
+
+- (id)init
+{
+  if (self = [super init]) {
+    _entries = [NSMutableDictionary dictionary];
+    _loading = [NSMutableSet set];
+  }
+  return self;
+}
+
+// The object loaded from path, as long as the file hasn't been modified since it was loaded.
+- (id)objectAtPath: (NSString *)path loader: (id (^)(void))loader
+{
+  if (!path) {
+    return nil;
+  }
+  NSDate *modified = [[[NSFileManager defaultManager] attributesOfItemAtPath: path error: NULL] fileModificationDate];
+  @synchronized (self) {
+    NSDictionary *entry = _entries[path];
+    if (!modified) {
+      [_entries removeObjectForKey: path];
+      return nil;
+    }
+    if ([entry[@"modified"] isEqualToDate: modified]) {
+      return entry[@"object"];
+    }
+    // Loading a language loads the languages nested in it, which mustn't lead back to itself.
+    if ([_loading containsObject: path]) {
+      return nil;
+    }
+    [_loading addObject: path];
+    id object = loader();
+    [_loading removeObject: path];
+    if (object) {
+      [_entries setObject: @{@"modified": modified, @"object": object} forKey: path];
+    } else {
+      [_entries removeObjectForKey: path];
+    }
+    return object;
+  }
+}
+
+- (NSDictionary *)languageAtPath:(NSString *)path
+{
+  return [self objectAtPath: path loader: ^id {
+    GMInstrumentationMark mark = GMInstrumentationBeginPhase();
+    NSDictionary *lang = [self loadLanguageAtPath: path];
+    GMInstrumentationEndPhase(GMInstrumentationPhaseLanguageLoading, mark);
+    if (!lang || lang[@"name"]) {
+      return lang;
+    }
+    NSMutableDictionary *named = [lang mutableCopy];
+    [named setObject: [[path lastPathComponent] stringByDeletingPathExtension] forKey: @"name"];
+    return [named copy];
+  }];
+}
+
+- (NSDictionary *)loadLanguageAtPath: (NSString *)path
+{
+  if ([[path pathExtension] isEqualToString: @"languagec"]) {
+    return [[GMCompiledLanguage languageWithContentsOfFile: path sourceData: nil] copy];
+  }
+  NSData *source = [NSData dataWithContentsOfFile: path options: NSDataReadingMappedIfSafe error: NULL];
+  if (!source) {
+    return nil;
+  }
+  NSDictionary *compiled = [GMCompiledLanguage languageWithContentsOfFile: [path stringByAppendingString: @"c"] sourceData: source];
+  if (compiled) {
+    return [compiled copy];
+  }
+  NSDictionary *dict = [NSPropertyListSerialization propertyListWithData: source options: NSPropertyListImmutable format: NULL error: NULL];
+  if (![dict isKindOfClass: [NSDictionary class]]) {
+    return nil;
+  }
+  return [[GMLanguage languageWithDictionary: dict] copy];
+}
+
+- (NSDictionary *)languageNamed:(NSString *)name
+{
+  for (NSString *directory in [self searchPaths]) {
+    NSString *path = [directory stringByAppendingPathComponent: name];
+    for (NSString *extension in @[@"language", @"languagec"]) {
+      if ([[NSFileManager defaultManager] fileExistsAtPath: [path stringByAppendingPathExtension: extension]]) {
+        return [self languageAtPath: [path stringByAppendingPathExtension: extension]];
+      }
+    }
+  }
+  NSBundle *bundle = [NSBundle mainBundle];
+  return [self languageAtPath: [bundle pathForResource: name ofType: @"language"] ?: [bundle pathForResource: name ofType: @"languagec"]];
+}
+
+- (GMTheme *)themeAtPath:(NSString *)path
+{
+  // Every caller gets its own copy, which shares the colors and fonts but can be modified on its own.
+  GMTheme *theme = [self objectAtPath: path loader: ^id {
+    return [GMTheme themeAtPath: path];
+  }];
+  return [theme copy];
+}
+
+- (GMTheme *)themeNamed:(NSString *)name
+{
+  return [self themeAtPath: [[NSBundle mainBundle] pathForResource: name ofType: @"theme"]];
+}
+
+- (void)removeAllObjects
+{
+  @synchronized (self) {
+    [_entries removeAllObjects];
+  }
+}
+
+@end
@@ -0,0 +1,81 @@
+//
+//  GMRenderer.h
+//  Code Editor
+//
+//  Created by Jakub Hampl on 17.10.26.
+//  Copyright (c) 2026 Jakub Hampl. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class GMSyntaxHighlighter;
+
+typedef enum {
+  /** `<span class='type'>` elements, like [GMSyntaxHighlighter convertToHTML:] makes. */
+  GMRendererFormatHTML = 0,
+  /** Text with the colors (and bold fonts) of the highlighter's theme as ANSI terminal escape codes. */
+  GMRendererFormatANSI,
+  /** No text, but a line of `location length type` for every token, with the location and length in UTF-16 units. */
+  GMRendererFormatTokens
+} GMRendererFormat;
+
+/**
+ Receives the output of a GMRenderer, a piece at a time. The bytes are only valid for the duration of the call.
+ */
+typedef void (^GMRendererSink)(const uint8_t *bytes, NSUInteger length);
+
+/**
+ GMRenderer turns code into highlighted HTML, terminal output or a list of tokens without going through an
+ NSAttributedString.
+ 
+ Tokens are written out as the highlighter finds them (see [GMSyntaxHighlighter enumerateTokensInText:usingBlock:])
+ into a buffer of a fixed size, which is handed to the sink whenever it fills up. However long the text, the
+ renderer itself never needs more memory than that.
+ 
+     GMRenderer *renderer = [[GMRenderer alloc] initWithHighlighter: sh format: GMRendererFormatHTML
+                                                               sink: ^(const uint8_t *bytes, NSUInteger length) {
+       fwrite(bytes, 1, length, stdout);
+     }];
+     [renderer renderText: code];
+ */
+@interface GMRenderer : NSObject
+{
+@private
+  GMSyntaxHighlighter *_highlighter;
+  GMRendererFormat _format;
+  GMRendererSink _sink;
+  uint8_t *_bytes;
+  NSUInteger _length;
+  NSUInteger _bufferSize;
+  NSMutableDictionary *_escapeCodes;
+}
+
+/**
+ @name Creating a renderer
+ */
+/**
+ Creates a renderer.
+ @param highlighter The highlighter whose language (and for ANSI output, theme) to render with.
+ @param format The output format.
+ @param sink The block the output is written to.
+ */
+- (id)initWithHighlighter: (GMSyntaxHighlighter *)highlighter format: (GMRendererFormat)format sink: (GMRendererSink)sink;
+/**
+ Creates a renderer that writes to an open output stream.
+ */
+- (id)initWithHighlighter: (GMSyntaxHighlighter *)highlighter format: (GMRendererFormat)format outputStream: (NSOutputStream *)stream;
+
+/**
+ The size of the output buffer in bytes. Defaults to 64 KB.
+ */
+@property (nonatomic) NSUInteger bufferSize;
+
+/**
+ @name Rendering
+ */
+/**
+ Renders a string of code. All of the output has been passed to the sink by the time this returns.
+ */
+- (void)renderText: (NSString *)text;
+
+@end
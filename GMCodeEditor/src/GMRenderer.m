@@ -0,0 +1,252 @@
+//
+//  GMRenderer.m
+//  Code Editor
+//
+//  Created by Jakub Hampl on 17.10.26.
+//  Copyright (c) 2026 Jakub Hampl. All rights reserved.
+//
+
+#import "GMRenderer.h"
+#import "GMSyntaxHighlighter.h"
+#ifndef GM_FOUNDATION_ONLY
+#import <AppKit/AppKit.h>
+#endif
+
+#define GMRendererDefaultBufferSize 65536
+// Room for the longest thing written one character at a time, an entity like `&apos;`.
+#define GMRendererMinimumBufferSize 16
+#define GMRendererCharacterChunk 512
+#define GMIsHighSurrogate(c) ((c) >= 0xD800 && (c) <= 0xDBFF)
+#define GMIsLowSurrogate(c) ((c) >= 0xDC00 && (c) <= 0xDFFF)
+
+@implementation GMRenderer
+
+- (id)initWithHighlighter:(GMSyntaxHighlighter *)highlighter format:(GMRendererFormat)format sink:(GMRendererSink)sink
+{
+  if (self = [super init]) {
+    _highlighter = highlighter;
+    _format = format;
+    _sink = [sink copy];
+    _bufferSize = GMRendererDefaultBufferSize;
+    _escapeCodes = [NSMutableDictionary dictionary];
+  }
+  return self;
+}
+
+- (id)initWithHighlighter:(GMSyntaxHighlighter *)highlighter format:(GMRendererFormat)format outputStream:(NSOutputStream *)stream
+{
+  return [self initWithHighlighter: highlighter format: format sink:^(const uint8_t *bytes, NSUInteger length) {
+    while (length > 0) {
+      NSInteger written = [stream write: bytes maxLength: length];
+      if (written <= 0) {
+        NSLog(@"ERROR: %@", [stream streamError]);
+        return;
+      }
+      bytes += written;
+      length -= written;
+    }
+  }];
+}
+
+- (void)dealloc
+{
+  free(_bytes);
+}
+
+- (NSUInteger)bufferSize
+{
+  return _bufferSize;
+}
+
+- (void)setBufferSize:(NSUInteger)bufferSize
+{
+  [self flush];
+  free(_bytes);
+  _bytes = NULL;
+  _bufferSize = MAX(bufferSize, GMRendererMinimumBufferSize);
+}
+
+#pragma mark - Writing
+
+- (void)flush
+{
+  if (_length > 0) {
+    _sink(_bytes, _length);
+    _length = 0;
+  }
+}
+
+// Makes sure there is room for length more bytes.
+- (void)reserve: (NSUInteger)length
+{
+  if (!_bytes) {
+    _bytes = malloc(_bufferSize);
+  }
+  if (_length + length > _bufferSize) {
+    [self flush];
+  }
+}
+
+- (void)writeBytes: (const void *)bytes length: (NSUInteger)length
+{
+  if (length >= _bufferSize) {
+    [self flush];
+    _sink(bytes, length);
+    return;
+  }
+  [self reserve: length];
+  memcpy(_bytes + _length, bytes, length);
+  _length += length;
+}
+
+- (void)writeString: (const char *)string
+{
+  [self writeBytes: string length: strlen(string)];
+}
+
+// Writes a stretch of the text as UTF-8, escaping it for HTML if that is the format.
+- (void)writeText: (NSString *)text range: (NSRange)range
+{
+  unichar characters[GMRendererCharacterChunk];
+  unichar highSurrogate = 0;
+  BOOL html = _format == GMRendererFormatHTML;
+  for (NSUInteger start = range.location; start < NSMaxRange(range); start += GMRendererCharacterChunk) {
+    NSUInteger count = MIN(GMRendererCharacterChunk, NSMaxRange(range) - start);
+    [text getCharacters: characters range: NSMakeRange(start, count)];
+    for (NSUInteger i = 0; i < count; i++) {
+      [self reserve: GMRendererMinimumBufferSize];
+      uint32_t c = characters[i];
+      if (highSurrogate && GMIsLowSurrogate(c)) {
+        c = 0x10000 + ((uint32_t)(highSurrogate - 0xD800) << 10) + (c - 0xDC00);
+        highSurrogate = 0;
+      } else {
+        // An unpaired surrogate can't be encoded, so it becomes a replacement character.
+        if (highSurrogate) {
+          [self writeCharacter: 0xFFFD];
+          highSurrogate = 0;
+        }
+        if (GMIsHighSurrogate(c)) {
+          highSurrogate = c;
+          continue;
+        }
+        if (GMIsLowSurrogate(c)) {
+          c = 0xFFFD;
+        }
+      }
+      if (html) {
+        const char *entity = NULL;
+        switch (c) {
+          case '&': entity = "&amp;"; break;
+          case '<': entity = "&lt;"; break;
+          case '>': entity = "&gt;"; break;
+          case '"': entity = "&quot;"; break;
+          case '\'': entity = "&apos;"; break;
+        }
+        if (entity) {
+          [self writeString: entity];
+          continue;
+        }
+      }
+      [self writeCharacter: c];
+    }
+  }
+  if (highSurrogate) {
+    [self reserve: GMRendererMinimumBufferSize];
+    [self writeCharacter: 0xFFFD];
+  }
+}
+
+// Writes a character as UTF-8. There has to be room for it.
+- (void)writeCharacter: (uint32_t)c
+{
+  uint8_t *out = _bytes + _length;
+  if (c < 0x80) {
+    out[0] = c;
+    _length += 1;
+  } else if (c < 0x800) {
+    out[0] = 0xC0 | (c >> 6);
+    out[1] = 0x80 | (c & 0x3F);
+    _length += 2;
+  } else if (c < 0x10000) {
+    out[0] = 0xE0 | (c >> 12);
+    out[1] = 0x80 | ((c >> 6) & 0x3F);
+    out[2] = 0x80 | (c & 0x3F);
+    _length += 3;
+  } else {
+    out[0] = 0xF0 | (c >> 18);
+    out[1] = 0x80 | ((c >> 12) & 0x3F);
+    out[2] = 0x80 | ((c >> 6) & 0x3F);
+    out[3] = 0x80 | (c & 0x3F);
+    _length += 4;
+  }
+}
+
+#pragma mark - Rendering
+
+// The escape code that sets the theme's formatting of a token type in a terminal, or an empty string.
+- (NSData *)escapeCodeForToken: (NSString *)token
+{
+  NSData *code = _escapeCodes[token];
+  if (!code) {
+    NSDictionary *attributes = [[_highlighter theme] attributesForToken: token];
+    NSMutableString *sequence = [NSMutableString string];
+#ifdef GM_FOUNDATION_ONLY
+    // The theme keeps the strings of the theme file (see [GMTheme initWithDictionary:]), like `13pt Monaco-Bold` and
+    // `#990055`, under the keys AppKit's attribute names stand for.
+    id font = attributes[@"NSFont"], color = attributes[@"NSColor"];
+    if ([font isKindOfClass: [NSString class]] && [font rangeOfString: @"bold" options: NSCaseInsensitiveSearch].location != NSNotFound) {
+      [sequence appendString: @"\e[1m"];
+    }
+    unsigned rgb;
+    if ([color isKindOfClass: [NSString class]] && [color hasPrefix: @"#"] && [[NSScanner scannerWithString: [color substringFromIndex: 1]] scanHexInt: &rgb]) {
+      [sequence appendFormat: @"\e[38;2;%u;%u;%um", (rgb >> 16) & 0xFF, (rgb >> 8) & 0xFF, rgb & 0xFF];
+    }
+#else
+    NSFont *font = attributes[NSFontAttributeName];
+    if (font && ([[NSFontManager sharedFontManager] traitsOfFont: font] & NSBoldFontMask)) {
+      [sequence appendString: @"\e[1m"];
+    }
+    NSColor *color = [attributes[NSForegroundColorAttributeName] colorUsingColorSpace: [NSColorSpace sRGBColorSpace]];
+    if (color) {
+      [sequence appendFormat: @"\e[38;2;%d;%d;%dm", (int)round([color redComponent] * 255), (int)round([color greenComponent] * 255), (int)round([color blueComponent] * 255)];
+    }
+#endif
+    code = [sequence dataUsingEncoding: NSUTF8StringEncoding];
+    [_escapeCodes setObject: code forKey: token];
+  }
+  return code;
+}
+
+- (void)renderText:(NSString *)text
+{
+  [_escapeCodes removeAllObjects];
+  [_highlighter enumerateTokensInText: text usingBlock:^(NSRange range, NSString *tokenType) {
+    if (_format == GMRendererFormatTokens) {
+      if (tokenType) {
+        char position[48];
+        int length = snprintf(position, sizeof(position), "%lu %lu ", (unsigned long)range.location, (unsigned long)range.length);
+        [self writeBytes: position length: length];
+        [self writeText: tokenType range: NSMakeRange(0, [tokenType length])];
+        [self writeString: "\n"];
+      }
+    } else if (!tokenType) {
+      [self writeText: text range: range];
+    } else if (_format == GMRendererFormatHTML) {
+      [self writeString: "<span class='"];
+      [self writeText: tokenType range: NSMakeRange(0, [tokenType length])];
+      [self writeString: "'>"];
+      [self writeText: text range: range];
+      [self writeString: "</span>"];
+    } else {
+      NSData *code = [self escapeCodeForToken: tokenType];
+      [self writeBytes: [code bytes] length: [code length]];
+      [self writeText: text range: range];
+      if ([code length] > 0) {
+        [self writeString: "\e[0m"];
+      }
+    }
+  }];
+  [self flush];
+}
+
+@end
@@ -0,0 +1,111 @@
+//
+//  GMSymbolIndex.h
+//  Code Editor
+//
+//  Created by Jakub Hampl on 17.10.26.
+//  Copyright (c) 2026 Jakub Hampl. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class GMTokenBuffer;
+
+/** The key of the name of a symbol in outline. */
+extern NSString * const GMSymbolNameKey;
+/** The key of the `kind` of the definition a symbol was found by in outline. */
+extern NSString * const GMSymbolKindKey;
+/** The key of the range of a symbol, as an NSValue, in outline. */
+extern NSString * const GMSymbolRangeKey;
+
+/**
+ GMSymbolIndex collects the names a document defines and uses, such as class names, instance variables or CSS
+ selectors, to complete them and to list the outline of the document.
+
+ What counts as a symbol is up to the `symbols` of a [language](LanguageReference): each definition names a token
+ type, and either the text of every such token is a symbol, or the matches of a `pattern` that start in the token
+ are (so that a `def` keyword can yield the name of the method that follows it).
+
+ Symbols are only looked for in the token buffers passed to updateWithTokenBuffer:, so with incremental
+ highlighting only the lines that were tokenized again are searched. Edits of the text are reported to
+ editedRange:changeInLength:, which moves the symbols after the edit and drops the ones it touched.
+ */
+@interface GMSymbolIndex : NSObject
+{
+@private
+  NSArray *_definitions;
+  NSArray *_completes;
+  NSMutableData *_symbols;
+  NSMutableData *_outline;
+  NSUInteger _maximumLength;
+  NSMutableArray *_names;
+  NSMutableDictionary *_nameIDs;
+  NSMutableData *_occurrences;
+  NSUInteger _generation;
+  NSArray *_lastTypeNames;
+  NSArray *_definitionsOfType;
+  NSMutableDictionary *_completions;
+  NSString *_excludedToken;
+  NSUInteger _excludedName;
+  NSArray *_excludedCompletions;
+}
+
+/**
+ Creates an empty index.
+ @param definitions The `symbols` of a language, as processed by GMLanguage.
+ */
+- (id)initWithDefinitions: (NSArray *)definitions;
+
+/**
+ @name Updating the index
+ */
+/**
+ Forgets all symbols.
+ */
+- (void)removeAllSymbols;
+/**
+ Updates the index for an edit of the text. Symbols the edit touches are dropped until their line is highlighted
+ again.
+ @param editedRange The range of the new characters, in the coordinates of the text after the edit.
+ @param delta The change in length caused by the edit.
+ */
+- (void)editedRange: (NSRange)editedRange changeInLength: (NSInteger)delta;
+/**
+ Replaces the symbols that start in the range of a token buffer with the ones found in its tokens.
+ */
+- (void)updateWithTokenBuffer: (GMTokenBuffer *)buffer;
+
+/**
+ @name Querying the index
+ */
+/**
+ The number of symbols found in the document.
+ */
+- (NSUInteger)count;
+/**
+ A number that changes whenever a name is first found or its last occurrence is gone, which is when the results of
+ namesForToken: change.
+ */
+- (NSUInteger)generation;
+/**
+ The names to complete while editing a token, which are those of every definition that `completes` the token.
+ The array is sorted and stays the same object until the generation changes.
+ @param token A token type name, or `text` for text outside of any token.
+ */
+- (NSArray *)namesForToken: (NSString *)token;
+/**
+ Like namesForToken:, but without the name of the symbol at location if it occurs nowhere else, which is usually the
+ word being typed.
+ */
+- (NSArray *)namesForToken: (NSString *)token excludingSymbolAtLocation: (NSUInteger)location;
+/**
+ The symbols of the definitions that are part of the `outline`, in the order of the document.
+ @return An array of dictionaries with the GMSymbolNameKey, GMSymbolKindKey and GMSymbolRangeKey.
+ */
+- (NSArray *)outline;
+/**
+ The last symbol of the outline that starts at or before a location, such as the method the location is in.
+ @return A dictionary like those in outline, or nil if there is none.
+ */
+- (NSDictionary *)outlineSymbolAtLocation: (NSUInteger)location;
+
+@end
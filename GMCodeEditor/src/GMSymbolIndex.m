@@ -0,0 +1,339 @@
+//
+//  GMSymbolIndex.m
+//  Code Editor
+//
+//  Created by Jakub Hampl on 17.10.26.
+//  Copyright (c) 2026 Jakub Hampl. All rights reserved.
+//
+
+#import "GMSymbolIndex.h"
+#import "GMTokenBuffer.h"
+
+NSString * const GMSymbolNameKey = @"GMSymbolName";
+NSString * const GMSymbolKindKey = @"GMSymbolKind";
+NSString * const GMSymbolRangeKey = @"GMSymbolRange";
+
+struct GMSymbol {
+  NSUInteger location;
+  NSUInteger length;
+  uint32_t definition;
+  uint32_t name;
+};
+
+static int GMCompareSymbols(const void *a, const void *b)
+{
+  NSUInteger x = ((const struct GMSymbol *)a)->location, y = ((const struct GMSymbol *)b)->location;
+  return x < y ? -1 : x > y;
+}
+
+// The index of the first symbol of list at or after location.
+static NSUInteger GMIndexOfFirstSymbolFromLocation(NSData *list, NSUInteger location)
+{
+  const struct GMSymbol *symbols = [list bytes];
+  NSUInteger low = 0, high = [list length] / sizeof(struct GMSymbol);
+  while (low < high) {
+    NSUInteger middle = low + (high - low) / 2;
+    if (symbols[middle].location < location) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+static NSRange GMByteRangeOfSymbols(NSUInteger first, NSUInteger last)
+{
+  return NSMakeRange(first * sizeof(struct GMSymbol), (last - first) * sizeof(struct GMSymbol));
+}
+
+@implementation GMSymbolIndex
+
+- (id)initWithDefinitions:(NSArray *)definitions
+{
+  if (self = [super init]) {
+    _definitions = [definitions copy];
+    NSMutableArray *completes = [NSMutableArray arrayWithCapacity: [definitions count]];
+    for (NSDictionary *definition in definitions) {
+      [completes addObject: [NSSet setWithArray: definition[@"completes"] ?: @[]]];
+    }
+    _completes = completes;
+    [self removeAllSymbols];
+  }
+  return self;
+}
+
+#pragma mark - Names
+
+- (void)removeAllSymbols
+{
+  _symbols = [NSMutableData data];
+  _outline = [NSMutableData data];
+  _maximumLength = 0;
+  _names = [NSMutableArray array];
+  _nameIDs = [NSMutableDictionary dictionary];
+  _occurrences = [NSMutableData data];
+  [self namesDidChange];
+}
+
+- (void)namesDidChange
+{
+  _generation++;
+  _completions = [NSMutableDictionary dictionary];
+  _excludedCompletions = nil;
+}
+
+- (uint32_t)IDOfName: (NSString *)name
+{
+  NSNumber *nameID = _nameIDs[name];
+  if (!nameID) {
+    nameID = @([_names count]);
+    _nameIDs[name] = nameID;
+    [_names addObject: name];
+    [_occurrences increaseLengthBy: sizeof(NSUInteger) * [_definitions count]];
+  }
+  return (uint32_t)[nameID unsignedIntegerValue];
+}
+
+- (NSUInteger *)occurrencesOfSymbol: (const struct GMSymbol *)symbol
+{
+  return (NSUInteger *)[_occurrences mutableBytes] + symbol->name * [_definitions count] + symbol->definition;
+}
+
+- (void)countSymbols: (const struct GMSymbol *)symbols count: (NSUInteger)count adding: (BOOL)adding
+{
+  BOOL changed = NO;
+  for (NSUInteger i = 0; i < count; i++) {
+    NSUInteger *occurrences = [self occurrencesOfSymbol: &symbols[i]];
+    if (adding) {
+      changed |= (*occurrences)++ == 0;
+    } else {
+      changed |= --(*occurrences) == 0;
+    }
+  }
+  if (changed) {
+    [self namesDidChange];
+  }
+}
+
+- (BOOL)isOutlineSymbol: (const struct GMSymbol *)symbol
+{
+  return [_definitions[symbol->definition][@"outline"] boolValue];
+}
+
+#pragma mark - Updating the index
+
+- (void)editedRange:(NSRange)editedRange changeInLength:(NSInteger)delta
+{
+  // The replaced characters, in the coordinates of the text before the edit.
+  NSRange replaced = NSMakeRange(editedRange.location, editedRange.length - delta);
+  for (NSMutableData *list in @[_symbols, _outline]) {
+    // No symbol is longer than _maximumLength, so none that starts before this can reach into the edit.
+    NSUInteger first = GMIndexOfFirstSymbolFromLocation(list, replaced.location - MIN(replaced.location, _maximumLength));
+    NSUInteger last = GMIndexOfFirstSymbolFromLocation(list, NSMaxRange(replaced));
+    struct GMSymbol *symbols = [list mutableBytes];
+    NSUInteger count = [list length] / sizeof(struct GMSymbol);
+    for (NSUInteger i = last; i < count; i++) {
+      symbols[i].location += delta;
+    }
+    NSUInteger kept = first;
+    for (NSUInteger i = first; i < last; i++) {
+      if (symbols[i].location + symbols[i].length <= replaced.location) {
+        symbols[kept++] = symbols[i];
+      } else if (list == _symbols) {
+        [self countSymbols: &symbols[i] count: 1 adding: NO];
+      }
+    }
+    [list replaceBytesInRange: GMByteRangeOfSymbols(kept, last) withBytes: NULL length: 0];
+  }
+}
+
+// For each token type of a buffer, the indexes of the definitions that look for symbols in its tokens.
+- (NSArray *)definitionsOfTypeNames: (NSArray *)typeNames
+{
+  if (typeNames != _lastTypeNames) {
+    NSMutableArray *definitionsOfType = [NSMutableArray arrayWithCapacity: [typeNames count]];
+    for (NSString *name in typeNames) {
+      NSMutableArray *definitions = [NSMutableArray array];
+      [_definitions enumerateObjectsUsingBlock:^(NSDictionary *definition, NSUInteger i, BOOL *stop) {
+        if ([definition[@"token"] isEqual: name]) {
+          [definitions addObject: @(i)];
+        }
+      }];
+      [definitionsOfType addObject: definitions];
+    }
+    _lastTypeNames = typeNames;
+    _definitionsOfType = definitionsOfType;
+  }
+  return _definitionsOfType;
+}
+
+- (void)findSymbolsOfDefinition: (uint32_t)definition inToken: (const GMTokenRecord *)token string: (NSString *)string range: (NSRange)range into: (NSMutableData *)found
+{
+  NSRegularExpression *pattern = _definitions[definition][@"pattern"];
+  NSRange tokenRange = NSMakeRange(token->offset, token->length);
+  NSMutableArray *ranges = [NSMutableArray array];
+  if (!pattern) {
+    [ranges addObject: [NSValue valueWithRange: tokenRange]];
+  } else {
+    // Patterns see the rest of the line, so that a keyword token can find the name that follows it.
+    NSUInteger lineEnd;
+    [string getLineStart: NULL end: NULL contentsEnd: &lineEnd forRange: NSMakeRange(token->offset, 0)];
+    NSRange searched = NSMakeRange(token->offset, MAX(lineEnd, NSMaxRange(tokenRange)) - token->offset);
+    [pattern enumerateMatchesInString: string options: 0 range: searched usingBlock:^(NSTextCheckingResult *result, NSMatchingFlags flags, BOOL *stop) {
+      if (result.range.location >= NSMaxRange(tokenRange)) {
+        *stop = YES;
+        return;
+      }
+      NSRange name = [result numberOfRanges] > 1 ? [result rangeAtIndex: 1] : result.range;
+      if (name.location != NSNotFound) {
+        [ranges addObject: [NSValue valueWithRange: name]];
+      }
+    }];
+  }
+  for (NSValue *value in ranges) {
+    NSRange name = [value rangeValue];
+    if (name.length == 0 || !NSLocationInRange(name.location, range)) {
+      continue;
+    }
+    struct GMSymbol symbol = {name.location, name.length, definition, [self IDOfName: [string substringWithRange: name]]};
+    [found appendBytes: &symbol length: sizeof(symbol)];
+  }
+}
+
+- (void)replaceSymbolsInRange: (NSRange)range ofList: (NSMutableData *)list withSymbols: (NSData *)symbols
+{
+  NSUInteger first = GMIndexOfFirstSymbolFromLocation(list, range.location);
+  NSUInteger last = GMIndexOfFirstSymbolFromLocation(list, NSMaxRange(range));
+  if (list == _symbols) {
+    // Counted in before the old ones are counted out, so that finding the same names again changes nothing.
+    [self countSymbols: [symbols bytes] count: [symbols length] / sizeof(struct GMSymbol) adding: YES];
+    [self countSymbols: (const struct GMSymbol *)[list bytes] + first count: last - first adding: NO];
+  }
+  [list replaceBytesInRange: GMByteRangeOfSymbols(first, last) withBytes: [symbols bytes] length: [symbols length]];
+}
+
+- (void)updateWithTokenBuffer:(GMTokenBuffer *)buffer
+{
+  NSArray *definitionsOfType = [self definitionsOfTypeNames: [buffer typeNames]];
+  NSString *string = [buffer string];
+  NSRange range = [buffer range];
+  NSMutableData *found = [NSMutableData data];
+  const GMTokenRecord *records = [buffer records];
+  NSUInteger count = [buffer count];
+  for (NSUInteger i = 0; i < count; i++) {
+    if (records[i].type >= [definitionsOfType count]) {
+      continue;
+    }
+    for (NSNumber *definition in definitionsOfType[records[i].type]) {
+      [self findSymbolsOfDefinition: [definition unsignedIntValue] inToken: &records[i] string: string range: range into: found];
+    }
+  }
+  NSUInteger foundCount = [found length] / sizeof(struct GMSymbol);
+  qsort([found mutableBytes], foundCount, sizeof(struct GMSymbol), GMCompareSymbols);
+
+  NSMutableData *outline = [NSMutableData data];
+  const struct GMSymbol *symbols = [found bytes];
+  for (NSUInteger i = 0; i < foundCount; i++) {
+    _maximumLength = MAX(_maximumLength, symbols[i].length);
+    if ([self isOutlineSymbol: &symbols[i]]) {
+      [outline appendBytes: &symbols[i] length: sizeof(struct GMSymbol)];
+    }
+  }
+  [self replaceSymbolsInRange: range ofList: _symbols withSymbols: found];
+  [self replaceSymbolsInRange: range ofList: _outline withSymbols: outline];
+}
+
+#pragma mark - Querying the index
+
+- (NSUInteger)count
+{
+  return [_symbols length] / sizeof(struct GMSymbol);
+}
+
+- (NSUInteger)generation
+{
+  return _generation;
+}
+
+// The number of symbols named name that the definitions completing token found.
+- (NSUInteger)occurrencesOfName: (NSUInteger)name completingToken: (NSString *)token
+{
+  const NSUInteger *occurrences = (const NSUInteger *)[_occurrences bytes] + name * [_definitions count];
+  NSUInteger total = 0;
+  for (NSUInteger d = 0; d < [_definitions count]; d++) {
+    if (occurrences[d] && [_completes[d] containsObject: token]) {
+      total += occurrences[d];
+    }
+  }
+  return total;
+}
+
+- (NSArray *)namesForToken:(NSString *)token
+{
+  if (!token) {
+    return @[];
+  }
+  NSArray *names = _completions[token];
+  if (!names) {
+    NSMutableArray *found = [NSMutableArray array];
+    for (NSUInteger name = 0; name < [_names count]; name++) {
+      if ([self occurrencesOfName: name completingToken: token]) {
+        [found addObject: _names[name]];
+      }
+    }
+    [found sortUsingSelector: @selector(caseInsensitiveCompare:)];
+    names = _completions[token] = [found copy];
+  }
+  return names;
+}
+
+- (NSArray *)namesForToken:(NSString *)token excludingSymbolAtLocation:(NSUInteger)location
+{
+  NSArray *names = [self namesForToken: token];
+  const struct GMSymbol *symbols = [_symbols bytes];
+  NSUInteger first = GMIndexOfFirstSymbolFromLocation(_symbols, location - MIN(location, _maximumLength));
+  NSUInteger last = GMIndexOfFirstSymbolFromLocation(_symbols, location + 1);
+  for (NSUInteger i = first; i < last; i++) {
+    if (!NSLocationInRange(location, NSMakeRange(symbols[i].location, symbols[i].length)) ||
+        ![_completes[symbols[i].definition] containsObject: token] ||
+        [self occurrencesOfName: symbols[i].name completingToken: token] != 1) {
+      continue;
+    }
+    if (!_excludedCompletions || _excludedName != symbols[i].name || ![_excludedToken isEqualToString: token]) {
+      NSMutableArray *remaining = [names mutableCopy];
+      [remaining removeObject: _names[symbols[i].name]];
+      _excludedCompletions = [remaining copy];
+      _excludedName = symbols[i].name;
+      _excludedToken = [token copy];
+    }
+    return _excludedCompletions;
+  }
+  return names;
+}
+
+- (NSDictionary *)dictionaryOfSymbol: (const struct GMSymbol *)symbol
+{
+  return @{GMSymbolNameKey: _names[symbol->name],
+           GMSymbolKindKey: _definitions[symbol->definition][@"kind"] ?: _definitions[symbol->definition][@"token"],
+           GMSymbolRangeKey: [NSValue valueWithRange: NSMakeRange(symbol->location, symbol->length)]};
+}
+
+- (NSArray *)outline
+{
+  const struct GMSymbol *symbols = [_outline bytes];
+  NSUInteger count = [_outline length] / sizeof(struct GMSymbol);
+  NSMutableArray *outline = [NSMutableArray arrayWithCapacity: count];
+  for (NSUInteger i = 0; i < count; i++) {
+    [outline addObject: [self dictionaryOfSymbol: &symbols[i]]];
+  }
+  return outline;
+}
+
+- (NSDictionary *)outlineSymbolAtLocation:(NSUInteger)location
+{
+  NSUInteger i = GMIndexOfFirstSymbolFromLocation(_outline, location + 1);
+  return i > 0 ? [self dictionaryOfSymbol: (const struct GMSymbol *)[_outline bytes] + i - 1] : nil;
+}
+
+@end
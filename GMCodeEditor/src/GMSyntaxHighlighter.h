@@ -8,6 +8,21 @@
 
 #import <Foundation/Foundation.h>
 #import "GMTheme.h"
+#import "GMLineCache.h"
+#import "GMTokenBuffer.h"
+#import "GMTokenCache.h"
+
+@class GMGrammar;
+
+/** The key of the name of a rule in exceededRules. */
+extern NSString * const GMSyntaxHighlighterRuleKey;
+/** The key of the range a rule was searched in, as an NSValue, in exceededRules. */
+extern NSString * const GMSyntaxHighlighterRangeKey;
+
+typedef enum {
+  GMTokenizerEngineScanner = 0,
+  GMTokenizerEngineRulePasses
+} GMTokenizerEngine;
 
 
 /**
@@ -41,6 +56,73 @@ attribute `"GMToken"` on the result to find what that part of the string was tok
 /** The language definition to tokenize the code with.
  */
 @property (retain) NSDictionary *language;
+/**
+ How tokenize: goes about applying the grammar.
+ 
+ `GMTokenizerEngineScanner` (the default) goes over the text once, in a single left to right pass that reuses
+ matches of earlier searches wherever a pattern allows it. `GMTokenizerEngineRulePasses` is the original
+ implementation, which splits the text into an array of strings and goes over all of them once for every rule.
+ Both produce the same tokens, except where the latter's handling of `predictive` patterns loses text; it is kept
+ around to compare against.
+ */
+@property GMTokenizerEngine engine;
+/**
+ Whether long texts are tokenized on all cores.
+ 
+ When enabled, highlight:, tokenize: and tokenBufferForText: split texts of a few hundred kilobytes and more into
+ chunks of whole lines and tokenize the chunks concurrently, each starting from a fresh tokenizer state. A chunk
+ is then checked against the state the chunk before it ended in, and tokenized again from that state in the rare
+ case the two differ (like when a comment runs across the boundary). The result is the same as without it.
+ 
+ Defaults to `NO`. Only applies to the scanner engine.
+ */
+@property BOOL tokenizesConcurrently;
+/**
+ How deep tokens get nested.
+ 
+ The content of a token whose rule has an `inside` grammar, or a nested `language`, is tokenized with that grammar,
+ and so on for the tokens found in it. Tokens at this depth (the language's own tokens being at depth 0) are left
+ as they are, which keeps grammars that nest languages in each other from going too deep.
+ 
+ Defaults to 8. Only applies to the scanner engine.
+ */
+@property NSUInteger maximumNestingDepth;
+/**
+ A cache of the tokens of texts tokenized before.
+ 
+ When set, tokenBufferForText: (and so highlight:, tokenize: and enumerateTokensInText:usingBlock:, which then
+ goes through a buffer as well) first looks the whole text up in the cache, keyed
+ by the language's `name`, the [fingerprint](GMGrammar fingerprint) of its grammar and maximumNestingDepth, and
+ stores the tokens of any text it has to tokenize. The incremental methods don't use it.
+ 
+ Defaults to nil.
+ */
+@property (retain) GMTokenCache *tokenCache;
+/**
+ How long a single search of a rule may take, in seconds.
+ 
+ Some patterns (typically ones with nested quantifiers, see [GMLanguage warningsForGrammar:]) take exponential time
+ to fail on text they almost match, like a long unterminated string. When a search of a rule takes longer than this,
+ the rule is given up on for the rest of the call: the text it was searched in is left as plain text, and the rule
+ doesn't match anywhere after that. The rule is then reported in exceededRules, and logged.
+ 
+ Defaults to half a second. 0 means no limit. Only applies to the scanner engine.
+ */
+@property NSTimeInterval ruleTimeLimit;
+/**
+ How long the searches of one call may take altogether, in seconds. Whatever hasn't been tokenized by then is left
+ as plain text, and reported the same way as a rule exceeding ruleTimeLimit.
+ 
+ Defaults to 0, no limit. Only applies to the scanner engine.
+ */
+@property NSTimeInterval tokenizingTimeLimit;
+/**
+ The rules that ran out of time in the last call that tokenized anything, as dictionaries with the name of the rule
+ under `GMSyntaxHighlighterRuleKey` and the range it was searched in under `GMSyntaxHighlighterRangeKey`.
+ 
+ Tokens from a call in which a rule ran out of time aren't stored in the tokenCache.
+ */
+@property (readonly) NSArray *exceededRules;
 
 /**
  Highlights a string of source code.
@@ -61,6 +143,92 @@ attribute `"GMToken"` on the result to find what that part of the string was tok
  @return Returns an array that contains NSStrings for pieces of code that were not matched to any token, or GMToken instances that are essentially tuples of a tokenType and a content, which is typically either a string or a list of tokens.
  */
 - (NSArray *)tokenize: (NSString *)text;
+/**
+ Tokenizes a string into a compact GMTokenBuffer.
+ 
+ This is what tokenize: and highlight: use under the hood. Unlike the array tokenize: returns, the buffer doesn't
+ create an object for every token, so it is the better choice for large amounts of text.
+ @param text The code you wish to tokenize.
+ @return A buffer covering the whole text.
+ */
+- (GMTokenBuffer *)tokenBufferForText: (NSString *)text;
+/**
+ @name Incremental highlighting
+ */
+/**
+ The tokenizer state at the start of every line of the text last passed to
+ tokenize:editedRange:changeInLength:tokenizedRange:.
+ 
+ The cache is discarded whenever the language changes.
+ */
+@property (readonly) GMLineCache *lineCache;
+/**
+ Discards the line cache, so that the next incremental call tokenizes the whole text.
+ */
+- (void)invalidateLineCache;
+/**
+ Tokenizes only the lines of a text that are affected by an edit.
+ 
+ The highlighter remembers the tokenizer state at the start of every line (see lineCache). Tokenizing starts at the
+ edited line, or at the line where a token running into it started (so that multi-line constructs like comments
+ are picked up). It continues past the edit until it reaches a line whose text and start state are the same as
+ in the previous run; everything from there on would come out the same, so it stops.
+ 
+ The first call (or the first call after invalidateLineCache) tokenizes the whole text. The same happens if the
+ length of the text doesn't match the edits reported so far.
+ @param text The whole text, after the edit.
+ @param editedRange The range of the edited characters, in the coordinates of the text after the edit.
+ @param delta The change in length caused by the edit.
+ @param tokenizedRange On return, the range of text that the returned tokens cover.
+ @return Tokens in the same format as tokenize: returns, for the characters in tokenizedRange.
+ */
+- (NSArray *)tokenize: (NSString *)text editedRange: (NSRange)editedRange changeInLength: (NSInteger)delta tokenizedRange: (NSRangePointer)tokenizedRange;
+/**
+ Like tokenize:editedRange:changeInLength:tokenizedRange:, but returns a GMTokenBuffer whose range is the range of
+ text that was tokenized.
+ @param text The whole text, after the edit.
+ @param editedRange The range of the edited characters, in the coordinates of the text after the edit.
+ @param delta The change in length caused by the edit.
+ */
+- (GMTokenBuffer *)tokenBufferForText: (NSString *)text editedRange: (NSRange)editedRange changeInLength: (NSInteger)delta;
+/**
+ Carries on tokenizing the part of a text that the lineCache has marked as dirty, but stops at a line boundary that
+ no token crosses.
+ 
+ Edits have to be reported to the lineCache (see [GMLineCache editedRange:changeInLength:]) beforehand.
+ Tokenizing stops as soon as it is back in sync with the previous run, or at the first line starting at or after
+ limit, whichever comes first, but never inside a token like a multi-line comment. In the latter case the rest
+ stays dirty, so calling this repeatedly with increasing limits tokenizes a text bit by bit.
+ @param text The whole text.
+ @param limit The location to stop at, or NSNotFound to go on until back in sync.
+ @return A buffer whose range is the range of text that was tokenized.
+ */
+- (GMTokenBuffer *)tokenBufferForText: (NSString *)text upToLocation: (NSUInteger)limit;
+/**
+ Tokenizes the lines of a text that intersect range, without updating the lineCache.
+ 
+ If the lineCache has caught up to range, tokenizing starts at the line the token running into range started on, if
+ any, and the result is exact. Otherwise it starts afresh at the beginning of the first line, so a token that runs
+ into range from before it (like a long comment) isn't recognized. A token that runs out of range is always included
+ whole, together with the lines it covers. This is meant for showing something sensible quickly, until
+ tokenBufferForText:upToLocation: gets there.
+ @param text The whole text.
+ @param range The range to tokenize. It is extended to whole lines.
+ @return A buffer whose range is the range of text that was tokenized.
+ */
+- (GMTokenBuffer *)tokenBufferForText: (NSString *)text inRange: (NSRange)range;
+/**
+ Highlights only the lines of a text that are affected by an edit.
+ 
+ See tokenize:editedRange:changeInLength:tokenizedRange: for how the affected lines are determined.
+ @param text The whole text, after the edit.
+ @param editedRange The range of the edited characters, in the coordinates of the text after the edit.
+ @param delta The change in length caused by the edit.
+ @param highlightedRange On return, the range of text that the returned string corresponds to.
+ @return An attributed string for highlightedRange of the text.
+ */
+- (NSAttributedString *)highlight: (NSString *)text editedRange: (NSRange)editedRange changeInLength: (NSInteger)delta highlightedRange: (NSRangePointer)highlightedRange;
+
 /**
  Returns an HTML string from a previously highlighted string.
  
@@ -80,17 +248,36 @@ attribute `"GMToken"` on the result to find what that part of the string was tok
 @return An HTML string where tokens are set as class names on spans.
 */
 - (NSString *)convertToHTML: (NSAttributedString *)as;
+/**
+ Goes over the outermost tokens and plain text of a string, in order.
+ 
+ These are what highlighting formats, so they are all that is needed for rendering the code in some other format
+ (see GMRenderer). Unless the language has `predictive` patterns, which need all of the tokens before they can be
+ applied, they come straight from the tokenizer as it goes, without collecting the tokens anywhere.
+ @param text The code to tokenize.
+ @param block Called with the range and type of every token, or a nil type for plain text.
+ */
+- (void)enumerateTokensInText: (NSString *)text usingBlock: (void (^)(NSRange range, NSString *tokenType))block;
 
 @end
 
 
 
 @interface GMToken : NSObject
+{
+@private
+  GMTokenBuffer *_buffer;
+  NSUInteger _index;
+}
 
 @property (retain) NSString *tokenType;
 @property (retain) id content;
 
 - (GMToken *)initWithToken: (NSString *)token inside: (id)inside;
+/**
+ Creates a token that is a view of a record in a GMTokenBuffer. The type and content are looked up when first asked for.
+ */
+- (GMToken *)initWithBuffer: (GMTokenBuffer *)buffer index: (NSUInteger)index;
 - (NSUInteger)contentLength;
 
 + (NSAttributedString *)stringify: (id)token theme: (GMTheme *)theme;
@@ -8,31 +8,1010 @@
 
 #import "GMSyntaxHighlighter.h"
 #import "GMLanguage.h"
+#import "GMRegistry.h"
+#import "GMGrammar.h"
+#import "GMInstrumentation.h"
+#import <dispatch/dispatch.h>
+
+NSString * const GMSyntaxHighlighterRuleKey = @"GMSyntaxHighlighterRule";
+NSString * const GMSyntaxHighlighterRangeKey = @"GMSyntaxHighlighterRange";
+
+typedef void (^GMScannerEmitBlock)(NSRange range, NSUInteger rule);
+
+// The shortest stretch of text worth tokenizing on its own in the concurrent path.
+#define GMMinimumChunkLength 65536
+
+// How far past a fragment a rule is searched at first.
+#define GMScannerMinimumSearchSpan 4096
+
+#define GMDefaultRuleTimeLimit 0.5
+
+// The last match of a rule, and the range it was searched in.
+typedef struct {
+  NSUInteger from;
+  NSUInteger bound;
+  NSRange match;
+  NSRange token;
+  // Set once a search of the rule has run out of time, after which the rule never matches.
+  BOOL exceeded;
+} GMMatchCacheEntry;
+
+// What a scanner measured of one of its rules, while instrumentation is enabled.
+typedef struct {
+  NSUInteger searches;
+  NSUInteger matches;
+  NSTimeInterval time;
+} GMRuleStatistics;
+
+/*
+ How long the searches of one tokenizing run may take: each search of a rule gets a time limit of its own, and all
+ of them together another one. NSRegularExpression can only be stopped from its progress callbacks, so the limits
+ are in time rather than in backtracking steps.
+ 
+ A budget is shared by all the scanners of a run, including those of the concurrent path, and collects the rules
+ that ran out of time so that the highlighter can report them afterwards. While GMInstrumentation is enabled, every
+ run gets a budget, limited or not, which also hands each scanner an array to count its searches and matches in.
+ */
+@interface GMTokenizerBudget : NSObject
+{
+  NSTimeInterval _ruleLimit;
+  NSTimeInterval _deadline;
+  NSMutableArray *_exceeded;
+  BOOL _reportedExhaustion;
+  GMInstrumentationMark _start;
+  NSMutableArray *_statistics;
+  NSMutableArray *_statisticsGrammars;
+}
+
+- (id)initWithRuleLimit: (NSTimeInterval)ruleLimit totalLimit: (NSTimeInterval)totalLimit;
+// Whether there is any limit. A budget without one only collects statistics.
+- (BOOL)isLimited;
+// When the search starting now has to be done by.
+- (NSTimeInterval)deadlineOfSearch;
+// Whether the run is out of time altogether.
+- (BOOL)isExhausted;
+- (void)rule: (NSString *)name exceededBudgetInRange: (NSRange)range;
+// The rules that ran out of time, as dictionaries with the GMSyntaxHighlighterRuleKey and GMSyntaxHighlighterRangeKey.
+- (NSArray *)exceededRules;
+// Zeroed statistics for every rule of a grammar, for a scanner to fill in during the run, or NULL if instrumentation
+// was off when the run started.
+- (GMRuleStatistics *)statisticsForGrammar: (GMGrammar *)grammar;
+// Reports the statistics of the scanners to GMInstrumentation, with nested rules named by their path from grammar,
+// and ends the tokenizing phase the budget was started with.
+- (void)reportStatisticsOfLanguage: (NSString *)language grammar: (GMGrammar *)grammar;
+
+@end
+
+@implementation GMTokenizerBudget
+
+- (id)initWithRuleLimit:(NSTimeInterval)ruleLimit totalLimit:(NSTimeInterval)totalLimit
+{
+  if (self = [super init]) {
+    NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+    _ruleLimit = ruleLimit > 0 ? ruleLimit : DBL_MAX;
+    _deadline = totalLimit > 0 ? now + totalLimit : DBL_MAX;
+    _exceeded = [NSMutableArray array];
+    _start = GMInstrumentationBeginPhase();
+    if (GMInstrumentationEnabled) {
+      _statistics = [NSMutableArray array];
+      _statisticsGrammars = [NSMutableArray array];
+    }
+  }
+  return self;
+}
+
+- (BOOL)isLimited
+{
+  return _ruleLimit != DBL_MAX || _deadline != DBL_MAX;
+}
+
+- (NSTimeInterval)deadlineOfSearch
+{
+  return _ruleLimit == DBL_MAX ? _deadline : MIN([NSDate timeIntervalSinceReferenceDate] + _ruleLimit, _deadline);
+}
+
+- (BOOL)isExhausted
+{
+  return _deadline != DBL_MAX && [NSDate timeIntervalSinceReferenceDate] > _deadline;
+}
+
+- (void)rule:(NSString *)name exceededBudgetInRange:(NSRange)range
+{
+  @synchronized (self) {
+    // Once the run is out of time every rule gives up, but only the first one tripped.
+    if (_reportedExhaustion) {
+      return;
+    }
+    _reportedExhaustion = [self isExhausted];
+    [_exceeded addObject: @{GMSyntaxHighlighterRuleKey: name, GMSyntaxHighlighterRangeKey: [NSValue valueWithRange: range]}];
+  }
+}
+
+- (NSArray *)exceededRules
+{
+  @synchronized (self) {
+    return [_exceeded copy];
+  }
+}
+
+- (GMRuleStatistics *)statisticsForGrammar:(GMGrammar *)grammar
+{
+  if (!_statistics) {
+    return NULL;
+  }
+  NSMutableData *statistics = [NSMutableData dataWithLength: MAX([grammar ruleCount], 1) * sizeof(GMRuleStatistics)];
+  @synchronized (self) {
+    [_statistics addObject: statistics];
+    [_statisticsGrammars addObject: grammar];
+  }
+  return [statistics mutableBytes];
+}
+
+// Names the rules of grammar and of the grammars nested in it, by the rules they are nested in. A grammar reached
+// along more than one path keeps the first.
+static void GMNameRulesOfGrammar(GMGrammar *grammar, NSString *prefix, NSMapTable *names)
+{
+  if ([names objectForKey: grammar]) {
+    return;
+  }
+  NSMutableArray *ruleNames = [NSMutableArray arrayWithCapacity: [grammar ruleCount]];
+  [names setObject: ruleNames forKey: grammar];
+  for (NSUInteger i = 0; i < [grammar ruleCount]; i++) {
+    NSString *name = prefix ? [NSString stringWithFormat: @"%@ > %@", prefix, [grammar nameOfRule: i]] : [grammar nameOfRule: i];
+    [ruleNames addObject: name];
+    GMGrammar *inside = [grammar insideOfRule: i];
+    if (inside) {
+      GMNameRulesOfGrammar(inside, name, names);
+    }
+  }
+}
+
+- (void)reportStatisticsOfLanguage:(NSString *)language grammar:(GMGrammar *)grammar
+{
+  if (!_statistics || !GMInstrumentationEnabled) {
+    return;
+  }
+  NSMapTable *names = [NSMapTable mapTableWithKeyOptions: NSPointerFunctionsObjectPointerPersonality valueOptions: NSPointerFunctionsStrongMemory];
+  GMNameRulesOfGrammar(grammar, nil, names);
+  // Scanners of the same grammar, like those of the chunks of the concurrent path, add up.
+  NSMutableDictionary *totals = [NSMutableDictionary dictionary];
+  @synchronized (self) {
+    for (NSUInteger i = 0; i < [_statistics count]; i++) {
+      GMGrammar *scanned = _statisticsGrammars[i];
+      const GMRuleStatistics *statistics = [_statistics[i] bytes];
+      NSArray *ruleNames = [names objectForKey: scanned];
+      for (NSUInteger rule = 0; rule < [scanned ruleCount]; rule++) {
+        if (statistics[rule].searches == 0) {
+          continue;
+        }
+        NSString *name = ruleNames ? ruleNames[rule] : [scanned nameOfRule: rule];
+        NSDictionary *total = totals[name];
+        [totals setObject: @{GMInstrumentationRuleKey: name,
+                             GMInstrumentationCountKey: @([total[GMInstrumentationCountKey] unsignedIntegerValue] + statistics[rule].searches),
+                             GMInstrumentationMatchesKey: @([total[GMInstrumentationMatchesKey] unsignedIntegerValue] + statistics[rule].matches),
+                             GMInstrumentationSecondsKey: @([total[GMInstrumentationSecondsKey] doubleValue] + statistics[rule].time)}
+                   forKey: name];
+      }
+    }
+  }
+  if ([totals count]) {
+    [[GMInstrumentation sharedInstrumentation] recordRules: [totals allValues] ofLanguage: language];
+  }
+  GMInstrumentationEndPhase(GMInstrumentationPhaseTokenizing, _start);
+}
+
+@end
+
+/*
+ GMScanner applies a grammar the same way -tokenize: does (every rule is matched in the gaps left by the rules before
+ it), but keeps the pending work on an explicit stack instead of splitting the text into an array. That way tokens
+ come out from left to right and the scanner can be stopped at any line boundary, where the stack is the tokenizer
+ state (see GMTokenizerState).
+ 
+ Fragments are matched in place with ranges into the original text. Since NSRegularExpression uses non-transparent,
+ anchoring bounds by default, this behaves exactly as matching substrings would.
+ 
+ Each rule remembers its last match. A rule whose pattern doesn't care about the bounds of the range it is matched in
+ finds the same first match in any part of a range it has already searched, so it only ever has to search a stretch
+ of text again after it has been tokenized up to that point. That makes one pass over the text per rule instead of
+ one per fragment.
+ */
+@interface GMScanner : NSObject
+{
+  NSString *_text;
+  GMGrammar *_grammar;
+  GMMatchCacheEntry *_cache;
+  NSUInteger _limit;
+  GMTokenizerFrame *_frames;
+  NSUInteger _count;
+  NSUInteger _capacity;
+  GMTokenizerBudget *_budget;
+  BOOL _limited;
+  GMRuleStatistics *_statistics;
+}
+
+- (id)initWithText: (NSString *)text grammar: (GMGrammar *)grammar range: (NSRange)range;
+- (id)initWithText: (NSString *)text grammar: (GMGrammar *)grammar state: (GMTokenizerState *)state atLocation: (NSUInteger)location;
+// Starts over on range, keeping the memory allocated so far.
+- (void)resetWithRange: (NSRange)range;
+// Limits how long searches may take. Without a budget they take as long as they take.
+- (void)setBudget: (GMTokenizerBudget *)budget;
+// Emits all tokens and plain text before location.
+- (void)runUpToLocation: (NSUInteger)location emit: (GMScannerEmitBlock)emit;
+// The same, but also returns the state at location.
+- (GMTokenizerState *)scanUpToLocation: (NSUInteger)location emit: (GMScannerEmitBlock)emit;
+// The end of the token that runUpToLocation:emit: stopped at because it started before location and runs past it, or
+// NSNotFound if there is none.
+- (NSUInteger)endOfTokenAcrossLocation: (NSUInteger)location;
+
+@end
+
+@implementation GMScanner
+
+- (id)initWithText:(NSString *)text grammar:(GMGrammar *)grammar
+{
+  if (self = [super init]) {
+    _text = text;
+    _grammar = grammar;
+    _limit = [text length];
+    _cache = calloc(MAX([grammar ruleCount], 1), sizeof(GMMatchCacheEntry));
+    for (NSUInteger i = 0; i < [grammar ruleCount]; i++) {
+      _cache[i].from = NSNotFound;
+    }
+  }
+  return self;
+}
+
+- (id)initWithText:(NSString *)text grammar:(GMGrammar *)grammar range:(NSRange)range
+{
+  if (self = [self initWithText: text grammar: grammar]) {
+    [self resetWithRange: range];
+  }
+  return self;
+}
+
+- (void)setBudget:(GMTokenizerBudget *)budget
+{
+  _budget = budget;
+  _limited = [budget isLimited];
+  _statistics = [budget statisticsForGrammar: _grammar];
+}
+
+- (void)resetWithRange:(NSRange)range
+{
+  for (NSUInteger i = 0; i < [_grammar ruleCount]; i++) {
+    _cache[i].from = NSNotFound;
+  }
+  _count = 0;
+  _limit = NSMaxRange(range);
+  [self pushLocation: range.location end: NSMaxRange(range) rule: 0 token: NO];
+}
+
+- (id)initWithText:(NSString *)text grammar:(GMGrammar *)grammar state:(GMTokenizerState *)state atLocation:(NSUInteger)location
+{
+  if (self = [self initWithText: text grammar: grammar]) {
+    _capacity = MAX([state frameCount], 16);
+    _frames = malloc(_capacity * sizeof(GMTokenizerFrame));
+    [state getFrames: _frames relativeTo: location textLength: _limit];
+    // Drop the frames that rebasing to a shorter text left empty.
+    for (NSUInteger i = 0; i < [state frameCount]; i++) {
+      if (_frames[i].location < _frames[i].end) {
+        _frames[_count++] = _frames[i];
+      }
+    }
+  }
+  return self;
+}
+
+- (void)dealloc
+{
+  free(_frames);
+  free(_cache);
+}
+
+- (void)pushLocation: (NSUInteger)location end: (NSUInteger)end rule: (NSUInteger)rule token: (BOOL)token
+{
+  if (end <= location) {
+    return;
+  }
+  if (_count == _capacity) {
+    _capacity = _capacity ? _capacity * 2 : 16;
+    _frames = realloc(_frames, _capacity * sizeof(GMTokenizerFrame));
+  }
+  _frames[_count++] = (GMTokenizerFrame){(NSInteger)location, (NSInteger)end, rule, token};
+}
+
+// Looks up the first match of a rule in range in the cache, if the cached search tells us.
+- (BOOL)cachedMatchRule: (NSUInteger)rule inRange: (NSRange)range result: (NSRange *)result
+{
+  GMMatchCacheEntry *entry = &_cache[rule];
+  GMRuleFlags flags = [_grammar flagsOfRule: rule];
+  NSUInteger start = range.location, end = NSMaxRange(range);
+  if (entry->exceeded) {
+    *result = NSMakeRange(NSNotFound, 0);
+    return YES;
+  }
+  if (entry->from == NSNotFound || start < entry->from || end > entry->bound) {
+    return NO;
+  }
+  if (((flags & GMRuleStartSensitive) && start != entry->from) || ((flags & GMRuleEndSensitive) && end != entry->bound)) {
+    return NO;
+  }
+  if (entry->match.location == NSNotFound || end <= entry->match.location) {
+    // Nothing before the end of range.
+    *result = NSMakeRange(NSNotFound, 0);
+    return YES;
+  }
+  if (start <= entry->match.location && NSMaxRange(entry->match) <= end) {
+    *result = entry->token;
+    return YES;
+  }
+  return NO;
+}
+
+// Searches range for the first match of a rule and caches it. Returns NO, without caching anything, if the search
+// runs out of time.
+- (BOOL)searchRule: (NSUInteger)rule inRange: (NSRange)range
+{
+  NSRegularExpression *pattern = [_grammar patternOfRule: rule];
+  __block NSTextCheckingResult *match = nil;
+  NSTimeInterval start = _statistics ? [NSDate timeIntervalSinceReferenceDate] : 0;
+  if (!_limited) {
+    match = [pattern firstMatchInString: _text options: 0 range: range];
+  } else {
+    if ([_budget isExhausted]) {
+      return NO;
+    }
+    NSTimeInterval deadline = [_budget deadlineOfSearch];
+    __block BOOL exceeded = NO;
+    [pattern enumerateMatchesInString: _text options: NSMatchingReportProgress range: range usingBlock:^(NSTextCheckingResult *result, NSMatchingFlags flags, BOOL *stop) {
+      if (result) {
+        match = result;
+        *stop = YES;
+      } else if ([NSDate timeIntervalSinceReferenceDate] > deadline) {
+        exceeded = YES;
+        *stop = YES;
+      }
+    }];
+    if (exceeded) {
+      if (_statistics) {
+        _statistics[rule].searches++;
+        _statistics[rule].time += [NSDate timeIntervalSinceReferenceDate] - start;
+      }
+      return NO;
+    }
+  }
+  if (_statistics) {
+    _statistics[rule].searches++;
+    _statistics[rule].time += [NSDate timeIntervalSinceReferenceDate] - start;
+  }
+  GMMatchCacheEntry *entry = &_cache[rule];
+  entry->from = range.location;
+  entry->bound = NSMaxRange(range);
+  entry->match = match ? match.range : NSMakeRange(NSNotFound, 0);
+  entry->token = NSMakeRange(NSNotFound, 0);
+  if (match) {
+    NSUInteger lookbehindLength = ([_grammar flagsOfRule: rule] & GMRuleLookbehind) ? [match rangeAtIndex: 1].length : 0;
+    // Empty tokens would never make progress, so they count as no match.
+    if (match.range.length > lookbehindLength) {
+      entry->token = NSMakeRange(match.range.location + lookbehindLength, match.range.length - lookbehindLength);
+    }
+  }
+  return YES;
+}
+
+// The first token of a rule in range, or NSNotFound. Sets exceeded if the search ran out of time, in which case the
+// rule is given up on for the rest of the run.
+- (NSRange)matchRule: (NSUInteger)rule inRange: (NSRange)range exceeded: (BOOL *)exceeded
+{
+  NSRange token;
+  *exceeded = NO;
+  if ([self cachedMatchRule: rule inRange: range result: &token]) {
+    return token;
+  }
+  // A rule that doesn't care about bounds at all is searched past the end of range, so that the result also answers
+  // for the fragments that follow. The distance doubles with every search, so that a scan that only covers a few
+  // lines doesn't search the rest of the text, while a long scan still searches every part of it about once.
+  NSRange searched = range;
+  if (([_grammar flagsOfRule: rule] & (GMRuleStartSensitive | GMRuleEndSensitive)) == 0 && _limit > NSMaxRange(range)) {
+    GMMatchCacheEntry *entry = &_cache[rule];
+    NSUInteger span = entry->from == NSNotFound ? GMScannerMinimumSearchSpan : MAX(2 * (entry->bound - entry->from), GMScannerMinimumSearchSpan);
+    searched.length = MIN(MAX(span, range.length), _limit - range.location);
+  }
+  if (![self searchRule: rule inRange: searched]) {
+    return [self giveUpOnRule: rule inRange: range exceeded: exceeded];
+  }
+  if (![self cachedMatchRule: rule inRange: range result: &token]) {
+    // The match runs past the end of range, where a shorter one might still fit.
+    if (![self searchRule: rule inRange: range]) {
+      return [self giveUpOnRule: rule inRange: range exceeded: exceeded];
+    }
+    [self cachedMatchRule: rule inRange: range result: &token];
+  }
+  return token;
+}
+
+- (NSRange)giveUpOnRule: (NSUInteger)rule inRange: (NSRange)range exceeded: (BOOL *)exceeded
+{
+  *exceeded = YES;
+  _cache[rule].exceeded = YES;
+  [_budget rule: [_grammar nameOfRule: rule] exceededBudgetInRange: range];
+  return NSMakeRange(NSNotFound, 0);
+}
+
+- (GMTokenizerState *)scanUpToLocation:(NSUInteger)location emit:(GMScannerEmitBlock)emit
+{
+  [self runUpToLocation: location emit: emit];
+  return [[GMTokenizerState alloc] initWithFrames: _frames count: _count relativeTo: location textLength: _limit];
+}
+
+- (NSUInteger)endOfTokenAcrossLocation:(NSUInteger)location
+{
+  if (_count == 0) {
+    return NSNotFound;
+  }
+  GMTokenizerFrame frame = _frames[_count - 1];
+  if (frame.token && frame.location < (NSInteger)location && frame.end > (NSInteger)location) {
+    return (NSUInteger)frame.end;
+  }
+  return NSNotFound;
+}
+
+- (void)runUpToLocation:(NSUInteger)location emit:(GMScannerEmitBlock)emit
+{
+  NSUInteger ruleCount = [_grammar ruleCount];
+  while (_count > 0) {
+    GMTokenizerFrame frame = _frames[_count - 1];
+    NSUInteger start = (NSUInteger)frame.location, end = (NSUInteger)frame.end;
+    if (frame.token) {
+      // Stop at a token that starts at location, or that started before it and runs past it.
+      if (start >= location || end > location) {
+        break;
+      }
+      _count--;
+      emit(NSMakeRange(start, end - start), frame.rule);
+    } else if (frame.rule >= ruleCount) {
+      // Plain text that no rule matched.
+      if (start >= location) {
+        break;
+      }
+      if (end <= location) {
+        _count--;
+        emit(NSMakeRange(start, end - start), NSNotFound);
+      } else {
+        _frames[_count - 1].location = (NSInteger)location;
+        emit(NSMakeRange(start, location - start), NSNotFound);
+        break;
+      }
+    } else {
+      BOOL exceeded;
+      NSRange match = [self matchRule: frame.rule inRange: NSMakeRange(start, end - start) exceeded: &exceeded];
+      _count--;
+      if (exceeded) {
+        // The rule ran out of time somewhere in here, so nothing in here is worth trying further.
+        [self pushLocation: start end: end rule: ruleCount token: NO];
+      } else if (match.location == NSNotFound) {
+        [self pushLocation: start end: end rule: frame.rule + 1 token: NO];
+      } else {
+        // Whatever follows the match is still up for the same rule, what precedes it only for the later ones.
+        if (_statistics) {
+          _statistics[frame.rule].matches++;
+        }
+        [self pushLocation: NSMaxRange(match) end: end rule: frame.rule token: NO];
+        [self pushLocation: match.location end: NSMaxRange(match) rule: frame.rule token: YES];
+        [self pushLocation: start end: match.location rule: frame.rule + 1 token: NO];
+      }
+    }
+  }
+}
+
+@end
+
+/*
+ Collects what a GMScanner emits into a GMTokenBuffer. The content of a token with an inside grammar is tokenized
+ as soon as the token is added, so its records directly follow the token's own.
+ 
+ Every collector keeps a collector for the inside grammar of each of its rules, with a scanner of its own, once the
+ rule first matches. Nested tokens are then tokenized in place, reusing those instead of setting up new ones for
+ every token.
+ */
+@interface GMTokenCollector : NSObject
+{
+  GMTokenBuffer *_buffer;
+  GMGrammar *_grammar;
+  uint32_t _depth;
+  uint32_t _maximumDepth;
+  GMScanner *_scanner;
+  NSMutableArray *_children;
+  GMTokenizerBudget *_budget;
+}
+
+- (id)initWithBuffer: (GMTokenBuffer *)buffer grammar: (GMGrammar *)grammar depth: (uint32_t)depth maximumDepth: (NSUInteger)maximumDepth budget: (GMTokenizerBudget *)budget;
+// Tokenizes range with the grammar and adds the result.
+- (void)collectRange: (NSRange)range;
+- (void)addRange: (NSRange)range rule: (NSUInteger)rule;
+// Runs the predictive patterns of the grammar over the records added since index, which cover range.
+- (void)applyPredictivesFromIndex: (NSUInteger)index inRange: (NSRange)range;
+
+@end
+
+/*
+ A stretch of lines tokenized on its own by the concurrent path of -tokenBufferForText:. Every chunk starts out from a
+ fresh tokenizer state at its first line. It is only right if that is the same state the previous chunk ends in;
+ otherwise it is tokenized again from that state.
+ */
+@interface GMTokenizerChunk : NSObject
+{
+  NSRange _range;
+  NSUInteger _maximumNestingDepth;
+  GMTokenizerBudget *_budget;
+  GMTokenBuffer *_buffer;
+  GMTokenizerState *_startState;
+  GMTokenizerState *_endState;
+}
+
+- (id)initWithRange: (NSRange)range maximumNestingDepth: (NSUInteger)maximumNestingDepth budget: (GMTokenizerBudget *)budget;
+// Tokenizes the chunk starting from state, or from a fresh state if it is nil. The state is rebased to the length of
+// text (see [GMTokenizerState getFrames:relativeTo:textLength:]).
+- (void)tokenizeText: (NSString *)text grammar: (GMGrammar *)grammar fromState: (GMTokenizerState *)state;
+- (GMTokenBuffer *)buffer;
+- (GMTokenizerState *)startState;
+- (GMTokenizerState *)endState;
+
+@end
+
+/*
+ The text a predictive pattern is matched against: the types of the last few tokens, as `<type>`, and the plain text
+ between them. Once there are more tokens than the limit, the oldest token and whatever precedes it are dropped.
+ */
+@interface GMPredictiveWindow : NSObject
+{
+  NSMutableString *_string;
+  NSMutableData *_pieces;
+  NSUInteger _first;
+  NSUInteger _tokens;
+  NSUInteger _limit;
+}
+
+- (id)initWithTokenLimit: (NSUInteger)limit;
+- (NSString *)string;
+- (void)appendText: (NSString *)text;
+- (void)appendTokenOfType: (NSString *)type;
+
+@end
+
+@interface GMSyntaxHighlighter ()
+{
+  GMGrammar *_grammar;
+  uint64_t _grammarFingerprint;
+  NSArray *_exceededRules;
+  NSMutableSet *_loggedRuleNames;
+}
+
+@end
+
+@implementation GMTokenCollector
+
+- (id)initWithBuffer:(GMTokenBuffer *)buffer grammar:(GMGrammar *)grammar depth:(uint32_t)depth maximumDepth:(NSUInteger)maximumDepth budget:(GMTokenizerBudget *)budget
+{
+  if (self = [super init]) {
+    _buffer = buffer;
+    _grammar = grammar;
+    _depth = depth;
+    _maximumDepth = (uint32_t)MIN(maximumDepth, UINT32_MAX);
+    _budget = budget;
+  }
+  return self;
+}
+
+- (void)collectRange:(NSRange)range
+{
+  NSUInteger index = [_buffer count];
+  if (_scanner) {
+    [_scanner resetWithRange: range];
+  } else {
+    _scanner = [[GMScanner alloc] initWithText: [_buffer string] grammar: _grammar range: range];
+    [_scanner setBudget: _budget];
+  }
+  [_scanner runUpToLocation: NSMaxRange(range) emit:^(NSRange r, NSUInteger rule) {
+    [self addRange: r rule: rule];
+  }];
+  [self applyPredictivesFromIndex: index inRange: range];
+}
+
+- (void)addRange:(NSRange)range rule:(NSUInteger)rule
+{
+  if (rule == NSNotFound) {
+    return;
+  }
+  [_buffer addTokenInRange: range type: [_grammar typeIDOfRule: rule] depth: _depth];
+  if (_depth >= _maximumDepth) {
+    return;
+  }
+  GMGrammar *inside = [_grammar insideOfRule: rule];
+  if (inside) {
+    if (!_children) {
+      _children = [NSMutableArray arrayWithCapacity: [_grammar ruleCount]];
+      for (NSUInteger i = 0; i < [_grammar ruleCount]; i++) {
+        [_children addObject: [NSNull null]];
+      }
+    }
+    GMTokenCollector *child = _children[rule];
+    if ((id)child == [NSNull null]) {
+      child = [[GMTokenCollector alloc] initWithBuffer: _buffer grammar: inside depth: _depth + 1 maximumDepth: _maximumDepth budget: _budget];
+      _children[rule] = child;
+    }
+    [child collectRange: range];
+  }
+}
+
+/*
+ The same as -[GMSyntaxHighlighter applyPredictives:toTokens:length:], but on records. Each pattern is matched against
+ the text so far, with tokens replaced by their `<type>`, followed by a stretch of plain text. A match turns the last
+ group into a token and the text after it is tried again.
+ 
+ "The text so far" is only the rule's window of the last few tokens (see [GMGrammar predictiveWindowForName:]), which
+ keeps the pass linear in the length of the text, and it starts out empty for every rule.
+ */
+- (void)applyPredictivesFromIndex:(NSUInteger)index inRange:(NSRange)range
+{
+  GMOrderedDictionary *predictives = [_grammar predictives];
+  if ([predictives count] == 0) {
+    return;
+  }
+  NSString *text = [_buffer string];
+  NSMutableData *records = [NSMutableData dataWithBytes: [_buffer records] + index length: ([_buffer count] - index) * sizeof(GMTokenRecord)];
+  
+  for (NSString *token in predictives) {
+    NSRegularExpression *pattern = predictives[token];
+    GMPredictiveWindow *window = [[GMPredictiveWindow alloc] initWithTokenLimit: [_grammar predictiveWindowForName: token]];
+    GMTokenRecord predicted = {0, 0, [_grammar typeIDForName: token], _depth};
+    const GMTokenRecord *old = [records bytes];
+    NSUInteger count = [records length] / sizeof(GMTokenRecord);
+    NSMutableData *result = [NSMutableData dataWithCapacity: [records length]];
+    NSUInteger location = range.location;
+    
+    for (NSUInteger i = 0; i <= count; i++) {
+      if (i < count && old[i].depth != _depth) {
+        [result appendBytes: &old[i] length: sizeof(GMTokenRecord)];
+        continue;
+      }
+      NSUInteger end = i < count ? old[i].offset : NSMaxRange(range);
+      while (location < end) {
+        NSString *str = [text substringWithRange: NSMakeRange(location, end - location)];
+        NSUInteger prefixLength = [[window string] length];
+        NSString *matchCopy = [[window string] stringByAppendingString: str];
+        NSTextCheckingResult *match = [pattern firstMatchInString: matchCopy options: 0 range: NSMakeRange(0, [matchCopy length])];
+        NSRange r = match ? [match rangeAtIndex: [match numberOfRanges] - 1] : NSMakeRange(NSNotFound, 0);
+        r = r.location == NSNotFound ? r : NSIntersectionRange(r, NSMakeRange(prefixLength, [str length]));
+        if (r.length == 0) {
+          [window appendText: str];
+          break;
+        }
+        NSUInteger before = r.location - prefixLength;
+        [window appendText: [str substringToIndex: before]];
+        [window appendTokenOfType: token];
+        predicted.offset = location + before;
+        predicted.length = r.length;
+        [result appendBytes: &predicted length: sizeof(GMTokenRecord)];
+        location = predicted.offset + predicted.length;
+      }
+      if (i < count) {
+        [window appendTokenOfType: [_buffer nameOfType: old[i].type]];
+        [result appendBytes: &old[i] length: sizeof(GMTokenRecord)];
+        location = old[i].offset + old[i].length;
+      }
+    }
+    records = result;
+  }
+  [_buffer replaceRecordsFromIndex: index withRecords: [records bytes] count: [records length] / sizeof(GMTokenRecord)];
+}
+
+@end
+
+typedef struct {
+  NSUInteger length;
+  BOOL token;
+} GMPredictiveWindowPiece;
+
+@implementation GMPredictiveWindow
+
+- (id)initWithTokenLimit:(NSUInteger)limit
+{
+  if (self = [super init]) {
+    _string = [NSMutableString string];
+    _pieces = [NSMutableData data];
+    _limit = limit;
+  }
+  return self;
+}
+
+- (NSString *)string
+{
+  return _string;
+}
+
+- (void)appendPiece: (NSString *)piece token: (BOOL)token
+{
+  if ([piece length] == 0) {
+    return;
+  }
+  GMPredictiveWindowPiece p = {[piece length], token};
+  [_pieces appendBytes: &p length: sizeof(p)];
+  [_string appendString: piece];
+  if (!token) {
+    return;
+  }
+  _tokens++;
+  NSUInteger drop = 0;
+  GMPredictiveWindowPiece *pieces = [_pieces mutableBytes];
+  while (_tokens > _limit) {
+    drop += pieces[_first].length;
+    if (pieces[_first].token) {
+      _tokens--;
+    }
+    _first++;
+  }
+  if (drop > 0) {
+    [_string deleteCharactersInRange: NSMakeRange(0, drop)];
+  }
+  // Reclaim the dropped pieces once they make up half of the array.
+  NSUInteger count = [_pieces length] / sizeof(GMPredictiveWindowPiece);
+  if (_first > 32 && _first * 2 > count) {
+    [_pieces replaceBytesInRange: NSMakeRange(0, _first * sizeof(GMPredictiveWindowPiece)) withBytes: NULL length: 0];
+    _first = 0;
+  }
+}
+
+- (void)appendText:(NSString *)text
+{
+  [self appendPiece: text token: NO];
+}
+
+- (void)appendTokenOfType:(NSString *)type
+{
+  [self appendPiece: [NSString stringWithFormat: @"<%@>", type] token: YES];
+}
+
+@end
+
+@implementation GMTokenizerChunk
+
+- (id)initWithRange:(NSRange)range maximumNestingDepth:(NSUInteger)maximumNestingDepth budget:(GMTokenizerBudget *)budget
+{
+  if (self = [super init]) {
+    _range = range;
+    _maximumNestingDepth = maximumNestingDepth;
+    _budget = budget;
+  }
+  return self;
+}
+
+- (void)tokenizeText:(NSString *)text grammar:(GMGrammar *)grammar fromState:(GMTokenizerState *)state
+{
+  NSUInteger start = _range.location, end = NSMaxRange(_range);
+  GMScanner *scanner;
+  if (state) {
+    scanner = [[GMScanner alloc] initWithText: text grammar: grammar state: state atLocation: start];
+  } else {
+    scanner = [[GMScanner alloc] initWithText: text grammar: grammar range: NSMakeRange(start, [text length] - start)];
+  }
+  [scanner setBudget: _budget];
+  _buffer = [[GMTokenBuffer alloc] initWithString: text range: _range typeNames: [grammar typeNames]];
+  GMTokenCollector *collector = [[GMTokenCollector alloc] initWithBuffer: _buffer grammar: grammar depth: 0 maximumDepth: _maximumNestingDepth budget: _budget];
+  GMScannerEmitBlock emit = ^(NSRange r, NSUInteger rule) {
+    [collector addRange: r rule: rule];
+  };
+  // Settle the state first, so that it compares equal to the end state of the previous chunk when it should.
+  _startState = [scanner scanUpToLocation: start emit: emit];
+  _endState = [scanner scanUpToLocation: end emit: emit];
+}
+
+- (GMTokenBuffer *)buffer
+{
+  return _buffer;
+}
+
+- (GMTokenizerState *)startState
+{
+  return _startState;
+}
+
+- (GMTokenizerState *)endState
+{
+  return _endState;
+}
+
+@end
 
 @implementation GMSyntaxHighlighter
 
+@synthesize language = _language;
+@synthesize theme = _theme;
+
 - (id)init
 {
   if (self = [super init]) {
-    _theme = [GMTheme themeFromBundleWithName: @"default"];
+    _theme = [[GMRegistry sharedRegistry] themeNamed: @"default"];
     _language = @{@"grammar": @{}};
+    _grammar = [GMGrammar grammarWithDictionary: @{}];
+    _lineCache = [[GMLineCache alloc] init];
+    _maximumNestingDepth = 8;
+    _ruleTimeLimit = GMDefaultRuleTimeLimit;
+    _loggedRuleNames = [NSMutableSet set];
   }
   return self;
 }
 
+- (NSDictionary *)language
+{
+  return _language;
+}
+
+- (void)setLanguage:(NSDictionary *)language
+{
+  _language = language;
+  _grammar = language[@"compiled_grammar"] ?: [GMGrammar grammarWithDictionary: language[@"grammar"]];
+  _grammarFingerprint = 0;
+  @synchronized (self) {
+    [_loggedRuleNames removeAllObjects];
+  }
+  [_theme attributesForTypeNames: [_grammar typeNames]];
+  [self invalidateLineCache];
+}
+
+- (GMTheme *)theme
+{
+  return _theme;
+}
+
+- (void)setTheme:(GMTheme *)theme
+{
+  _theme = theme;
+  // Have the theme work out the attributes of every token type now rather than while highlighting.
+  [theme attributesForTypeNames: [_grammar typeNames]];
+}
+
 - (NSAttributedString *)highlight: (NSString *)text
 {
-  return [GMToken stringify: [self tokenize: text] theme: [self theme]];
+  if (_engine == GMTokenizerEngineRulePasses) {
+    return [GMToken stringify: [self tokenizeWithRulePasses: text] theme: [self theme]];
+  }
+  return [[self tokenBufferForText: text] attributedStringWithTheme: [self theme]];
 }
 
 - (NSArray *)tokenize:(NSString *)text
 {
+  if (_engine == GMTokenizerEngineRulePasses) {
+    return [self tokenizeWithRulePasses: text];
+  }
+  return [[self tokenBufferForText: text] tokens];
+}
+
+- (GMTokenBuffer *)tokenBufferForText:(NSString *)text
+{
+  GMTokenCache *cache = _tokenCache;
+  if (!cache) {
+    GMTokenizerBudget *budget = [self newBudget];
+    GMTokenBuffer *buffer = [self tokenizeIntoBuffer: text budget: budget];
+    [self reportBudget: budget];
+    return buffer;
+  }
+  uint64_t contentHash = GMHashOfString(text), grammarHash = [self grammarHash];
+  NSString *name = _language[@"name"];
+  GMTokenBuffer *buffer = [cache tokenBufferForText: text contentHash: contentHash languageName: name grammarHash: grammarHash typeNames: [_grammar typeNames]];
+  if (!buffer) {
+    GMTokenizerBudget *budget = [self newBudget];
+    buffer = [self tokenizeIntoBuffer: text budget: budget];
+    // Tokens cut short by the budget would stay that way.
+    if ([self reportBudget: budget]) {
+      [cache storeTokenBuffer: buffer contentHash: contentHash languageName: name grammarHash: grammarHash];
+    }
+  }
+  return buffer;
+}
+
+- (GMTokenizerBudget *)newBudget
+{
+  if (_ruleTimeLimit <= 0 && _tokenizingTimeLimit <= 0 && !GMInstrumentationEnabled) {
+    return nil;
+  }
+  return [[GMTokenizerBudget alloc] initWithRuleLimit: _ruleTimeLimit totalLimit: _tokenizingTimeLimit];
+}
+
+// Hands the statistics of the run to GMInstrumentation, makes the rules that ran out of time the exceededRules and
+// logs the ones that haven't been yet. Returns whether all rules kept within the budget.
+- (BOOL)reportBudget: (GMTokenizerBudget *)budget
+{
+  [budget reportStatisticsOfLanguage: _language[@"name"] grammar: _grammar];
+  NSArray *exceeded = [budget exceededRules] ?: @[];
+  @synchronized (self) {
+    _exceededRules = exceeded;
+    for (NSDictionary *entry in exceeded) {
+      NSString *name = entry[GMSyntaxHighlighterRuleKey];
+      if (![_loggedRuleNames containsObject: name]) {
+        [_loggedRuleNames addObject: name];
+        NSLog(@"WARNING: Rule %@ of language %@ ran out of time in %@, leaving the rest of it as plain text.", name,
+              _language[@"name"] ?: @"(unnamed)", NSStringFromRange([entry[GMSyntaxHighlighterRangeKey] rangeValue]));
+      }
+    }
+  }
+  return [exceeded count] == 0;
+}
+
+- (NSArray *)exceededRules
+{
+  @synchronized (self) {
+    return _exceededRules;
+  }
+}
+
+// What the tokens of the grammar depend on, for the token cache.
+- (uint64_t)grammarHash
+{
+  if (!_grammarFingerprint) {
+    _grammarFingerprint = [_grammar fingerprint];
+  }
+  uint64_t hash = _grammarFingerprint ^ _maximumNestingDepth;
+  return hash * 1099511628211ULL;
+}
+
+- (GMTokenBuffer *)tokenizeIntoBuffer: (NSString *)text budget: (GMTokenizerBudget *)budget
+{
+  NSRange range = NSMakeRange(0, [text length]);
+  if (_tokenizesConcurrently && range.length >= 2 * GMMinimumChunkLength) {
+    return [self tokenBufferConcurrentlyForText: text budget: budget];
+  }
+  GMTokenBuffer *buffer = [[GMTokenBuffer alloc] initWithString: text range: range typeNames: [_grammar typeNames]];
+  [[[GMTokenCollector alloc] initWithBuffer: buffer grammar: _grammar depth: 0 maximumDepth: _maximumNestingDepth budget: budget] collectRange: range];
+  return buffer;
+}
+
+- (GMTokenBuffer *)tokenBufferConcurrentlyForText: (NSString *)text budget: (GMTokenizerBudget *)budget
+{
+  NSUInteger length = [text length];
+  // A few chunks per core, so that a core that got an easy one isn't left idle.
+  NSUInteger chunkCount = MIN([[NSProcessInfo processInfo] activeProcessorCount] * 4, length / GMMinimumChunkLength);
+  NSMutableArray *chunks = [NSMutableArray array];
+  NSUInteger start = 0;
+  for (NSUInteger i = 1; i <= chunkCount && start < length; i++) {
+    NSUInteger end = length;
+    if (i < chunkCount) {
+      [text getLineStart: NULL end: &end contentsEnd: NULL forRange: NSMakeRange(MAX(length / chunkCount * i, start), 0)];
+    }
+    [chunks addObject: [[GMTokenizerChunk alloc] initWithRange: NSMakeRange(start, end - start) maximumNestingDepth: _maximumNestingDepth budget: budget]];
+    start = end;
+  }
+  
+  GMGrammar *grammar = _grammar;
+  dispatch_apply([chunks count], dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t i) {
+    [chunks[i] tokenizeText: text grammar: grammar fromState: nil];
+  });
   
+  // Equal states followed by the same text produce the same tokens, so a chunk is right if the one before it ends
+  // in the state it started from. The first one always is.
+  GMTokenBuffer *buffer = [[GMTokenBuffer alloc] initWithString: text range: NSMakeRange(0, length) typeNames: [grammar typeNames]];
+  GMTokenizerState *state = nil;
+  for (GMTokenizerChunk *chunk in chunks) {
+    if (state && ![[chunk startState] isEqual: state]) {
+      [chunk tokenizeText: text grammar: grammar fromState: state];
+    }
+    state = [chunk endState];
+    [buffer replaceRecordsFromIndex: [buffer count] withRecords: [[chunk buffer] records] count: [[chunk buffer] count]];
+  }
+  [[[GMTokenCollector alloc] initWithBuffer: buffer grammar: grammar depth: 0 maximumDepth: 0 budget: nil] applyPredictivesFromIndex: 0 inRange: [buffer range]];
+  return buffer;
+}
+
+- (NSArray *)tokenizeWithRulePasses:(NSString *)text
+{
+  GMInstrumentationMark mark = GMInstrumentationBeginPhase();
   NSMutableArray *strarr = [NSMutableArray arrayWithObject: text];
   GMOrderedDictionary *predictives = [GMOrderedDictionary dictionary];
   
-  for (NSString *token in _language[@"grammar"]) {
-    id val = _language[@"grammar"][token];
+  NSDictionary *grammar = _language[@"grammar"];
+  for (NSString *token in grammar) {
+    id val = grammar[token];
     GMOrderedDictionary *inside;
     NSRegularExpression *pattern;
     NSRegularExpression *predictive;
@@ -92,7 +1071,7 @@
           GMSyntaxHighlighter *sh = [[GMSyntaxHighlighter alloc] init];
           sh.language = @{@"grammar": inside};
           sh.theme = [self theme];
-          wrapped = [[GMToken alloc] initWithToken: token inside: [sh tokenize:slice]];
+          wrapped = [[GMToken alloc] initWithToken: token inside: [sh tokenizeWithRulePasses:slice]];
         } else {
           wrapped = [[GMToken alloc] initWithToken: token inside: slice];
         }
@@ -109,6 +1088,13 @@
     
   }
   
+  [self applyPredictives: predictives toTokens: strarr length: [text length]];
+  GMInstrumentationEndPhase(GMInstrumentationPhaseTokenizing, mark);
+  return strarr;
+}
+
+- (void)applyPredictives: (GMOrderedDictionary *)predictives toTokens: (NSMutableArray *)strarr length: (NSUInteger)length
+{
   NSMutableString *tokenString = [NSMutableString string];
   NSUInteger offset = 0;
   
@@ -116,7 +1102,7 @@
     for (int i = 0; i < [strarr count]; i++) {
       id str = strarr[i];
       
-      if ([strarr count] > [text length]) {
+      if ([strarr count] > length) {
         break;
       }
       
@@ -157,15 +1143,187 @@
       
     }
   }
-  return strarr;
 }
 
 
+#pragma mark - Incremental highlighting
+
+- (void)invalidateLineCache
+{
+  [_lineCache removeAllLines];
+}
+
+- (NSArray *)tokenize:(NSString *)text editedRange:(NSRange)editedRange changeInLength:(NSInteger)delta tokenizedRange:(NSRangePointer)tokenizedRange
+{
+  GMTokenBuffer *buffer = [self tokenBufferForText: text editedRange: editedRange changeInLength: delta];
+  if (tokenizedRange) *tokenizedRange = [buffer range];
+  return [buffer tokens];
+}
+
+- (GMTokenBuffer *)tokenBufferForText:(NSString *)text editedRange:(NSRange)editedRange changeInLength:(NSInteger)delta
+{
+  [_lineCache editedRange: editedRange changeInLength: delta];
+  return [self tokenBufferForText: text upToLocation: NSNotFound];
+}
+
+- (GMTokenBuffer *)tokenBufferForText:(NSString *)text upToLocation:(NSUInteger)limit
+{
+  NSUInteger length = [text length];
+  if ([_lineCache count] == 0 || [_lineCache textLength] != length) {
+    [_lineCache resetWithTextLength: length];
+  }
+  NSRange dirty = [_lineCache dirtyRange];
+  if (dirty.location == NSNotFound) {
+    return [[GMTokenBuffer alloc] initWithString: text range: NSMakeRange(length, 0) typeNames: [_grammar typeNames]];
+  }
+  
+  GMGrammar *grammar = _grammar;
+  NSUInteger safeLine = [_lineCache indexOfSafeLineForLocation: dirty.location];
+  NSUInteger start = safeLine == NSNotFound ? 0 : [_lineCache startOfLineAtIndex: safeLine];
+  NSUInteger dirtyEnd = NSMaxRange(dirty), stop = length;
+  BOOL inSync = YES;
+  
+  GMTokenizerBudget *budget = [self newBudget];
+  GMScanner *scanner = [[GMScanner alloc] initWithText: text grammar: grammar range: NSMakeRange(start, length - start)];
+  [scanner setBudget: budget];
+  GMTokenBuffer *buffer = [[GMTokenBuffer alloc] initWithString: text range: NSMakeRange(start, length - start) typeNames: [grammar typeNames]];
+  GMTokenCollector *collector = [[GMTokenCollector alloc] initWithBuffer: buffer grammar: grammar depth: 0 maximumDepth: _maximumNestingDepth budget: budget];
+  GMScannerEmitBlock emit = ^(NSRange r, NSUInteger rule) {
+    [collector addRange: r rule: rule];
+  };
+  NSMutableData *starts = [NSMutableData data], *hashes = [NSMutableData data];
+  NSMutableArray *states = [NSMutableArray array];
+  
+  NSUInteger lineStart = start;
+  while (lineStart < length) {
+    GMTokenizerState *state = [scanner scanUpToLocation: lineStart emit: emit];
+    NSUInteger lineEnd;
+    [text getLineStart: NULL end: &lineEnd contentsEnd: NULL forRange: NSMakeRange(lineStart, 0)];
+    NSUInteger hash = GMLineHash(text, NSMakeRange(lineStart, lineEnd - lineStart));
+    
+    // Past the edit, a line with the same text and start state as last time is where we are back in sync. Only
+    // ever stop between tokens though, a token that runs past stop wouldn't be emitted at all.
+    BOOL insideToken = [state isInsideToken];
+    if (lineStart > start && lineStart >= dirtyEnd && !insideToken) {
+      NSUInteger cached = [_lineCache indexOfLineStartingAtLocation: lineStart];
+      if (cached != NSNotFound && [_lineCache hashOfLineAtIndex: cached] == hash && [[_lineCache stateAtIndex: cached] isEqual: state]) {
+        stop = lineStart;
+        break;
+      }
+    }
+    [starts appendBytes: &lineStart length: sizeof(NSUInteger)];
+    [hashes appendBytes: &hash length: sizeof(NSUInteger)];
+    [states addObject: state];
+    if (lineStart > start && limit != NSNotFound && lineStart >= limit && !insideToken) {
+      // The state of this line is kept, so that the next call can pick up from here.
+      stop = lineStart;
+      inSync = NO;
+      break;
+    }
+    lineStart = lineEnd;
+  }
+  [scanner runUpToLocation: stop emit: emit];
+  [_lineCache replaceLinesInRange: NSMakeRange(start, stop - start + (inSync ? 0 : 1)) withStarts: starts hashes: hashes states: states];
+  if (!inSync) {
+    // Whatever is left of the dirty range, or at least the line we stopped at, is still to be done.
+    [_lineCache setDirtyRange: NSMakeRange(stop, MAX(dirtyEnd, stop) - stop)];
+  }
+  
+  [buffer setRange: NSMakeRange(start, stop - start)];
+  [collector applyPredictivesFromIndex: 0 inRange: [buffer range]];
+  [self reportBudget: budget];
+  return buffer;
+}
+
+- (GMTokenBuffer *)tokenBufferForText:(NSString *)text inRange:(NSRange)range
+{
+  NSUInteger length = [text length], start;
+  [text getLineStart: &start end: NULL contentsEnd: NULL forRange: NSMakeRange(range.location, 0)];
+  NSUInteger end = NSMaxRange(range) < length ? NSMaxRange([text lineRangeForRange: NSMakeRange(NSMaxRange(range), 0)]) : length;
+  
+  // Before the dirty range the cache knows whether a token runs into range, and where it started. The cached states
+  // themselves are not resumed from: their frames reach ahead to matches in text that may have been edited since.
+  // Past the dirty range, start afresh and hope no token runs into range.
+  NSRange dirty = [_lineCache dirtyRange];
+  if ([_lineCache textLength] == length && (dirty.location == NSNotFound || dirty.location > start)) {
+    NSUInteger safeLine = [_lineCache indexOfSafeLineForLocation: start];
+    if (safeLine != NSNotFound) {
+      start = [_lineCache startOfLineAtIndex: safeLine];
+    }
+  }
+  GMScanner *scanner = [[GMScanner alloc] initWithText: text grammar: _grammar range: NSMakeRange(start, length - start)];
+  GMTokenizerBudget *budget = [self newBudget];
+  [scanner setBudget: budget];
+  GMTokenBuffer *buffer = [[GMTokenBuffer alloc] initWithString: text range: NSMakeRange(start, length - start) typeNames: [_grammar typeNames]];
+  GMTokenCollector *collector = [[GMTokenCollector alloc] initWithBuffer: buffer grammar: _grammar depth: 0 maximumDepth: _maximumNestingDepth budget: budget];
+  GMScannerEmitBlock emit = ^(NSRange r, NSUInteger rule) {
+    [collector addRange: r rule: rule];
+  };
+  [scanner runUpToLocation: end emit: emit];
+  NSUInteger tokenEnd;
+  while ((tokenEnd = [scanner endOfTokenAcrossLocation: end]) != NSNotFound) {
+    // A token that runs out of range (like a long comment) would be left out, so take the lines it covers as well.
+    end = NSMaxRange([text lineRangeForRange: NSMakeRange(tokenEnd - 1, 0)]);
+    [scanner runUpToLocation: end emit: emit];
+  }
+  [buffer setRange: NSMakeRange(start, end - start)];
+  [collector applyPredictivesFromIndex: 0 inRange: [buffer range]];
+  [self reportBudget: budget];
+  return buffer;
+}
+
+- (NSAttributedString *)highlight:(NSString *)text editedRange:(NSRange)editedRange changeInLength:(NSInteger)delta highlightedRange:(NSRangePointer)highlightedRange
+{
+  GMTokenBuffer *buffer = [self tokenBufferForText: text editedRange: editedRange changeInLength: delta];
+  if (highlightedRange) *highlightedRange = [buffer range];
+  return [buffer attributedStringWithTheme: [self theme]];
+}
+
+
+- (void)enumerateTokensInText:(NSString *)text usingBlock:(void (^)(NSRange, NSString *))block
+{
+  NSRange all = NSMakeRange(0, [text length]);
+  GMGrammar *grammar = _grammar;
+  if ([[grammar predictives] count] == 0 && !_tokenCache) {
+    GMTokenizerBudget *budget = [self newBudget];
+    GMScanner *scanner = [[GMScanner alloc] initWithText: text grammar: grammar range: all];
+    [scanner setBudget: budget];
+    [scanner runUpToLocation: NSMaxRange(all) emit:^(NSRange r, NSUInteger rule) {
+      block(r, rule == NSNotFound ? nil : [grammar nameOfRule: rule]);
+    }];
+    [self reportBudget: budget];
+    return;
+  }
+  GMTokenBuffer *buffer = [self tokenBufferForText: text];
+  const GMTokenRecord *records = [buffer records];
+  NSUInteger location = 0;
+  for (NSUInteger i = 0; i < [buffer count]; i++) {
+    if (records[i].depth > 0) {
+      continue;
+    }
+    if (records[i].offset > location) {
+      block(NSMakeRange(location, records[i].offset - location), nil);
+    }
+    block(NSMakeRange(records[i].offset, records[i].length), [buffer nameOfType: records[i].type]);
+    location = records[i].offset + records[i].length;
+  }
+  if (location < NSMaxRange(all)) {
+    block(NSMakeRange(location, NSMaxRange(all) - location), nil);
+  }
+}
+
+// The same entities as CFXMLCreateStringByEscapingEntities(), which needs CoreFoundation. The ampersand goes first, so
+// that the others aren't escaped twice.
+static NSString * const GMHTMLEntities[][2] = {{@"&", @"&amp;"}, {@"<", @"&lt;"}, {@">", @"&gt;"}, {@"\"", @"&quot;"}, {@"'", @"&apos;"}};
+
 - (NSString *)convertToHTML:(NSAttributedString *)as
 {
   NSMutableString *html = [NSMutableString string];
   [as enumerateAttribute: @"GMToken" inRange:NSMakeRange(0, [as length]) options:0 usingBlock:^(id value, NSRange range, BOOL *stop) {
-    NSString *str = (__bridge NSString *)(CFXMLCreateStringByEscapingEntities(NULL, (__bridge CFStringRef)([[as string] substringWithRange: range]), NULL));
+    NSMutableString *str = [[[as string] substringWithRange: range] mutableCopy];
+    for (NSUInteger i = 0; i < sizeof(GMHTMLEntities) / sizeof(GMHTMLEntities[0]); i++) {
+      [str replaceOccurrencesOfString: GMHTMLEntities[i][0] withString: GMHTMLEntities[i][1] options: 0 range: NSMakeRange(0, [str length])];
+    }
     if (value) {
       [html appendFormat: @"<span class='%@'>%@</span>", value, str];
     } else {
@@ -180,6 +1338,9 @@
 
 @implementation GMToken
 
+@synthesize tokenType = _tokenType;
+@synthesize content = _content;
+
 - (GMToken *)initWithToken:(NSString *)token inside:(id)inside
 {
   if (self = [super init]) {
@@ -189,8 +1350,36 @@
   return self;
 }
 
+- (GMToken *)initWithBuffer:(GMTokenBuffer *)buffer index:(NSUInteger)index
+{
+  if (self = [super init]) {
+    _buffer = buffer;
+    _index = index;
+  }
+  return self;
+}
+
+- (NSString *)tokenType
+{
+  if (!_tokenType && _buffer) {
+    _tokenType = [_buffer nameOfType: [_buffer records][_index].type];
+  }
+  return _tokenType;
+}
+
+- (id)content
+{
+  if (!_content && _buffer) {
+    _content = [_buffer contentOfRecordAtIndex: _index];
+  }
+  return _content;
+}
+
 - (NSUInteger)contentLength
 {
+  if (!_content && _buffer) {
+    return [_buffer records][_index].length;
+  }
   if ([_content isKindOfClass: [NSString class]]) {
     return [_content length];
   } else if ([_content isKindOfClass: [NSArray class]]) {
@@ -203,24 +1392,60 @@
   return 0;
 }
 
-+(NSAttributedString *)stringify:(id)token theme: (GMTheme *)theme
+- (void)appendTextToString: (NSMutableString *)string
 {
-  if ([token isKindOfClass: [NSString class]]) {
-    return [[NSAttributedString alloc] initWithString: token attributes: theme.defaultAttributes];
+  if (!_content && _buffer) {
+    GMTokenRecord record = [_buffer records][_index];
+    [string appendString: [[_buffer string] substringWithRange: NSMakeRange(record.offset, record.length)]];
+  } else {
+    [GMToken appendTextOf: _content toString: string];
   }
-  
-  if ([token isKindOfClass: [NSArray class]]) {
-    NSMutableAttributedString *ret = [[NSMutableAttributedString alloc] init];
-    for(id element in token) {
-      [ret appendAttributedString: [GMToken stringify: element theme: theme]];
+}
+
++ (void)appendTextOf: (id)token toString: (NSMutableString *)string
+{
+  if ([token isKindOfClass: [NSString class]]) {
+    [string appendString: token];
+  } else if ([token isKindOfClass: [NSArray class]]) {
+    for (id element in token) {
+      [GMToken appendTextOf: element toString: string];
     }
-    return ret;
+  } else {
+    [token appendTextToString: string];
   }
+}
 
-  NSAttributedString *content = [GMToken stringify: [token content] theme: theme];
+/*
+ A token is formatted as a whole, whatever is nested in it, so only the outermost tokens matter. The text is put
+ together first and the attributes of those tokens applied to their ranges afterwards, in a single attributed string.
+ */
++(NSAttributedString *)stringify:(id)token theme: (GMTheme *)theme
+{
+  GMInstrumentationMark mark = GMInstrumentationBeginPhase();
+  NSArray *elements = [token isKindOfClass: [NSArray class]] ? token : @[token];
+  NSMutableString *text = [NSMutableString string];
+  NSMutableData *ranges = [NSMutableData data];
+  for (id element in elements) {
+    NSRange range = NSMakeRange([text length], 0);
+    [GMToken appendTextOf: element toString: text];
+    if ([element isKindOfClass: [GMToken class]]) {
+      range.length = [text length] - range.location;
+      [ranges appendBytes: &range length: sizeof(NSRange)];
+    }
+  }
   
-  return [theme formatString: content forToken: [token tokenType]];
-
+  NSMutableAttributedString *ret = [[NSMutableAttributedString alloc] initWithString: text attributes: theme.defaultAttributes];
+  const NSRange *tokenRanges = [ranges bytes];
+  NSUInteger i = 0;
+  [ret beginEditing];
+  for (id element in elements) {
+    if ([element isKindOfClass: [GMToken class]]) {
+      [ret setAttributes: [theme attributesForToken: [element tokenType]] range: tokenRanges[i++]];
+    }
+  }
+  [ret endEditing];
+  GMInstrumentationEndPhase(GMInstrumentationPhaseFormatting, mark);
+  return ret;
 }
 
 -(NSString *)description
@@ -13,17 +13,22 @@
  representation of a theme from a stored file system location as well as actually formatting strings.
  
  If you wish to subclass or replace GMTheme in your application (a usefull alternative in some applications
- would surely be a NSUserDefaults based variant for allowing users to customize the theme), the only method
- that this object has to respond to is formatString:forToken:. This method must return an appropriately 
- formated NSAttributedString based on the token name. It also must set the custom attribute `GMToken` to the
- value of the token.
+ would surely be a NSUserDefaults based variant for allowing users to customize the theme), the only methods
+ that this object has to respond to are attributesForToken:, attributesForTypeNames: and formatString:forToken:.
+ These must return the attributes for, or an appropriately formated NSAttributedString based on the token name. They also must set the
+ custom attribute `GMToken` to the value of the token.
  
  ## Serialization Format
  
  d
  
 */
-@interface GMTheme : NSObject
+@interface GMTheme : NSObject <NSCopying>
+{
+@private
+  NSMutableDictionary *_attributes;
+  NSMapTable *_attributeTables;
+}
 @property (retain) NSDictionary *theme;
 
 
@@ -58,6 +63,9 @@
 /**
  Processes a dictionary, turning certain key value pairs into the appropriate data types for NSAttributedString.
  
+ Built with `GM_FOUNDATION_ONLY` defined, as the command line tools are with GNUstep, there is no AppKit to make
+ colors and fonts with, so the attributes keep the strings of the theme file, like `#990055` and `13pt Monaco`.
+ 
  @param dict The theme definition dictionary.
  @return Returns a new GMTheme.
  */
@@ -66,6 +74,7 @@
  Modifies a property for a token without processing.
  
  This is usefull for specifying things that the current format doesn't support like colors with alpha values or fonts created with a matrix.
+ Copies of the theme made before or after are not affected.
  @param value The value of the attribute.
  @param attribute A key that will go into NSAttributedString's attributes property.
  @param token The token you want this setting to apply to. Use `*` to modify the -defaultAttributes.
@@ -84,6 +93,25 @@
  @return An attributed string with appropriate formatting applied.
 */
 - (NSAttributedString *)formatString:(NSAttributedString *)string forToken:(NSString *)token;
+/**
+ Returns the attributes a token is formatted with.
+ 
+ These are the defaultAttributes, overriden by the settings for the token, and the custom attribute `GMToken`.
+ formatString:forToken: applies these to the whole string. The dictionary is worked out once per token type and
+ then shared by all tokens of the type, until the theme is modified.
+ @param token The name of the token which should match the [language](GMLanguage) definition.
+ @return A dictionary of attributes that go into NSAttributedString.
+ */
+- (NSDictionary *)attributesForToken:(NSString *)token;
+/**
+ Returns the attributes for all token types of a grammar.
+ 
+ The table is built the first time it's asked for, which GMSyntaxHighlighter does as soon as it has both a theme and
+ a language, and kept for as long as neither changes.
+ @param typeNames The token type names of a grammar, see [GMGrammar typeNames].
+ @return The attributesForToken: of each type name, indexed by type ID.
+ */
+- (NSArray *)attributesForTypeNames:(NSArray *)typeNames;
 
 /**
  Returns the attributes that should be used for the default string.
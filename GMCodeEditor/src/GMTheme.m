@@ -7,6 +7,10 @@
 //
 
 #import "GMTheme.h"
+#import "GMInstrumentation.h"
+#ifndef GM_FOUNDATION_ONLY
+#import <AppKit/AppKit.h>
+#endif
 
 @implementation GMTheme
 
@@ -29,17 +33,45 @@
 }
 
 
+@synthesize theme = _theme;
+
 - (GMTheme *)initWithDictionary: (NSDictionary *)dict
 {
   if (self = [super init]) {
     _theme = [self processStyleItem: dict];
+    _attributes = [NSMutableDictionary dictionary];
+    _attributeTables = [NSMapTable mapTableWithKeyOptions: NSPointerFunctionsWeakMemory | NSPointerFunctionsObjectPointerPersonality valueOptions: NSPointerFunctionsStrongMemory];
   }
   return self;
 }
 
+- (id)copyWithZone:(NSZone *)zone
+{
+  GMTheme *copy = [[[self class] allocWithZone: zone] init];
+  copy->_attributes = [NSMutableDictionary dictionary];
+  copy->_attributeTables = [NSMapTable mapTableWithKeyOptions: NSPointerFunctionsWeakMemory | NSPointerFunctionsObjectPointerPersonality valueOptions: NSPointerFunctionsStrongMemory];
+  @synchronized (self) {
+    copy->_theme = _theme;
+  }
+  return copy;
+}
+
+- (void)setTheme:(NSDictionary *)theme
+{
+  @synchronized (self) {
+    _theme = theme;
+    [_attributes removeAllObjects];
+    [_attributeTables removeAllObjects];
+  }
+}
+
 
 - (id)processStyleItem: (id)item
 {
+#ifdef GM_FOUNDATION_ONLY
+  // Without AppKit there are no colors and fonts to make, so the strings of the theme file stay as they are.
+  return item;
+#else
   if ([item isKindOfClass: [NSString class]] && [item characterAtIndex: 0] == '#') {
     return [self colorWithHexColorString: [item substringFromIndex: 1]];
   }
@@ -56,8 +88,11 @@
     return ret;
   }
   return item;
+#endif
 }
 
+#ifndef GM_FOUNDATION_ONLY
+
 
 - (NSColor*)colorWithHexColorString:(NSString*)inColorString
 {
@@ -93,26 +128,69 @@
   NSFont *fn = [NSFont fontWithName:name size: size];
   return fn;
 }
+#endif
+
+- (NSDictionary *)attributesForToken:(NSString *)token
+{
+  // Themes are shared between threads (see GMRegistry).
+  @synchronized (self) {
+    NSDictionary *attributes = _attributes[token];
+    if (!attributes) {
+      NSMutableDictionary *def = [NSMutableDictionary dictionaryWithDictionary: [self defaultAttributes]];
+      [def addEntriesFromDictionary: _theme[token]];
+      [def setValue: token forKey: @"GMToken"];
+      attributes = [def copy];
+      [_attributes setObject: attributes forKey: token];
+    }
+    return attributes;
+  }
+}
+
+- (NSArray *)attributesForTypeNames:(NSArray *)typeNames
+{
+  @synchronized (self) {
+    NSArray *table = [_attributeTables objectForKey: typeNames];
+    if ([table count] != [typeNames count]) {
+      NSMutableArray *attributes = [NSMutableArray arrayWithCapacity: [typeNames count]];
+      for (NSString *name in typeNames) {
+        [attributes addObject: [self attributesForToken: name]];
+      }
+      table = [attributes copy];
+      [_attributeTables setObject: table forKey: typeNames];
+    }
+    return table;
+  }
+}
 
 - (NSAttributedString *)formatString:(NSAttributedString *)string forToken:(NSString *)token
 {
-  NSMutableDictionary *def = [NSMutableDictionary dictionaryWithDictionary: [self defaultAttributes]];
-  [def addEntriesFromDictionary: _theme[token]];
-  [def setValue: token forKey: @"GMToken"];
   //  NSLog(@"FormatString: '%@' with def %@", string, def);
+  GMInstrumentationMark mark = GMInstrumentationBeginPhase();
   NSMutableAttributedString *ret = [[NSMutableAttributedString alloc] initWithAttributedString: string];
-  [ret setAttributes: def range: NSMakeRange(0, [string length])];
+  [ret setAttributes: [self attributesForToken: token] range: NSMakeRange(0, [string length])];
+  GMInstrumentationEndPhase(GMInstrumentationPhaseFormatting, mark);
   return ret;
 }
 
 - (NSDictionary *)defaultAttributes
 {
-  return _theme[@"*"];
+  @synchronized (self) {
+    return _theme[@"*"];
+  }
 }
 
 - (void)setValue:(id)value forAttribute:(NSString *)attribute inToken:(NSString *)token
 {
-  [_theme[token] setValue: value forKey: attribute];
+  @synchronized (self) {
+    // Copies of the theme share the dictionaries, so they are replaced rather than changed.
+    NSMutableDictionary *attributes = [NSMutableDictionary dictionaryWithDictionary: _theme[token]];
+    [attributes setValue: value forKey: attribute];
+    NSMutableDictionary *theme = [NSMutableDictionary dictionaryWithDictionary: _theme];
+    [theme setObject: attributes forKey: token];
+    _theme = theme;
+    [_attributes removeAllObjects];
+    [_attributeTables removeAllObjects];
+  }
 }
 
 @end
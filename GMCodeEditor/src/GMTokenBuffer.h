@@ -0,0 +1,117 @@
+//
+//  GMTokenBuffer.h
+//  Code Editor
+//
+//  Created by Jakub Hampl on 17.10.26.
+//  Copyright (c) 2026 Jakub Hampl. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class GMTheme;
+
+/**
+ A token in a GMTokenBuffer.
+
+ `offset` and `length` refer to the string the buffer was tokenized from, `type` is a type ID of the grammar (see
+ [GMGrammar typeNames]) and `depth` is 0 for tokens produced by the language grammar itself, 1 for tokens produced
+ by the `inside` grammar of a depth 0 token and so on.
+ */
+typedef struct {
+  NSUInteger offset;
+  NSUInteger length;
+  uint32_t type;
+  uint32_t depth;
+} GMTokenRecord;
+
+/**
+ GMTokenBuffer is the compact result of tokenizing a string: a contiguous array of token records that refer back to
+ the source string instead of holding copies of it.
+
+ Records are stored in the order their tokens start, with nested tokens following the token they are nested in.
+ Text that isn't covered by a token at some depth is plain text at that depth, so it doesn't need records of its own.
+
+ The tree of NSString and GMToken objects that [GMSyntaxHighlighter tokenize:] returns is available through
+ tokens, which creates GMToken objects that only look up their type and content when asked for them.
+ */
+@interface GMTokenBuffer : NSObject
+{
+@private
+  NSString *_string;
+  NSRange _range;
+  NSArray *_typeNames;
+  GMTokenRecord *_records;
+  NSUInteger _count;
+  NSUInteger _capacity;
+}
+
+/**
+ Creates an empty buffer.
+ @param string The tokenized string.
+ @param range The range of string the buffer covers.
+ @param typeNames The token type names, indexed by type ID.
+ */
+- (id)initWithString: (NSString *)string range: (NSRange)range typeNames: (NSArray *)typeNames;
+
+/**
+ @name Accessing records
+ */
+- (NSString *)string;
+/**
+ The range of the string the buffer covers.
+ */
+- (NSRange)range;
+- (NSArray *)typeNames;
+/**
+ The number of records.
+ */
+- (NSUInteger)count;
+/**
+ The records themselves. The pointer is only valid until the buffer is modified.
+ */
+- (const GMTokenRecord *)records;
+- (NSString *)nameOfType: (uint32_t)type;
+/**
+ The index just past the last record nested inside the record at index.
+ */
+- (NSUInteger)indexAfterChildrenOfRecordAtIndex: (NSUInteger)index;
+
+/**
+ @name Building a buffer
+ */
+- (void)addTokenInRange: (NSRange)range type: (uint32_t)type depth: (NSUInteger)depth;
+/**
+ Changes the range the buffer covers, for when tokenizing stopped short of the end of the original range.
+ */
+- (void)setRange: (NSRange)range;
+/**
+ Replaces all records from index on.
+ */
+- (void)replaceRecordsFromIndex: (NSUInteger)index withRecords: (const GMTokenRecord *)records count: (NSUInteger)count;
+
+/**
+ @name Using the tokens
+ */
+/**
+ The tokens in the same format as [GMSyntaxHighlighter tokenize:] returns them.
+ */
+- (NSArray *)tokens;
+/**
+ The content of the token at index: its text, or an array of the text and tokens nested in it.
+ */
+- (id)contentOfRecordAtIndex: (NSUInteger)index;
+/**
+ Goes over the buffer's range in runs of uniform attributes.
+
+ Since an enclosing token is formatted as a whole, only tokens at depth 0 make a difference; the rest of the text
+ gets the theme's default attributes.
+ @param theme The theme to format tokens with.
+ @param block Called with the attributes and range (in the coordinates of the string) of every run.
+ */
+- (void)enumerateAttributesWithTheme: (GMTheme *)theme usingBlock: (void (^)(NSDictionary *attributes, NSRange range))block;
+/**
+ An attributed string for the buffer's range, the same as [GMToken stringify:theme:] makes of tokens.
+ */
+- (NSAttributedString *)attributedStringWithTheme: (GMTheme *)theme;
+
+@end
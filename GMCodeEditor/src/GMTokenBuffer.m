@@ -0,0 +1,172 @@
+//
+//  GMTokenBuffer.m
+//  Code Editor
+//
+//  Created by Jakub Hampl on 17.10.26.
+//  Copyright (c) 2026 Jakub Hampl. All rights reserved.
+//
+
+#import "GMTokenBuffer.h"
+#import "GMSyntaxHighlighter.h"
+#import "GMTheme.h"
+#import "GMInstrumentation.h"
+
+@implementation GMTokenBuffer
+
+- (id)initWithString:(NSString *)string range:(NSRange)range typeNames:(NSArray *)typeNames
+{
+  if (self = [super init]) {
+    _string = string;
+    _range = range;
+    _typeNames = typeNames;
+  }
+  return self;
+}
+
+- (void)dealloc
+{
+  free(_records);
+}
+
+#pragma mark - Accessing records
+
+- (NSString *)string
+{
+  return _string;
+}
+
+- (NSRange)range
+{
+  return _range;
+}
+
+- (NSArray *)typeNames
+{
+  return _typeNames;
+}
+
+- (NSUInteger)count
+{
+  return _count;
+}
+
+- (const GMTokenRecord *)records
+{
+  return _records;
+}
+
+- (NSString *)nameOfType:(uint32_t)type
+{
+  return _typeNames[type];
+}
+
+- (NSUInteger)indexAfterChildrenOfRecordAtIndex:(NSUInteger)index
+{
+  uint32_t depth = _records[index].depth;
+  NSUInteger i = index + 1;
+  while (i < _count && _records[i].depth > depth) {
+    i++;
+  }
+  return i;
+}
+
+#pragma mark - Building a buffer
+
+- (void)reserveCapacity: (NSUInteger)capacity
+{
+  if (capacity > _capacity) {
+    _capacity = MAX(capacity, _capacity ? _capacity * 2 : 64);
+    _records = realloc(_records, _capacity * sizeof(GMTokenRecord));
+  }
+}
+
+- (void)addTokenInRange:(NSRange)range type:(uint32_t)type depth:(NSUInteger)depth
+{
+  [self reserveCapacity: _count + 1];
+  _records[_count++] = (GMTokenRecord){range.location, range.length, type, (uint32_t)depth};
+}
+
+- (void)setRange:(NSRange)range
+{
+  _range = range;
+}
+
+- (void)replaceRecordsFromIndex:(NSUInteger)index withRecords:(const GMTokenRecord *)records count:(NSUInteger)count
+{
+  [self reserveCapacity: index + count];
+  memmove(_records + index, records, count * sizeof(GMTokenRecord));
+  _count = index + count;
+}
+
+#pragma mark - Using the tokens
+
+// Plain text and tokens at depth between location and end, starting with the record at index.
+- (NSArray *)tokensFromLocation: (NSUInteger)location to: (NSUInteger)end depth: (uint32_t)depth index: (NSUInteger)index
+{
+  NSMutableArray *tokens = [NSMutableArray array];
+  for (NSUInteger i = index; i < _count && _records[i].depth >= depth; i++) {
+    if (_records[i].depth > depth) {
+      continue;
+    }
+    if (_records[i].offset > location) {
+      [tokens addObject: [_string substringWithRange: NSMakeRange(location, _records[i].offset - location)]];
+    }
+    [tokens addObject: [[GMToken alloc] initWithBuffer: self index: i]];
+    location = _records[i].offset + _records[i].length;
+  }
+  if (location < end) {
+    [tokens addObject: [_string substringWithRange: NSMakeRange(location, end - location)]];
+  }
+  return tokens;
+}
+
+- (NSArray *)tokens
+{
+  return [self tokensFromLocation: _range.location to: NSMaxRange(_range) depth: 0 index: 0];
+}
+
+- (id)contentOfRecordAtIndex:(NSUInteger)index
+{
+  GMTokenRecord record = _records[index];
+  if (index + 1 < _count && _records[index + 1].depth > record.depth) {
+    return [self tokensFromLocation: record.offset to: record.offset + record.length depth: record.depth + 1 index: index + 1];
+  }
+  return [_string substringWithRange: NSMakeRange(record.offset, record.length)];
+}
+
+- (void)enumerateAttributesWithTheme:(GMTheme *)theme usingBlock:(void (^)(NSDictionary *, NSRange))block
+{
+  NSDictionary *defaultAttributes = [theme defaultAttributes];
+  NSArray *attributes = [theme attributesForTypeNames: _typeNames];
+  NSUInteger location = _range.location;
+  for (NSUInteger i = 0; i < _count; i++) {
+    GMTokenRecord record = _records[i];
+    if (record.depth > 0) {
+      continue;
+    }
+    if (record.offset > location) {
+      block(defaultAttributes, NSMakeRange(location, record.offset - location));
+    }
+    block(attributes[record.type], NSMakeRange(record.offset, record.length));
+    location = record.offset + record.length;
+  }
+  if (location < NSMaxRange(_range)) {
+    block(defaultAttributes, NSMakeRange(location, NSMaxRange(_range) - location));
+  }
+}
+
+- (NSAttributedString *)attributedStringWithTheme:(GMTheme *)theme
+{
+  GMInstrumentationMark mark = GMInstrumentationBeginPhase();
+  NSMutableAttributedString *string = [[NSMutableAttributedString alloc] initWithString: [_string substringWithRange: _range]];
+  NSUInteger offset = _range.location;
+  [string beginEditing];
+  [self enumerateAttributesWithTheme: theme usingBlock:^(NSDictionary *attributes, NSRange range) {
+    [string setAttributes: attributes range: NSMakeRange(range.location - offset, range.length)];
+  }];
+  [string endEditing];
+  GMInstrumentationEndPhase(GMInstrumentationPhaseFormatting, mark);
+  return string;
+}
+
+@end
@@ -0,0 +1,98 @@
+//
+//  GMTokenCache.h
+//  Code Editor
+//
+//  Created by Jakub Hampl on 17.10.26.
+//  Copyright (c) 2026 Jakub Hampl. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class GMTokenBuffer;
+
+/**
+ GMTokenCache keeps the tokens of texts that have been tokenized before in files in a directory, so that tokenizing
+ the same text with the same grammar again is a matter of reading a file.
+
+ An entry is keyed by a hash of the text (see GMHashOfString()), the name of the language and a hash of the grammar
+ (such as [GMGrammar fingerprint]). The file holds a small header followed by the token records exactly as they
+ are laid out in a GMTokenBuffer, so it is memory mapped and copied into the buffer without any decoding. Like
+ compiled languages, the files are only meant to be read on the kind of machine that wrote them.
+
+ The cache is bounded by maximumSize. Reading an entry marks it as recently used, and when storing an entry takes
+ the directory over the limit, the least recently used entries are removed.
+
+ GMSyntaxHighlighter uses a cache when its tokenCache is set. A cache can be shared between highlighters and threads.
+ */
+@interface GMTokenCache : NSObject
+{
+@private
+  NSString *_directory;
+  unsigned long long _maximumSize;
+  NSUInteger _hits;
+  NSUInteger _misses;
+}
+
+/**
+ A `Tokens` directory in the user's caches directory, under the main bundle's identifier.
+ */
++ (NSString *)defaultDirectory;
+/**
+ Creates a cache, creating its directory if needed.
+ @param directory The directory to keep the entries in. Anything else in it is left alone.
+ @param maximumSize How many bytes the entries may take up, at the most.
+ */
+- (id)initWithDirectory: (NSString *)directory maximumSize: (unsigned long long)maximumSize;
+
+@property (readonly) NSString *directory;
+@property (readonly) unsigned long long maximumSize;
+
+/**
+ @name Using the cache
+ */
+/**
+ Looks up the tokens of a text.
+ @param text The text.
+ @param contentHash GMHashOfString() of the text.
+ @param name The name of the language.
+ @param grammarHash The hash of the grammar.
+ @param typeNames The type names of the grammar, for the buffer.
+ @return A buffer covering the whole text, or nil if the cache has no entry for it.
+ */
+- (GMTokenBuffer *)tokenBufferForText: (NSString *)text contentHash: (uint64_t)contentHash languageName: (NSString *)name grammarHash: (uint64_t)grammarHash typeNames: (NSArray *)typeNames;
+/**
+ Stores the tokens of a text.
+ @param buffer A buffer covering the whole of its string.
+ @param contentHash GMHashOfString() of the buffer's string.
+ @param name The name of the language.
+ @param grammarHash The hash of the grammar.
+ @return Whether the entry was written.
+ */
+- (BOOL)storeTokenBuffer: (GMTokenBuffer *)buffer contentHash: (uint64_t)contentHash languageName: (NSString *)name grammarHash: (uint64_t)grammarHash;
+/**
+ Removes every entry.
+ */
+- (void)removeAllEntries;
+
+/**
+ @name Statistics
+ */
+/**
+ How many lookups found an entry.
+ */
+- (NSUInteger)hits;
+/**
+ How many lookups didn't.
+ */
+- (NSUInteger)misses;
+/**
+ Sets both counters back to 0.
+ */
+- (void)resetStatistics;
+
+@end
+
+/**
+ The 64 bit FNV-1a hash of the UTF-16 characters of a string.
+ */
+extern uint64_t GMHashOfString(NSString *string);
@@ -0,0 +1,225 @@
+//
+//  GMTokenCache.m
+//  Code Editor
+//
+//  Created by Jakub Hampl on 17.10.26.
+//  Copyright (c) 2026 Jakub Hampl. All rights reserved.
+//
+
+#import "GMTokenCache.h"
+#import "GMTokenBuffer.h"
+
+#define GMTokenCacheVersion 1
+#define GMTokenCacheExtension @"tokens"
+#define GMHashChunkLength 4096
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint32_t recordSize;
+  uint32_t typeCount;
+  uint64_t contentHash;
+  uint64_t nameHash;
+  uint64_t grammarHash;
+  uint64_t textLength;
+  uint64_t recordCount;
+} GMTokenCacheHeader;
+
+static uint64_t GMHashBytes(uint64_t hash, const void *bytes, NSUInteger length)
+{
+  const uint8_t *b = bytes;
+  for (NSUInteger i = 0; i < length; i++) {
+    hash ^= b[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+uint64_t GMHashOfString(NSString *string)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  NSUInteger length = [string length];
+  unichar characters[GMHashChunkLength];
+  for (NSUInteger start = 0; start < length; start += GMHashChunkLength) {
+    NSUInteger count = MIN((NSUInteger)GMHashChunkLength, length - start);
+    [string getCharacters: characters range: NSMakeRange(start, count)];
+    hash = GMHashBytes(hash, characters, count * sizeof(unichar));
+  }
+  return hash;
+}
+
+@implementation GMTokenCache
+
+@synthesize directory = _directory;
+@synthesize maximumSize = _maximumSize;
+
++ (NSString *)defaultDirectory
+{
+  NSString *caches = [NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES) firstObject] ?: NSTemporaryDirectory();
+  NSString *identifier = [[NSBundle mainBundle] bundleIdentifier] ?: @"GMCodeEditor";
+  return [[caches stringByAppendingPathComponent: identifier] stringByAppendingPathComponent: @"Tokens"];
+}
+
+- (id)initWithDirectory:(NSString *)directory maximumSize:(unsigned long long)maximumSize
+{
+  if (self = [super init]) {
+    _directory = [directory copy];
+    _maximumSize = maximumSize;
+    [[NSFileManager defaultManager] createDirectoryAtPath: directory withIntermediateDirectories: YES attributes: nil error: NULL];
+  }
+  return self;
+}
+
+- (NSString *)pathForContentHash: (uint64_t)contentHash nameHash: (uint64_t)nameHash grammarHash: (uint64_t)grammarHash
+{
+  uint64_t key = GMHashBytes(GMHashBytes(14695981039346656037ULL, &nameHash, sizeof(nameHash)), &grammarHash, sizeof(grammarHash));
+  NSString *file = [NSString stringWithFormat: @"%016llx-%016llx.%@", contentHash, key, GMTokenCacheExtension];
+  return [_directory stringByAppendingPathComponent: file];
+}
+
+static uint64_t GMHashOfName(NSString *name)
+{
+  const char *utf8 = [name UTF8String] ?: "";
+  return GMHashBytes(14695981039346656037ULL, utf8, strlen(utf8));
+}
+
+#pragma mark - Using the cache
+
+- (GMTokenBuffer *)tokenBufferForText:(NSString *)text contentHash:(uint64_t)contentHash languageName:(NSString *)name grammarHash:(uint64_t)grammarHash typeNames:(NSArray *)typeNames
+{
+  uint64_t nameHash = GMHashOfName(name);
+  NSString *path = [self pathForContentHash: contentHash nameHash: nameHash grammarHash: grammarHash];
+  GMTokenBuffer *buffer = [self tokenBufferAtPath: path text: text contentHash: contentHash nameHash: nameHash grammarHash: grammarHash typeNames: typeNames];
+  @synchronized (self) {
+    if (buffer) {
+      _hits++;
+    } else {
+      _misses++;
+    }
+  }
+  if (buffer) {
+    [[NSURL fileURLWithPath: path] setResourceValue: [NSDate date] forKey: NSURLContentModificationDateKey error: NULL];
+  }
+  return buffer;
+}
+
+- (GMTokenBuffer *)tokenBufferAtPath: (NSString *)path text: (NSString *)text contentHash: (uint64_t)contentHash nameHash: (uint64_t)nameHash grammarHash: (uint64_t)grammarHash typeNames: (NSArray *)typeNames
+{
+  NSData *data = [NSData dataWithContentsOfFile: path options: NSDataReadingMappedIfSafe error: NULL];
+  if ([data length] < sizeof(GMTokenCacheHeader)) {
+    return nil;
+  }
+  const GMTokenCacheHeader *header = [data bytes];
+  NSUInteger length = [text length];
+  if (memcmp(header->magic, "GMTC", 4) != 0 || header->version != GMTokenCacheVersion || header->recordSize != sizeof(GMTokenRecord) ||
+      header->typeCount != [typeNames count] || header->contentHash != contentHash || header->nameHash != nameHash ||
+      header->grammarHash != grammarHash || header->textLength != length ||
+      header->recordCount > ([data length] - sizeof(GMTokenCacheHeader)) / sizeof(GMTokenRecord)) {
+    return nil;
+  }
+  // The hash could still collide, or the file be damaged; neither may lead out of the text.
+  const GMTokenRecord *records = (const GMTokenRecord *)(header + 1);
+  NSUInteger count = (NSUInteger)header->recordCount;
+  for (NSUInteger i = 0; i < count; i++) {
+    if (records[i].offset > length || records[i].length > length - records[i].offset || records[i].type >= header->typeCount) {
+      return nil;
+    }
+  }
+  GMTokenBuffer *buffer = [[GMTokenBuffer alloc] initWithString: text range: NSMakeRange(0, length) typeNames: typeNames];
+  [buffer replaceRecordsFromIndex: 0 withRecords: records count: count];
+  return buffer;
+}
+
+- (BOOL)storeTokenBuffer:(GMTokenBuffer *)buffer contentHash:(uint64_t)contentHash languageName:(NSString *)name grammarHash:(uint64_t)grammarHash
+{
+  NSString *text = [buffer string];
+  if (!NSEqualRanges([buffer range], NSMakeRange(0, [text length]))) {
+    return NO;
+  }
+  uint64_t nameHash = GMHashOfName(name);
+  GMTokenCacheHeader header = {{'G', 'M', 'T', 'C'}, GMTokenCacheVersion, sizeof(GMTokenRecord), (uint32_t)[[buffer typeNames] count],
+    contentHash, nameHash, grammarHash, [text length], [buffer count]};
+  NSString *path = [self pathForContentHash: contentHash nameHash: nameHash grammarHash: grammarHash];
+
+  // Written atomically, so that readers never see half of an entry and a failed write (like a full disk) leaves
+  // nothing behind.
+  NSMutableData *data = [NSMutableData dataWithCapacity: sizeof(header) + [buffer count] * sizeof(GMTokenRecord)];
+  [data appendBytes: &header length: sizeof(header)];
+  [data appendBytes: [buffer records] length: [buffer count] * sizeof(GMTokenRecord)];
+  NSError *err;
+  if (![data writeToFile: path options: NSDataWritingAtomic error: &err]) {
+    NSLog(@"WARNING: Can't store tokens in %@: %@", path, err);
+    return NO;
+  }
+  [self evictEntries];
+  return YES;
+}
+
+// Removes the least recently used entries until the entries fit in maximumSize.
+- (void)evictEntries
+{
+  NSArray *keys = @[NSURLContentModificationDateKey, NSURLFileSizeKey];
+  NSArray *urls = [[NSFileManager defaultManager] contentsOfDirectoryAtURL: [NSURL fileURLWithPath: _directory] includingPropertiesForKeys: keys options: NSDirectoryEnumerationSkipsHiddenFiles error: NULL];
+  NSMutableArray *entries = [NSMutableArray array];
+  unsigned long long total = 0;
+  for (NSURL *url in urls) {
+    if (![[url pathExtension] isEqualToString: GMTokenCacheExtension]) {
+      continue;
+    }
+    NSDictionary *values = [url resourceValuesForKeys: keys error: NULL];
+    if (values) {
+      total += [values[NSURLFileSizeKey] unsignedLongLongValue];
+      [entries addObject: @{@"url": url, @"values": values}];
+    }
+  }
+  if (total <= _maximumSize) {
+    return;
+  }
+  [entries sortUsingComparator: ^NSComparisonResult(NSDictionary *a, NSDictionary *b) {
+    return [a[@"values"][NSURLContentModificationDateKey] compare: b[@"values"][NSURLContentModificationDateKey]];
+  }];
+  for (NSDictionary *entry in entries) {
+    if (total <= _maximumSize) {
+      break;
+    }
+    if ([[NSFileManager defaultManager] removeItemAtURL: entry[@"url"] error: NULL]) {
+      total -= [entry[@"values"][NSURLFileSizeKey] unsignedLongLongValue];
+    }
+  }
+}
+
+- (void)removeAllEntries
+{
+  NSArray *urls = [[NSFileManager defaultManager] contentsOfDirectoryAtURL: [NSURL fileURLWithPath: _directory] includingPropertiesForKeys: nil options: NSDirectoryEnumerationSkipsHiddenFiles error: NULL];
+  for (NSURL *url in urls) {
+    if ([[url pathExtension] isEqualToString: GMTokenCacheExtension]) {
+      [[NSFileManager defaultManager] removeItemAtURL: url error: NULL];
+    }
+  }
+}
+
+#pragma mark - Statistics
+
+- (NSUInteger)hits
+{
+  @synchronized (self) {
+    return _hits;
+  }
+}
+
+- (NSUInteger)misses
+{
+  @synchronized (self) {
+    return _misses;
+  }
+}
+
+- (void)resetStatistics
+{
+  @synchronized (self) {
+    _hits = 0;
+    _misses = 0;
+  }
+}
+
+@end
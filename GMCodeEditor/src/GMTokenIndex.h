@@ -0,0 +1,114 @@
+//
+//  GMTokenIndex.h
+//  Code Editor
+//
+//  Created by Jakub Hampl on 17.10.26.
+//  Copyright (c) 2026 Jakub Hampl. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class GMTokenBuffer;
+
+/**
+ GMTokenIndex answers what token a text has at some offset, and where the next or previous token of some type is,
+ from the token buffers a GMSyntaxHighlighter produces rather than from the attributes they are turned into.
+
+ The tokens are kept twice: once per nesting depth, where the tokens of one depth never overlap and so form a sorted
+ list of intervals, and once per token type. Finding the token at an offset is a binary search on each depth down to
+ the innermost token there, and finding the next token of a type a binary search on the tokens of that type.
+
+ The index is kept up to date the same way as GMBracketIndex: every edit of the text is reported to
+ editedRange:changeInLength:, which moves the tokens after it and stretches the tokens around it, and every token
+ buffer the text is highlighted with is passed to updateWithTokenBuffer:, which replaces the tokens in its range.
+ As in GMLineIndex, the move of the tokens after an edit is kept pending rather than written to each of them, so an
+ edit only rewrites the tokens around it.
+ GMCodeEditor keeps one for its text (see [GMCodeEditor tokenIndex]).
+ */
+@interface GMTokenIndex : NSObject
+{
+@private
+  NSArray *_typeNames;
+  NSMutableDictionary *_typeIDs;
+  NSMutableArray *_levels;
+  NSMutableArray *_types;
+}
+
+/**
+ @name Updating the index
+ */
+/**
+ Forgets all tokens.
+ */
+- (void)removeAllTokens;
+/**
+ Updates the index for an edit of the text.
+
+ Tokens after the edit move along, tokens that the edit falls in grow or shrink with it, and tokens that were
+ replaced altogether are removed. The tokens are exact again once the edited lines are highlighted.
+ @param editedRange The range of the new characters, in the coordinates of the text after the edit.
+ @param delta The change in length caused by the edit.
+ */
+- (void)editedRange: (NSRange)editedRange changeInLength: (NSInteger)delta;
+/**
+ Replaces the tokens in the range of a buffer with those of the buffer.
+
+ A buffer with different type names than the buffers before it (as after the language changed) replaces all tokens.
+ */
+- (void)updateWithTokenBuffer: (GMTokenBuffer *)buffer;
+
+/**
+ @name Querying the index
+ */
+/**
+ The number of tokens, at all depths.
+ */
+- (NSUInteger)count;
+/**
+ The token type names of the buffers the tokens come from, indexed by type ID.
+ */
+- (NSArray *)typeNames;
+/**
+ The innermost token a character is in.
+ @param location The index of the character.
+ @param type On return, the type of the token, or nil if there is none. May be NULL.
+ @return The range of the token, or `{NSNotFound, 0}` if the character is plain text.
+ */
+- (NSRange)rangeOfTokenAtLocation: (NSUInteger)location type: (NSString **)type;
+/**
+ The token at a given depth that a character is in. Depth 0 are the tokens of the language itself, which are the
+ ones highlighting formats.
+ @param location The index of the character.
+ @param depth The nesting depth.
+ @param type On return, the type of the token, or nil if there is none. May be NULL.
+ @return The range of the token, or `{NSNotFound, 0}` if there is no token of that depth at location.
+ */
+- (NSRange)rangeOfTokenAtLocation: (NSUInteger)location depth: (NSUInteger)depth type: (NSString **)type;
+/**
+ The first token at a given depth that starts at or after a location, which is where the plain text at that depth
+ ends if the location is in plain text.
+ @param location The index of a character.
+ @param depth The nesting depth.
+ @param type On return, the type of the token, or nil if there is none. May be NULL.
+ @return The range of the token, or `{NSNotFound, 0}` if there is none.
+ */
+- (NSRange)rangeOfNextTokenFromLocation: (NSUInteger)location depth: (NSUInteger)depth type: (NSString **)type;
+/**
+ The innermost token that contains all of a range.
+ @param range A range of the text. An empty range is contained by the token its location is in.
+ @param type On return, the type of the token, or nil if there is none. May be NULL.
+ @return The range of the token, or `{NSNotFound, 0}` if no token contains range.
+ */
+- (NSRange)rangeOfTokenEnclosingRange: (NSRange)range type: (NSString **)type;
+/**
+ The first token of a type that starts at or after a location, at any depth.
+ @return The range of the token, or `{NSNotFound, 0}` if there is none.
+ */
+- (NSRange)rangeOfNextTokenOfType: (NSString *)type fromLocation: (NSUInteger)location;
+/**
+ The last token of a type that starts before a location, at any depth.
+ @return The range of the token, or `{NSNotFound, 0}` if there is none.
+ */
+- (NSRange)rangeOfPreviousTokenOfType: (NSString *)type beforeLocation: (NSUInteger)location;
+
+@end
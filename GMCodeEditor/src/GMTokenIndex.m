@@ -0,0 +1,408 @@
+//
+//  GMTokenIndex.m
+//  Code Editor
+//
+//  Created by Jakub Hampl on 17.10.26.
+//  Copyright (c) 2026 Jakub Hampl. All rights reserved.
+//
+
+#import "GMTokenIndex.h"
+#import "GMTokenBuffer.h"
+
+static NSUInteger GMEndOfRecord(const GMTokenRecord *record)
+{
+  return record->offset + record->length;
+}
+
+// Where an edit replacing the characters in replaced with newLength others moves a token boundary. Boundaries in the
+// replaced characters move to its start if they end a token and past the new characters if they start one.
+static NSUInteger GMMoveBoundary(NSUInteger boundary, BOOL start, NSRange replaced, NSUInteger newLength)
+{
+  if (boundary < replaced.location || (boundary == replaced.location && !start)) {
+    return boundary;
+  } else if (boundary > NSMaxRange(replaced) || (boundary == NSMaxRange(replaced) && start)) {
+    return boundary - replaced.length + newLength;
+  }
+  return start ? replaced.location + newLength : replaced.location;
+}
+
+#pragma mark - GMTokenList
+
+// The tokens of one depth, or of one type at one depth. Such tokens never overlap, so sorted by offset their ends
+// are sorted as well.
+//
+// Like GMLineIndex, the list keeps the shift of the tokens after an edit pending, as a shift of every token from some
+// index on, rather than rewriting them all. Records are only moved for the tokens an edit falls in, and for those
+// between it and the previous edit.
+@interface GMTokenList : NSObject
+{
+  NSMutableData *_data;
+  NSUInteger _shiftIndex;
+  NSInteger _shift;
+}
+- (NSUInteger)count;
+- (GMTokenRecord)recordAtIndex: (NSUInteger)index;
+- (NSUInteger)indexOfFirstTokenEndingAfterLocation: (NSUInteger)location;
+- (NSUInteger)indexOfFirstTokenFromLocation: (NSUInteger)location;
+- (BOOL)getToken: (GMTokenRecord *)token atLocation: (NSUInteger)location;
+- (void)replaceTokensInRange: (NSRange)range withTokens: (NSData *)tokens;
+- (void)replacedRange: (NSRange)replaced newLength: (NSUInteger)newLength;
+@end
+
+@implementation GMTokenList
+
+- (id)init
+{
+  if (self = [super init]) {
+    _data = [NSMutableData data];
+  }
+  return self;
+}
+
+- (NSUInteger)count
+{
+  return [_data length] / sizeof(GMTokenRecord);
+}
+
+- (GMTokenRecord)recordAtIndex: (NSUInteger)index
+{
+  GMTokenRecord record = ((const GMTokenRecord *)[_data bytes])[index];
+  if (index >= _shiftIndex) {
+    record.offset += _shift;
+  }
+  return record;
+}
+
+// Makes the pending shift apply from index on instead of from _shiftIndex on.
+- (void)moveShiftToIndex: (NSUInteger)index
+{
+  GMTokenRecord *records = [_data mutableBytes];
+  if (_shift != 0) {
+    for (NSUInteger i = index; i < _shiftIndex; i++) {
+      records[i].offset -= _shift;
+    }
+    for (NSUInteger i = _shiftIndex; i < index; i++) {
+      records[i].offset += _shift;
+    }
+  }
+  _shiftIndex = index;
+}
+
+- (NSUInteger)indexOfFirstTokenEndingAfterLocation: (NSUInteger)location
+{
+  NSUInteger low = 0, high = [self count];
+  while (low < high) {
+    NSUInteger middle = low + (high - low) / 2;
+    GMTokenRecord record = [self recordAtIndex: middle];
+    if (GMEndOfRecord(&record) <= location) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+- (NSUInteger)indexOfFirstTokenFromLocation: (NSUInteger)location
+{
+  NSUInteger low = 0, high = [self count];
+  while (low < high) {
+    NSUInteger middle = low + (high - low) / 2;
+    if ([self recordAtIndex: middle].offset < location) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+- (BOOL)getToken: (GMTokenRecord *)token atLocation: (NSUInteger)location
+{
+  NSUInteger i = [self indexOfFirstTokenEndingAfterLocation: location];
+  if (i < [self count] && [self recordAtIndex: i].offset <= location) {
+    *token = [self recordAtIndex: i];
+    return YES;
+  }
+  return NO;
+}
+
+// Tokens that reach out of range keep the parts outside of it, like the attributes of the text would.
+- (void)replaceTokensInRange: (NSRange)range withTokens: (NSData *)tokens
+{
+  if (range.length == 0) {
+    return;
+  }
+  NSUInteger first = [self indexOfFirstTokenEndingAfterLocation: range.location];
+  NSUInteger last = MAX(first, [self indexOfFirstTokenFromLocation: NSMaxRange(range)]);
+  [self moveShiftToIndex: last];
+  const GMTokenRecord *records = [_data bytes];
+  NSMutableData *replacement = [NSMutableData dataWithCapacity: [tokens length] + 2 * sizeof(GMTokenRecord)];
+  if (first < last && records[first].offset < range.location) {
+    GMTokenRecord head = records[first];
+    head.length = range.location - head.offset;
+    [replacement appendBytes: &head length: sizeof(head)];
+  }
+  [replacement appendData: tokens];
+  if (first < last && GMEndOfRecord(&records[last - 1]) > NSMaxRange(range)) {
+    GMTokenRecord tail = records[last - 1];
+    tail.length = GMEndOfRecord(&tail) - NSMaxRange(range);
+    tail.offset = NSMaxRange(range);
+    [replacement appendBytes: &tail length: sizeof(tail)];
+  }
+  [_data replaceBytesInRange: NSMakeRange(first * sizeof(GMTokenRecord), (last - first) * sizeof(GMTokenRecord))
+                   withBytes: [replacement bytes] length: [replacement length]];
+  _shiftIndex = first + [replacement length] / sizeof(GMTokenRecord);
+}
+
+- (void)replacedRange: (NSRange)replaced newLength: (NSUInteger)newLength
+{
+  // Only the tokens the replaced characters reach into change shape; the ones starting after them just move along.
+  NSUInteger first = [self indexOfFirstTokenEndingAfterLocation: replaced.location];
+  NSUInteger last = MAX(first, [self indexOfFirstTokenFromLocation: NSMaxRange(replaced)]);
+  [self moveShiftToIndex: last];
+  _shift += (NSInteger)newLength - (NSInteger)replaced.length;
+
+  GMTokenRecord *records = [_data mutableBytes];
+  NSUInteger kept = first;
+  for (NSUInteger i = first; i < last; i++) {
+    NSUInteger start = GMMoveBoundary(records[i].offset, YES, replaced, newLength);
+    NSUInteger end = GMMoveBoundary(GMEndOfRecord(&records[i]), NO, replaced, newLength);
+    if (end > start) {
+      records[kept] = records[i];
+      records[kept].offset = start;
+      records[kept].length = end - start;
+      kept++;
+    }
+  }
+  if (kept < last) {
+    [_data replaceBytesInRange: NSMakeRange(kept * sizeof(GMTokenRecord), (last - kept) * sizeof(GMTokenRecord)) withBytes: NULL length: 0];
+  }
+  _shiftIndex = kept;
+}
+
+@end
+
+#pragma mark - GMTokenIndex
+
+@implementation GMTokenIndex
+
+- (id)init
+{
+  if (self = [super init]) {
+    [self removeAllTokens];
+  }
+  return self;
+}
+
+#pragma mark - Updating the index
+
+- (void)removeAllTokens
+{
+  _levels = [NSMutableArray array];
+  _types = [NSMutableArray arrayWithCapacity: [_typeNames count]];
+  for (NSUInteger i = 0; i < [_typeNames count]; i++) {
+    [_types addObject: [NSMutableArray array]];
+  }
+}
+
+// Every list of tokens, to adjust for an edit.
+- (NSArray *)allLists
+{
+  NSMutableArray *lists = [NSMutableArray arrayWithArray: _levels];
+  for (NSArray *depths in _types) {
+    [lists addObjectsFromArray: depths];
+  }
+  return lists;
+}
+
+- (void)editedRange:(NSRange)editedRange changeInLength:(NSInteger)delta
+{
+  // The replaced characters, in the coordinates of the text before the edit.
+  NSRange replaced = NSMakeRange(editedRange.location, editedRange.length - delta);
+  for (GMTokenList *list in [self allLists]) {
+    [list replacedRange: replaced newLength: editedRange.length];
+  }
+}
+
+- (void)setTypeNames: (NSArray *)typeNames
+{
+  _typeNames = typeNames;
+  [self removeAllTokens];
+  _typeIDs = [NSMutableDictionary dictionaryWithCapacity: [typeNames count]];
+  uint32_t type = 0;
+  for (NSString *name in typeNames) {
+    if (!_typeIDs[name]) {
+      _typeIDs[name] = @(type);
+    }
+    type++;
+  }
+}
+
+// The list at index of lists, adding empty lists up to it as needed.
+static GMTokenList *GMListAtIndex(NSMutableArray *lists, NSUInteger index)
+{
+  while ([lists count] <= index) {
+    [lists addObject: [[GMTokenList alloc] init]];
+  }
+  return lists[index];
+}
+
+static NSNumber *GMTypeKey(uint32_t type, uint32_t depth)
+{
+  return @(((uint64_t)type << 32) | depth);
+}
+
+- (void)updateWithTokenBuffer:(GMTokenBuffer *)buffer
+{
+  NSArray *typeNames = [buffer typeNames];
+  if (typeNames != _typeNames && ![typeNames isEqualToArray: _typeNames]) {
+    [self setTypeNames: typeNames];
+  }
+
+  // The buffer's tokens sorted into their lists; the buffer is in document order, so each list stays sorted.
+  NSMutableArray *levelTokens = [NSMutableArray array];
+  NSMutableDictionary *typeTokens = [NSMutableDictionary dictionary];
+  const GMTokenRecord *records = [buffer records];
+  NSUInteger count = [buffer count];
+  for (NSUInteger i = 0; i < count; i++) {
+    if (records[i].length == 0 || records[i].type >= [_types count]) {
+      continue;
+    }
+    while ([levelTokens count] <= records[i].depth) {
+      [levelTokens addObject: [NSMutableData data]];
+    }
+    [levelTokens[records[i].depth] appendBytes: &records[i] length: sizeof(GMTokenRecord)];
+    NSNumber *key = GMTypeKey(records[i].type, records[i].depth);
+    NSMutableData *tokens = typeTokens[key];
+    if (!tokens) {
+      tokens = typeTokens[key] = [NSMutableData data];
+    }
+    [tokens appendBytes: &records[i] length: sizeof(GMTokenRecord)];
+  }
+
+  NSRange range = [buffer range];
+  NSData *none = [NSData data];
+  NSUInteger depths = MAX([_levels count], [levelTokens count]);
+  for (NSUInteger depth = 0; depth < depths; depth++) {
+    NSData *tokens = depth < [levelTokens count] ? levelTokens[depth] : none;
+    [GMListAtIndex(_levels, depth) replaceTokensInRange: range withTokens: tokens];
+  }
+  for (NSNumber *key in typeTokens) {
+    uint64_t value = [key unsignedLongLongValue];
+    GMListAtIndex(_types[(NSUInteger)(value >> 32)], (NSUInteger)(value & 0xffffffff));
+  }
+  for (uint32_t type = 0; type < [_types count]; type++) {
+    NSArray *lists = _types[type];
+    for (uint32_t depth = 0; depth < [lists count]; depth++) {
+      [lists[depth] replaceTokensInRange: range withTokens: typeTokens[GMTypeKey(type, depth)] ?: none];
+    }
+  }
+}
+
+#pragma mark - Querying the index
+
+- (NSUInteger)count
+{
+  NSUInteger count = 0;
+  for (GMTokenList *list in _levels) {
+    count += [list count];
+  }
+  return count;
+}
+
+- (NSArray *)typeNames
+{
+  return _typeNames;
+}
+
+- (NSRange)rangeOfRecord: (const GMTokenRecord *)record type: (NSString **)type
+{
+  if (type) {
+    *type = record ? _typeNames[record->type] : nil;
+  }
+  return record ? NSMakeRange(record->offset, record->length) : NSMakeRange(NSNotFound, 0);
+}
+
+- (NSRange)rangeOfTokenAtLocation:(NSUInteger)location type:(NSString **)type
+{
+  // Tokens are nested in the tokens one depth up, so where a depth has no token none of the deeper ones has either.
+  GMTokenRecord record, innermost;
+  BOOL found = NO;
+  for (GMTokenList *list in _levels) {
+    if (![list getToken: &record atLocation: location]) {
+      break;
+    }
+    innermost = record;
+    found = YES;
+  }
+  return [self rangeOfRecord: found ? &innermost : NULL type: type];
+}
+
+- (NSRange)rangeOfTokenAtLocation:(NSUInteger)location depth:(NSUInteger)depth type:(NSString **)type
+{
+  GMTokenRecord record;
+  BOOL found = depth < [_levels count] && [_levels[depth] getToken: &record atLocation: location];
+  return [self rangeOfRecord: found ? &record : NULL type: type];
+}
+
+- (NSRange)rangeOfNextTokenFromLocation:(NSUInteger)location depth:(NSUInteger)depth type:(NSString **)type
+{
+  GMTokenList *list = depth < [_levels count] ? _levels[depth] : nil;
+  NSUInteger i = [list indexOfFirstTokenFromLocation: location];
+  GMTokenRecord record;
+  if (i < [list count]) {
+    record = [list recordAtIndex: i];
+  }
+  return [self rangeOfRecord: i < [list count] ? &record : NULL type: type];
+}
+
+- (NSRange)rangeOfTokenEnclosingRange:(NSRange)range type:(NSString **)type
+{
+  GMTokenRecord record, innermost;
+  BOOL found = NO;
+  for (GMTokenList *list in _levels) {
+    if (![list getToken: &record atLocation: range.location] || GMEndOfRecord(&record) < NSMaxRange(range)) {
+      break;
+    }
+    innermost = record;
+    found = YES;
+  }
+  return [self rangeOfRecord: found ? &innermost : NULL type: type];
+}
+
+- (NSArray *)listsOfType: (NSString *)type
+{
+  NSNumber *typeID = _typeIDs[type];
+  return typeID ? _types[[typeID unsignedIntegerValue]] : nil;
+}
+
+- (NSRange)rangeOfNextTokenOfType:(NSString *)type fromLocation:(NSUInteger)location
+{
+  GMTokenRecord next;
+  BOOL found = NO;
+  for (GMTokenList *list in [self listsOfType: type]) {
+    NSUInteger i = [list indexOfFirstTokenFromLocation: location];
+    if (i < [list count] && (!found || [list recordAtIndex: i].offset < next.offset)) {
+      next = [list recordAtIndex: i];
+      found = YES;
+    }
+  }
+  return [self rangeOfRecord: found ? &next : NULL type: NULL];
+}
+
+- (NSRange)rangeOfPreviousTokenOfType:(NSString *)type beforeLocation:(NSUInteger)location
+{
+  GMTokenRecord previous;
+  BOOL found = NO;
+  for (GMTokenList *list in [self listsOfType: type]) {
+    NSUInteger i = [list indexOfFirstTokenFromLocation: location];
+    if (i > 0 && (!found || [list recordAtIndex: i - 1].offset > previous.offset)) {
+      previous = [list recordAtIndex: i - 1];
+      found = YES;
+    }
+  }
+  return [self rangeOfRecord: found ? &previous : NULL type: NULL];
+}
+
+@end
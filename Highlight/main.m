@@ -0,0 +1,379 @@
+//
+//  main.m
+//  Highlight
+//
+//  Created by Jakub Hampl on 17.10.26.
+//  Copyright (c) 2026 Jakub Hampl. All rights reserved.
+//
+
+/*
+ Highlights files outside of any application, to pre-render code for documentation:
+
+    Highlight -output html docs/examples styles/main.css
+
+ Every argument that isn't an option is a file, or a directory to highlight all files in. The language of a file is
+ picked by its extension (see the `extensions` of a language), and files without a language are skipped. Options
+ are read from the arguments through NSUserDefaults, so they are passed as `-name value`:
+
+ - `-format` `html` for `<span class='type'>` elements (the default), `tokens` for a line of `location length type`
+   per token, or `ansi` for terminal colors.
+ - `-output` A directory to write a file for every input to, named after the input (relative to the directory it was
+   found in) with `.html`, `.tokens` or `.ansi` appended. Without it, everything goes to standard output, every file
+   preceded by a line with its path.
+ - `-resources` The directory with the `.language` and `.theme` files. Defaults to the app's resources.
+ - `-language` The name of a language to highlight all files with, whatever their extension.
+ - `-theme` The theme of the `ansi` format. Defaults to `light`.
+ - `-jobs` How many files are highlighted at once. Defaults to the number of cores.
+ - `-instrumentation` A file to write the measurements of GMInstrumentation to, as JSON.
+
+ Files are handed out to the workers largest first, each taking the next one as soon as it is done with the last, so
+ that a few big files don't leave the other workers idle at the end. Every language is loaded once, and its grammar
+ shared by the highlighters of all workers. A worker keeps a highlighter and a renderer per language, along with its
+ input and output buffers, for all the files it does.
+
+ When done, the tool prints how many files and bytes it went through and how fast to standard error.
+ */
+
+#import <Foundation/Foundation.h>
+#import <dispatch/dispatch.h>
+#import "GMRegistry.h"
+#import "GMSyntaxHighlighter.h"
+#import "GMRenderer.h"
+#import "GMTheme.h"
+#import "GMInstrumentation.h"
+
+#define GMHighlightJobPathKey @"path"
+#define GMHighlightJobNameKey @"name"
+#define GMHighlightJobLanguageKey @"language"
+#define GMHighlightJobSizeKey @"size"
+
+static NSTimeInterval GMNow(void)
+{
+  return [NSDate timeIntervalSinceReferenceDate];
+}
+
+#pragma mark - Languages
+
+// The languages in a directory by name, and their names by the extensions they are for.
+static NSDictionary *GMLoadLanguages(NSString *resources, NSMutableDictionary *extensions)
+{
+  NSMutableDictionary *languages = [NSMutableDictionary dictionary];
+  NSArray *files = [[NSFileManager defaultManager] contentsOfDirectoryAtPath: resources error: NULL];
+  // The languages nested in these are looked for next to them.
+  [[GMRegistry sharedRegistry] setSearchPaths: @[resources]];
+  for (NSString *file in [files sortedArrayUsingSelector: @selector(compare:)]) {
+    NSString *extension = [file pathExtension];
+    NSString *name = [file stringByDeletingPathExtension];
+    // A compiled language is only loaded on its own if it has no source next to it, which would be loaded instead.
+    if (!([extension isEqualToString: @"language"] || ([extension isEqualToString: @"languagec"] && ![files containsObject: [name stringByAppendingPathExtension: @"language"]]))) {
+      continue;
+    }
+    NSDictionary *language = [[GMRegistry sharedRegistry] languageAtPath: [resources stringByAppendingPathComponent: file]];
+    if (!language) {
+      fprintf(stderr, "Can't load %s\n", [file fileSystemRepresentation]);
+      continue;
+    }
+    [languages setObject: language forKey: name];
+    for (NSString *languageExtension in language[@"extensions"] ?: @[name]) {
+      [extensions setObject: name forKey: [languageExtension lowercaseString]];
+    }
+  }
+  return languages;
+}
+
+#pragma mark - Jobs
+
+// The file arguments, which are the ones that are neither options nor their values.
+static NSArray *GMPathsFromArguments(NSArray *arguments)
+{
+  NSMutableArray *paths = [NSMutableArray array];
+  for (NSUInteger i = 1; i < [arguments count]; i++) {
+    NSString *argument = arguments[i];
+    if ([argument hasPrefix: @"-"] && [argument length] > 1) {
+      i++;
+    } else {
+      [paths addObject: argument];
+    }
+  }
+  return paths;
+}
+
+// A job for every file to highlight, largest first.
+static NSArray *GMJobsForPaths(NSArray *paths, NSDictionary *extensions, NSString *forcedLanguage)
+{
+  NSFileManager *fileManager = [NSFileManager defaultManager];
+  NSMutableArray *jobs = [NSMutableArray array];
+  void (^addJob)(NSString *, NSString *, NSDictionary *, BOOL) = ^(NSString *path, NSString *name, NSDictionary *attributes, BOOL explicit) {
+    NSString *language = forcedLanguage ?: extensions[[[path pathExtension] lowercaseString]];
+    if (!language) {
+      if (explicit) {
+        fprintf(stderr, "No language for %s\n", [path fileSystemRepresentation]);
+      }
+      return;
+    }
+    [jobs addObject: @{GMHighlightJobPathKey: path, GMHighlightJobNameKey: name, GMHighlightJobLanguageKey: language,
+                       GMHighlightJobSizeKey: @([attributes fileSize])}];
+  };
+  for (NSString *path in paths) {
+    BOOL directory = NO;
+    if (![fileManager fileExistsAtPath: path isDirectory: &directory]) {
+      fprintf(stderr, "No such file %s\n", [path fileSystemRepresentation]);
+      continue;
+    }
+    if (!directory) {
+      addJob(path, [path lastPathComponent], [fileManager attributesOfItemAtPath: path error: NULL], YES);
+      continue;
+    }
+    NSDirectoryEnumerator *enumerator = [fileManager enumeratorAtPath: path];
+    for (NSString *relativePath in enumerator) {
+      NSDictionary *attributes = [enumerator fileAttributes];
+      if ([[relativePath lastPathComponent] hasPrefix: @"."]) {
+        if ([attributes[NSFileType] isEqualToString: NSFileTypeDirectory]) {
+          [enumerator skipDescendents];
+        }
+        continue;
+      }
+      if ([attributes[NSFileType] isEqualToString: NSFileTypeRegular]) {
+        addJob([path stringByAppendingPathComponent: relativePath], relativePath, attributes, NO);
+      }
+    }
+  }
+  [jobs sortUsingDescriptors: @[[NSSortDescriptor sortDescriptorWithKey: GMHighlightJobSizeKey ascending: NO]]];
+  return jobs;
+}
+
+#pragma mark - Workers
+
+@interface GMHighlightWorker : NSObject
+{
+  NSDictionary *_languages;
+  GMTheme *_theme;
+  GMRendererFormat _format;
+  NSFileManager *_fileManager;
+  NSMutableDictionary *_renderers;
+  NSMutableData *_input;
+  NSMutableData *_output;
+  FILE *_file;
+  unsigned long long _bytesRead;
+  unsigned long long _bytesWritten;
+  NSUInteger _files;
+}
+
+- (id)initWithLanguages: (NSDictionary *)languages theme: (GMTheme *)theme format: (GMRendererFormat)format;
+// Highlights a file into a file, or to standard output if outputPath is nil. Returns NO if either can't be opened.
+- (BOOL)highlightFileAtPath: (NSString *)path language: (NSString *)language toPath: (NSString *)outputPath;
+- (unsigned long long)bytesRead;
+- (unsigned long long)bytesWritten;
+- (NSUInteger)files;
+
+@end
+
+@implementation GMHighlightWorker
+
+- (id)initWithLanguages:(NSDictionary *)languages theme:(GMTheme *)theme format:(GMRendererFormat)format
+{
+  if (self = [super init]) {
+    _languages = languages;
+    _theme = theme;
+    _format = format;
+    _fileManager = [[NSFileManager alloc] init];
+    _renderers = [NSMutableDictionary dictionary];
+    _input = [NSMutableData data];
+    _output = [NSMutableData data];
+  }
+  return self;
+}
+
+- (GMRenderer *)rendererForLanguage: (NSString *)name
+{
+  GMRenderer *renderer = _renderers[name];
+  if (!renderer) {
+    GMSyntaxHighlighter *highlighter = [[GMSyntaxHighlighter alloc] init];
+    highlighter.theme = _theme;
+    highlighter.language = _languages[name];
+    // The renderer is kept by the worker, so the sink doesn't need to keep the worker.
+    __unsafe_unretained GMHighlightWorker *worker = self;
+    renderer = [[GMRenderer alloc] initWithHighlighter: highlighter format: _format sink: ^(const uint8_t *bytes, NSUInteger length) {
+      [worker writeBytes: bytes length: length];
+    }];
+    [_renderers setObject: renderer forKey: name];
+  }
+  return renderer;
+}
+
+- (void)writeBytes: (const uint8_t *)bytes length: (NSUInteger)length
+{
+  if (_file) {
+    fwrite(bytes, 1, length, _file);
+  } else {
+    [_output appendBytes: bytes length: length];
+  }
+  _bytesWritten += length;
+}
+
+// Reads a file into the input buffer, which is reused from file to file. The string refers to the buffer, so it is
+// only good until the next file is read.
+- (NSString *)readFileAtPath: (NSString *)path
+{
+  FILE *file = fopen([path fileSystemRepresentation], "rb");
+  if (!file) {
+    return nil;
+  }
+  NSUInteger length = 0;
+  size_t read;
+  do {
+    if ([_input length] < length + 65536) {
+      [_input setLength: MAX(length + 65536, [_input length] * 2)];
+    }
+    read = fread((uint8_t *)[_input mutableBytes] + length, 1, [_input length] - length, file);
+    length += read;
+  } while (read > 0);
+  BOOL failed = ferror(file);
+  fclose(file);
+  if (failed) {
+    return nil;
+  }
+  _bytesRead += length;
+  NSString *text = [[NSString alloc] initWithBytesNoCopy: [_input mutableBytes] length: length encoding: NSUTF8StringEncoding freeWhenDone: NO];
+  // Anything that isn't UTF-8 is taken byte for byte.
+  return text ?: [[NSString alloc] initWithBytesNoCopy: [_input mutableBytes] length: length encoding: NSISOLatin1StringEncoding freeWhenDone: NO];
+}
+
+- (BOOL)highlightFileAtPath:(NSString *)path language:(NSString *)language toPath:(NSString *)outputPath
+{
+  NSString *text = [self readFileAtPath: path];
+  if (!text) {
+    fprintf(stderr, "Can't read %s\n", [path fileSystemRepresentation]);
+    return NO;
+  }
+  GMRenderer *renderer = [self rendererForLanguage: language];
+  if (outputPath) {
+    [_fileManager createDirectoryAtPath: [outputPath stringByDeletingLastPathComponent] withIntermediateDirectories: YES attributes: nil error: NULL];
+    _file = fopen([outputPath fileSystemRepresentation], "wb");
+    if (!_file) {
+      fprintf(stderr, "Can't write %s\n", [outputPath fileSystemRepresentation]);
+      return NO;
+    }
+    [renderer renderText: text];
+    fclose(_file);
+    _file = NULL;
+  } else {
+    [_output setLength: 0];
+    [renderer renderText: text];
+    // Files are written out whole, so that the output of the workers doesn't interleave.
+    @synchronized ([GMHighlightWorker class]) {
+      printf("==> %s <==\n", [path fileSystemRepresentation]);
+      fwrite([_output bytes], 1, [_output length], stdout);
+      if ([_output length] > 0 && ((const char *)[_output bytes])[[_output length] - 1] != '\n') {
+        putchar('\n');
+      }
+    }
+  }
+  _files++;
+  return YES;
+}
+
+- (unsigned long long)bytesRead
+{
+  return _bytesRead;
+}
+
+- (unsigned long long)bytesWritten
+{
+  return _bytesWritten;
+}
+
+- (NSUInteger)files
+{
+  return _files;
+}
+
+@end
+
+int main(int argc, const char *argv[])
+{
+  @autoreleasepool {
+    NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];
+    NSString *here = [[NSString stringWithUTF8String: __FILE__] stringByDeletingLastPathComponent];
+    [defaults registerDefaults: @{
+      @"format": @"html",
+      @"resources": [[here stringByDeletingLastPathComponent] stringByAppendingPathComponent: @"GMCodeEditor/resources"],
+      @"theme": @"light",
+      @"jobs": @([[NSProcessInfo processInfo] activeProcessorCount])
+    }];
+
+    NSDictionary *formats = @{@"html": @(GMRendererFormatHTML), @"tokens": @(GMRendererFormatTokens), @"ansi": @(GMRendererFormatANSI)};
+    NSString *formatName = [defaults stringForKey: @"format"];
+    if (!formats[formatName]) {
+      fprintf(stderr, "Unknown format %s, use html, tokens or ansi\n", [formatName UTF8String]);
+      return 1;
+    }
+    GMRendererFormat format = [formats[formatName] intValue];
+    NSArray *paths = GMPathsFromArguments([[NSProcessInfo processInfo] arguments]);
+    if ([paths count] == 0) {
+      fprintf(stderr, "Usage: Highlight [-format html|tokens|ansi] [-output directory] [-jobs n] file-or-directory...\n");
+      return 1;
+    }
+    NSString *instrumentation = [defaults stringForKey: @"instrumentation"];
+    [[GMInstrumentation sharedInstrumentation] setEnabled: instrumentation != nil];
+
+    NSString *resources = [defaults stringForKey: @"resources"];
+    NSMutableDictionary *extensions = [NSMutableDictionary dictionary];
+    NSDictionary *languages = GMLoadLanguages(resources, extensions);
+    NSString *forcedLanguage = [defaults stringForKey: @"language"];
+    if (forcedLanguage && !languages[forcedLanguage]) {
+      fprintf(stderr, "No language %s in %s\n", [forcedLanguage UTF8String], [resources fileSystemRepresentation]);
+      return 1;
+    }
+    GMTheme *theme = [GMTheme themeAtPath: [[resources stringByAppendingPathComponent: [defaults stringForKey: @"theme"]] stringByAppendingPathExtension: @"theme"]];
+    NSArray *jobs = GMJobsForPaths(paths, extensions, forcedLanguage);
+    NSString *output = [defaults stringForKey: @"output"];
+
+    NSUInteger workerCount = MAX(1, MIN((NSUInteger)MAX([defaults integerForKey: @"jobs"], 1), [jobs count]));
+    NSMutableArray *workers = [NSMutableArray array];
+    for (NSUInteger i = 0; i < workerCount; i++) {
+      [workers addObject: [[GMHighlightWorker alloc] initWithLanguages: languages theme: theme format: format]];
+    }
+    long next = 0, *cursor = &next;
+    long failures = 0;
+    long *failureCount = &failures;
+    NSTimeInterval start = GMNow();
+    dispatch_apply(workerCount, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t w) {
+      GMHighlightWorker *worker = workers[w];
+      for (long i = __sync_fetch_and_add(cursor, 1); i < (long)[jobs count]; i = __sync_fetch_and_add(cursor, 1)) {
+        @autoreleasepool {
+          NSDictionary *job = jobs[i];
+          NSString *outputPath = nil;
+          if (output) {
+            outputPath = [[output stringByAppendingPathComponent: job[GMHighlightJobNameKey]] stringByAppendingPathExtension: formatName];
+          }
+          if (![worker highlightFileAtPath: job[GMHighlightJobPathKey] language: job[GMHighlightJobLanguageKey] toPath: outputPath]) {
+            __sync_fetch_and_add(failureCount, 1);
+          }
+        }
+      }
+    });
+    NSTimeInterval elapsed = GMNow() - start;
+
+    unsigned long long bytesRead = 0, bytesWritten = 0;
+    NSUInteger files = 0;
+    for (GMHighlightWorker *worker in workers) {
+      bytesRead += [worker bytesRead];
+      bytesWritten += [worker bytesWritten];
+      files += [worker files];
+    }
+    fprintf(stderr, "%lu files, %.2f MB in, %.2f MB out in %.3f s on %lu workers: %.2f MB/s, %.0f files/s\n",
+            (unsigned long)files, bytesRead / 1e6, bytesWritten / 1e6, elapsed, (unsigned long)workerCount,
+            elapsed > 0 ? bytesRead / elapsed / 1e6 : 0, elapsed > 0 ? files / elapsed : 0);
+
+    NSError *error = nil;
+    if (instrumentation && ![[GMInstrumentation sharedInstrumentation] writeJSONToFile: instrumentation error: &error]) {
+      fprintf(stderr, "Can't write %s: %s\n", [instrumentation fileSystemRepresentation], [[error localizedDescription] UTF8String]);
+      return 1;
+    }
+    if (failures > 0) {
+      return 1;
+    }
+  }
+  return 0;
+}